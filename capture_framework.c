@@ -2471,6 +2471,83 @@ int cf_send_data(kis_capture_handler_t *caph,
     return cf_stream_packet(caph, "DATA", kv_pairs, kv_pos);
 }
 
+int cf_send_data_batch(kis_capture_handler_t *caph, unsigned int in_count,
+        struct timeval *in_ts, uint32_t *in_packet_sz, uint8_t **in_pack) {
+
+    simple_cap_proto_kv_t **kvs;
+    simple_cap_proto_t **hdrs;
+    size_t *proto_szs;
+
+    unsigned int i;
+    unsigned int num_queued = 0;
+    int ret = 0;
+
+    if (in_count == 0)
+        return 0;
+
+    kvs = (simple_cap_proto_kv_t **) calloc(in_count, sizeof(simple_cap_proto_kv_t *));
+    hdrs = (simple_cap_proto_t **) calloc(in_count, sizeof(simple_cap_proto_t *));
+    proto_szs = (size_t *) calloc(in_count, sizeof(size_t));
+
+    if (kvs == NULL || hdrs == NULL || proto_szs == NULL) {
+        fprintf(stderr, "FATAL: Unable to allocate DATA batch\n");
+        ret = -1;
+        goto cleanup;
+    }
+
+    /* Encode everything before we take the buffer lock */
+    for (i = 0; i < in_count; i++) {
+        kvs[i] = encode_kv_capdata(in_ts[i], in_packet_sz[i], in_pack[i]);
+
+        if (kvs[i] == NULL) {
+            fprintf(stderr, "FATAL: Unable to allocate KV DATA pair\n");
+            ret = -1;
+            goto cleanup;
+        }
+
+        hdrs[i] = encode_simple_cap_proto_hdr(&(proto_szs[i]), "DATA", 0, 
+                &(kvs[i]), 1);
+
+        if (hdrs[i] == NULL) {
+            fprintf(stderr, "FATAL: Unable to allocate protocol frame header\n");
+            ret = -1;
+            goto cleanup;
+        }
+    }
+
+    pthread_mutex_lock(&(caph->out_ringbuf_lock));
+
+    for (i = 0; i < in_count; i++) {
+        if (kis_simple_ringbuf_available(caph->out_ringbuf) < proto_szs[i])
+            break;
+
+        kis_simple_ringbuf_write(caph->out_ringbuf, (uint8_t *) hdrs[i], 
+                sizeof(simple_cap_proto_t));
+        kis_simple_ringbuf_write(caph->out_ringbuf, (uint8_t *) kvs[i],
+                ntohl(kvs[i]->header.obj_sz) + sizeof(simple_cap_proto_kv_t));
+
+        num_queued++;
+    }
+
+    pthread_mutex_unlock(&(caph->out_ringbuf_lock));
+
+    ret = num_queued;
+
+cleanup:
+    for (i = 0; i < in_count; i++) {
+        if (kvs != NULL && kvs[i] != NULL)
+            free(kvs[i]);
+        if (hdrs != NULL && hdrs[i] != NULL)
+            free(hdrs[i]);
+    }
+
+    free(kvs);
+    free(hdrs);
+    free(proto_szs);
+
+    return ret;
+}
+
 int cf_send_configresp(kis_capture_handler_t *caph, unsigned int seqno, 
         unsigned int success, const char *msg) {
     size_t num_kvs = 1;
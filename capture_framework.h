@@ -765,6 +765,22 @@ int cf_send_data(kis_capture_handler_t *caph,
         simple_cap_proto_kv_t *kv_gps,
         struct timeval ts, uint32_t packet_sz, uint8_t *pack);
 
+/* Send a batch of DATA frames, such as a block of frames from a kernel capture
+ * ring.  The frames are encoded first and then queued to the write buffer
+ * under a single lock.
+ *
+ * Frames are queued in order until one does not fit in the buffer; the caller
+ * should wait for the buffer to flush and send the remaining frames.
+ *
+ * Can be called from any thread
+ *
+ * Returns:
+ * -1   An error occurred
+ *  0+  Number of frames queued
+ */
+int cf_send_data_batch(kis_capture_handler_t *caph, unsigned int in_count,
+        struct timeval *in_ts, uint32_t *in_packet_sz, uint8_t **in_pack);
+
 /* Send a CONFIGRESP with only a success and optional message
  *
  * Returns:
@@ -60,6 +60,14 @@
 #include <net/if.h>
 #include <arpa/inet.h>
 
+#include <sys/mman.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <poll.h>
+#include <linux/if_packet.h>
+#include <linux/if_ether.h>
+#include <net/if_arp.h>
+
 #include <ifaddrs.h>
 
 #include "../config.h"
@@ -74,6 +82,7 @@
 
 #include "../interface_control.h"
 #include "linux_wireless_control.h"
+#include "linux_tpacket.h"
 #include "linux_netlink_control.h"
 #include "linux_wireless_rfkill.h"
 
@@ -81,10 +90,21 @@
 
 #define MAX_PACKET_LEN  8192
 
+/* How often we check the kernel drop counters, in seconds */
+#define TPACKET_STATS_INTERVAL  10
+
 /* State tracking, put in userdata */
 typedef struct {
     pcap_t *pd;
 
+    /* TPACKET_V3 mmap ring, if we're capturing that way instead of via pcap */
+    int use_tpacket;
+    linux_tpacket_ring_t tp;
+
+    /* Kernel drop counters */
+    uint64_t tp_total_packets;
+    uint64_t tp_total_drops;
+
     char *interface;
     char *cap_interface;
 
@@ -676,6 +696,64 @@ int probe_callback(kis_capture_handler_t *caph, uint32_t seqno, char *definition
     return 1;
 }
 
+/* Close a TPACKET_V3 ring, if we have one */
+void tpacket_close(local_wifi_t *local_wifi) {
+    linux_tpacket_close(&(local_wifi->tp));
+}
+
+/* Open a TPACKET_V3 mmap ring on the capture interface
+ *
+ * The kernel packs frames into large blocks and hands us a whole block at a
+ * time, so we wake up once per block instead of once per packet, and the
+ * frames are read directly from the shared ring.
+ *
+ * Returns:
+ * -1   Error, errstr is populated
+ *  1   Success, *ret_dlt is populated
+ */
+int tpacket_open(local_wifi_t *local_wifi, int *ret_dlt, char *errstr) {
+    struct ifreq ifr;
+
+    local_wifi->tp_total_packets = 0;
+    local_wifi->tp_total_drops = 0;
+
+    /* Frames are truncated to the same length as the pcap capture path, so
+     * the server never gets a frame larger than it can handle */
+    if (linux_tpacket_open(&(local_wifi->tp), local_wifi->cap_interface, 
+                MAX_PACKET_LEN, errstr) < 0)
+        return -1;
+
+    /* Figure out the DLT from the hardware type of the interface */
+    memset(&ifr, 0, sizeof(struct ifreq));
+    strncpy(ifr.ifr_name, local_wifi->cap_interface, IFNAMSIZ - 1);
+
+    if (ioctl(local_wifi->tp.fd, SIOCGIFHWADDR, &ifr) < 0) {
+        snprintf(errstr, STATUS_MAX, "could not get interface type: %s",
+                strerror(errno));
+        tpacket_close(local_wifi);
+        return -1;
+    }
+
+    switch (ifr.ifr_hwaddr.sa_family) {
+        case ARPHRD_IEEE80211_RADIOTAP:
+            *ret_dlt = DLT_IEEE802_11_RADIO;
+            break;
+        case ARPHRD_IEEE80211_PRISM:
+            *ret_dlt = DLT_PRISM_HEADER;
+            break;
+        case ARPHRD_IEEE80211:
+            *ret_dlt = DLT_IEEE802_11;
+            break;
+        default:
+            snprintf(errstr, STATUS_MAX, "unsupported interface type %u",
+                    ifr.ifr_hwaddr.sa_family);
+            tpacket_close(local_wifi);
+            return -1;
+    }
+
+    return 1;
+}
+
 int open_callback(kis_capture_handler_t *caph, uint32_t seqno, char *definition,
         char *msg, uint32_t *dlt, char **uuid, simple_cap_proto_frame_t *frame,
         cf_params_interface_t **ret_interface,
@@ -757,6 +835,8 @@ int open_callback(kis_capture_handler_t *caph, uint32_t seqno, char *definition,
         local_wifi->pd = NULL;
     }
 
+    tpacket_close(local_wifi);
+
     /* Start processing the open */
 
     if ((placeholder_len = cf_parse_interface(&placeholder, definition)) <= 0) {
@@ -1268,18 +1348,39 @@ int open_callback(kis_capture_handler_t *caph, uint32_t seqno, char *definition,
         }
     }
 
+    local_wifi->use_tpacket = 0;
+
+    if ((placeholder_len = cf_find_flag(&placeholder, "tpacket", definition)) > 0) {
+        if (strncasecmp(placeholder, "true", placeholder_len) == 0) {
+            if (tpacket_open(local_wifi, &(local_wifi->datalink_type), errstr2) < 0) {
+                snprintf(errstr, STATUS_MAX, "Source '%s' could not open a TPACKET_V3 "
+                        "capture ring on '%s', falling back to pcap: %s",
+                        local_wifi->interface, local_wifi->cap_interface, errstr2);
+                cf_send_message(caph, errstr, MSGFLAG_INFO);
+            } else {
+                snprintf(errstr, STATUS_MAX, "Source '%s' capturing from a TPACKET_V3 "
+                        "ring on '%s'", local_wifi->interface, local_wifi->cap_interface);
+                cf_send_message(caph, errstr, MSGFLAG_INFO);
+                local_wifi->use_tpacket = 1;
+            }
+        }
+    }
+
     /* Open the pcap */
-    local_wifi->pd = pcap_open_live(local_wifi->cap_interface, 
-            MAX_PACKET_LEN, 1, 1000, pcap_errstr);
+    if (!local_wifi->use_tpacket) {
+        local_wifi->pd = pcap_open_live(local_wifi->cap_interface, 
+                MAX_PACKET_LEN, 1, 1000, pcap_errstr);
+
+        if (local_wifi->pd == NULL || strlen(pcap_errstr) != 0) {
+            snprintf(msg, STATUS_MAX, "Could not open capture interface '%s' on '%s' "
+                    "as a pcap capture: %s", local_wifi->cap_interface, 
+                    local_wifi->interface, pcap_errstr);
+            return -1;
+        }
 
-    if (local_wifi->pd == NULL || strlen(pcap_errstr) != 0) {
-        snprintf(msg, STATUS_MAX, "Could not open capture interface '%s' on '%s' "
-                "as a pcap capture: %s", local_wifi->cap_interface, 
-                local_wifi->interface, pcap_errstr);
-        return -1;
+        local_wifi->datalink_type = pcap_datalink(local_wifi->pd);
     }
 
-    local_wifi->datalink_type = pcap_datalink(local_wifi->pd);
     *dlt = local_wifi->datalink_type;
 
     if (strcmp(local_wifi->interface, local_wifi->cap_interface) != 0) {
@@ -1402,20 +1503,184 @@ void pcap_dispatch_cb(u_char *user, const struct pcap_pkthdr *header,
     }
 }
 
+/* Fetch the kernel packet counters for the TPACKET ring and report any drops;
+ * the kernel resets the counters each time they are read */
+void tpacket_check_drops(kis_capture_handler_t *caph) {
+    local_wifi_t *local_wifi = (local_wifi_t *) caph->userdata;
+    struct tpacket_stats_v3 stats;
+    socklen_t stats_len = sizeof(stats);
+    char errstr[STATUS_MAX];
+
+    if (getsockopt(local_wifi->tp.fd, SOL_PACKET, PACKET_STATISTICS, 
+                &stats, &stats_len) < 0)
+        return;
+
+    local_wifi->tp_total_packets += stats.tp_packets;
+    local_wifi->tp_total_drops += stats.tp_drops;
+
+    if (stats.tp_drops == 0)
+        return;
+
+    snprintf(errstr, STATUS_MAX, "Kernel dropped %u of %u packets on '%s' in the "
+            "last %u seconds (%llu of %llu total); the system may not be keeping up "
+            "with the capture rate", stats.tp_drops, stats.tp_packets, 
+            local_wifi->cap_interface, TPACKET_STATS_INTERVAL,
+            (unsigned long long) local_wifi->tp_total_drops,
+            (unsigned long long) local_wifi->tp_total_packets);
+    cf_send_warning(caph, errstr, MSGFLAG_INFO, errstr);
+}
+
+/* Walk the blocks of the TPACKET ring, handing each block of frames to the
+ * framework as a single batch.  Returns when the interface fails. */
+void tpacket_capture_loop(kis_capture_handler_t *caph, char *errstr) {
+    local_wifi_t *local_wifi = (local_wifi_t *) caph->userdata;
+    unsigned int block_num = 0;
+    struct pollfd pfd;
+    time_t last_stats = time(NULL);
+
+    struct tpacket_block_desc *bd;
+    struct tpacket3_hdr *ppd;
+    unsigned int num_pkts, i, sent;
+    int ret;
+    int err;
+    socklen_t err_len;
+
+    /* Per-block batch */
+    unsigned int batch_max = 0;
+    struct timeval *batch_ts = NULL;
+    uint32_t *batch_sz = NULL;
+    uint8_t **batch_data = NULL;
+    struct timeval *new_ts;
+    uint32_t *new_sz;
+    uint8_t **new_data;
+
+    memset(&pfd, 0, sizeof(struct pollfd));
+    pfd.fd = local_wifi->tp.fd;
+    pfd.events = POLLIN | POLLERR;
+
+    while (1) {
+        if (time(NULL) - last_stats >= TPACKET_STATS_INTERVAL) {
+            tpacket_check_drops(caph);
+            last_stats = time(NULL);
+        }
+
+        bd = linux_tpacket_block(&(local_wifi->tp), block_num);
+
+        if ((bd->hdr.bh1.block_status & TP_STATUS_USER) == 0) {
+            pfd.revents = 0;
+
+            if (poll(&pfd, 1, 1000) < 0 && errno != EINTR) {
+                snprintf(errstr, STATUS_MAX, "%s", strerror(errno));
+                break;
+            }
+
+            if (pfd.revents & (POLLERR | POLLHUP | POLLNVAL)) {
+                err = 0;
+                err_len = sizeof(err);
+                getsockopt(local_wifi->tp.fd, SOL_SOCKET, SO_ERROR, &err, &err_len);
+                snprintf(errstr, STATUS_MAX, "%s", 
+                        err == 0 ? "interface closed" : strerror(err));
+                break;
+            }
+
+            continue;
+        }
+
+        num_pkts = bd->hdr.bh1.num_pkts;
+
+        if (num_pkts > batch_max) {
+            /* A successful realloc frees the old array, so keep each one which
+             * grew even if another fails; they're all freed on the way out.  The
+             * batch only takes the new size once all three have grown. */
+            new_ts = (struct timeval *) realloc(batch_ts, 
+                    sizeof(struct timeval) * num_pkts);
+            if (new_ts != NULL)
+                batch_ts = new_ts;
+
+            new_sz = (uint32_t *) realloc(batch_sz, sizeof(uint32_t) * num_pkts);
+            if (new_sz != NULL)
+                batch_sz = new_sz;
+
+            new_data = (uint8_t **) realloc(batch_data, sizeof(uint8_t *) * num_pkts);
+            if (new_data != NULL)
+                batch_data = new_data;
+
+            if (new_ts == NULL || new_sz == NULL || new_data == NULL) {
+                snprintf(errstr, STATUS_MAX, "unable to allocate packet batch");
+                break;
+            }
+
+            batch_max = num_pkts;
+        }
+
+        ppd = (struct tpacket3_hdr *) ((uint8_t *) bd + bd->hdr.bh1.offset_to_first_pkt);
+
+        for (i = 0; i < num_pkts; i++) {
+            batch_ts[i].tv_sec = ppd->tp_sec;
+            batch_ts[i].tv_usec = ppd->tp_nsec / 1000;
+            /* The ring truncates to MAX_PACKET_LEN already; never trust a
+             * length from shared memory past that */
+            batch_sz[i] = ppd->tp_snaplen > MAX_PACKET_LEN ? 
+                MAX_PACKET_LEN : ppd->tp_snaplen;
+            batch_data[i] = (uint8_t *) ppd + ppd->tp_mac;
+
+            ppd = (struct tpacket3_hdr *) ((uint8_t *) ppd + ppd->tp_next_offset);
+        }
+
+        /* Send the whole block, waiting for the write buffer to flush if it
+         * can't take all of it */
+        sent = 0;
+        ret = 0;
+
+        while (sent < num_pkts) {
+            ret = cf_send_data_batch(caph, num_pkts - sent, batch_ts + sent,
+                    batch_sz + sent, batch_data + sent);
+
+            if (ret < 0)
+                break;
+
+            sent += ret;
+
+            if (sent < num_pkts)
+                cf_handler_wait_ringbuffer(caph);
+        }
+
+        if (ret < 0) {
+            snprintf(errstr, STATUS_MAX, "unable to send DATA frame");
+            break;
+        }
+
+        /* Hand the block back to the kernel */
+        __sync_synchronize();
+        bd->hdr.bh1.block_status = TP_STATUS_KERNEL;
+
+        block_num = (block_num + 1) % TPACKET_NUM_BLOCKS;
+    }
+
+    free(batch_ts);
+    free(batch_sz);
+    free(batch_data);
+}
+
 void capture_thread(kis_capture_handler_t *caph) {
     local_wifi_t *local_wifi = (local_wifi_t *) caph->userdata;
     char errstr[PCAP_ERRBUF_SIZE];
     char *pcap_errstr;
     char iferrstr[STATUS_MAX];
+    char tperrstr[STATUS_MAX] = "";
     int ifflags = 0, ifret;
 
     /* Simple capture thread: since we don't care about blocking and 
      * channel control is managed by the channel hopping thread, all we have
      * to do is enter a blocking pcap loop */
 
-    pcap_loop(local_wifi->pd, -1, pcap_dispatch_cb, (u_char *) caph);
-
-    pcap_errstr = pcap_geterr(local_wifi->pd);
+    if (local_wifi->use_tpacket) {
+        tpacket_capture_loop(caph, tperrstr);
+        pcap_errstr = tperrstr;
+    } else {
+        pcap_loop(local_wifi->pd, -1, pcap_dispatch_cb, (u_char *) caph);
+        pcap_errstr = pcap_geterr(local_wifi->pd);
+    }
 
     snprintf(errstr, PCAP_ERRBUF_SIZE, "Interface '%s' closed: %s", 
             local_wifi->cap_interface, 
@@ -1439,6 +1704,10 @@ void capture_thread(kis_capture_handler_t *caph) {
 int main(int argc, char *argv[]) {
     local_wifi_t local_wifi = {
         .pd = NULL,
+        .use_tpacket = 0,
+        .tp = { .fd = -1, .ring = NULL, .ring_sz = 0 },
+        .tp_total_packets = 0,
+        .tp_total_drops = 0,
         .interface = NULL,
         .cap_interface = NULL,
         .datalink_type = -1,
@@ -1548,6 +1817,8 @@ int main(int argc, char *argv[]) {
     }
 #endif
 
+    tpacket_close(&local_wifi);
+
     cf_handler_free(caph);
 
     return 1;
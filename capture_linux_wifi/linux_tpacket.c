@@ -0,0 +1,147 @@
+/*
+    This file is part of Kismet
+
+    Kismet is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Kismet is distributed in the hope that it will be useful,
+      but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Kismet; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "../config.h"
+#include "linux_tpacket.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include <net/if.h>
+#include <arpa/inet.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <linux/if_ether.h>
+#include <linux/filter.h>
+
+void linux_tpacket_close(linux_tpacket_ring_t *ring) {
+    if (ring->ring != NULL) {
+        munmap(ring->ring, ring->ring_sz);
+        ring->ring = NULL;
+    }
+
+    if (ring->fd >= 0) {
+        close(ring->fd);
+        ring->fd = -1;
+    }
+}
+
+int linux_tpacket_open(linux_tpacket_ring_t *ring, const char *interface,
+        unsigned int snaplen, char *errstr) {
+    struct sockaddr_ll sll;
+    struct tpacket_req3 req;
+    int version = TPACKET_V3;
+    int ifindex;
+    unsigned int frame_sz;
+
+    /* Accept every frame, truncated to the snaplen; this is how the kernel 
+     * implements a snaplen on a packet socket */
+    struct sock_filter snap_insns[] = {
+        { BPF_RET | BPF_K, 0, 0, snaplen },
+    };
+    struct sock_fprog snap_prog;
+
+    ring->fd = -1;
+    ring->ring = NULL;
+    ring->ring_sz = 0;
+
+    /* A frame slot has to hold the ring header, the link address, and the 
+     * full snaplen, and a block has to hold at least one slot */
+    frame_sz = TPACKET_ALIGN(TPACKET3_HDRLEN + 16 + snaplen);
+
+    if (snaplen == 0 || frame_sz > TPACKET_BLOCK_SZ) {
+        snprintf(errstr, STATUS_MAX, "invalid snaplen %u for capture ring", snaplen);
+        return -1;
+    }
+
+    if ((ifindex = if_nametoindex(interface)) == 0) {
+        snprintf(errstr, STATUS_MAX, "could not find interface index: %s",
+                strerror(errno));
+        return -1;
+    }
+
+    if ((ring->fd = socket(AF_PACKET, SOCK_RAW, htons(ETH_P_ALL))) < 0) {
+        snprintf(errstr, STATUS_MAX, "could not open packet socket: %s",
+                strerror(errno));
+        return -1;
+    }
+
+    snap_prog.len = sizeof(snap_insns) / sizeof(struct sock_filter);
+    snap_prog.filter = snap_insns;
+
+    if (setsockopt(ring->fd, SOL_SOCKET, SO_ATTACH_FILTER, 
+                &snap_prog, sizeof(snap_prog)) < 0) {
+        snprintf(errstr, STATUS_MAX, "could not set capture snaplen: %s",
+                strerror(errno));
+        linux_tpacket_close(ring);
+        return -1;
+    }
+
+    if (setsockopt(ring->fd, SOL_PACKET, PACKET_VERSION, 
+                &version, sizeof(version)) < 0) {
+        snprintf(errstr, STATUS_MAX, "kernel does not support TPACKET_V3: %s",
+                strerror(errno));
+        linux_tpacket_close(ring);
+        return -1;
+    }
+
+    memset(&req, 0, sizeof(struct tpacket_req3));
+    req.tp_block_size = TPACKET_BLOCK_SZ;
+    req.tp_block_nr = TPACKET_NUM_BLOCKS;
+    req.tp_frame_size = frame_sz;
+    req.tp_frame_nr = (TPACKET_BLOCK_SZ / frame_sz) * TPACKET_NUM_BLOCKS;
+    req.tp_retire_blk_tov = TPACKET_BLOCK_TIMEOUT;
+
+    if (setsockopt(ring->fd, SOL_PACKET, PACKET_RX_RING, 
+                &req, sizeof(req)) < 0) {
+        snprintf(errstr, STATUS_MAX, "could not allocate capture ring: %s",
+                strerror(errno));
+        linux_tpacket_close(ring);
+        return -1;
+    }
+
+    ring->ring_sz = (size_t) req.tp_block_size * req.tp_block_nr;
+
+    ring->ring = (uint8_t *) mmap(NULL, ring->ring_sz, 
+            PROT_READ | PROT_WRITE, MAP_SHARED | MAP_LOCKED, ring->fd, 0);
+
+    if (ring->ring == MAP_FAILED) {
+        ring->ring = NULL;
+        snprintf(errstr, STATUS_MAX, "could not map capture ring: %s",
+                strerror(errno));
+        linux_tpacket_close(ring);
+        return -1;
+    }
+
+    memset(&sll, 0, sizeof(struct sockaddr_ll));
+    sll.sll_family = AF_PACKET;
+    sll.sll_protocol = htons(ETH_P_ALL);
+    sll.sll_ifindex = ifindex;
+
+    if (bind(ring->fd, (struct sockaddr *) &sll, sizeof(sll)) < 0) {
+        snprintf(errstr, STATUS_MAX, "could not bind packet socket: %s",
+                strerror(errno));
+        linux_tpacket_close(ring);
+        return -1;
+    }
+
+    return 1;
+}
+
@@ -0,0 +1,67 @@
+/*
+    This file is part of Kismet
+
+    Kismet is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Kismet is distributed in the hope that it will be useful,
+      but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Kismet; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#ifndef __LINUX_TPACKET_H__
+#define __LINUX_TPACKET_H__
+
+#include "../config.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <linux/if_packet.h>
+
+/* TPACKET_V3 ring layout; frames are packed into blocks by the kernel and a
+ * block is handed to us once it is full or times out */
+#define TPACKET_BLOCK_SZ        (1 << 17)
+#define TPACKET_NUM_BLOCKS      32
+#define TPACKET_BLOCK_TIMEOUT   100
+
+typedef struct {
+    int fd;
+    uint8_t *ring;
+    size_t ring_sz;
+} linux_tpacket_ring_t;
+
+/* Open a TPACKET_V3 mmap ring on an interface
+ *
+ * Frames are truncated to snaplen by the kernel, and each ring frame slot is
+ * sized to hold a full snaplen frame, so a jumbo or A-MSDU frame can never be
+ * handed to us larger than the capture can send.
+ *
+ * errstr must be allocated by the caller and must be able to hold STATUS_MAX
+ * characters.
+ *
+ * Returns:
+ * -1   Error, errstr is populated
+ *  1   Success
+ */
+int linux_tpacket_open(linux_tpacket_ring_t *ring, const char *interface,
+        unsigned int snaplen, char *errstr);
+
+/* Close a TPACKET_V3 ring, if it is open */
+void linux_tpacket_close(linux_tpacket_ring_t *ring);
+
+/* Get a block of the ring */
+static inline struct tpacket_block_desc *linux_tpacket_block(linux_tpacket_ring_t *ring,
+        unsigned int block_num) {
+    return (struct tpacket_block_desc *) (ring->ring + (block_num * TPACKET_BLOCK_SZ));
+}
+
+#endif
+
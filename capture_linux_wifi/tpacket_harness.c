@@ -0,0 +1,301 @@
+/* test harness for the TPACKET_V3 capture ring
+ *
+ * Opens the same capture ring as kismet_cap_linux_wifi on one interface and
+ * sends frames of every size from typical up to jumbo out another, then
+ * checks that no frame is handed to us past the capture snaplen and reports
+ * the capture rate and kernel drops.
+ *
+ * A veth pair with a jumbo MTU exercises the snaplen clamp:
+ *
+ * ip link add kt0 type veth peer name kt1
+ * ip link set kt0 mtu 12000 up
+ * ip link set kt1 mtu 12000 up
+ *
+ * or capture from the mac80211_hwsim monitor interface while sending on a
+ * monitor mode radio:
+ *
+ * modprobe mac80211_hwsim radios=2
+ * ip link set hwsim0 up
+ * (put wlan1 in monitor mode on any channel, and up)
+ *
+ * # build kismet, then
+ * cd capture_linux_wifi
+ * make tpacket_harness
+ *
+ * ./tpacket_harness [capture interface] [send interface] [packets] [largest frame]
+ *
+ * ie:
+ *
+ * ./tpacket_harness kt1 kt0 100000 11454
+ * ./tpacket_harness hwsim0 wlan1 100000 2304
+ *
+ */
+
+#include "../config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <pthread.h>
+#include <time.h>
+
+#include <net/if.h>
+#include <net/if_arp.h>
+#include <arpa/inet.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <linux/if_ether.h>
+
+#include "linux_tpacket.h"
+
+/* Same snaplen as the capture source */
+#define MAX_PACKET_LEN  8192
+
+/* Local experimental ethertype */
+#define HARNESS_ETHERTYPE   0x88B5
+
+typedef struct {
+    const char *interface;
+    unsigned int num_packets;
+    unsigned int max_frame;
+
+    unsigned int sent;
+    unsigned int failed;
+    int done;
+} harness_send_t;
+
+static double now_s(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Build a frame of the requested length for the link type of the interface;
+ * an ethernet frame, or a radiotap + 802.11 data frame for a monitor mode
+ * interface */
+static size_t build_frame(uint8_t *buf, size_t len, int hwtype, unsigned int seqno) {
+    size_t hdr_len;
+
+    memset(buf, 0, len);
+
+    if (hwtype == ARPHRD_IEEE80211_RADIOTAP) {
+        /* Empty radiotap header */
+        buf[2] = 8;
+
+        /* Data frame, to broadcast */
+        buf[8] = 0x08;
+        memset(buf + 8 + 4, 0xFF, 6);
+        buf[8 + 10] = 0x02;
+
+        hdr_len = 8 + 24;
+    } else {
+        memset(buf, 0xFF, 6);
+        buf[6] = 0x02;
+        buf[12] = HARNESS_ETHERTYPE >> 8;
+        buf[13] = HARNESS_ETHERTYPE & 0xFF;
+
+        hdr_len = 14;
+    }
+
+    if (len < hdr_len + 4)
+        return hdr_len;
+
+    memcpy(buf + hdr_len, &seqno, 4);
+
+    return len;
+}
+
+static void *send_thread(void *arg) {
+    harness_send_t *send_opts = (harness_send_t *) arg;
+    struct sockaddr_ll sll;
+    struct ifreq ifr;
+    uint8_t *buf;
+    unsigned int i;
+    int fd;
+    int hwtype;
+
+    /* Typical frames, a full 802.11 MPDU, and jumbo / A-MSDU sizes past the
+     * capture snaplen */
+    const unsigned int sizes[] = { 64, 256, 1500, 2304, 4000, 8192, 9000, 11454 };
+
+    if ((fd = socket(AF_PACKET, SOCK_RAW, htons(ETH_P_ALL))) < 0) {
+        fprintf(stderr, "could not open send socket: %s\n", strerror(errno));
+        send_opts->done = 1;
+        return NULL;
+    }
+
+    memset(&ifr, 0, sizeof(struct ifreq));
+    strncpy(ifr.ifr_name, send_opts->interface, IFNAMSIZ - 1);
+
+    if (ioctl(fd, SIOCGIFHWADDR, &ifr) < 0) {
+        fprintf(stderr, "could not get send interface type: %s\n", strerror(errno));
+        close(fd);
+        send_opts->done = 1;
+        return NULL;
+    }
+
+    hwtype = ifr.ifr_hwaddr.sa_family;
+
+    memset(&sll, 0, sizeof(struct sockaddr_ll));
+    sll.sll_family = AF_PACKET;
+    sll.sll_protocol = htons(ETH_P_ALL);
+    sll.sll_ifindex = if_nametoindex(send_opts->interface);
+
+    buf = (uint8_t *) malloc(send_opts->max_frame);
+
+    for (i = 0; i < send_opts->num_packets; i++) {
+        size_t len = sizes[i % (sizeof(sizes) / sizeof(unsigned int))];
+
+        if (len > send_opts->max_frame)
+            len = send_opts->max_frame;
+
+        len = build_frame(buf, len, hwtype, i);
+
+        if (sendto(fd, buf, len, 0, (struct sockaddr *) &sll, sizeof(sll)) < 0) {
+            /* Larger than the MTU, or the queue is full */
+            send_opts->failed++;
+            continue;
+        }
+
+        send_opts->sent++;
+    }
+
+    free(buf);
+    close(fd);
+
+    __sync_synchronize();
+    send_opts->done = 1;
+
+    return NULL;
+}
+
+int main(int argc, char *argv[]) {
+    linux_tpacket_ring_t ring;
+    harness_send_t send_opts;
+    pthread_t send_tid;
+    struct pollfd pfd;
+    struct tpacket_stats_v3 stats;
+    socklen_t stats_len = sizeof(stats);
+    char errstr[STATUS_MAX];
+
+    unsigned int block_num = 0;
+    unsigned int blocks = 0, packets = 0, truncated = 0, oversize = 0;
+    uint32_t largest = 0;
+    uint64_t bytes = 0;
+    double start, last_packet;
+
+    if (argc < 3) {
+        fprintf(stderr, "usage: %s [capture interface] [send interface] [packets] "
+                "[largest frame]\n", argv[0]);
+        return 1;
+    }
+
+    send_opts.interface = argv[2];
+    send_opts.num_packets = 100000;
+    send_opts.max_frame = 11454;
+    send_opts.sent = 0;
+    send_opts.failed = 0;
+    send_opts.done = 0;
+
+    if (argc > 3)
+        send_opts.num_packets = strtoul(argv[3], NULL, 10);
+    if (argc > 4)
+        send_opts.max_frame = strtoul(argv[4], NULL, 10);
+
+    if (send_opts.num_packets == 0 || send_opts.max_frame < 64) {
+        fprintf(stderr, "usage: %s [capture interface] [send interface] [packets] "
+                "[largest frame]\n", argv[0]);
+        return 1;
+    }
+
+    if (linux_tpacket_open(&ring, argv[1], MAX_PACKET_LEN, errstr) < 0) {
+        fprintf(stderr, "could not open capture ring on %s: %s\n", argv[1], errstr);
+        return 1;
+    }
+
+    if (pthread_create(&send_tid, NULL, send_thread, &send_opts) != 0) {
+        fprintf(stderr, "could not start send thread\n");
+        linux_tpacket_close(&ring);
+        return 1;
+    }
+
+    memset(&pfd, 0, sizeof(struct pollfd));
+    pfd.fd = ring.fd;
+    pfd.events = POLLIN | POLLERR;
+
+    start = last_packet = now_s();
+
+    /* Walk the ring the same way the capture source does, until the sender is
+     * done and nothing has arrived for a second */
+    while (1) {
+        struct tpacket_block_desc *bd = linux_tpacket_block(&ring, block_num);
+        struct tpacket3_hdr *ppd;
+        unsigned int i;
+
+        if ((bd->hdr.bh1.block_status & TP_STATUS_USER) == 0) {
+            __sync_synchronize();
+
+            if (send_opts.done && now_s() - last_packet > 1)
+                break;
+
+            poll(&pfd, 1, 100);
+            continue;
+        }
+
+        ppd = (struct tpacket3_hdr *) ((uint8_t *) bd + bd->hdr.bh1.offset_to_first_pkt);
+
+        for (i = 0; i < bd->hdr.bh1.num_pkts; i++) {
+            if (ppd->tp_snaplen > largest)
+                largest = ppd->tp_snaplen;
+
+            if (ppd->tp_snaplen > MAX_PACKET_LEN)
+                oversize++;
+            else if (ppd->tp_snaplen < ppd->tp_len)
+                truncated++;
+
+            bytes += ppd->tp_snaplen;
+
+            ppd = (struct tpacket3_hdr *) ((uint8_t *) ppd + ppd->tp_next_offset);
+        }
+
+        packets += bd->hdr.bh1.num_pkts;
+        blocks++;
+        last_packet = now_s();
+
+        __sync_synchronize();
+        bd->hdr.bh1.block_status = TP_STATUS_KERNEL;
+
+        block_num = (block_num + 1) % TPACKET_NUM_BLOCKS;
+    }
+
+    pthread_join(send_tid, NULL);
+
+    memset(&stats, 0, sizeof(stats));
+    getsockopt(ring.fd, SOL_PACKET, PACKET_STATISTICS, &stats, &stats_len);
+
+    linux_tpacket_close(&ring);
+
+    printf("%u frames sent on %s (%u rejected by the interface), up to %u bytes\n",
+            send_opts.sent, argv[2], send_opts.failed, send_opts.max_frame);
+    printf("  %u frames captured on %s in %u blocks, %.1f frames/sec, %.1f MB/sec\n",
+            packets, argv[1], blocks, packets / (last_packet - start),
+            bytes / (last_packet - start) / (1024 * 1024));
+    printf("  %u truncated to the %u byte snaplen, largest %u bytes, %u past the snaplen\n",
+            truncated, MAX_PACKET_LEN, largest, oversize);
+    printf("  kernel counted %u frames, dropped %u\n", stats.tp_packets, stats.tp_drops);
+
+    if (oversize != 0) {
+        fprintf(stderr, "FAILED: frames larger than the snaplen reached the ring\n");
+        return 1;
+    }
+
+    if (packets == 0) {
+        fprintf(stderr, "FAILED: no frames captured\n");
+        return 1;
+    }
+
+    return 0;
+}
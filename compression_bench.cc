@@ -0,0 +1,229 @@
+/* benchmark harness for compressed REST responses
+ *
+ * Serializes a device list the way the device endpoints do, then streams it
+ * through the webserver buffer stream reader: a generator thread writes the
+ * JSON into a chain buffer while the microhttpd content reader callback pulls
+ * it out, uncompressed or deflated at each compression level.  The compressed
+ * output is inflated again and compared to the original, and the size and
+ * throughput of each level are reported.
+ *
+ * # build kismet, then
+ * make compression_bench
+ *
+ * ./compression_bench [devices] [iterations]
+ *
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <zlib.h>
+
+#include <chrono>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+
+#include "globalregistry.h"
+#include "entrytracker.h"
+#include "trackedelement.h"
+#include "devicetracker.h"
+#include "json_adapter.h"
+#include "buffer_handler.h"
+#include "chainbuf.h"
+#include "kis_net_microhttpd.h"
+
+static double elapsed_ns(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start).count();
+}
+
+// Stream the body through the response reader at a compression level, or
+// uncompressed at level 0; returns the time taken and the response body
+static double stream_response(const std::string& body, int level, std::string& out) {
+    out.clear();
+
+    shared_ptr<BufferHandlerGeneric> rbh(new BufferHandler<Chainbuf>(NULL,
+                new Chainbuf(64 * 1024, 512)));
+
+    // No server connection, so the reader blocks for data the way a thread per
+    // connection server does
+    Kis_Net_Httpd_Buffer_Stream_Aux *aux =
+        new Kis_Net_Httpd_Buffer_Stream_Aux(NULL, NULL, rbh, NULL, NULL);
+
+    if (level != 0 && !aux->enable_compression(level, true)) {
+        delete aux;
+        return 0;
+    }
+
+    char buf[32 * 1024];
+
+    auto start = std::chrono::steady_clock::now();
+
+    // The generator writes in serializer sized chunks, then finishes the stream
+    std::thread generator([&body, aux, rbh]() {
+            for (size_t pos = 0; pos < body.length(); pos += 8192) {
+                size_t len = std::min((size_t) 8192, body.length() - pos);
+                rbh->PutWriteBufferData((void *) (body.data() + pos), len, true);
+            }
+
+            aux->trigger_error();
+        });
+
+    while (1) {
+        ssize_t r;
+
+        if (level == 0)
+            r = Kis_Net_Httpd_Buffer_Stream_Handler::buffer_event_cb(aux, 0, buf,
+                    sizeof(buf));
+        else
+            r = Kis_Net_Httpd_Buffer_Stream_Handler::buffer_compress_event_cb(aux, 0, buf,
+                    sizeof(buf));
+
+        if (r < 0)
+            break;
+
+        out.append(buf, r);
+    }
+
+    double ns = elapsed_ns(start);
+
+    generator.join();
+    delete aux;
+
+    return ns;
+}
+
+static bool gunzip(const std::string& in, std::string& out) {
+    z_stream zs;
+    char buf[64 * 1024];
+    int r;
+
+    memset(&zs, 0, sizeof(z_stream));
+
+    if (inflateInit2(&zs, 15 + 16) != Z_OK)
+        return false;
+
+    zs.next_in = (Bytef *) in.data();
+    zs.avail_in = in.length();
+
+    out.clear();
+
+    do {
+        zs.next_out = (Bytef *) buf;
+        zs.avail_out = sizeof(buf);
+
+        r = inflate(&zs, Z_NO_FLUSH);
+
+        out.append(buf, sizeof(buf) - zs.avail_out);
+    } while (r == Z_OK);
+
+    inflateEnd(&zs);
+
+    return r == Z_STREAM_END;
+}
+
+int main(int argc, char *argv[]) {
+    unsigned int num_devices = 2000;
+    unsigned int iterations = 10;
+
+    if (argc > 1)
+        num_devices = strtoul(argv[1], NULL, 10);
+    if (argc > 2)
+        iterations = strtoul(argv[2], NULL, 10);
+
+    if (num_devices == 0 || iterations == 0) {
+        fprintf(stderr, "usage: %s [devices] [iterations]\n", argv[0]);
+        return 1;
+    }
+
+    GlobalRegistry *globalreg = new GlobalRegistry();
+    EntryTracker::create_entrytracker(globalreg);
+
+    time_t now = 1500000000;
+    globalreg->timestamp.tv_sec = now;
+    globalreg->timestamp.tv_usec = 0;
+
+    int device_id =
+        globalreg->entrytracker->RegisterField("kismet.device.base", TrackerMap,
+                "core device record");
+
+    SharedTrackerElement devvec(new TrackerElement(TrackerVector));
+
+    uint64_t r = 0x9E3779B97F4A7C15ULL;
+
+    for (unsigned int d = 0; d < num_devices; d++) {
+        std::shared_ptr<kis_tracked_device_base> dev(new kis_tracked_device_base(globalreg,
+                    device_id));
+
+        r ^= r << 13;
+        r ^= r >> 7;
+        r ^= r << 17;
+
+        mac_addr mac((uint8_t *) &r, 6);
+
+        dev->set_key(TrackedDeviceKey(1, 2, mac));
+        dev->set_macaddr(mac);
+        dev->set_phyname("IEEE802.11");
+        dev->set_devicename("Device " + std::to_string(d));
+        dev->set_type_string("Wi-Fi AP");
+        dev->set_crypt_string("WPA2-PSK");
+        dev->set_first_time(now - (r % 3600));
+        dev->set_last_time(now - (r % 60));
+        dev->set_packets(r % 100000);
+        dev->set_datasize(r % 100000000);
+        dev->set_channel(std::to_string(1 + (r % 11)));
+        dev->set_frequency(2412000 + 5000 * (r % 11));
+        dev->set_manuf("Unknown");
+
+        for (unsigned int s = 0; s < 120; s++)
+            dev->get_packets_rrd()->add_sample((r >> (s % 32)) % 50, now - 3600 + s * 30);
+
+        devvec->add_vector(dev);
+    }
+
+    std::stringstream ss;
+    FastJsonAdapter::Pack(globalreg, ss, devvec, NULL);
+    std::string body = ss.str();
+
+    printf("%u devices, %zu bytes of JSON, best of %u iterations\n", num_devices,
+            body.length(), iterations);
+    printf("  %-8s %12s %8s %10s\n", "level", "bytes", "ratio", "MB/sec");
+
+    const int levels[] = { 0, 1, 3, 6, 9 };
+    bool ok = true;
+
+    for (auto level : levels) {
+        double best = 0;
+        std::string out;
+
+        for (unsigned int i = 0; i < iterations; i++) {
+            double ns = stream_response(body, level, out);
+
+            if (i == 0 || ns < best)
+                best = ns;
+        }
+
+        std::string check;
+
+        if (level == 0)
+            check = out;
+        else if (!gunzip(out, check))
+            check.clear();
+
+        bool match = check == body;
+        ok = ok && match;
+
+        printf("  %-8s %12zu %7.1f%% %10.1f%s\n",
+                level == 0 ? "identity" : std::to_string(level).c_str(),
+                out.length(), 100.0 * out.length() / body.length(),
+                body.length() / (best / 1e9) / (1024 * 1024),
+                match ? "" : "  MISMATCH");
+    }
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,251 @@
+/*
+    This file is part of Kismet
+
+    Kismet is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Kismet is distributed in the hope that it will be useful,
+      but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Kismet; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "config.h"
+
+#include "crc32.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HAVE_CRC32_PCLMUL 1
+#include <immintrin.h>
+#endif
+
+// Reflected 802.3 polynomial
+#define CRC32_80211_POLY 0xEDB88320
+
+// Slice-by-8 tables; table 0 is the classic byte-at-a-time table, and table n
+// is the CRC of a byte followed by n zero bytes
+class crc32_slice8_tables {
+public:
+    crc32_slice8_tables() {
+        for (unsigned int i = 0; i < 256; i++) {
+            uint32_t crc = i;
+
+            for (unsigned int j = 0; j < 8; j++)
+                crc = (crc >> 1) ^ ((crc & 1) ? CRC32_80211_POLY : 0);
+
+            table[0][i] = crc;
+        }
+
+        for (unsigned int i = 0; i < 256; i++) {
+            for (unsigned int t = 1; t < 8; t++)
+                table[t][i] = (table[t - 1][i] >> 8) ^ table[0][table[t - 1][i] & 0xFF];
+        }
+    }
+
+    uint32_t table[8][256];
+};
+
+static const crc32_slice8_tables& crc32_get_tables() {
+    static crc32_slice8_tables tables;
+    return tables;
+}
+
+// The update functions work on the running (inverted) CRC value
+
+static uint32_t crc32_update_bytewise(uint32_t crc, const uint8_t *buf, size_t len) {
+    const uint32_t *t0 = crc32_get_tables().table[0];
+
+    for (size_t i = 0; i < len; i++)
+        crc = (crc >> 8) ^ t0[(crc ^ buf[i]) & 0xFF];
+
+    return crc;
+}
+
+static uint32_t crc32_update_slice8(uint32_t crc, const uint8_t *buf, size_t len) {
+    const crc32_slice8_tables& t = crc32_get_tables();
+
+    while (len >= 8) {
+        // Assemble the words from bytes so this works on any host endian; the
+        // compiler turns these into plain loads on little-endian systems
+        uint32_t one = crc ^ ((uint32_t) buf[0] | ((uint32_t) buf[1] << 8) |
+                ((uint32_t) buf[2] << 16) | ((uint32_t) buf[3] << 24));
+        uint32_t two = (uint32_t) buf[4] | ((uint32_t) buf[5] << 8) |
+            ((uint32_t) buf[6] << 16) | ((uint32_t) buf[7] << 24);
+
+        crc = t.table[7][one & 0xFF] ^
+            t.table[6][(one >> 8) & 0xFF] ^
+            t.table[5][(one >> 16) & 0xFF] ^
+            t.table[4][one >> 24] ^
+            t.table[3][two & 0xFF] ^
+            t.table[2][(two >> 8) & 0xFF] ^
+            t.table[1][(two >> 16) & 0xFF] ^
+            t.table[0][two >> 24];
+
+        buf += 8;
+        len -= 8;
+    }
+
+    return crc32_update_bytewise(crc, buf, len);
+}
+
+#ifdef HAVE_CRC32_PCLMUL
+// Fold the buffer with carry-less multiplies, per the Intel paper "Fast CRC
+// Computation for Generic Polynomials Using PCLMULQDQ Instruction", using the
+// bit-reflected constants for the 802.3 polynomial.  Needs at least 64 bytes;
+// handles a multiple of 16 bytes and leaves the tail to the caller.
+__attribute__((target("pclmul,sse4.1")))
+static uint32_t crc32_fold_pclmul(uint32_t crc, const uint8_t *buf, size_t len) {
+    const __m128i k1k2 = _mm_set_epi64x(0x01c6e41596LL, 0x0154442bd4LL);
+    const __m128i k3k4 = _mm_set_epi64x(0x00ccaa009eLL, 0x01751997d0LL);
+    const __m128i k5k0 = _mm_set_epi64x(0, 0x0163cd6124LL);
+    const __m128i poly = _mm_set_epi64x(0x01f7011641LL, 0x01db710641LL);
+    const __m128i mask32 = _mm_setr_epi32(~0, 0, ~0, 0);
+
+    __m128i x0, x1, x2, x3, x4, x5, x6, x7, x8, y5, y6, y7, y8;
+
+    x1 = _mm_loadu_si128((const __m128i *) (buf + 0x00));
+    x2 = _mm_loadu_si128((const __m128i *) (buf + 0x10));
+    x3 = _mm_loadu_si128((const __m128i *) (buf + 0x20));
+    x4 = _mm_loadu_si128((const __m128i *) (buf + 0x30));
+
+    x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128((int) crc));
+
+    buf += 64;
+    len -= 64;
+
+    // Fold 64 bytes at a time across 4 lanes
+    while (len >= 64) {
+        x5 = _mm_clmulepi64_si128(x1, k1k2, 0x00);
+        x6 = _mm_clmulepi64_si128(x2, k1k2, 0x00);
+        x7 = _mm_clmulepi64_si128(x3, k1k2, 0x00);
+        x8 = _mm_clmulepi64_si128(x4, k1k2, 0x00);
+
+        x1 = _mm_clmulepi64_si128(x1, k1k2, 0x11);
+        x2 = _mm_clmulepi64_si128(x2, k1k2, 0x11);
+        x3 = _mm_clmulepi64_si128(x3, k1k2, 0x11);
+        x4 = _mm_clmulepi64_si128(x4, k1k2, 0x11);
+
+        y5 = _mm_loadu_si128((const __m128i *) (buf + 0x00));
+        y6 = _mm_loadu_si128((const __m128i *) (buf + 0x10));
+        y7 = _mm_loadu_si128((const __m128i *) (buf + 0x20));
+        y8 = _mm_loadu_si128((const __m128i *) (buf + 0x30));
+
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), y5);
+        x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), y6);
+        x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), y7);
+        x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), y8);
+
+        buf += 64;
+        len -= 64;
+    }
+
+    // Fold the 4 lanes into one
+    x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+
+    x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+
+    x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+
+    // Fold any remaining 16 byte blocks
+    while (len >= 16) {
+        x2 = _mm_loadu_si128((const __m128i *) buf);
+
+        x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+
+        buf += 16;
+        len -= 16;
+    }
+
+    // Fold 128 bits down to 64
+    x2 = _mm_clmulepi64_si128(x1, k3k4, 0x10);
+    x1 = _mm_srli_si128(x1, 8);
+    x1 = _mm_xor_si128(x1, x2);
+
+    x2 = _mm_srli_si128(x1, 4);
+    x1 = _mm_and_si128(x1, mask32);
+    x1 = _mm_clmulepi64_si128(x1, k5k0, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+
+    // Barrett reduction down to 32 bits
+    x0 = _mm_and_si128(x1, mask32);
+    x0 = _mm_clmulepi64_si128(x0, poly, 0x10);
+    x0 = _mm_and_si128(x0, mask32);
+    x0 = _mm_clmulepi64_si128(x0, poly, 0x00);
+    x1 = _mm_xor_si128(x1, x0);
+
+    return (uint32_t) _mm_extract_epi32(x1, 1);
+}
+
+static uint32_t crc32_update_pclmul(uint32_t crc, const uint8_t *buf, size_t len) {
+    // Not worth setting up the fold for short frames
+    if (len < 64)
+        return crc32_update_slice8(crc, buf, len);
+
+    size_t fold_len = len & ~((size_t) 15);
+
+    crc = crc32_fold_pclmul(crc, buf, fold_len);
+
+    return crc32_update_slice8(crc, buf + fold_len, len - fold_len);
+}
+#endif
+
+typedef uint32_t (*crc32_update_func)(uint32_t, const uint8_t *, size_t);
+
+class crc32_engine {
+public:
+    crc32_engine() {
+        // Build the tables before any packet threads race to do it
+        crc32_get_tables();
+
+        update = crc32_update_slice8;
+        name = "slice-by-8";
+
+#ifdef HAVE_CRC32_PCLMUL
+        __builtin_cpu_init();
+
+        if (__builtin_cpu_supports("pclmul") && __builtin_cpu_supports("sse4.1")) {
+            update = crc32_update_pclmul;
+            name = "pclmul";
+        }
+#endif
+    }
+
+    crc32_update_func update;
+    const char *name;
+};
+
+static const crc32_engine& crc32_get_engine() {
+    static crc32_engine engine;
+    return engine;
+}
+
+uint32_t crc32_80211(const uint8_t *in_buf, size_t in_len) {
+    return crc32_get_engine().update(0xFFFFFFFF, in_buf, in_len) ^ 0xFFFFFFFF;
+}
+
+const char *crc32_80211_engine() {
+    return crc32_get_engine().name;
+}
+
+uint32_t crc32_80211_bytewise(const uint8_t *in_buf, size_t in_len) {
+    return crc32_update_bytewise(0xFFFFFFFF, in_buf, in_len) ^ 0xFFFFFFFF;
+}
+
+uint32_t crc32_80211_slice8(const uint8_t *in_buf, size_t in_len) {
+    return crc32_update_slice8(0xFFFFFFFF, in_buf, in_len) ^ 0xFFFFFFFF;
+}
+
@@ -0,0 +1,47 @@
+/*
+    This file is part of Kismet
+
+    Kismet is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Kismet is distributed in the hope that it will be useful,
+      but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Kismet; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#ifndef __CRC32_H__
+#define __CRC32_H__
+
+#include "config.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+
+/* CRC32 for 802.11 (and 802.3) frame check sequences
+ *
+ * The FCS of every frame with an FCS attached is checked, so this is on the
+ * hot path for each packet.  On x86 CPUs with carry-less multiply the bulk of
+ * the frame is folded 64 bytes at a time with PCLMULQDQ; everywhere else, and
+ * for the short tail of a frame, a slice-by-8 table is used.  The engine is
+ * picked once, the first time a CRC is computed.
+ */
+
+// Compute the FCS over a buffer
+uint32_t crc32_80211(const uint8_t *in_buf, size_t in_len);
+
+// Name of the engine in use
+const char *crc32_80211_engine();
+
+// Individual engines, so results can be compared against each other
+uint32_t crc32_80211_bytewise(const uint8_t *in_buf, size_t in_len);
+uint32_t crc32_80211_slice8(const uint8_t *in_buf, size_t in_len);
+
+#endif
+
@@ -0,0 +1,95 @@
+/* benchmark harness for the 802.11 FCS CRC32
+ *
+ * Reports the throughput of each CRC32 engine, and of zlib for reference, at
+ * typical frame sizes.  Frames are checked at an odd offset, since the FCS
+ * covers a frame which starts wherever the capture header ends.
+ *
+ * # build kismet, then
+ * make crc32_bench
+ *
+ * ./crc32_bench [iterations]
+ *
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <zlib.h>
+
+#include <chrono>
+#include <vector>
+
+#include "crc32.h"
+
+static double elapsed_ns(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start).count();
+}
+
+template<class F>
+static double run(F crc, const uint8_t *buf, size_t len, unsigned int iterations,
+        uint32_t& sum) {
+    auto start = std::chrono::steady_clock::now();
+
+    for (unsigned int i = 0; i < iterations; i++)
+        sum += crc(buf, len);
+
+    double ns = elapsed_ns(start);
+
+    // MB/sec
+    return ((double) len * iterations / (1024 * 1024)) / (ns / 1e9);
+}
+
+int main(int argc, char *argv[]) {
+    unsigned int iterations = 200000;
+
+    if (argc > 1)
+        iterations = strtoul(argv[1], NULL, 10);
+
+    if (iterations == 0) {
+        fprintf(stderr, "usage: %s [iterations]\n", argv[0]);
+        return 1;
+    }
+
+    std::vector<uint8_t> buf(65536 + 3);
+    uint64_t r = 0x9E3779B97F4A7C15ULL;
+
+    for (auto& b : buf) {
+        r ^= r << 13;
+        r ^= r >> 7;
+        r ^= r << 17;
+        b = (uint8_t) r;
+    }
+
+    printf("%u iterations per size, engine %s, MB/sec\n", iterations, crc32_80211_engine());
+    printf("  %6s %10s %10s %10s %10s\n", "bytes", "bytewise", "slice-by-8", "engine", "zlib");
+
+    const size_t sizes[] = { 64, 128, 256, 512, 1500, 2346, 4096, 65536 };
+
+    for (auto len : sizes) {
+        const uint8_t *data = buf.data() + 3;
+        uint32_t bytewise_sum = 0, slice8_sum = 0, engine_sum = 0, zlib_sum = 0;
+
+        // Keep the big buffer from taking forever on the bytewise engine
+        unsigned int iter = iterations;
+        if (len > 4096)
+            iter = iter / (len / 4096);
+        if (iter == 0)
+            iter = 1;
+
+        double bytewise = run(crc32_80211_bytewise, data, len, iter, bytewise_sum);
+        double slice8 = run(crc32_80211_slice8, data, len, iter, slice8_sum);
+        double engine = run(crc32_80211, data, len, iter, engine_sum);
+        double zl = run([](const uint8_t *b, size_t l) {
+                    return (uint32_t) crc32(0, b, l);
+                }, data, len, iter, zlib_sum);
+
+        printf("  %6zu %10.1f %10.1f %10.1f %10.1f%s\n", len, bytewise, slice8, engine, zl,
+                (bytewise_sum == zlib_sum && slice8_sum == zlib_sum &&
+                 engine_sum == zlib_sum) ? "" : "  MISMATCH");
+    }
+
+    return 0;
+}
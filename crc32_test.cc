@@ -0,0 +1,72 @@
+/* test harness for the 802.11 FCS CRC32
+ *
+ * Checks every CRC32 engine against zlib, which uses the same polynomial,
+ * over every start alignment and every length around the 64 byte PCLMUL
+ * fold and 16 byte block boundaries, plus a few full size frames.
+ *
+ * # build kismet, then
+ * make check
+ *
+ * ./crc32_test
+ *
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <zlib.h>
+
+#include <vector>
+
+#include "crc32.h"
+
+int main(void) {
+    uint8_t buf[16 + 8192];
+    uint64_t r = 0x9E3779B97F4A7C15ULL;
+    unsigned int failed = 0, checked = 0;
+
+    for (size_t i = 0; i < sizeof(buf); i++) {
+        r ^= r << 13;
+        r ^= r >> 7;
+        r ^= r << 17;
+        buf[i] = (uint8_t) r;
+    }
+
+    std::vector<size_t> lengths;
+
+    for (size_t l = 0; l <= 1100; l++)
+        lengths.push_back(l);
+
+    lengths.push_back(1500);
+    lengths.push_back(2304);
+    lengths.push_back(2346);
+    lengths.push_back(7951);
+    lengths.push_back(8192);
+
+    for (size_t offt = 0; offt < 16; offt++) {
+        for (auto l : lengths) {
+            const uint8_t *data = buf + offt;
+            uint32_t expected = (uint32_t) crc32(0, data, l);
+
+            uint32_t engine = crc32_80211(data, l);
+            uint32_t slice8 = crc32_80211_slice8(data, l);
+            uint32_t bytewise = crc32_80211_bytewise(data, l);
+
+            checked++;
+
+            if (engine != expected || slice8 != expected || bytewise != expected) {
+                fprintf(stderr, "crc mismatch offset %zu length %zu: zlib %08x %s %08x "
+                        "slice-by-8 %08x bytewise %08x\n", offt, l, expected,
+                        crc32_80211_engine(), engine, slice8, bytewise);
+                failed++;
+            }
+        }
+    }
+
+    printf("crc32 (%s): %u of %u buffers match zlib\n", crc32_80211_engine(),
+            checked - failed, checked);
+
+    return failed != 0;
+}
@@ -0,0 +1,146 @@
+/* benchmark harness for the per-packet device lookup
+ *
+ * Every packet looks up its device by key (and, for some phys, by mac) under
+ * the device list lock.  This times that lookup against:
+ *
+ *  - the ordered std::map / std::multimap the device tracker used to keep
+ *  - the hashed std::unordered_map / std::unordered_multimap it keeps now
+ *
+ * at several device counts, with the devices spread over sequential macs in a
+ * handful of vendor prefixes (the usual case, and the hardest for a weak hash)
+ * and packets hitting devices at random.
+ *
+ * # build kismet, then
+ * make device_lookup_bench
+ *
+ * ./device_lookup_bench [lookups] [devices] [devices] ...
+ *
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <chrono>
+#include <map>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include "kis_mutex.h"
+#include "macaddr.h"
+#include "trackedelement.h"
+
+static double elapsed_ns(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start).count();
+}
+
+struct bench_device {
+    bench_device(TrackedDeviceKey in_key, mac_addr in_mac) : key(in_key), mac(in_mac) { }
+
+    TrackedDeviceKey key;
+    mac_addr mac;
+};
+
+// Look up random devices by key and by mac, under a lock as the tracker does;
+// returns ns per lookup
+template<class K, class M>
+static double run(K& key_map, M& mac_map, std::vector<std::shared_ptr<bench_device> >& devices,
+        unsigned int num_lookups, size_t& found) {
+    kis_recursive_timed_mutex mutex;
+    uint64_t r = 0x9E3779B97F4A7C15ULL;
+
+    found = 0;
+
+    auto start = std::chrono::steady_clock::now();
+
+    for (unsigned int l = 0; l < num_lookups; l++) {
+        r ^= r << 13;
+        r ^= r >> 7;
+        r ^= r << 17;
+
+        const std::shared_ptr<bench_device>& d = devices[r % devices.size()];
+
+        local_locker lock(&mutex);
+
+        auto ki = key_map.find(d->key);
+        if (ki != key_map.end())
+            found++;
+
+        auto mi = mac_map.equal_range(d->mac);
+        for (auto i = mi.first; i != mi.second; ++i)
+            if (i->second->key == d->key)
+                found++;
+    }
+
+    return elapsed_ns(start) / num_lookups;
+}
+
+int main(int argc, char *argv[]) {
+    unsigned int num_lookups = 5000000;
+    std::vector<unsigned int> counts;
+
+    if (argc > 1)
+        num_lookups = strtoul(argv[1], NULL, 10);
+
+    for (int a = 2; a < argc; a++)
+        counts.push_back(strtoul(argv[a], NULL, 10));
+
+    if (counts.size() == 0)
+        counts = { 10000, 100000, 1000000 };
+
+    if (num_lookups == 0) {
+        fprintf(stderr, "usage: %s [lookups] [devices] [devices] ...\n", argv[0]);
+        return 1;
+    }
+
+    printf("%u lookups by key and by mac per run\n", num_lookups);
+    printf("  %10s %14s %14s\n", "devices", "ordered ns", "hashed ns");
+
+    for (auto num_devices : counts) {
+        if (num_devices == 0)
+            continue;
+
+        std::vector<std::shared_ptr<bench_device> > devices;
+
+        std::map<TrackedDeviceKey, std::shared_ptr<bench_device> > ordered_key;
+        std::multimap<mac_addr, std::shared_ptr<bench_device> > ordered_mac;
+
+        std::unordered_map<TrackedDeviceKey, std::shared_ptr<bench_device> > hashed_key;
+        std::unordered_multimap<mac_addr, std::shared_ptr<bench_device> > hashed_mac;
+
+        // Sequential macs under 8 vendor prefixes
+        for (unsigned int d = 0; d < num_devices; d++) {
+            uint32_t oui = 0x001122 + (d % 8) * 0x0F0F;
+            uint32_t serial = d / 8;
+            uint8_t m[6] = { (uint8_t) (oui >> 16), (uint8_t) (oui >> 8), (uint8_t) oui,
+                (uint8_t) (serial >> 16), (uint8_t) (serial >> 8), (uint8_t) serial };
+            mac_addr mac(m, 6);
+
+            std::shared_ptr<bench_device> dev(new bench_device(TrackedDeviceKey(1, 2, mac), mac));
+            devices.push_back(dev);
+
+            ordered_key.emplace(dev->key, dev);
+            ordered_mac.emplace(dev->mac, dev);
+            hashed_key.emplace(dev->key, dev);
+            hashed_mac.emplace(dev->mac, dev);
+        }
+
+        size_t ordered_found, hashed_found;
+
+        double ordered_ns = run(ordered_key, ordered_mac, devices, num_lookups, ordered_found);
+        double hashed_ns = run(hashed_key, hashed_mac, devices, num_lookups, hashed_found);
+
+        if (ordered_found != hashed_found || hashed_found != (size_t) num_lookups * 2) {
+            fprintf(stderr, "lookup mismatch: %zu ordered, %zu hashed\n", ordered_found,
+                    hashed_found);
+            return 1;
+        }
+
+        printf("  %10u %14.1f %14.1f\n", num_devices, ordered_ns, hashed_ns);
+    }
+
+    return 0;
+}
@@ -0,0 +1,160 @@
+/* benchmark harness for the memory held by tracked devices
+ *
+ * Builds devices the way the phys do (a base device record with the phy
+ * record attached) and reports the heap held per device for:
+ *
+ *  - a bare base device record
+ *  - a Wi-Fi access point: base record, dot11 record and one advertised SSID
+ *  - a Bluetooth device: base record and bluetooth record
+ *
+ * along with the size of the TrackerElement every field is built from.
+ *
+ * # build kismet, then
+ * make device_mem_bench
+ *
+ * ./device_mem_bench [devices]
+ *
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <malloc.h>
+
+#include <chrono>
+#include <memory>
+#include <vector>
+
+#include "globalregistry.h"
+#include "entrytracker.h"
+#include "trackedelement.h"
+#include "devicetracker.h"
+#include "phy_80211.h"
+#include "phy_bluetooth.h"
+
+static size_t heap_used() {
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+    return mallinfo2().uordblks;
+#else
+    return 0;
+#endif
+}
+
+static double elapsed_ns(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start).count();
+}
+
+// Build num_devices with the builder and report the heap each one holds
+template<class F>
+static void measure(const char *name, unsigned int num_devices, F build) {
+    std::vector<std::shared_ptr<kis_tracked_device_base> > devices;
+    devices.reserve(num_devices);
+
+    size_t heap_start = heap_used();
+    auto start = std::chrono::steady_clock::now();
+
+    for (unsigned int d = 0; d < num_devices; d++)
+        devices.push_back(build(d));
+
+    double ns = elapsed_ns(start);
+    size_t heap_end = heap_used();
+
+    printf("  %-20s %8.1f bytes per device, %8.1f ns to build\n", name,
+            (double) (heap_end - heap_start) / num_devices, ns / num_devices);
+}
+
+int main(int argc, char *argv[]) {
+    unsigned int num_devices = 20000;
+
+    if (argc > 1)
+        num_devices = strtoul(argv[1], NULL, 10);
+
+    if (num_devices == 0) {
+        fprintf(stderr, "usage: %s [devices]\n", argv[0]);
+        return 1;
+    }
+
+    if (heap_used() == 0) {
+        fprintf(stderr, "heap usage needs glibc 2.33 or newer\n");
+        return 1;
+    }
+
+    GlobalRegistry *globalreg = new GlobalRegistry();
+    EntryTracker::create_entrytracker(globalreg);
+
+    time_t now = 1500000000;
+    globalreg->timestamp.tv_sec = now;
+    globalreg->timestamp.tv_usec = 0;
+
+    int device_id =
+        globalreg->entrytracker->RegisterField("kismet.device.base", TrackerMap,
+                "core device record");
+    int dot11_id =
+        globalreg->entrytracker->RegisterField("dot11.device",
+                std::shared_ptr<dot11_tracked_device>(new dot11_tracked_device(globalreg, 0)),
+                "IEEE802.11 device");
+    int bt_id =
+        globalreg->entrytracker->RegisterField("bluetooth.device",
+                std::shared_ptr<bluetooth_tracked_device>(new bluetooth_tracked_device(globalreg, 0)),
+                "bluetooth device");
+
+    auto base = [globalreg, device_id, now](unsigned int d) {
+        std::shared_ptr<kis_tracked_device_base> dev(new kis_tracked_device_base(globalreg,
+                    device_id));
+
+        uint64_t m = 0x001122000000ULL + d;
+        mac_addr mac((uint8_t *) &m, 6);
+
+        dev->set_key(TrackedDeviceKey(1, 2, mac));
+        dev->set_macaddr(mac);
+        dev->set_first_time(now);
+        dev->set_last_time(now);
+
+        return dev;
+    };
+
+    // Warm up the field registrations so they aren't counted
+    {
+        auto dev = base(0);
+        std::shared_ptr<dot11_tracked_device> dot11(new dot11_tracked_device(globalreg, dot11_id));
+        dot11->new_advertised_ssid();
+        std::shared_ptr<bluetooth_tracked_device> bt(new bluetooth_tracked_device(globalreg, bt_id));
+    }
+
+    printf("%u devices, sizeof(TrackerElement) %zu\n", num_devices, sizeof(TrackerElement));
+
+    measure("base device", num_devices, base);
+
+    measure("Wi-Fi AP", num_devices, [&](unsigned int d) {
+            auto dev = base(d);
+            dev->set_phyname("IEEE802.11");
+            dev->set_type_string("Wi-Fi AP");
+
+            std::shared_ptr<dot11_tracked_device> dot11(new dot11_tracked_device(globalreg,
+                        dot11_id));
+            dot11_tracked_device::attach_base_parent(dot11, dev);
+
+            auto ssid = dot11->new_advertised_ssid();
+            ssid->set_ssid("bench network");
+            ssid->set_first_time(now);
+            dot11->get_advertised_ssid_map()->add_intmap((int32_t) d, ssid);
+
+            return dev;
+        });
+
+    measure("Bluetooth device", num_devices, [&](unsigned int d) {
+            auto dev = base(d);
+            dev->set_phyname("Bluetooth");
+            dev->set_type_string("BTLE");
+
+            std::shared_ptr<bluetooth_tracked_device> bt(new bluetooth_tracked_device(globalreg,
+                        bt_id));
+            dev->add_map(bt);
+
+            return dev;
+        });
+
+    return 0;
+}
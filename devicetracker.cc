@@ -25,6 +25,12 @@
 #include <list>
 #include <map>
 #include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <exception>
+#include <limits>
 
 #include "kismet_algorithm.h"
 
@@ -54,6 +60,8 @@
 
 #include "zstr.hpp"
 
+std::atomic<uint64_t> kis_tracked_device_base::next_mod_sequence(1);
+
 void kis_tracked_device_base::inc_frequency_count(double frequency) {
     if (frequency <= 0)
         return;
@@ -321,6 +329,18 @@ Devicetracker::Devicetracker(GlobalRegistry *in_globalreg) :
     // Create the pcap httpd
     httpd_pcap.reset(new Devicetracker_Httpd_Pcap(globalreg));
 
+    // Route our endpoints directly to us instead of being asked about every
+    // url; Httpd_VerifyRoute still checks the details
+    Httpd_RegisterRoute("/devices/:file");
+    Httpd_RegisterRoute("/phy/:file");
+    Httpd_RegisterRoute("/devices/summary/:file");
+    Httpd_RegisterRoute("/devices/columnar/:file");
+    Httpd_RegisterRoute("/devices/by-key/:key/:file");
+    Httpd_RegisterRoute("/devices/by-key/:key/:file/*path");
+    Httpd_RegisterRoute("/devices/by-mac/:mac/:file");
+    Httpd_RegisterRoute("/devices/by-phy/:phy/:file");
+    Httpd_RegisterRoute("/devices/last-time/:ts/:file");
+
     entrytracker =
         Globalreg::FetchGlobalAs<EntryTracker>(globalreg, "ENTRY_TRACKER");
 
@@ -363,6 +383,28 @@ Devicetracker::Devicetracker(GlobalRegistry *in_globalreg) :
         entrytracker->RegisterField("kismet.datatables.draw", TrackerUInt64,
                 "Datatable records draw ID");
 
+    lock_stats_id =
+        entrytracker->RegisterField("kismet.devicetracker.lock_stats", TrackerMap,
+                "device list lock statistics");
+    lock_stats_devicelist_id =
+        entrytracker->RegisterField("kismet.devicetracker.lock.devicelist", TrackerMap,
+                "device list lock");
+    lock_stats_shards_id =
+        entrytracker->RegisterField("kismet.devicetracker.lock.shards", TrackerVector,
+                "device index shard locks");
+    lock_stats_shard_id =
+        entrytracker->RegisterField("kismet.devicetracker.lock.shard", TrackerMap,
+                "device index shard lock");
+    lock_stats_locks_id =
+        entrytracker->RegisterField("kismet.devicetracker.lock.locks", TrackerUInt64,
+                "number of times the lock was acquired");
+    lock_stats_contended_id =
+        entrytracker->RegisterField("kismet.devicetracker.lock.contended", TrackerUInt64,
+                "number of times the lock was already held by another thread");
+    lock_stats_devices_id =
+        entrytracker->RegisterField("kismet.devicetracker.lock.devices", TrackerUInt64,
+                "number of devices indexed in the shard");
+
     packets_rrd.reset(new kis_tracked_rrd<>(globalreg, 0));
     packets_rrd_id =
         globalreg->entrytracker->RegisterField("kismet.device.packets_rrd",
@@ -371,6 +413,9 @@ Devicetracker::Devicetracker(GlobalRegistry *in_globalreg) :
 	num_packets = num_datapackets = num_errorpackets =
 		num_filterpackets = 0;
 
+    devicelist_lock_count = 0;
+    devicelist_contended_count = 0;
+
 	next_phy_id = 0;
 
     std::shared_ptr<Packetchain> packetchain =
@@ -465,7 +510,7 @@ Devicetracker::Devicetracker(GlobalRegistry *in_globalreg) :
 
                             // Run the device storage in its own thread
                             std::thread t([this] {
-                                store_devices(immutable_tracked_vec);
+                                store_devices();
 
                                 {
                                     local_locker l(&storing_mutex);
@@ -545,7 +590,9 @@ Devicetracker::Devicetracker(GlobalRegistry *in_globalreg) :
     }
 
     last_devicelist_saved = 0;
+    last_devicelist_saved_seq = 0;
     last_database_logged = 0;
+    last_database_logged_seq = 0;
 
     // Set up the device timeout
     device_idle_expiration =
@@ -564,6 +611,26 @@ Devicetracker::Devicetracker(GlobalRegistry *in_globalreg) :
         device_idle_timer = -1;
     }
 
+    match_threads =
+        globalreg->kismet_config->FetchOptUInt("device_match_threads", 0);
+
+    if (match_threads == 0)
+        match_threads = std::thread::hardware_concurrency();
+
+    if (match_threads == 0)
+        match_threads = 1;
+
+    match_job = NULL;
+    match_job_slots = 0;
+    match_job_active = 0;
+    match_pool_shutdown = false;
+
+    for (unsigned int t = 1; t < match_threads; t++)
+        match_helpers.push_back(std::thread([this]() { match_helper_processor(); }));
+
+    view_timeout =
+        globalreg->kismet_config->FetchOptUInt("device_view_timeout", 300);
+
 	max_num_devices =
 		globalreg->kismet_config->FetchOptUInt("tracker_max_devices", 0);
 
@@ -606,10 +673,21 @@ Devicetracker::Devicetracker(GlobalRegistry *in_globalreg) :
 }
 
 Devicetracker::~Devicetracker() {
+    {
+        std::lock_guard<std::mutex> lk(match_pool_mutex);
+        match_pool_shutdown = true;
+    }
+    match_pool_cv.notify_all();
+
+    for (auto& t : match_helpers)
+        t.join();
+    match_helpers.clear();
+
     local_eol_locker lock(&devicelist_mutex);
 
-    store_all_devices();
-    databaselog_write_all_devices();
+    // Flush anything which changed since the last timed write
+    store_devices();
+    databaselog_write_devices();
 
     if (statestore != NULL) {
         delete(statestore);
@@ -646,7 +724,13 @@ Devicetracker::~Devicetracker() {
 
     tracked_vec.clear();
     immutable_tracked_vec.clear();
-    tracked_mac_multimap.clear();
+
+    for (unsigned int s = 0; s < num_device_shards; s++) {
+        local_eol_locker shardlock(&(device_shards[s].mutex));
+        device_shards[s].tracked_map.clear();
+        device_shards[s].tracked_mac_multimap.clear();
+        device_shards[s].recency_index.clear();
+    }
 }
 
 Kis_Phy_Handler *Devicetracker::FetchPhyHandler(int in_phy) {
@@ -682,9 +766,17 @@ std::string Devicetracker::FetchPhyName(int in_phy) {
 }
 
 int Devicetracker::FetchNumDevices() {
-    local_locker lock(&devicelist_mutex);
+    int num = 0;
+
+    for (unsigned int s = 0; s < num_device_shards; s++) {
+        device_shard *shard = &device_shards[s];
+        local_counting_locker shardlock(&(shard->mutex), 
+                &(shard->lock_count), &(shard->contended_count));
+
+        num += shard->tracked_map.size();
+    }
 
-    return tracked_map.size();
+    return num;
 }
 
 int Devicetracker::FetchNumPackets() {
@@ -716,18 +808,167 @@ void Devicetracker::UpdateFullRefresh() {
 }
 
 std::shared_ptr<kis_tracked_device_base> Devicetracker::FetchDevice(TrackedDeviceKey in_key) {
-    local_locker lock(&devicelist_mutex);
+    device_shard *shard = fetch_key_shard(in_key);
+    local_counting_locker lock(&(shard->mutex), 
+            &(shard->lock_count), &(shard->contended_count));
 
-	device_itr i = tracked_map.find(in_key);
+	device_itr i = shard->tracked_map.find(in_key);
 
-	if (i != tracked_map.end())
+	if (i != shard->tracked_map.end())
 		return i->second;
 
 	return NULL;
 }
 
+std::vector<std::shared_ptr<kis_tracked_device_base> > 
+    Devicetracker::FetchDevicesByMac(mac_addr in_mac) {
+
+    std::vector<std::shared_ptr<kis_tracked_device_base> > ret;
+
+    device_shard *shard = fetch_mac_shard(in_mac);
+    local_counting_locker lock(&(shard->mutex), 
+            &(shard->lock_count), &(shard->contended_count));
+
+    auto mmp = shard->tracked_mac_multimap.equal_range(in_mac);
+    for (auto mmpi = mmp.first; mmpi != mmp.second; ++mmpi)
+        ret.push_back(mmpi->second);
+
+    return ret;
+}
+
+SharedTrackerElement Devicetracker::FetchDevicesSince(time_t in_ts) {
+    SharedTrackerElement ret(new TrackerElement(TrackerVector));
+
+    // Each shard's index is in order on its own; hold every shard, in order, and
+    // merge the runs after in_ts straight into the results, oldest first.  
+    // Nothing else holds more than one shard at a time.
+    std::unique_ptr<local_counting_locker> locks[num_device_shards];
+
+    typedef std::pair<recency_map::iterator, recency_map::iterator> recent_run;
+    std::vector<recent_run> runs;
+
+    for (unsigned int s = 0; s < num_device_shards; s++) {
+        device_shard *shard = &device_shards[s];
+        locks[s].reset(new local_counting_locker(&(shard->mutex), 
+                    &(shard->lock_count), &(shard->contended_count)));
+
+        // Everything after the last possible key at in_ts
+        auto ri = shard->recency_index.upper_bound(std::make_pair(in_ts, 
+                    std::numeric_limits<uint64_t>::max()));
+
+        if (ri != shard->recency_index.end())
+            runs.push_back(recent_run(ri, shard->recency_index.end()));
+    }
+
+    // Min-heap of the next device in each run
+    auto later = [](const recent_run& a, const recent_run& b) {
+        return b.first->first < a.first->first;
+    };
+
+    std::make_heap(runs.begin(), runs.end(), later);
+
+    while (!runs.empty()) {
+        std::pop_heap(runs.begin(), runs.end(), later);
+
+        recent_run& r = runs.back();
+
+        ret->add_vector(r.first->second);
+
+        if (++r.first == r.second)
+            runs.pop_back();
+        else
+            std::push_heap(runs.begin(), runs.end(), later);
+    }
+
+    return ret;
+}
+
+void Devicetracker::update_last_time(std::shared_ptr<kis_tracked_device_base> device,
+        time_t in_time) {
+    // Nearly every packet is from a device already seen this second, so check
+    // the indexed time before taking the shard lock.  It only ever moves
+    // forward, and only under the shard lock, so a stale read here can only
+    // send us on to the locked check below.
+    if (device->get_recency_time() >= in_time)
+        return;
+
+    device_shard *shard = fetch_key_shard(device->get_key());
+    local_counting_locker lock(&(shard->mutex), 
+            &(shard->lock_count), &(shard->contended_count));
+
+    time_t last_time = device->get_recency_time();
+
+    if (last_time >= in_time)
+        return;
+
+    // Only re-insert devices which are already indexed, so a device which 
+    // isn't tracked (or has already been removed) doesn't get added back
+    bool indexed = 
+        shard->recency_index.erase(std::make_pair(last_time, 
+                    device->get_kis_internal_id())) != 0;
+
+    device->set_last_time(in_time);
+    device->set_recency_time(in_time);
+
+    if (indexed)
+        shard->recency_index.emplace(std::make_pair(in_time, 
+                    device->get_kis_internal_id()), device);
+}
+
+void Devicetracker::index_device(std::shared_ptr<kis_tracked_device_base> device) {
+    {
+        device_shard *shard = fetch_key_shard(device->get_key());
+        local_counting_locker lock(&(shard->mutex), 
+                &(shard->lock_count), &(shard->contended_count));
+        shard->tracked_map[device->get_key()] = device;
+
+        device->set_recency_time(device->get_last_time());
+        shard->recency_index.emplace(std::make_pair(device->get_recency_time(),
+                    device->get_kis_internal_id()), device);
+    }
+
+    {
+        device_shard *shard = fetch_mac_shard(device->get_macaddr());
+        local_counting_locker lock(&(shard->mutex), 
+                &(shard->lock_count), &(shard->contended_count));
+        shard->tracked_mac_multimap.emplace(device->get_macaddr(), device);
+    }
+}
+
+void Devicetracker::unindex_device(std::shared_ptr<kis_tracked_device_base> device) {
+    {
+        device_shard *shard = fetch_key_shard(device->get_key());
+        local_counting_locker lock(&(shard->mutex), 
+                &(shard->lock_count), &(shard->contended_count));
+
+        shard->recency_index.erase(std::make_pair(device->get_recency_time(),
+                    device->get_kis_internal_id()));
+
+        device_itr mi = shard->tracked_map.find(device->get_key());
+        if (mi != shard->tracked_map.end())
+            shard->tracked_map.erase(mi);
+    }
+
+    {
+        device_shard *shard = fetch_mac_shard(device->get_macaddr());
+        local_counting_locker lock(&(shard->mutex), 
+                &(shard->lock_count), &(shard->contended_count));
+
+        auto mmp = shard->tracked_mac_multimap.equal_range(device->get_macaddr());
+
+        for (auto mmpi = mmp.first; mmpi != mmp.second; ++mmpi) {
+            if (mmpi->second->get_key() == device->get_key()) {
+                shard->tracked_mac_multimap.erase(mmpi);
+                break;
+            }
+        }
+    }
+}
+
 int Devicetracker::CommonTracker(kis_packet *in_pack) {
-    local_locker lock(&devicelist_mutex);
+    // Only the counters are touched here; looking up and creating devices is
+    // handled by the phy in UpdateCommonDevice
+    local_locker lock(&packetcount_mutex);
 
 	if (in_pack->error) {
 		// and bail
@@ -811,9 +1052,6 @@ std::shared_ptr<kis_tracked_device_base> Devicetracker::UpdateCommonDevice(mac_a
 
 	if ((device = FetchDevice(key)) == NULL) {
         device.reset(new kis_tracked_device_base(globalreg, device_base_id));
-        // Device ID is the size of the vector so a new device always gets put
-        // in it's numbered slot
-        device->set_kis_internal_id(immutable_tracked_vec.size());
 
         device->set_key(key);
         device->set_macaddr(in_mac);
@@ -827,12 +1065,18 @@ std::shared_ptr<kis_tracked_device_base> Devicetracker::UpdateCommonDevice(mac_a
         // fprintf(stderr, "debug - new device from key %s server %X phy %X\n", key.as_string().c_str(), globalreg->server_uuid_hash, in_phy->FetchPhynameHash());
         
         {
-            local_locker devlocker(&devicelist_mutex);
-            tracked_map[key] = device;
+            local_counting_locker devlocker(&devicelist_mutex,
+                    &devicelist_lock_count, &devicelist_contended_count);
+
+            // Device ID is the size of the vector so a new device always gets put
+            // in it's numbered slot
+            device->set_kis_internal_id(immutable_tracked_vec.size());
+
             tracked_vec.push_back(device);
             immutable_tracked_vec.push_back(device);
-            tracked_mac_multimap.emplace(in_mac, device);
         }
+
+        index_device(device);
     }
 
     // Lock the device itself
@@ -851,8 +1095,7 @@ std::shared_ptr<kis_tracked_device_base> Devicetracker::UpdateCommonDevice(mac_a
     // Update the mod data
     device->update_modtime();
 
-    if (device->get_last_time() < in_pack->ts.tv_sec)
-        device->set_last_time(in_pack->ts.tv_sec);
+    update_last_time(device, in_pack->ts.tv_sec);
 
     if (in_flags & UCD_UPDATE_PACKETS) {
         device->inc_packets();
@@ -1023,8 +1266,7 @@ int Devicetracker::PopulateCommon(std::shared_ptr<kis_tracked_device_base> devic
 
     device->get_packets_rrd()->add_sample(1, globalreg->timestamp.tv_sec);
 
-    if (device->get_last_time() < in_pack->ts.tv_sec) 
-        device->set_last_time(in_pack->ts.tv_sec);
+    update_last_time(device, in_pack->ts.tv_sec);
 
     if (pack_common->error)
         device->inc_error_packets();
@@ -1110,12 +1352,39 @@ bool devicetracker_sort_internal_id(std::shared_ptr<kis_tracked_device_base> a,
 void Devicetracker::MatchOnDevices(DevicetrackerFilterWorker *worker, 
         TrackerElementVector vec, bool batch) {
 
-    kismet__for_each(vec.begin(), vec.end(), [&](SharedTrackerElement val) {
-                if (val == NULL)
-                    return;
+    // Take a snapshot of the list, since devices can be added while we're 
+    // matching
+    std::vector<SharedTrackerElement> devs;
+    {
+        local_counting_locker lock(&devicelist_mutex,
+                &devicelist_lock_count, &devicelist_contended_count);
+        devs.reserve(vec.size());
+        devs.insert(devs.end(), vec.begin(), vec.end());
+    }
+
+    // The list is split into chunks which threads claim as they go, so a 
+    // thread which lands on cheap devices picks up more of the work.  Matches
+    // are kept per chunk and merged in order, so the results come out in the 
+    // same order no matter how many threads ran.
+    const size_t chunk_sz = 512;
+    size_t num_chunks = (devs.size() + chunk_sz - 1) / chunk_sz;
+
+    std::vector<std::vector<SharedTrackerElement> > chunk_matches(num_chunks);
+    std::atomic<size_t> next_chunk(0);
+
+    auto match_chunks = [&]() {
+        size_t c;
+
+        while ((c = next_chunk++) < num_chunks) {
+            auto b = devs.begin() + (c * chunk_sz);
+            auto e = devs.begin() + std::min(devs.size(), (c + 1) * chunk_sz);
+
+            for (auto di = b; di != e; ++di) {
+                if (*di == NULL)
+                    continue;
 
                 std::shared_ptr<kis_tracked_device_base> v = 
-                    std::static_pointer_cast<kis_tracked_device_base>(val);
+                    std::static_pointer_cast<kis_tracked_device_base>(*di);
 
                 bool m;
 
@@ -1125,86 +1394,115 @@ void Devicetracker::MatchOnDevices(DevicetrackerFilterWorker *worker,
                     m = worker->MatchDevice(this, v);
                 }
 
-                if (m) 
-                    worker->MatchedDevice(v);
-            });
-
-    worker->Finalize(this);
-
-#if 0
-    // We chunk into blocks of 500 devices and perform the match in 
-    // batches; this prevents a single query from running so long that
-    // things fall down.  It is slightly less efficient on huge data sets,
-    // but the tradeoff is a naive client being able to crash the whole
-    // show by doing a query against 20,000 devices in one go.
-   
-    // Handle non-batched stuff like internal memory management ops
-    if (!batch) {
-        local_locker lock(&devicelist_mutex);
-
-        kismet__for_each(vec.begin(), vec.end(), 
-                [&](SharedTrackerElement val) {
-                std::shared_ptr<kis_tracked_device_base> v = 
-                        std::static_pointer_cast<kis_tracked_device_base>(val);
-                    worker->MatchDevice(this, v);
-                });
+                if (m)
+                    chunk_matches[c].push_back(v);
+            }
+        }
+    };
 
-        worker->Finalize(this);
-        return;
-    }
-    
-    size_t dpos = 0;
-    size_t chunk_sz = 10;
+    unsigned int num_threads = 1;
 
-    while (1) {
-        local_demand_locker lock(&devicelist_mutex);
+    if (worker->ParallelMatch())
+        num_threads = std::min((size_t) match_threads, num_chunks);
 
-        lock.lock();
+    // Only one match at a time gets the helpers; a concurrent match runs on its
+    // own thread rather than waiting for them
+    std::unique_lock<std::mutex> job_lock(match_job_mutex, std::defer_lock);
 
-        auto b = vec.begin() + dpos;
-        auto e = b + chunk_sz;
-        bool last_loop = false;
+    if (num_threads > 1 && job_lock.try_lock()) {
+        std::function<void ()> job = match_chunks;
+        std::exception_ptr error;
 
-        if (e > vec.end()) {
-            e = vec.end();
-            last_loop = true;
+        {
+            std::lock_guard<std::mutex> lk(match_pool_mutex);
+            match_job = &job;
+            match_job_slots = num_threads - 1;
+            match_job_error = nullptr;
         }
+        match_pool_cv.notify_all();
 
-        // Parallel for-each while inside a lock
-        
-        
-        kismet__for_each(b, e, 
-                [&](SharedTrackerElement val) {
-
-                if (val == NULL)
-                    return;
-                std::shared_ptr<kis_tracked_device_base> v = 
-                std::static_pointer_cast<kis_tracked_device_base>(val);
+        try {
+            match_chunks();
+        } catch (...) {
+            error = std::current_exception();
+        }
 
-                worker->MatchDevice(this, v);
-                });
+        // Every chunk has been claimed by now, so helpers which haven't picked
+        // up the job yet aren't needed; wait for the ones which did
+        {
+            std::unique_lock<std::mutex> lk(match_pool_mutex);
+            match_job_slots = 0;
+            match_done_cv.wait(lk, [this]() { return match_job_active == 0; });
+            match_job = NULL;
+
+            if (error == nullptr)
+                error = match_job_error;
+            match_job_error = nullptr;
+        }
 
-        lock.unlock();
+        if (error != nullptr)
+            std::rethrow_exception(error);
+    } else {
+        match_chunks();
+    }
 
-        if (last_loop)
-            break;
+    size_t num_matched = 0;
+    for (auto& cm : chunk_matches)
+        num_matched += cm.size();
 
-        dpos += chunk_sz;
+    std::vector<SharedTrackerElement> matched;
+    matched.reserve(num_matched);
 
-        // We're now unlocked, do a tiny sleep to let another thread grab the lock
-        // if it needs to
-        usleep(1000);
+    for (auto& cm : chunk_matches)
+        matched.insert(matched.end(), cm.begin(), cm.end());
 
-    }
+    worker->MatchedDevices(matched);
 
     worker->Finalize(this);
-#endif
 }
 
 void Devicetracker::MatchOnDevices(DevicetrackerFilterWorker *worker, bool batch) {
     MatchOnDevices(worker, immutable_tracked_vec, batch);
 }
 
+void Devicetracker::match_helper_processor() {
+    std::unique_lock<std::mutex> lk(match_pool_mutex);
+
+    while (1) {
+        match_pool_cv.wait(lk, [this]() { 
+                return match_pool_shutdown || match_job_slots > 0; 
+                });
+
+        if (match_pool_shutdown)
+            return;
+
+        match_job_slots--;
+        match_job_active++;
+
+        std::function<void ()> *job = match_job;
+
+        lk.unlock();
+
+        std::exception_ptr error;
+
+        try {
+            (*job)();
+        } catch (...) {
+            error = std::current_exception();
+        }
+
+        lk.lock();
+
+        if (error != nullptr && match_job_error == nullptr)
+            match_job_error = error;
+
+        match_job_active--;
+
+        if (match_job_active == 0)
+            match_done_cv.notify_all();
+    }
+}
+
 // Simple std::sort comparison function to order by the least frequently
 // seen devices
 bool devicetracker_sort_lastseen(std::shared_ptr<kis_tracked_device_base> a,
@@ -1215,7 +1513,8 @@ bool devicetracker_sort_lastseen(std::shared_ptr<kis_tracked_device_base> a,
 
 int Devicetracker::timetracker_event(int eventid) {
     if (eventid == device_idle_timer) {
-        local_locker lock(&devicelist_mutex);
+        local_counting_locker lock(&devicelist_mutex,
+                &devicelist_lock_count, &devicelist_contended_count);
 
         time_t ts_now = globalreg->timestamp.tv_sec;
         bool purged = false;
@@ -1227,25 +1526,15 @@ int Devicetracker::timetracker_event(int eventid) {
                     local_locker devlocker(&(d->device_mutex));
 
                     if (ts_now - d->get_last_time() > device_idle_expiration) {
-                        device_itr mi = tracked_map.find(d->get_key());
-                        if (mi != tracked_map.end())
-                            tracked_map.erase(mi);
+                        // Remove it from the key and mac indexes; this only
+                        // locks the shards the device lives in
+                        unindex_device(d);
 
                         // Forget it from the immutable vec, but keep its 
                         // position; we need to have vecpos = devid
                         auto iti = immutable_tracked_vec.begin() + d->get_kis_internal_id();
                         (*iti).reset();
 
-                        // Erase it from the multimap
-                        auto mmp = tracked_mac_multimap.equal_range(d->get_macaddr());
-
-                        for (auto mmpi = mmp.first; mmpi != mmp.second; ++mmpi) {
-                            if (mmpi->second->get_key() == d->get_key()) {
-                                tracked_mac_multimap.erase(mmpi);
-                                break;
-                            }
-                        }
-
                         purged = true;
 
                         return true;
@@ -1259,7 +1548,8 @@ int Devicetracker::timetracker_event(int eventid) {
             UpdateFullRefresh();
 
     } else if (eventid == max_devices_timer) {
-		local_locker lock(&devicelist_mutex);
+        local_counting_locker lock(&devicelist_mutex,
+                &devicelist_lock_count, &devicelist_contended_count);
 
 		// Do nothing if we don't care
 		if (max_num_devices <= 0)
@@ -1282,10 +1572,7 @@ int Devicetracker::timetracker_event(int eventid) {
 
 		// Figure out how many we don't care about, and remove them from the map
 		for (unsigned int d = 0; d < drop; d++) {
-			device_itr mi = tracked_map.find(tracked_vec[d]->get_key());
-
-			if (mi != tracked_map.end())
-				tracked_map.erase(mi);
+            unindex_device(tracked_vec[d]);
 		}
 
 		// Clear them out of the vector
@@ -1418,7 +1705,8 @@ int Devicetracker::Database_UpgradeDB() {
 }
 
 void Devicetracker::AddDevice(std::shared_ptr<kis_tracked_device_base> device) {
-    local_locker lock(&devicelist_mutex);
+    local_counting_locker lock(&devicelist_mutex,
+            &devicelist_lock_count, &devicelist_contended_count);
 
     if (FetchDevice(device->get_key()) != NULL) {
         _MSG("Devicetracker tried to add device " + device->get_macaddr().Mac2String() + 
@@ -1430,34 +1718,43 @@ void Devicetracker::AddDevice(std::shared_ptr<kis_tracked_device_base> device) {
     // in it's numbered slot
     device->set_kis_internal_id(immutable_tracked_vec.size());
 
-    tracked_map[device->get_key()] = device;
     tracked_vec.push_back(device);
     immutable_tracked_vec.push_back(device);
-    tracked_mac_multimap.emplace(device->get_macaddr(), device);
+
+    index_device(device);
 }
 
-int Devicetracker::store_devices() {
+SharedTrackerElement Devicetracker::fetch_dirty_devices(uint64_t in_seq) {
     SharedTrackerElement devs(new TrackerElement(TrackerVector));
     TrackerElementVector dv(devs);
 
-    // Find anything that has changed
-    for (auto v : immutable_tracked_vec) {
-        if (v == NULL)
-            continue;
+    local_counting_locker lock(&devicelist_mutex,
+            &devicelist_lock_count, &devicelist_contended_count);
 
-        std::shared_ptr<kis_tracked_device_base> kdb =
-            std::static_pointer_cast<kis_tracked_device_base>(v);
-        if (kdb->get_mod_time() > last_database_logged)
+    for (auto v : tracked_vec) {
+        if (v->get_mod_sequence() >= in_seq)
             dv.push_back(v);
     }
 
+    return devs;
+}
+
+int Devicetracker::store_devices() {
+    // Anything modified from here on is picked up next time; a device modified
+    // while we collect may be written twice, which is harmless
+    uint64_t seq = kis_tracked_device_base::current_mod_sequence();
+
+    SharedTrackerElement devs = fetch_dirty_devices(last_devicelist_saved_seq);
+
     last_devicelist_saved = time(0);
+    last_devicelist_saved_seq = seq;
 
     return store_devices(devs);
 }
 
 int Devicetracker::store_all_devices() {
     last_devicelist_saved = time(0);
+    last_devicelist_saved_seq = kis_tracked_device_base::current_mod_sequence();
 
     return store_devices(immutable_tracked_vec);
 }
@@ -1475,27 +1772,19 @@ int Devicetracker::store_devices(TrackerElementVector devices) {
 }
 
 void Devicetracker::databaselog_write_devices() {
-    SharedTrackerElement devs(new TrackerElement(TrackerVector));
-    TrackerElementVector dv(devs);
-
-    // Find anything that has changed
-    for (auto v : immutable_tracked_vec) {
-        if (v == NULL)
-            continue;
+    uint64_t seq = kis_tracked_device_base::current_mod_sequence();
 
-        std::shared_ptr<kis_tracked_device_base> kdb =
-            std::static_pointer_cast<kis_tracked_device_base>(v);
-        if (kdb->get_mod_time() > last_database_logged)
-            dv.push_back(v);
-    }
+    SharedTrackerElement devs = fetch_dirty_devices(last_database_logged_seq);
 
     last_database_logged = time(0);
+    last_database_logged_seq = seq;
 
     databaselog_write_devices(devs);
 }
 
 void Devicetracker::databaselog_write_all_devices() {
     last_database_logged = time(0);
+    last_database_logged_seq = kis_tracked_device_base::current_mod_sequence();
 
     databaselog_write_devices(immutable_tracked_vec);
 }
@@ -1749,6 +2038,9 @@ void Devicetracker::SetDeviceUserName(std::shared_ptr<kis_tracked_device_base> i
 
     in_dev->set_username(in_username);
 
+    // Mark the device modified so cached summaries and loggers pick it up
+    in_dev->update_modtime();
+
     if (!Database_Valid()) {
         _MSG("Unable to store device name to permanent storage, the database connection "
                 "is not available", MSGFLAG_ERROR);
@@ -1809,6 +2101,8 @@ void Devicetracker::SetDeviceTag(std::shared_ptr<kis_tracked_device_base> in_dev
         sm.erase(t);
     sm.insert(TrackerElementStringMap::pair(in_tag, e));
 
+    in_dev->update_modtime();
+
     if (!Database_Valid()) {
         _MSG("Unable to store device name to permanent storage, the database connection "
                 "is not available", MSGFLAG_ERROR);
@@ -2161,9 +2455,13 @@ int DevicetrackerStateStore::store_devices(TrackerElementVector devices) {
         return -1;
     }
 
+    // Devices are packed in parallel by the match threads; only the insert
+    // itself is serialized
+    kis_recursive_timed_mutex stmt_mutex;
+
     // Use a function worker to insert it into the db
-    devicetracker_function_worker fw(globalreg,
-            [this, &stmt] 
+    devicetracker_parallel_function_worker fw(globalreg,
+            [this, &stmt, &stmt_mutex] 
                 (Devicetracker *, std::shared_ptr<kis_tracked_device_base> d) -> bool {
                 std::shared_ptr<kis_tracked_device_base> kdb =
                     std::static_pointer_cast<kis_tracked_device_base>(d);
@@ -2189,13 +2487,10 @@ int DevicetrackerStateStore::store_devices(TrackerElementVector devices) {
 
 
                 sbuf.str("");
-                sqlite3_reset(stmt);
 
-                // Pack a storage formatted blob
-                {
-                    local_locker lock(&(devicetracker->devicelist_mutex));
-                    StorageMsgpackAdapter::Pack(globalreg, *serialstream, d, NULL);
-                }
+                // Pack a storage formatted blob; the device is already locked
+                // by the worker
+                StorageMsgpackAdapter::Pack(globalreg, *serialstream, d, NULL);
 
                 // Sync the buffers
                 zobuf.pubsync();
@@ -2206,6 +2501,10 @@ int DevicetrackerStateStore::store_devices(TrackerElementVector devices) {
                 macstring = kdb->get_macaddr().Mac2String();
                 phystring = kdb->get_phyname();
 
+                local_locker lock(&stmt_mutex);
+
+                sqlite3_reset(stmt);
+
                 sqlite3_bind_int(stmt, 1, kdb->get_first_time());
                 sqlite3_bind_int(stmt, 2, kdb->get_mod_time());
                 sqlite3_bind_text(stmt, 3, phystring.c_str(), phystring.length(), 0);
@@ -25,6 +25,13 @@
 #include <time.h>
 #include <list>
 #include <map>
+#include <unordered_map>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <exception>
 #include <vector>
 #include <algorithm>
 #include <string>
@@ -109,6 +116,10 @@ public:
 
         register_fields();
         reserve_fields(NULL);
+
+        // New devices are always dirty
+        mod_sequence = next_mod_sequence++;
+        recency_time = 0;
     }
 
     kis_tracked_device_base(GlobalRegistry *in_globalreg, int in_id,
@@ -116,6 +127,9 @@ public:
         
         register_fields();
         reserve_fields(e);
+
+        mod_sequence = next_mod_sequence++;
+        recency_time = 0;
     }
 
     virtual ~kis_tracked_device_base() {
@@ -152,8 +166,20 @@ public:
     __Proxy(mod_time, uint64_t, time_t, time_t, mod_time);
     void update_modtime() {
         set_mod_time(time(0));
+        mod_sequence = next_mod_sequence++;
     }
 
+    // Every modification takes a new number from a global sequence, so a writer
+    // which remembers current_mod_sequence() when it starts a flush can find
+    // exactly the devices modified since, without second-granularity races
+    uint64_t get_mod_sequence() { return mod_sequence; }
+    static uint64_t current_mod_sequence() { return next_mod_sequence; }
+
+    // last_time as the device is keyed in the device tracker's recency index;
+    // unlike the tracked last_time it can be read without the index lock
+    time_t get_recency_time() { return recency_time; }
+    void set_recency_time(time_t in_time) { recency_time = in_time; }
+
     __Proxy(packets, uint64_t, uint64_t, uint64_t, packets);
     __ProxyIncDec(packets, uint64_t, uint64_t, packets);
 
@@ -251,6 +277,11 @@ protected:
     virtual void register_fields();
     virtual void reserve_fields(SharedTrackerElement e);
 
+    std::atomic<uint64_t> mod_sequence;
+    static std::atomic<uint64_t> next_mod_sequence;
+
+    std::atomic<time_t> recency_time;
+
     // Unique, meaningless, incremental ID.  Practically, this is the order
     // in which kismet saw devices; it has no purpose other than a sorting
     // key which will always preserve order - time, etc, will not.  Used for breaking
@@ -397,6 +428,11 @@ public:
     // Finalize operations
     virtual void Finalize(Devicetracker *devicetracker) { }
 
+    // Can MatchDevice be called from several threads at once?  Workers which
+    // only read the device and their own fixed state can return true, and 
+    // large device lists will be matched in parallel
+    virtual bool ParallelMatch() { return false; }
+
     virtual SharedTrackerElement GetMatchedDevices() {
         return matched_devices;
     }
@@ -407,6 +443,13 @@ protected:
         matched_devices_vec.push_back(d);
     }
 
+    // Add a list of matched devices at once
+    virtual void MatchedDevices(const std::vector<SharedTrackerElement>& in_devs) {
+        local_locker lock(&worker_mutex);
+        for (auto d : in_devs)
+            matched_devices_vec.push_back(d);
+    }
+
     kis_recursive_timed_mutex worker_mutex;
 
     SharedTrackerElement matched_devices;
@@ -442,6 +485,62 @@ protected:
     Devicetracker *devicetracker;
 };
 
+// Cached summary view for paged device tables.  Holds the rendered json summary
+// of each device, keyed by the device internal id, and only re-renders a device
+// when it has been modified since the cached copy was made.  Views are named by
+// the client and looked up by the name and field list, so clients asking for 
+// the same columns share the same cache.
+//
+// The modification sequence only covers changes made through the device; RRDs
+// also change as time passes (the buckets are fast-forwarded when they are
+// serialized), so records which include any part of an RRD are only reused
+// within the second they were rendered in.
+class devicetracker_summary_view {
+public:
+    devicetracker_summary_view(GlobalRegistry *in_globalreg,
+            std::vector<SharedElementSummary> in_summary_vec,
+            unsigned int in_timeout);
+
+    // Write the summarized devices as a json array
+    void render(std::ostream &stream,
+            std::vector<std::shared_ptr<kis_tracked_device_base> >& devices);
+
+    time_t get_last_used() {
+        return last_used;
+    }
+
+protected:
+    struct cached_record {
+        uint64_t mod_sequence;
+        time_t rendered;
+        bool has_rrd;
+        time_t last_used;
+        std::string record;
+    };
+
+    // Does a summarized record include an RRD, or part of one
+    bool contains_rrd(SharedTrackerElement in_elem);
+
+    GlobalRegistry *globalreg;
+    std::shared_ptr<EntryTracker> entrytracker;
+
+    kis_recursive_timed_mutex view_mutex;
+
+    std::vector<SharedElementSummary> summary_vec;
+    std::unordered_map<uint64_t, cached_record> records;
+
+    // Field ids which only appear in RRDs, and if any of the fields in the view
+    // are a path into an RRD
+    std::vector<int> rrd_field_ids;
+    bool rrd_path;
+
+    // Records for devices which haven't been part of the view for this long 
+    // are dropped
+    unsigned int timeout;
+    std::atomic<time_t> last_used;
+    time_t last_prune;
+};
+
 class Devicetracker : public Kis_Net_Httpd_Chain_Stream_Handler,
     public TimetrackerEvent, public LifetimeGlobal, public KisDatabase {
 
@@ -486,11 +585,21 @@ public:
 	// Look for an existing device record
     std::shared_ptr<kis_tracked_device_base> FetchDevice(TrackedDeviceKey in_key);
 
+    // Find all devices with a given mac, in any phy
+    std::vector<std::shared_ptr<kis_tracked_device_base> > FetchDevicesByMac(mac_addr in_mac);
+
+    // Find all devices seen after a given time as a vector of devices, ordered
+    // by last_time, oldest first, and by device id within the same second.  Only
+    // looks at the devices which qualify, so it's cheap for clients polling for
+    // recent changes.
+    SharedTrackerElement FetchDevicesSince(time_t in_ts);
+
     // Perform a device filter.  Pass a subclassed filter instance.
     //
-    // If "batch" is true, Kismet will sort the devices based on the internal ID 
-    // and batch this processing in several groups to allow other threads time 
-    // to operate.
+    // Large lists are split into chunks which are matched in parallel by the
+    // match helper threads, if the worker allows it.  "batch" is kept for
+    // compatibility and no longer changes how the match runs; matching never
+    // holds the device list lock, only each device's own lock.
     //
     // Typically used to build a subset of devices for serialization
     void MatchOnDevices(DevicetrackerFilterWorker *worker, bool batch = true);
@@ -500,8 +609,8 @@ public:
     void MatchOnDevices(DevicetrackerFilterWorker *worker, 
             TrackerElementVector source_vec, bool batch = true);
 
-	typedef std::map<TrackedDeviceKey, std::shared_ptr<kis_tracked_device_base> >::iterator device_itr;
-	typedef std::map<TrackedDeviceKey, std::shared_ptr<kis_tracked_device_base> >::const_iterator const_device_itr;
+	typedef std::unordered_map<TrackedDeviceKey, std::shared_ptr<kis_tracked_device_base> >::iterator device_itr;
+	typedef std::unordered_map<TrackedDeviceKey, std::shared_ptr<kis_tracked_device_base> >::const_iterator const_device_itr;
 
 	static void Usage(char *argv);
 
@@ -551,6 +660,8 @@ public:
 
     // HTTP handlers
     virtual bool Httpd_VerifyPath(const char *path, const char *method);
+    virtual bool Httpd_VerifyRoute(const char *path, const char *method,
+            const Kis_Net_Httpd_Route_Match& match);
 
     virtual int Httpd_CreateStreamResponse(Kis_Net_Httpd *httpd,
             Kis_Net_Httpd_Connection *connection,
@@ -565,6 +676,18 @@ public:
     void httpd_all_phys(string url, std::ostream &stream, 
             std::string in_wrapper_key = "");
 
+    // Write the summarized fields of a list of devices as a columnar binary
+    // stream, read directly from the devices instead of building a summarized
+    // record for each one first.  The format is described in webui_rest.md.
+    void httpd_columnar_devices(std::ostream &stream,
+            std::vector<SharedElementSummary>& summary_vec, 
+            SharedTrackerElement devices);
+
+    // Find or create the cached summary view for a view name and field list, and
+    // discard views which haven't been used recently
+    std::shared_ptr<devicetracker_summary_view> fetch_summary_view(std::string in_name,
+            std::vector<SharedElementSummary>& summary_vec);
+
     // Timetracker event handler
     virtual int timetracker_event(int eventid);
 
@@ -581,12 +704,14 @@ public:
     // Database API
     virtual int Database_UpgradeDB();
 
-    // Store all devices to the database
+    // Store devices to the database; store_devices() only stores the devices
+    // modified since the last time it was called
     virtual int store_devices();
     virtual int store_all_devices();
     virtual int store_devices(TrackerElementVector devices);
 
-    // Store all devices to the database
+    // Log devices to the kismet database log; databaselog_write_devices() only
+    // logs the devices modified since the last time it was called
     virtual void databaselog_write_devices();
     virtual void databaselog_write_all_devices();
     virtual void databaselog_write_devices(TrackerElementVector devices);
@@ -606,6 +731,11 @@ protected:
 
     int dt_length_id, dt_filter_id, dt_draw_id;
 
+    // Lock contention stats
+    int lock_stats_id, lock_stats_devicelist_id, lock_stats_shards_id,
+        lock_stats_shard_id, lock_stats_locks_id, lock_stats_contended_id,
+        lock_stats_devices_id;
+
 	// Total # of packets
 	int num_packets;
 	int num_datapackets;
@@ -626,6 +756,31 @@ protected:
     int device_idle_expiration;
     int device_idle_timer;
 
+    // Number of threads used to match devices for workers which support it
+    unsigned int match_threads;
+
+    // Persistent helper threads for parallel matches; the thread calling 
+    // MatchOnDevices is always one of the match threads, so there are 
+    // match_threads - 1 helpers.  Only one match uses the helpers at a time, 
+    // any other parallel match runs on its calling thread alone.
+    void match_helper_processor();
+
+    std::vector<std::thread> match_helpers;
+    std::mutex match_job_mutex;
+    std::mutex match_pool_mutex;
+    std::condition_variable match_pool_cv;
+    std::condition_variable match_done_cv;
+    std::function<void ()> *match_job;
+    unsigned int match_job_slots;
+    unsigned int match_job_active;
+    std::exception_ptr match_job_error;
+    bool match_pool_shutdown;
+
+    // Cached summary views, keyed by view name and field list
+    kis_recursive_timed_mutex view_mutex;
+    std::map<std::string, std::shared_ptr<devicetracker_summary_view> > summary_views;
+    unsigned int view_timeout;
+
     // Maximum number of devices
     unsigned int max_num_devices;
     int max_devices_timer;
@@ -647,14 +802,66 @@ protected:
 	int pack_comp_device, pack_comp_common, pack_comp_basicdata,
 		pack_comp_radiodata, pack_comp_gps, pack_comp_datasrc;
 
-	// Tracked devices
-    std::map<TrackedDeviceKey, std::shared_ptr<kis_tracked_device_base> > tracked_map;
+    // Devices ordered by last_time, so that a last-time query only has to look
+    // at the devices seen since the requested time instead of every device.
+    // Keyed by the device recency time and the device id to keep the key 
+    // unique; the recency time of an indexed device is only changed via 
+    // update_last_time so the key can always be found again.
+    typedef std::map<std::pair<time_t, uint64_t>, 
+            std::shared_ptr<kis_tracked_device_base> > recency_map;
+
+    // Device lookup indexes, split into lock-striped shards so that looking up 
+    // a device for a packet, expiring a device, and looking up a device from 
+    // the REST interface only contend when they land on the same shard.
+    //
+    // Each shard holds the devices whose key hashes to it in tracked_map and
+    // recency_index, and the devices whose mac hashes to it in 
+    // tracked_mac_multimap (in theory multiple objects in different PHYs could
+    // have the same MAC so it's not a simple 1:1 map).  Only the recency index
+    // is kept in order, and only within the shard; anything which needs to 
+    // iterate the devices uses tracked_vec or immutable_tracked_vec under
+    // devicelist_mutex.
+    class device_shard {
+    public:
+        device_shard() :
+            lock_count(0),
+            contended_count(0) { }
+
+        kis_recursive_timed_mutex mutex;
+
+        std::unordered_map<TrackedDeviceKey, 
+            std::shared_ptr<kis_tracked_device_base> > tracked_map;
+        std::unordered_multimap<mac_addr, 
+            std::shared_ptr<kis_tracked_device_base> > tracked_mac_multimap;
+        recency_map recency_index;
+
+        std::atomic<uint64_t> lock_count;
+        std::atomic<uint64_t> contended_count;
+    };
+
+    static const unsigned int num_device_shards = 16;
+    device_shard device_shards[num_device_shards];
+
+    device_shard *fetch_key_shard(const TrackedDeviceKey& in_key) {
+        return &device_shards[std::hash<TrackedDeviceKey>()(in_key) % num_device_shards];
+    }
+
+    device_shard *fetch_mac_shard(const mac_addr& in_mac) {
+        return &device_shards[std::hash<mac_addr>()(in_mac) % num_device_shards];
+    }
+
+    // Add and remove a device from the key, mac, and recency indexes
+    void index_device(std::shared_ptr<kis_tracked_device_base> device);
+    void unindex_device(std::shared_ptr<kis_tracked_device_base> device);
+
+    // Advance the last_time of a device and move it in the recency index of its
+    // key shard.  A device seen again within the same second doesn't take any
+    // lock.  Callers hold the device lock.
+    void update_last_time(std::shared_ptr<kis_tracked_device_base> device, 
+            time_t in_time);
+
 	// Vector of tracked devices so we can iterate them quickly
     std::vector<std::shared_ptr<kis_tracked_device_base> > tracked_vec;
-    // MAC address lookups are incredibly expensive from the webui if we don't
-    // track by map; in theory multiple objects in different PHYs could have the
-    // same MAC so it's not a simple 1:1 map
-    std::multimap<mac_addr, std::shared_ptr<kis_tracked_device_base> > tracked_mac_multimap;
 
     // Immutable vector, one entry per device; may never be sorted.  Devices
     // which are removed are set to 'null'.  Each position corresponds to the
@@ -674,8 +881,18 @@ protected:
     // Insert a device directly into the records
     void AddDevice(std::shared_ptr<kis_tracked_device_base> device);
 
+    // Protects tracked_vec and immutable_tracked_vec
     kis_recursive_timed_mutex devicelist_mutex;
 
+    // Lock and contention counts for the devicelist and index shards, served as
+    // /devices/lock_stats
+    void httpd_lock_stats(const char *path, std::ostream &stream);
+    std::atomic<uint64_t> devicelist_lock_count;
+    std::atomic<uint64_t> devicelist_contended_count;
+
+    // Protects the packet counters updated by CommonTracker
+    kis_recursive_timed_mutex packetcount_mutex;
+
     std::shared_ptr<Devicetracker_Httpd_Pcap> httpd_pcap;
 
     // Load a specific device
@@ -687,8 +904,10 @@ protected:
         convert_stored_device(mac_addr macaddr, 
                 const unsigned char *raw_stored_data, unsigned long stored_len);
 
-    // Timestamp of the last time we wrote the device list, if we're storing state
+    // Timestamp and modification sequence of the last time we wrote the device 
+    // list, if we're storing state
     time_t last_devicelist_saved;
+    uint64_t last_devicelist_saved_seq;
 
     kis_recursive_timed_mutex storing_mutex;
     bool devices_storing;
@@ -719,7 +938,11 @@ protected:
     // If we log devices to the kismet database...
     int databaselog_timer;
     time_t last_database_logged;
+    uint64_t last_database_logged_seq;
     kis_recursive_timed_mutex databaselog_mutex;
+
+    // Collect the devices modified since in_seq
+    SharedTrackerElement fetch_dirty_devices(uint64_t in_seq);
     bool databaselog_logging;
 };
 
@@ -812,6 +1035,20 @@ protected:
     function<void (Devicetracker *)> fcb;
 };
 
+// Function worker which is safe to run from several threads at once, so large
+// device lists are split across the match threads; the callback must lock
+// anything it shares outside of the device itself
+class devicetracker_parallel_function_worker : public devicetracker_function_worker {
+public:
+    devicetracker_parallel_function_worker(GlobalRegistry *in_globalreg,
+            function<bool (Devicetracker *, 
+                std::shared_ptr<kis_tracked_device_base>)> in_mcb,
+            function<void (Devicetracker *)> in_fcb) :
+        devicetracker_function_worker(in_globalreg, in_mcb, in_fcb) { }
+
+    virtual bool ParallelMatch() { return true; }
+};
+
 // Matching worker to match fields against a string search term
 
 class devicetracker_stringmatch_worker : public DevicetrackerFilterWorker {
@@ -833,6 +1070,8 @@ public:
 
     virtual void Finalize(Devicetracker *devicetracker);
 
+    virtual bool ParallelMatch() { return true; }
+
 protected:
     GlobalRegistry *globalreg;
     std::shared_ptr<EntryTracker> entrytracker;
@@ -903,6 +1142,9 @@ public:
 
     virtual void Finalize(Devicetracker *devicetracker);
 
+    // Compiled filters are only read during matching
+    virtual bool ParallelMatch() { return true; }
+
 protected:
     GlobalRegistry *globalreg;
     std::shared_ptr<EntryTracker> entrytracker;
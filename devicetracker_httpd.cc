@@ -52,6 +52,15 @@
 
 // HTTP interfaces
 bool Devicetracker::Httpd_VerifyPath(const char *path, const char *method) {
+    Kis_Net_Httpd_Route_Match match;
+
+    match.tokenurl = StrTokenize(path, "/");
+
+    return Httpd_VerifyRoute(path, method, match);
+}
+
+bool Devicetracker::Httpd_VerifyRoute(const char *path, const char *method,
+        const Kis_Net_Httpd_Route_Match& match) {
     if (strcmp(method, "GET") == 0) {
         // Simple fixed URLS
 
@@ -69,8 +78,10 @@ bool Devicetracker::Httpd_VerifyPath(const char *path, const char *method) {
         if (stripped == "/phy/all_phys_dt" && can_serialize)
             return true;
 
-        // Split URL and process
-        vector<string> tokenurl = StrTokenize(path, "/");
+        if (stripped == "/devices/lock_stats" && can_serialize)
+            return true;
+
+        const vector<string>& tokenurl = match.tokenurl;
         if (tokenurl.size() < 2)
             return false;
 
@@ -128,12 +139,8 @@ bool Devicetracker::Httpd_VerifyPath(const char *path, const char *method) {
                     return false;
                 }
 
-                { 
-                    local_locker devlock(&devicelist_mutex);
-
-                    if (tracked_mac_multimap.count(mac) > 0)
-                        return true;
-                }
+                if (FetchDevicesByMac(mac).size() > 0)
+                    return true;
 
                 return false;
             } else if (tokenurl[2] == "last-time") {
@@ -154,8 +161,7 @@ bool Devicetracker::Httpd_VerifyPath(const char *path, const char *method) {
             }
         }
     } else if (strcmp(method, "POST") == 0) {
-        // Split URL and process
-        vector<string> tokenurl = StrTokenize(path, "/");
+        const vector<string>& tokenurl = match.tokenurl;
         if (tokenurl.size() < 2)
             return false;
 
@@ -165,6 +171,8 @@ bool Devicetracker::Httpd_VerifyPath(const char *path, const char *method) {
 
             } else if (tokenurl[2] == "summary") {
                 return Httpd_CanSerialize(tokenurl[3]);
+            } else if (tokenurl[2] == "columnar") {
+                return tokenurl[3] == "devices.kcol";
             } else if (tokenurl[2] == "last-time") {
                 if (tokenurl.size() < 5) {
                     return false;
@@ -215,11 +223,8 @@ bool Devicetracker::Httpd_VerifyPath(const char *path, const char *method) {
                     return false;
                 }
 
-                {
-                    local_locker listlocker(&devicelist_mutex);
-                    if (tracked_mac_multimap.count(mac) > 0)
-                        return true;
-                }
+                if (FetchDevicesByMac(mac).size() > 0)
+                    return true;
 
                 return false;
             } else if (tokenurl[2] == "by-phy") {
@@ -271,6 +276,53 @@ void Devicetracker::httpd_all_phys(string path, std::ostream &stream,
     entrytracker->Serialize(httpd->GetSuffix(path), stream, wrapper, NULL);
 }
 
+void Devicetracker::httpd_lock_stats(const char *path, std::ostream &stream) {
+    SharedTrackerElement stats(new TrackerElement(TrackerMap, lock_stats_id));
+
+    SharedTrackerElement dl(new TrackerElement(TrackerMap, lock_stats_devicelist_id));
+    stats->add_map(dl);
+
+    SharedTrackerElement dl_locks(new TrackerElement(TrackerUInt64, lock_stats_locks_id));
+    dl_locks->set((uint64_t) devicelist_lock_count);
+    dl->add_map(dl_locks);
+
+    SharedTrackerElement dl_contended(new TrackerElement(TrackerUInt64, 
+                lock_stats_contended_id));
+    dl_contended->set((uint64_t) devicelist_contended_count);
+    dl->add_map(dl_contended);
+
+    SharedTrackerElement shards(new TrackerElement(TrackerVector, lock_stats_shards_id));
+    stats->add_map(shards);
+
+    for (unsigned int s = 0; s < num_device_shards; s++) {
+        device_shard *shard = &device_shards[s];
+
+        SharedTrackerElement se(new TrackerElement(TrackerMap, lock_stats_shard_id));
+
+        SharedTrackerElement se_locks(new TrackerElement(TrackerUInt64, 
+                    lock_stats_locks_id));
+        se_locks->set((uint64_t) shard->lock_count);
+        se->add_map(se_locks);
+
+        SharedTrackerElement se_contended(new TrackerElement(TrackerUInt64, 
+                    lock_stats_contended_id));
+        se_contended->set((uint64_t) shard->contended_count);
+        se->add_map(se_contended);
+
+        SharedTrackerElement se_devices(new TrackerElement(TrackerUInt64,
+                    lock_stats_devices_id));
+        {
+            local_locker lock(&(shard->mutex));
+            se_devices->set((uint64_t) shard->tracked_map.size());
+        }
+        se->add_map(se_devices);
+
+        shards->add_vector(se);
+    }
+
+    entrytracker->Serialize(httpd->GetSuffix(path), stream, stats, NULL);
+}
+
 int Devicetracker::Httpd_CreateStreamResponse(
         Kis_Net_Httpd *httpd __attribute__((unused)),
         Kis_Net_Httpd_Connection *connection,
@@ -307,7 +359,7 @@ int Devicetracker::Httpd_CreateStreamResponse(
 
     if (strcmp(path, "/devices/all_devices.ekjson") == 0) {
         // Instantiate a manual serializer
-        JsonAdapter::Serializer serial(globalreg); 
+        FastJsonAdapter::Serializer serial(globalreg); 
 
         devicetracker_function_worker fw(globalreg, 
                 [this, &stream, &serial](Devicetracker *, shared_ptr<kis_tracked_device_base> d) -> bool {
@@ -335,7 +387,12 @@ int Devicetracker::Httpd_CreateStreamResponse(
         return MHD_YES;
     }
 
-    vector<string> tokenurl = StrTokenize(path, "/");
+    if (stripped == "/devices/lock_stats") {
+        httpd_lock_stats(path, stream);
+        return MHD_YES;
+    }
+
+    const vector<string>& tokenurl = connection->route.tokenurl;
 
     if (tokenurl.size() < 2)
         return MHD_YES;
@@ -395,8 +452,6 @@ int Devicetracker::Httpd_CreateStreamResponse(
             if (!Httpd_CanSerialize(tokenurl[4]))
                 return MHD_YES;
 
-            local_locker lock(&devicelist_mutex);
-
             mac_addr mac = mac_addr(tokenurl[3]);
 
             if (mac.error) {
@@ -405,9 +460,8 @@ int Devicetracker::Httpd_CreateStreamResponse(
 
             SharedTrackerElement devvec(new TrackerElement(TrackerVector));
 
-            auto mmp = tracked_mac_multimap.equal_range(mac);
-            for (auto mmpi = mmp.first; mmpi != mmp.second; ++mmpi) {
-                devvec->add_vector(mmpi->second);
+            for (auto d : FetchDevicesByMac(mac)) {
+                devvec->add_vector(d);
             }
 
             entrytracker->Serialize(httpd->GetSuffix(tokenurl[4]), stream, devvec, NULL);
@@ -431,18 +485,9 @@ int Devicetracker::Httpd_CreateStreamResponse(
             if (!Httpd_CanSerialize(tokenurl[4]))
                 return MHD_YES;
 
-            SharedTrackerElement devvec;
-
-            devicetracker_function_worker fw(globalreg, 
-                    [this, &stream, devvec, lastts](Devicetracker *, 
-                        shared_ptr<kis_tracked_device_base> d) -> bool {
-                        if (d->get_last_time() <= lastts)
-                            return false;
-
-                        return true;
-                    }, NULL);
-            MatchOnDevices(&fw);
-            devvec = fw.GetMatchedDevices();
+            // Pull the recently seen devices from the recency index instead of
+            // matching every device
+            SharedTrackerElement devvec = FetchDevicesSince(lastts);
 
             entrytracker->Serialize(httpd->GetSuffix(tokenurl[4]), stream, devvec, NULL);
 
@@ -455,8 +500,7 @@ int Devicetracker::Httpd_CreateStreamResponse(
 }
 
 int Devicetracker::Httpd_PostComplete(Kis_Net_Httpd_Connection *concls) {
-    // Split URL and process
-    vector<string> tokenurl = StrTokenize(concls->url, "/");
+    const vector<string>& tokenurl = concls->route.tokenurl;
 
     Kis_Net_Httpd_Buffer_Stream_Aux *saux = 
         (Kis_Net_Httpd_Buffer_Stream_Aux *) concls->custom_extension;
@@ -495,6 +539,9 @@ int Devicetracker::Httpd_PostComplete(Kis_Net_Httpd_Connection *concls) {
     // Wrapper, if any
     string wrapper_name;
 
+    // Cached summary view, if any
+    string view_name;
+
     // Rename cache generated during simplification
     TrackerElementSerializer::rename_map rename_map;
 
@@ -551,6 +598,9 @@ int Devicetracker::Httpd_PostComplete(Kis_Net_Httpd_Connection *concls) {
         // Get the wrapper, if one exists, default to empty if it doesn't
         wrapper_name = structdata->getKeyAsString("wrapper", "");
 
+        // Get the cached view name, if one exists
+        view_name = structdata->getKeyAsString("view", "");
+
         if (structdata->hasKey("regex")) {
             regexdata = structdata->getStructuredByKey("regex");
         }
@@ -584,14 +634,6 @@ int Devicetracker::Httpd_PostComplete(Kis_Net_Httpd_Connection *concls) {
                 return MHD_YES;
             }
 
-            local_demand_locker lock(&devicelist_mutex);
-
-            if (!Httpd_CanSerialize(tokenurl[4])) {
-                stream << "Invalid request";
-                concls->httpcode = 400;
-                return MHD_YES;
-            }
-
             mac_addr mac = mac_addr(tokenurl[3]);
 
             if (mac.error) {
@@ -600,27 +642,23 @@ int Devicetracker::Httpd_PostComplete(Kis_Net_Httpd_Connection *concls) {
                 return MHD_YES;
             }
 
-            lock.lock();
-            if (tracked_mac_multimap.count(mac) == 0) {
+            auto macdevs = FetchDevicesByMac(mac);
+
+            if (macdevs.size() == 0) {
                 stream << "Invalid request";
                 concls->httpcode = 400;
                 return MHD_YES;
             }
-            lock.unlock();
 
             string target = Httpd_StripSuffix(tokenurl[4]);
 
             if (target == "devices") {
                 SharedTrackerElement devvec(new TrackerElement(TrackerVector));
 
-                lock.lock();
-                auto mmp = tracked_mac_multimap.equal_range(mac);
-                lock.unlock();
-
-                for (auto mmpi = mmp.first; mmpi != mmp.second; ++mmpi) {
+                for (auto d : macdevs) {
                     SharedTrackerElement simple;
 
-                    SummarizeTrackerElement(entrytracker, mmpi->second, summary_vec,
+                    SummarizeTrackerElement(entrytracker, d, summary_vec,
                             simple, rename_map);
             
                     devvec->add_vector(simple);
@@ -694,6 +732,29 @@ int Devicetracker::Httpd_PostComplete(Kis_Net_Httpd_Connection *concls) {
             SharedTrackerElement outdevs =
                 globalreg->entrytracker->GetTrackedInstance(device_list_base_id);
 
+            // Cached view; views render json only, so any other format falls 
+            // back to summarizing every device
+            std::shared_ptr<devicetracker_summary_view> view;
+            std::vector<std::shared_ptr<kis_tracked_device_base> > view_devs;
+
+            if (view_name != "" && summary_vec.size() != 0 &&
+                    httpd->GetSuffix(tokenurl[3]) == "json")
+                view = fetch_summary_view(view_name, summary_vec);
+
+            // Summarize a device into the output list, or queue it for the view
+            auto add_summary = [&](SharedTrackerElement d) {
+                if (view != NULL) {
+                    view_devs.push_back(std::static_pointer_cast<kis_tracked_device_base>(d));
+                    return;
+                }
+
+                SharedTrackerElement simple;
+
+                SummarizeTrackerElement(entrytracker, d, summary_vec, simple, rename_map);
+
+                outdevs->add_vector(simple);
+            };
+
             unsigned int dt_start = 0;
             unsigned int dt_length = 0;
             int dt_draw = 0;
@@ -869,13 +930,8 @@ int Devicetracker::Httpd_PostComplete(Kis_Net_Httpd_Connection *concls) {
                 else
                     ei = pcrevec.begin() + dt_start + dt_length;
 
-                for (vi = pcrevec.begin() + dt_start; vi != ei; ++vi) {
-                    SharedTrackerElement simple;
-
-                    SummarizeTrackerElement(entrytracker, (*vi), summary_vec, simple, rename_map);
-
-                    outdevs->add_vector(simple);
-                }
+                for (vi = pcrevec.begin() + dt_start; vi != ei; ++vi)
+                    add_summary(*vi);
             } else if (dt_search_paths.size() != 0) {
                 // Otherwise, we're doing a search inside a datatables query,
                 // so go through every device and do a search on every element
@@ -921,13 +977,8 @@ int Devicetracker::Httpd_PostComplete(Kis_Net_Httpd_Connection *concls) {
 
                 // If we filtered, that's our list
                 TrackerElementVector::iterator vi;
-                for (vi = matchvec.begin() + dt_start; vi != ei; ++vi) {
-                    SharedTrackerElement simple;
-
-                    SummarizeTrackerElement(entrytracker, (*vi), summary_vec, simple, rename_map);
-
-                    outdevs->add_vector(simple);
-                }
+                for (vi = matchvec.begin() + dt_start; vi != ei; ++vi)
+                    add_summary(*vi);
             } else {
                 local_locker listlock(&devicelist_mutex);
 
@@ -963,15 +1014,31 @@ int Devicetracker::Httpd_PostComplete(Kis_Net_Httpd_Connection *concls) {
                 else
                     ei = tracked_vec.begin() + dt_start + dt_length;
 
-                for (vi = tracked_vec.begin() + dt_start; vi != ei; ++vi) {
-                    SharedTrackerElement simple;
-
-                    SummarizeTrackerElement(entrytracker,
-                            (*vi), summary_vec,
-                            simple, rename_map);
+                for (vi = tracked_vec.begin() + dt_start; vi != ei; ++vi)
+                    add_summary(*vi);
+            }
 
-                    outdevs->add_vector(simple);
+            // Cached views write the wrapper themselves around the cached records,
+            // after the device list lock has been released
+            if (view != NULL) {
+                if (dt_length_elem != NULL) {
+                    stream << "{\"data\": ";
+                    view->render(stream, view_devs);
+                    stream << ",\"draw\": " << dt_draw;
+                    stream << ",\"recordsTotal\": " << 
+                        GetTrackerValue<uint64_t>(dt_length_elem);
+                    stream << ",\"recordsFiltered\": " << 
+                        GetTrackerValue<uint64_t>(dt_filter_elem);
+                    stream << "}";
+                } else if (wrapper_name != "") {
+                    stream << "{\"" << JsonAdapter::SanitizeString(wrapper_name) << "\": ";
+                    view->render(stream, view_devs);
+                    stream << "}";
+                } else {
+                    view->render(stream, view_devs);
                 }
+
+                return MHD_YES;
             }
 
             // Apply wrapper if we haven't applied it already
@@ -987,6 +1054,41 @@ int Devicetracker::Httpd_PostComplete(Kis_Net_Httpd_Connection *concls) {
                     wrapper, &rename_map);
             return MHD_YES;
 
+        } else if (tokenurl[2] == "columnar") {
+            if (tokenurl[3] != "devices.kcol") {
+                stream << "Invalid request";
+                concls->httpcode = 400;
+                return MHD_YES;
+            }
+
+            if (summary_vec.size() == 0) {
+                stream << "Invalid request: Expected fields";
+                concls->httpcode = 400;
+                return MHD_YES;
+            }
+
+            SharedTrackerElement coldevs;
+
+            if (post_ts != 0) {
+                coldevs = FetchDevicesSince(post_ts);
+            } else {
+                coldevs.reset(new TrackerElement(TrackerVector));
+
+                local_locker listlock(&devicelist_mutex);
+
+                for (auto d : tracked_vec)
+                    coldevs->add_vector(d);
+            }
+
+            if (regexdata != NULL) {
+                devicetracker_pcre_worker worker(globalreg, regexdata);
+                MatchOnDevices(&worker, coldevs);
+                coldevs = worker.GetMatchedDevices();
+            }
+
+            httpd_columnar_devices(stream, summary_vec, coldevs);
+
+            return MHD_YES;
         } else if (tokenurl[2] == "last-time") {
             // We don't lock the device list since we use workers
             
@@ -1014,23 +1116,12 @@ int Devicetracker::Httpd_PostComplete(Kis_Net_Httpd_Connection *concls) {
             // Rename cache generated during simplification
             TrackerElementSerializer::rename_map rename_map;
         
-            // List of devices that pass the timestamp filter
-            SharedTrackerElement timedevs;
+            // List of devices that pass the timestamp filter, from the recency index
+            SharedTrackerElement timedevs = FetchDevicesSince(lastts);
             
             //  List of devices that pass the regex filter
             SharedTrackerElement regexdevs(new TrackerElement(TrackerVector));
 
-            devicetracker_function_worker tw(globalreg, 
-                    [this, &stream, lastts](Devicetracker *, shared_ptr<kis_tracked_device_base> d) -> bool {
-
-                        if (d->get_last_time() <= lastts)
-                            return false;
-
-                        return true;
-                    }, NULL);
-            MatchOnDevices(&tw);
-            timedevs = tw.GetMatchedDevices();
-
             if (regexdata != NULL) {
                 devicetracker_pcre_worker worker(globalreg, regexdata);
                 MatchOnDevices(&worker, timedevs);
@@ -1087,16 +1178,6 @@ int Devicetracker::Httpd_PostComplete(Kis_Net_Httpd_Connection *concls) {
             SharedTrackerElement regexdevs;
 
 
-            // Filter by time first, it's fast
-            devicetracker_function_worker tw(globalreg, 
-                    [this, &stream, post_ts](Devicetracker *, shared_ptr<kis_tracked_device_base> d) -> bool {
-
-                    if (d->get_last_time() <= post_ts)
-                        return false;
-       
-                    return true;
-                    }, NULL);
-
             devicetracker_function_worker pw(globalreg, 
                     [this, &stream, phydevs, phy](Devicetracker *, shared_ptr<kis_tracked_device_base> d) -> bool {
                         if (d->get_phyname() != phy->FetchPhyName())
@@ -1106,9 +1187,9 @@ int Devicetracker::Httpd_PostComplete(Kis_Net_Httpd_Connection *concls) {
                     }, NULL);
        
             if (post_ts != 0) {
-                // time-match then phy-match then pass to regex
-                MatchOnDevices(&tw);
-                timedevs = tw.GetMatchedDevices();
+                // time-match from the recency index, then phy-match, then
+                // pass to regex
+                timedevs = FetchDevicesSince(post_ts);
                 MatchOnDevices(&pw, timedevs);
                 phydevs = pw.GetMatchedDevices();
             }  else {
@@ -1152,3 +1233,529 @@ int Devicetracker::Httpd_PostComplete(Kis_Net_Httpd_Connection *concls) {
     return MHD_YES;
 }
 
+
+// Accumulator for one column of the columnar device export.  Values are 
+// appended row by row straight from the device records; the column type is
+// taken from the first device which has the field, and rows which don't have 
+// it (or have it as a different type) are recorded as null.
+class devicetracker_columnar_column {
+public:
+    // Column types beyond the basic tracker types
+    const static uint8_t column_json = 0xFE;
+    const static uint8_t column_null = 0xFF;
+
+    devicetracker_columnar_column(GlobalRegistry *in_globalreg, std::string in_name) :
+        globalreg(in_globalreg),
+        name(in_name),
+        type(column_null),
+        width(0),
+        rows(0),
+        pending_nulls(0) { }
+
+    void append(SharedTrackerElement e) {
+        if (e == NULL) {
+            append_null();
+            return;
+        }
+
+        uint8_t etype = column_type(e->get_type());
+
+        if (type == column_null) {
+            type = etype;
+            width = column_width(type);
+
+            if (width == 0)
+                offsets.push_back(0);
+
+            // Rows before the first value get empty entries now that we know
+            // how big an entry is
+            for (size_t x = 0; x < pending_nulls; x++)
+                append_empty();
+            pending_nulls = 0;
+        } else if (etype != type) {
+            append_null();
+            return;
+        }
+
+        set_valid(rows++, true);
+
+        switch (e->get_type()) {
+            case TrackerInt8:
+                put_le((uint8_t) e->get_int8(), 1);
+                break;
+            case TrackerUInt8:
+                put_le(e->get_uint8(), 1);
+                break;
+            case TrackerInt16:
+                put_le((uint16_t) e->get_int16(), 2);
+                break;
+            case TrackerUInt16:
+                put_le(e->get_uint16(), 2);
+                break;
+            case TrackerInt32:
+                put_le((uint32_t) e->get_int32(), 4);
+                break;
+            case TrackerUInt32:
+                put_le(e->get_uint32(), 4);
+                break;
+            case TrackerInt64:
+                put_le((uint64_t) e->get_int64(), 8);
+                break;
+            case TrackerUInt64:
+                put_le(e->get_uint64(), 8);
+                break;
+            case TrackerFloat: {
+                float f = e->get_float();
+                uint32_t u;
+                memcpy(&u, &f, sizeof(u));
+                put_le(u, 4);
+                break;
+            }
+            case TrackerDouble: {
+                double d = e->get_double();
+                uint64_t u;
+                memcpy(&u, &d, sizeof(u));
+                put_le(u, 8);
+                break;
+            }
+            case TrackerMac: {
+                mac_addr m = e->get_mac();
+                for (unsigned int x = 0; x < MAC_LEN_MAX; x++)
+                    data.push_back((char) m.index64(m.longmac, x));
+                break;
+            }
+            case TrackerUuid: {
+                uuid u = e->get_uuid();
+                data.append((const char *) u.uuid_block, sizeof(u.uuid_block));
+                break;
+            }
+            case TrackerString:
+                data.append(e->get_string_ref());
+                offsets.push_back(data.length());
+                break;
+            case TrackerKey:
+                data.append(e->get_key().as_string());
+                offsets.push_back(data.length());
+                break;
+            case TrackerByteArray:
+                data.append((const char *) e->get_bytearray().get(), 
+                        e->get_bytearray_size());
+                offsets.push_back(data.length());
+                break;
+            default: {
+                // Anything complex is carried as a json document
+                std::stringstream ss;
+                FastJsonAdapter::Pack(globalreg, ss, e, NULL);
+                data.append(ss.str());
+                offsets.push_back(data.length());
+                break;
+            }
+        }
+    }
+
+    void append_null() {
+        set_valid(rows++, false);
+
+        if (type == column_null)
+            pending_nulls++;
+        else
+            append_empty();
+    }
+
+    uint8_t get_type() const {
+        return type;
+    }
+
+    const std::string& get_name() const {
+        return name;
+    }
+
+    // Size of the column block written by write_block
+    uint64_t block_length() const {
+        uint64_t len = valid.size();
+
+        if (type == column_null)
+            return len;
+
+        if (width == 0)
+            len += offsets.size() * 8;
+
+        return len + data.length();
+    }
+
+    void write_block(std::ostream& stream) {
+        stream.write((const char *) valid.data(), valid.size());
+
+        if (type == column_null)
+            return;
+
+        if (width == 0) {
+            std::string offt;
+            offt.reserve(offsets.size() * 8);
+
+            for (auto o : offsets) {
+                for (unsigned int b = 0; b < 8; b++)
+                    offt.push_back((char) ((o >> (b * 8)) & 0xFF));
+            }
+
+            stream.write(offt.data(), offt.length());
+        }
+
+        stream.write(data.data(), data.length());
+    }
+
+protected:
+    static uint8_t column_type(TrackerType t) {
+        switch (t) {
+            case TrackerString:
+            case TrackerKey:
+                return TrackerString;
+            case TrackerInt8:
+            case TrackerUInt8:
+            case TrackerInt16:
+            case TrackerUInt16:
+            case TrackerInt32:
+            case TrackerUInt32:
+            case TrackerInt64:
+            case TrackerUInt64:
+            case TrackerFloat:
+            case TrackerDouble:
+            case TrackerMac:
+            case TrackerUuid:
+            case TrackerByteArray:
+                return (uint8_t) t;
+            default:
+                return column_json;
+        }
+    }
+
+    // Fixed width of a column entry, or 0 for variable length columns
+    static size_t column_width(uint8_t t) {
+        switch (t) {
+            case TrackerInt8:
+            case TrackerUInt8:
+                return 1;
+            case TrackerInt16:
+            case TrackerUInt16:
+                return 2;
+            case TrackerInt32:
+            case TrackerUInt32:
+            case TrackerFloat:
+                return 4;
+            case TrackerInt64:
+            case TrackerUInt64:
+            case TrackerDouble:
+                return 8;
+            case TrackerMac:
+                return MAC_LEN_MAX;
+            case TrackerUuid:
+                return 16;
+            default:
+                return 0;
+        }
+    }
+
+    void append_empty() {
+        if (width == 0)
+            offsets.push_back(data.length());
+        else
+            data.append(width, '\0');
+    }
+
+    void set_valid(uint64_t row, bool v) {
+        if ((row / 8) >= valid.size())
+            valid.push_back(0);
+
+        if (v)
+            valid[row / 8] |= (1 << (row % 8));
+    }
+
+    void put_le(uint64_t v, unsigned int bytes) {
+        for (unsigned int b = 0; b < bytes; b++)
+            data.push_back((char) ((v >> (b * 8)) & 0xFF));
+    }
+
+    GlobalRegistry *globalreg;
+
+    std::string name;
+    uint8_t type;
+    size_t width;
+
+    uint64_t rows;
+    size_t pending_nulls;
+
+    std::vector<uint8_t> valid;
+    std::vector<uint64_t> offsets;
+    std::string data;
+};
+
+void Devicetracker::httpd_columnar_devices(std::ostream &stream,
+        std::vector<SharedElementSummary>& summary_vec, SharedTrackerElement devices) {
+    std::vector<devicetracker_columnar_column> columns;
+    std::vector<SharedElementSummary> column_summaries;
+
+    // Columns are named the same way SummarizeTrackerElement names the fields
+    for (auto s : summary_vec) {
+        if (s->resolved_path.size() == 0)
+            continue;
+
+        std::string cname = s->rename;
+
+        if (cname.length() == 0) {
+            int lastid = s->resolved_path[s->resolved_path.size() - 1];
+            cname = entrytracker->GetFieldName(lastid);
+        }
+
+        columns.push_back(devicetracker_columnar_column(globalreg, cname));
+
+        // Our own copy of the summary, so the parent can be pointed at each
+        // device in turn for pre/post serialization
+        column_summaries.push_back(SharedElementSummary(new TrackerElementSummary(s)));
+    }
+
+    TrackerElementVector devvec(devices);
+    uint64_t nrows = 0;
+
+    for (auto d : devvec) {
+        std::shared_ptr<kis_tracked_device_base> dev = 
+            std::static_pointer_cast<kis_tracked_device_base>(d);
+
+        local_locker lock(&(dev->device_mutex));
+
+        for (unsigned int ci = 0; ci < columns.size(); ci++) {
+            SharedTrackerElement f;
+
+            // Walk the path the same way the serializers do so that records
+            // which are only populated for serialization (like RRDs) are
+            // filled in, and fast-forwarded, while we read them
+            column_summaries[ci]->parent_element = dev;
+            TrackerElementSerializer::pre_serialize_path(column_summaries[ci]);
+
+            try {
+                f = GetTrackerElementPath(column_summaries[ci]->resolved_path, dev);
+            } catch (const std::runtime_error& e) {
+                f = NULL;
+            }
+
+            columns[ci].append(f);
+
+            TrackerElementSerializer::post_serialize_path(column_summaries[ci]);
+            column_summaries[ci]->parent_element = NULL;
+        }
+
+        nrows++;
+    }
+
+    std::string header;
+
+    auto put_le = [&header](uint64_t v, unsigned int bytes) {
+        for (unsigned int b = 0; b < bytes; b++)
+            header.push_back((char) ((v >> (b * 8)) & 0xFF));
+    };
+
+    header.append("KCOL", 4);
+    put_le(1, 4);
+    put_le(columns.size(), 4);
+    put_le(nrows, 8);
+
+    for (auto& c : columns) {
+        put_le(c.get_type(), 1);
+        put_le(c.get_name().length(), 4);
+        header.append(c.get_name());
+        put_le(c.block_length(), 8);
+    }
+
+    stream.write(header.data(), header.length());
+
+    for (auto& c : columns)
+        c.write_block(stream);
+}
+
+devicetracker_summary_view::devicetracker_summary_view(GlobalRegistry *in_globalreg,
+        std::vector<SharedElementSummary> in_summary_vec, unsigned int in_timeout) {
+    globalreg = in_globalreg;
+
+    entrytracker =
+        Globalreg::FetchGlobalAs<EntryTracker>(globalreg, "ENTRY_TRACKER");
+
+    summary_vec = in_summary_vec;
+    timeout = in_timeout;
+
+    rrd_path = false;
+
+    last_used = time(0);
+    last_prune = last_used;
+}
+
+bool devicetracker_summary_view::contains_rrd(SharedTrackerElement in_elem) {
+    if (in_elem == NULL)
+        return false;
+
+    if (std::find(rrd_field_ids.begin(), rrd_field_ids.end(), 
+                in_elem->get_id()) != rrd_field_ids.end())
+        return true;
+
+    switch (in_elem->get_type()) {
+        case TrackerVector:
+            for (auto i : *(in_elem->get_vector()))
+                if (contains_rrd(i))
+                    return true;
+            break;
+        case TrackerMap:
+            for (auto i : *(in_elem->get_map()))
+                if (contains_rrd(i.second))
+                    return true;
+            break;
+        case TrackerIntMap:
+            for (auto i : *(in_elem->get_intmap()))
+                if (contains_rrd(i.second))
+                    return true;
+            break;
+        case TrackerMacMap:
+            for (auto i : *(in_elem->get_macmap()))
+                if (contains_rrd(i.second))
+                    return true;
+            break;
+        case TrackerStringMap:
+            for (auto i : *(in_elem->get_stringmap()))
+                if (contains_rrd(i.second))
+                    return true;
+            break;
+        case TrackerDoubleMap:
+            for (auto i : *(in_elem->get_doublemap()))
+                if (contains_rrd(i.second))
+                    return true;
+            break;
+        case TrackerKeyMap:
+            for (auto i : *(in_elem->get_keymap()))
+                if (contains_rrd(i.second))
+                    return true;
+            break;
+        default:
+            break;
+    }
+
+    return false;
+}
+
+void devicetracker_summary_view::render(std::ostream &stream,
+        std::vector<std::shared_ptr<kis_tracked_device_base> >& devices) {
+    local_locker lock(&view_mutex);
+
+    time_t now = time(0);
+    last_used = now;
+
+    // RRD fields are registered by the first RRD created, which may be after
+    // the view was
+    if (rrd_field_ids.size() == 0 || 
+            std::find(rrd_field_ids.begin(), rrd_field_ids.end(), -1) != 
+            rrd_field_ids.end()) {
+        rrd_field_ids.clear();
+
+        for (auto f : { "kismet.common.rrd.last_time", "kismet.common.rrd.minute_vec",
+                "kismet.common.rrd.hour_vec", "kismet.common.rrd.day_vec",
+                "kismet.common.rrd.second", "kismet.common.rrd.minute",
+                "kismet.common.rrd.hour" })
+            rrd_field_ids.push_back(entrytracker->GetFieldId(f));
+
+        // Paths into an RRD resolve to a placeholder until the RRD is serialized,
+        // so they have to be caught by the field list
+        rrd_path = false;
+        for (auto s : summary_vec) {
+            for (auto p : s->resolved_path) {
+                if (p >= 0 && std::find(rrd_field_ids.begin(), rrd_field_ids.end(), 
+                            p) != rrd_field_ids.end())
+                    rrd_path = true;
+            }
+        }
+    }
+
+    stream << "[";
+
+    for (unsigned int di = 0; di < devices.size(); di++) {
+        auto d = devices[di];
+
+        if (di != 0)
+            stream << ",";
+
+        local_locker devlock(&(d->device_mutex));
+
+        uint64_t seq = d->get_mod_sequence();
+        cached_record& r = records[d->get_kis_internal_id()];
+
+        // Only re-summarize devices which have changed since we rendered them,
+        // or which include an RRD and were rendered in an earlier second
+        if (r.record.length() == 0 || r.mod_sequence != seq ||
+                (r.has_rrd && r.rendered != now)) {
+            TrackerElementSerializer::rename_map rename_map;
+            SharedTrackerElement simple;
+
+            SummarizeTrackerElement(entrytracker, d, summary_vec, simple, rename_map);
+
+            std::stringstream ss;
+            FastJsonAdapter::Pack(globalreg, ss, simple, &rename_map);
+
+            r.record = ss.str();
+            r.mod_sequence = seq;
+            r.rendered = now;
+            r.has_rrd = rrd_path || contains_rrd(simple);
+        }
+
+        r.last_used = now;
+
+        stream << r.record;
+    }
+
+    stream << "]";
+
+    // Drop the records of devices which have left the view (or been removed
+    // entirely) so the cache doesn't grow forever
+    if (now - last_prune > 60) {
+        last_prune = now;
+
+        for (auto ri = records.begin(); ri != records.end(); ) {
+            if (now - ri->second.last_used > (time_t) timeout)
+                ri = records.erase(ri);
+            else
+                ++ri;
+        }
+    }
+}
+
+std::shared_ptr<devicetracker_summary_view> 
+    Devicetracker::fetch_summary_view(std::string in_name,
+            std::vector<SharedElementSummary>& summary_vec) {
+    local_locker lock(&view_mutex);
+
+    time_t now = time(0);
+
+    for (auto vi = summary_views.begin(); vi != summary_views.end(); ) {
+        if (now - vi->second->get_last_used() > (time_t) view_timeout)
+            vi = summary_views.erase(vi);
+        else
+            ++vi;
+    }
+
+    // Views are keyed by the resolved field list as well as the name, so that
+    // clients with different columns don't keep replacing each other's records
+    std::stringstream ss;
+    ss << in_name << "/";
+
+    for (auto s : summary_vec) {
+        for (auto p : s->resolved_path)
+            ss << p << ",";
+        ss << "=" << s->rename << ";";
+    }
+
+    auto vi = summary_views.find(ss.str());
+
+    if (vi != summary_views.end())
+        return vi->second;
+
+    std::shared_ptr<devicetracker_summary_view> 
+        view(new devicetracker_summary_view(globalreg, summary_vec, view_timeout));
+
+    summary_views[ss.str()] = view;
+
+    return view;
+}
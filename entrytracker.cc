@@ -23,6 +23,7 @@
 
 #include "entrytracker.h"
 #include "messagebus.h"
+#include "json_adapter.h"
 
 EntryTracker::EntryTracker(GlobalRegistry *in_globalreg) :
     Kis_Net_Httpd_CPPStream_Handler(in_globalreg) {
@@ -75,6 +76,7 @@ int EntryTracker::RegisterField(string in_name, TrackerType in_type, string in_d
     definition->builder = NULL;
 
     definition->field_description = in_desc;
+    definition->json_token = "\"" + JsonAdapter::SanitizeString(in_name) + "\": ";
 
     field_name_map[mod_name] = definition;
     field_id_map[definition->field_id] = definition;
@@ -111,6 +113,7 @@ int EntryTracker::RegisterField(string in_name, shared_ptr<TrackerElement> in_bu
     definition->builder = in_builder->clone_type();
 
     definition->field_description = in_desc;
+    definition->json_token = "\"" + JsonAdapter::SanitizeString(in_name) + "\": ";
 
     field_name_map[mod_name] = definition;
     field_id_map[definition->field_id] = definition;
@@ -150,6 +153,20 @@ string EntryTracker::GetFieldName(int in_id) {
     return iter->second->field_name;
 }
 
+const string *EntryTracker::GetFieldJsonToken(int in_id) {
+    local_locker lock(&entry_mutex);
+
+    static const string unknown_token = "\"field.unknown.not.registered\": ";
+
+    id_itr iter = field_id_map.find(in_id);
+
+    if (iter == field_id_map.end()) {
+        return &unknown_token;
+    }
+
+    return &(iter->second->json_token);
+}
+
 string EntryTracker::GetFieldDescription(int in_id) {
     local_locker lock(&entry_mutex);
 
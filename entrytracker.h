@@ -77,6 +77,12 @@ public:
 
     int GetFieldId(string in_name);
     string GetFieldName(int in_id);
+
+    // Get the pre-escaped '"name": ' token of a field, used by the JSON serializers
+    // so they don't have to escape the same names for every record.  Fields are
+    // never removed, so the token remains valid for the life of the entrytracker.
+    const string *GetFieldJsonToken(int in_id);
+
     string GetFieldDescription(int in_id);
     TrackerType GetFieldType(int in_id);
 
@@ -121,6 +127,9 @@ protected:
 
         // Might as well track this for auto-doc
         string field_description;
+
+        // Quoted and escaped name for json output
+        string json_token;
     };
 
     map<string, shared_ptr<reserved_field> > field_name_map;
@@ -0,0 +1,514 @@
+/* stress harness for the pollable event loop and TCP server
+ *
+ * Runs the main loop the way kismet_server does, with an echo server on top
+ * of TcpServerV2, and opens a large number of idle loopback connections plus
+ * a set of busy ones.  Every busy connection echoes random sized messages,
+ * which have to come back intact; then half the idle connections close and
+ * the loop is watched while everything is quiet, to check that it only wakes
+ * for the main loop tick and that idle and closed connections aren't polled.
+ *
+ * Client and server ends share the process, so 1000 idle connections also
+ * push the server descriptors past FD_SETSIZE.  Once they're open, a pipe
+ * client, which merges its descriptors every loop instead of having them
+ * watched, is opened past FD_SETSIZE as well and has to echo through the loop.
+ *
+ * # build kismet, then
+ * make epoll_stress
+ *
+ * ./epoll_stress [idle connections] [busy connections] [rounds]
+ *
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "globalregistry.h"
+#include "messagebus.h"
+#include "pollabletracker.h"
+#include "pipeclient.h"
+#include "ringbuf2.h"
+#include "tcpserver2.h"
+
+static double elapsed_ns(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start).count();
+}
+
+// Echo everything a connection sends back to it
+class echo_server : public TcpServerV2 {
+public:
+    echo_server(GlobalRegistry *in_globalreg) :
+        TcpServerV2(in_globalreg),
+        accepted(0),
+        closed(0),
+        pollfd_calls(0) { }
+
+    virtual void NewConnection(shared_ptr<BufferHandlerGeneric> conn_handler) {
+        std::shared_ptr<echo_interface> echo(new echo_interface(this, conn_handler));
+
+        echo_map[conn_handler.get()] = echo;
+        conn_handler->SetReadBufferInterface(echo.get());
+
+        accepted++;
+    }
+
+    virtual void PollFd(int in_fd, bool in_read, bool in_write) {
+        pollfd_calls++;
+        TcpServerV2::PollFd(in_fd, in_read, in_write);
+    }
+
+    unsigned short get_port() {
+        struct sockaddr_in sin;
+        socklen_t len = sizeof(sin);
+
+        if (getsockname(server_fd, (struct sockaddr *) &sin, &len) < 0)
+            return 0;
+
+        return ntohs(sin.sin_port);
+    }
+
+    std::atomic<unsigned int> accepted;
+    std::atomic<unsigned int> closed;
+    std::atomic<unsigned long> pollfd_calls;
+
+protected:
+    class echo_interface : public BufferInterface {
+    public:
+        echo_interface(echo_server *in_server, shared_ptr<BufferHandlerGeneric> in_handler) :
+            server(in_server),
+            handler(in_handler.get()),
+            errored(false) { }
+
+        virtual void BufferAvailable(size_t in_amt) {
+            void *buf;
+            ssize_t len = handler->PeekReadBufferData(&buf, in_amt);
+
+            if (len > 0 && handler->PutWriteBufferData(buf, len, true) == (size_t) len) {
+                handler->PeekFreeReadBufferData(buf);
+                handler->ConsumeReadBufferData(len);
+                return;
+            }
+
+            handler->PeekFreeReadBufferData(buf);
+        }
+
+        virtual void BufferError(string in_error __attribute__((unused))) {
+            if (!errored)
+                server->closed++;
+            errored = true;
+        }
+
+    protected:
+        echo_server *server;
+        BufferHandlerGeneric *handler;
+        bool errored;
+    };
+
+    std::map<BufferHandlerGeneric *, std::shared_ptr<echo_interface> > echo_map;
+};
+
+// Pipe client which counts the descriptor events it's called with
+class counted_pipeclient : public PipeClient {
+public:
+    counted_pipeclient(GlobalRegistry *in_globalreg, 
+            shared_ptr<BufferHandlerGeneric> in_rbhandler) :
+        PipeClient(in_globalreg, in_rbhandler),
+        pollfd_calls(0) { }
+
+    virtual void PollFd(int in_fd, bool in_read, bool in_write) {
+        pollfd_calls++;
+        PipeClient::PollFd(in_fd, in_read, in_write);
+    }
+
+    std::atomic<unsigned long> pollfd_calls;
+};
+
+// Echo everything read from a buffer back into its write side
+class buffer_echo : public BufferInterface {
+public:
+    buffer_echo(BufferHandlerGeneric *in_handler) :
+        handler(in_handler) { }
+
+    virtual void BufferAvailable(size_t in_amt) {
+        void *buf;
+        ssize_t len = handler->PeekReadBufferData(&buf, in_amt);
+
+        if (len > 0 && handler->PutWriteBufferData(buf, len, true) == (size_t) len) {
+            handler->PeekFreeReadBufferData(buf);
+            handler->ConsumeReadBufferData(len);
+            return;
+        }
+
+        handler->PeekFreeReadBufferData(buf);
+    }
+
+protected:
+    BufferHandlerGeneric *handler;
+};
+
+// Move a descriptor to FD_SETSIZE or above
+static int dup_past_fd_setsize(int fd) {
+    int nfd = fcntl(fd, F_DUPFD_CLOEXEC, FD_SETSIZE);
+
+    close(fd);
+
+    return nfd;
+}
+
+// Wait for a descriptor to become readable, so a broken loop fails instead of
+// hanging the test
+static bool wait_readable(int fd, int timeout_ms) {
+    struct pollfd pfd;
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+
+    return poll(&pfd, 1, timeout_ms) > 0;
+}
+
+static bool write_all(int fd, const uint8_t *buf, size_t len) {
+    while (len > 0) {
+        ssize_t r = write(fd, buf, len);
+
+        if (r < 0 && errno == EINTR)
+            continue;
+        if (r <= 0)
+            return false;
+
+        buf += r;
+        len -= r;
+    }
+
+    return true;
+}
+
+static bool read_all(int fd, uint8_t *buf, size_t len) {
+    while (len > 0) {
+        ssize_t r = read(fd, buf, len);
+
+        if (r < 0 && errno == EINTR)
+            continue;
+        if (r <= 0)
+            return false;
+
+        buf += r;
+        len -= r;
+    }
+
+    return true;
+}
+
+int main(int argc, char *argv[]) {
+    unsigned int num_idle = 1000;
+    unsigned int num_busy = 50;
+    unsigned int rounds = 200;
+
+    if (argc > 1)
+        num_idle = strtoul(argv[1], NULL, 10);
+    if (argc > 2)
+        num_busy = strtoul(argv[2], NULL, 10);
+    if (argc > 3)
+        rounds = strtoul(argv[3], NULL, 10);
+
+    if (num_busy == 0 || rounds == 0) {
+        fprintf(stderr, "usage: %s [idle connections] [busy connections] [rounds]\n",
+                argv[0]);
+        return 1;
+    }
+
+    // Both ends of every connection, plus the loop's own descriptors, and room
+    // for the pipes past FD_SETSIZE
+    struct rlimit rl;
+    rlim_t need_fds = 2 * (num_idle + num_busy) + 64;
+
+    if (need_fds < FD_SETSIZE + 64)
+        need_fds = FD_SETSIZE + 64;
+
+    getrlimit(RLIMIT_NOFILE, &rl);
+
+    if (rl.rlim_cur < need_fds) {
+        rl.rlim_cur = rl.rlim_max < need_fds ? rl.rlim_max : need_fds;
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+
+    if (rl.rlim_cur < need_fds) {
+        fprintf(stderr, "need %u descriptors, limited to %u\n", (unsigned int) need_fds,
+                (unsigned int) rl.rlim_cur);
+        return 1;
+    }
+
+    GlobalRegistry *globalreg = new GlobalRegistry();
+    MessageBus::create_messagebus(globalreg);
+    shared_ptr<PollableTracker> pollabletracker =
+        PollableTracker::create_pollabletracker(globalreg);
+
+    shared_ptr<echo_server> server(new echo_server(globalreg));
+    server->SetBufferSize(16384);
+
+    if (server->ConfigureServer(0, num_idle + num_busy, "127.0.0.1",
+                vector<string>()) < 0) {
+        fprintf(stderr, "could not start the echo server\n");
+        return 1;
+    }
+
+    pollabletracker->RegisterPollable(server);
+
+    if (!pollabletracker->CanWatchFds())
+        printf("descriptors can't be watched directly, using select()\n");
+
+    std::atomic<bool> running(true);
+    std::atomic<unsigned long> wakeups(0);
+
+    // The main loop, as kismet_server runs it
+    std::thread loop([&]() {
+            while (running) {
+                if (pollabletracker->WaitPollableEvents() < 0) {
+                    if (errno != EINTR && errno != EAGAIN) {
+                        fprintf(stderr, "main event loop failed: %s\n", strerror(errno));
+                        break;
+                    }
+                }
+
+                wakeups++;
+
+                pollabletracker->ProcessPollableEvents();
+            }
+        });
+
+    struct sockaddr_in sin;
+    memset(&sin, 0, sizeof(sin));
+    sin.sin_family = AF_INET;
+    sin.sin_port = htons(server->get_port());
+    sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    std::vector<int> idle_fds, busy_fds;
+    bool ok = true;
+
+    auto start = std::chrono::steady_clock::now();
+
+    for (unsigned int c = 0; c < num_idle + num_busy && ok; c++) {
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+
+        if (fd < 0 || connect(fd, (struct sockaddr *) &sin, sizeof(sin)) < 0) {
+            fprintf(stderr, "connection %u failed: %s\n", c, strerror(errno));
+            ok = false;
+            break;
+        }
+
+        if (c < num_idle)
+            idle_fds.push_back(fd);
+        else
+            busy_fds.push_back(fd);
+
+        // Stay inside the listen backlog, or connects stall in SYN retries
+        while ((c + 1) - server->accepted > 16)
+            std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+
+    while (ok && server->accepted < num_idle + num_busy)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+    double connect_ns = elapsed_ns(start);
+
+    if (ok)
+        printf("%u idle and %u busy connections accepted in %.1f ms\n", num_idle, num_busy,
+                connect_ns / 1e6);
+
+    // Echo random sized messages on every busy connection at once
+    std::vector<uint8_t> sendbuf(4096), recvbuf(4096);
+    uint64_t r = 0x9E3779B97F4A7C15ULL;
+    uint64_t bytes = 0;
+    unsigned int mismatched = 0;
+
+    std::vector<size_t> lengths(num_busy);
+
+    unsigned long pollfd_before = server->pollfd_calls;
+    start = std::chrono::steady_clock::now();
+
+    for (unsigned int round = 0; round < rounds && ok; round++) {
+        for (unsigned int c = 0; c < busy_fds.size() && ok; c++) {
+            r ^= r << 13;
+            r ^= r >> 7;
+            r ^= r << 17;
+
+            lengths[c] = 1 + (r % sendbuf.size());
+
+            for (size_t i = 0; i < lengths[c]; i++)
+                sendbuf[i] = (uint8_t) (round + c + i);
+
+            ok = write_all(busy_fds[c], sendbuf.data(), lengths[c]);
+        }
+
+        for (unsigned int c = 0; c < busy_fds.size() && ok; c++) {
+            ok = read_all(busy_fds[c], recvbuf.data(), lengths[c]);
+
+            for (size_t i = 0; ok && i < lengths[c]; i++) {
+                if (recvbuf[i] != (uint8_t) (round + c + i)) {
+                    mismatched++;
+                    break;
+                }
+            }
+
+            bytes += lengths[c];
+        }
+    }
+
+    double echo_ns = elapsed_ns(start);
+    unsigned long echo_pollfd = server->pollfd_calls - pollfd_before;
+
+    if (!ok)
+        fprintf(stderr, "echo failed: %s\n", strerror(errno));
+    else
+        printf("  echoed %lu bytes in %u round trips, %.1f round trips/sec, %.1f MB/sec, "
+                "%lu descriptor events\n", bytes, rounds * num_busy,
+                rounds * num_busy / (echo_ns / 1e9), bytes / (echo_ns / 1e9) / (1024 * 1024),
+                echo_pollfd);
+
+    // Open a pipe client past FD_SETSIZE while every connection is still open;
+    // it merges its descriptors every loop, and has to echo through the loop
+    // like the connections do
+    int to_pipe[2] = { -1, -1 }, from_pipe[2] = { -1, -1 };
+
+    if (ok && (pipe(to_pipe) < 0 || pipe(from_pipe) < 0)) {
+        fprintf(stderr, "could not open pipes: %s\n", strerror(errno));
+        ok = false;
+    }
+
+    for (int i = 0; ok && i < 2; i++) {
+        to_pipe[i] = dup_past_fd_setsize(to_pipe[i]);
+        from_pipe[i] = dup_past_fd_setsize(from_pipe[i]);
+
+        if (to_pipe[i] < 0 || from_pipe[i] < 0) {
+            fprintf(stderr, "could not move pipes past FD_SETSIZE: %s\n", strerror(errno));
+            ok = false;
+        }
+    }
+
+    shared_ptr<BufferHandlerGeneric> pipe_handler(new BufferHandler<RingbufV2>(4096, 4096));
+    buffer_echo pipe_echo(pipe_handler.get());
+    pipe_handler->SetReadBufferInterface(&pipe_echo);
+
+    shared_ptr<counted_pipeclient> pipeclient(new counted_pipeclient(globalreg, pipe_handler));
+
+    if (ok) {
+        pipeclient->OpenPipes(to_pipe[0], from_pipe[1]);
+        pollabletracker->RegisterPollable(pipeclient);
+
+        unsigned int pipe_msgs = 0, pipe_mismatched = 0;
+
+        start = std::chrono::steady_clock::now();
+
+        for (unsigned int round = 0; round < rounds && ok; round++) {
+            size_t len = 1 + (round * 37) % 512;
+
+            for (size_t i = 0; i < len; i++)
+                sendbuf[i] = (uint8_t) (round ^ i);
+
+            ok = write_all(to_pipe[1], sendbuf.data(), len) &&
+                wait_readable(from_pipe[0], 5000) &&
+                read_all(from_pipe[0], recvbuf.data(), len);
+
+            if (ok && memcmp(sendbuf.data(), recvbuf.data(), len) != 0)
+                pipe_mismatched++;
+
+            pipe_msgs++;
+        }
+
+        if (!ok)
+            fprintf(stderr, "pipe echo failed\n");
+        else
+            printf("  pipe client on descriptors %d/%d echoed %u messages in %.1f ms, "
+                    "%lu descriptor events\n", to_pipe[0], from_pipe[1], pipe_msgs, 
+                    elapsed_ns(start) / 1e6, (unsigned long) pipeclient->pollfd_calls);
+
+        if (pipe_mismatched != 0) {
+            fprintf(stderr, "FAILED: %u piped messages differ\n", pipe_mismatched);
+            ok = false;
+        }
+    }
+
+    // Close half the idle connections and wait for the server to reap them
+    unsigned int num_closed = idle_fds.size() / 2;
+
+    for (unsigned int c = 0; c < num_closed; c++)
+        close(idle_fds[c]);
+
+    start = std::chrono::steady_clock::now();
+
+    while (server->closed < num_closed && elapsed_ns(start) < 5e9)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+    printf("  %u of %u closed connections reaped in %.1f ms\n",
+            (unsigned int) server->closed, num_closed, elapsed_ns(start) / 1e6);
+
+    if (server->closed < num_closed)
+        ok = false;
+
+    // Let the closes settle, then watch the quiet loop
+    std::this_thread::sleep_for(std::chrono::milliseconds(250));
+
+    unsigned long wakeups_before = wakeups;
+    pollfd_before = server->pollfd_calls;
+    start = std::chrono::steady_clock::now();
+
+    std::this_thread::sleep_for(std::chrono::seconds(2));
+
+    double idle_s = elapsed_ns(start) / 1e9;
+    double idle_wakeups = (wakeups - wakeups_before) / idle_s;
+    unsigned long idle_pollfd = server->pollfd_calls - pollfd_before;
+
+    printf("  idle: %.1f wakeups/sec, %lu descriptor events with %zu connections open\n",
+            idle_wakeups, idle_pollfd, idle_fds.size() - num_closed + busy_fds.size());
+
+    // A 10Hz tick, with some slack for a loaded machine
+    if (idle_wakeups > 15 || idle_pollfd != 0)
+        ok = false;
+
+    running = false;
+    loop.join();
+
+    server->Shutdown();
+
+    pipe_handler->RemoveReadBufferInterface();
+    pipeclient->ClosePipes();
+
+    if (to_pipe[1] >= 0)
+        close(to_pipe[1]);
+    if (from_pipe[0] >= 0)
+        close(from_pipe[0]);
+
+    for (unsigned int c = num_closed; c < idle_fds.size(); c++)
+        close(idle_fds[c]);
+    for (auto fd : busy_fds)
+        close(fd);
+
+    if (mismatched != 0) {
+        fprintf(stderr, "FAILED: %u echoed messages differ\n", mismatched);
+        return 1;
+    }
+
+    if (!ok) {
+        fprintf(stderr, "FAILED\n");
+        return 1;
+    }
+
+    return 0;
+}
@@ -44,9 +44,12 @@ GpsTracker::GpsTracker(GlobalRegistry *in_globalreg) :
         globalreg->packetchain->RegisterPacketComponent("gps");
 
     // Register the packet chain hook
-    globalreg->packetchain->RegisterHandler(&kis_gpspack_hook, this,
+    int pack_hook_id = globalreg->packetchain->RegisterHandler(&kis_gpspack_hook, this,
             CHAINPOS_POSTCAP, -100);
 
+    // get_best_location() holds the gps manager lock
+    globalreg->packetchain->SetHandlerParallelSafe(pack_hook_id, CHAINPOS_POSTCAP);
+
     gps_prototypes.reset(new TrackerElement(TrackerVector));
     gps_prototypes_vec = TrackerElementVector(gps_prototypes);
 
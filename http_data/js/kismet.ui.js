@@ -661,6 +661,7 @@ exports.InitializeDeviceTable = function(element) {
     var json = {
         fields: fields,
         datatable: true,
+        view: "devicetable",
     };
     var postdata = "json=" + JSON.stringify(json);
 
@@ -0,0 +1,273 @@
+/* load test harness for the webserver
+ *
+ * Opens a number of concurrent clients against a running Kismet server, each
+ * making requests back to back, and reports request latency.  If the server
+ * pid is given, the thread count of the server is sampled while the test runs;
+ * with the generator pool it should stay flat no matter how many clients are
+ * streaming, where a thread per request grows with the clients.
+ *
+ * # build kismet, then
+ * make httpd_load_bench
+ *
+ * ./httpd_load_bench [clients] [requests per client] [url] [host:port] [user:password] [server pid]
+ *
+ * ie, 200 clients each fetching the device list 10 times:
+ *
+ * ./httpd_load_bench 200 10 /devices/all_devices.ekjson localhost:2501 kismet:kismet `pidof kismet`
+ *
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <netdb.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+static double elapsed_ns(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start).count();
+}
+
+// Basic auth credentials; the server side only has a decoder
+static std::string b64_encode(const std::string& in) {
+    static const char *b64 =
+        "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    std::string out;
+
+    for (size_t x = 0; x < in.length(); x += 3) {
+        uint32_t v = (uint8_t) in[x] << 16;
+
+        if (x + 1 < in.length())
+            v |= (uint8_t) in[x + 1] << 8;
+        if (x + 2 < in.length())
+            v |= (uint8_t) in[x + 2];
+
+        out += b64[(v >> 18) & 0x3F];
+        out += b64[(v >> 12) & 0x3F];
+        out += x + 1 < in.length() ? b64[(v >> 6) & 0x3F] : '=';
+        out += x + 2 < in.length() ? b64[v & 0x3F] : '=';
+    }
+
+    return out;
+}
+
+// Threads in a process, from /proc
+static unsigned int process_threads(pid_t pid) {
+    char path[64];
+    char line[256];
+    unsigned int threads = 0;
+
+    snprintf(path, sizeof(path), "/proc/%d/status", (int) pid);
+
+    FILE *f = fopen(path, "r");
+
+    if (f == NULL)
+        return 0;
+
+    while (fgets(line, sizeof(line), f) != NULL) {
+        if (sscanf(line, "Threads: %u", &threads) == 1)
+            break;
+    }
+
+    fclose(f);
+
+    return threads;
+}
+
+struct request_result {
+    bool ok;
+    double ns;
+    size_t bytes;
+};
+
+// One request on a fresh connection, read to the end of the response
+static request_result http_get(const struct addrinfo *addr, const std::string& request) {
+    request_result res;
+    res.ok = false;
+    res.ns = 0;
+    res.bytes = 0;
+
+    auto start = std::chrono::steady_clock::now();
+
+    int fd = socket(addr->ai_family, addr->ai_socktype, addr->ai_protocol);
+
+    if (fd < 0)
+        return res;
+
+    if (connect(fd, addr->ai_addr, addr->ai_addrlen) < 0) {
+        close(fd);
+        return res;
+    }
+
+    size_t sent = 0;
+
+    while (sent < request.length()) {
+        ssize_t w = send(fd, request.data() + sent, request.length() - sent, 0);
+
+        if (w <= 0) {
+            close(fd);
+            return res;
+        }
+
+        sent += w;
+    }
+
+    char buf[64 * 1024];
+    char status[16] = { 0 };
+    size_t status_len = 0;
+    ssize_t r;
+
+    while ((r = recv(fd, buf, sizeof(buf), 0)) > 0) {
+        if (status_len < sizeof(status) - 1) {
+            size_t c = std::min((size_t) r, sizeof(status) - 1 - status_len);
+            memcpy(status + status_len, buf, c);
+            status_len += c;
+        }
+
+        res.bytes += r;
+    }
+
+    close(fd);
+
+    res.ok = r == 0 && strncmp(status, "HTTP/1.", 7) == 0 && 
+        strncmp(status + 8, " 200", 4) == 0;
+    res.ns = elapsed_ns(start);
+
+    return res;
+}
+
+int main(int argc, char *argv[]) {
+    unsigned int num_clients = 100;
+    unsigned int num_requests = 10;
+    std::string url = "/system/status.json";
+    std::string hostport = "localhost:2501";
+    std::string auth;
+    pid_t server_pid = 0;
+
+    if (argc > 1)
+        num_clients = strtoul(argv[1], NULL, 10);
+    if (argc > 2)
+        num_requests = strtoul(argv[2], NULL, 10);
+    if (argc > 3)
+        url = argv[3];
+    if (argc > 4)
+        hostport = argv[4];
+    if (argc > 5)
+        auth = argv[5];
+    if (argc > 6)
+        server_pid = strtoul(argv[6], NULL, 10);
+
+    if (num_clients == 0 || num_requests == 0) {
+        fprintf(stderr, "usage: %s [clients] [requests per client] [url] [host:port] "
+                "[user:password] [server pid]\n", argv[0]);
+        return 1;
+    }
+
+    std::string host = hostport, port = "2501";
+    size_t colon = hostport.rfind(':');
+
+    if (colon != std::string::npos) {
+        host = hostport.substr(0, colon);
+        port = hostport.substr(colon + 1);
+    }
+
+    struct addrinfo hints, *addr;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    if (getaddrinfo(host.c_str(), port.c_str(), &hints, &addr) != 0) {
+        fprintf(stderr, "unable to resolve %s\n", hostport.c_str());
+        return 1;
+    }
+
+    std::string request = "GET " + url + " HTTP/1.1\r\n"
+        "Host: " + hostport + "\r\n"
+        "Accept-Encoding: identity\r\n"
+        "Connection: close\r\n";
+
+    if (auth.length() != 0)
+        request += "Authorization: Basic " + b64_encode(auth) + "\r\n";
+
+    request += "\r\n";
+
+    printf("%u clients, %u requests each, GET %s from %s\n", num_clients,
+            num_requests, url.c_str(), hostport.c_str());
+
+    unsigned int base_threads = server_pid ? process_threads(server_pid) : 0;
+
+    std::vector<std::vector<request_result> > results(num_clients);
+    std::vector<std::thread> clients;
+    std::atomic<unsigned int> running(num_clients);
+
+    auto start = std::chrono::steady_clock::now();
+
+    for (unsigned int c = 0; c < num_clients; c++) {
+        clients.push_back(std::thread([&results, &running, addr, &request, c, num_requests]() {
+            for (unsigned int r = 0; r < num_requests; r++)
+                results[c].push_back(http_get(addr, request));
+
+            running--;
+        }));
+    }
+
+    // Sample the server threads while the clients run
+    unsigned int max_threads = base_threads;
+
+    while (server_pid != 0 && running != 0) {
+        max_threads = std::max(max_threads, process_threads(server_pid));
+        usleep(10000);
+    }
+
+    for (auto& t : clients)
+        t.join();
+
+    double total_s = elapsed_ns(start) / 1e9;
+
+    freeaddrinfo(addr);
+
+    std::vector<double> latency;
+    size_t failed = 0, bytes = 0;
+
+    for (auto& cr : results) {
+        for (auto& r : cr) {
+            if (!r.ok) {
+                failed++;
+                continue;
+            }
+
+            latency.push_back(r.ns);
+            bytes += r.bytes;
+        }
+    }
+
+    std::sort(latency.begin(), latency.end());
+
+    printf("  %zu ok, %zu failed, %.1f requests/sec, %.1f MB/sec\n", latency.size(),
+            failed, latency.size() / total_s, bytes / total_s / (1024 * 1024));
+
+    if (latency.size() != 0) {
+        printf("  latency p50 %8.2f ms, p90 %8.2f ms, p99 %8.2f ms, max %8.2f ms\n",
+                latency[latency.size() / 2] / 1e6,
+                latency[latency.size() * 9 / 10] / 1e6,
+                latency[latency.size() * 99 / 100] / 1e6,
+                latency.back() / 1e6);
+    }
+
+    if (server_pid != 0)
+        printf("  server threads %u before, %u peak\n", base_threads, max_threads);
+
+    return failed != 0;
+}
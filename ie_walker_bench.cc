@@ -0,0 +1,283 @@
+/* benchmark harness for 802.11 IE tag parsing
+ *
+ * Walks the tagged parameters of a corpus of beacons two ways:
+ *
+ *  - through kaitai, as the IE dissector used to: the tag block is wrapped
+ *    in a stream and parsed into a dot11_ie_t, then every tag is copied into
+ *    a stringstream and kaitai stream of its own (and RSN parsed by the
+ *    kaitai RSN parser)
+ *  - in place with dot11_ie_walker, as the IE dissector does now, reading
+ *    the RSN fields straight from the tag view
+ *
+ * Both paths fold the SSID length, tag numbers and RSN cipher and key
+ * management types into a digest, which has to match.
+ *
+ * The corpus is read from a pcap of 802.11 (DLT 105) or radiotap (DLT 127)
+ * frames if one is given, otherwise a set of typical access point beacons is
+ * generated.
+ *
+ * # build kismet, then
+ * make ie_walker_bench
+ *
+ * ./ie_walker_bench [iterations] [capture.pcap]
+ *
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+extern "C" {
+#ifndef HAVE_PCAPPCAP_H
+#include <pcap.h>
+#else
+#include <pcap/pcap.h>
+#endif
+}
+
+#include <chrono>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "util.h"
+#include "phy_80211_ie.h"
+#include "kaitai/kaitaistream.h"
+#include "kaitai_parsers/dot11_ie.h"
+#include "kaitai_parsers/dot11_ie_48_rsn.h"
+
+static double elapsed_ns(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start).count();
+}
+
+// Management header plus the beacon timestamp, interval and capabilities
+#define BEACON_IE_OFFSET        (24 + 12)
+
+static uint64_t digest_mix(uint64_t d, uint64_t v) {
+    return (d ^ v) * 0x100000001b3ULL;
+}
+
+static uint64_t kaitai_walk(const std::string& ies) {
+    uint64_t d = 0xcbf29ce484222325ULL;
+
+    membuf ie_membuf((char *) ies.data(), (char *) ies.data() + ies.length());
+    std::istream ie_istream(&ie_membuf);
+    kaitai::kstream ie_ks(&ie_istream);
+
+    dot11_ie_t ie(&ie_ks);
+
+    for (auto t : *(ie.tags())) {
+        std::stringstream tag_stream(t->tag_data());
+        kaitai::kstream tag_ks(&tag_stream);
+
+        d = digest_mix(d, t->tag_num());
+
+        if (t->tag_num() == 0) {
+            d = digest_mix(d, t->tag_data().length());
+        } else if (t->tag_num() == 48) {
+            dot11_ie_48_rsn_t rsn(&tag_ks);
+
+            d = digest_mix(d, rsn.group_cipher()->cipher_type());
+
+            for (auto c : *(rsn.pairwise_ciphers()))
+                d = digest_mix(d, c->cipher_type());
+
+            for (auto a : *(rsn.akm_ciphers()))
+                d = digest_mix(d, a->management_type());
+        }
+    }
+
+    return d;
+}
+
+static uint64_t view_walk(const std::string& ies) {
+    uint64_t d = 0xcbf29ce484222325ULL;
+
+    dot11_ie_walker walker((const uint8_t *) ies.data(), ies.length());
+
+    if (!walker.validate())
+        return 0;
+
+    uint8_t tag_num;
+    dot11_ie_view tag;
+
+    while (walker.next(tag_num, tag)) {
+        d = digest_mix(d, tag_num);
+
+        if (tag_num == 0) {
+            d = digest_mix(d, tag.length());
+        } else if (tag_num == 48) {
+            if (tag.length() < 8)
+                continue;
+
+            unsigned int pairwise_count = tag.u16le(6);
+            size_t akm_offt = 8 + pairwise_count * 4;
+
+            if (akm_offt + 2 > tag.length())
+                continue;
+
+            unsigned int akm_count = tag.u16le(akm_offt);
+            akm_offt += 2;
+
+            if (akm_offt + akm_count * 4 > tag.length())
+                continue;
+
+            d = digest_mix(d, tag[5]);
+
+            for (unsigned int i = 0; i < pairwise_count; i++)
+                d = digest_mix(d, tag[8 + i * 4 + 3]);
+
+            for (unsigned int i = 0; i < akm_count; i++)
+                d = digest_mix(d, tag[akm_offt + i * 4 + 3]);
+        }
+    }
+
+    return d;
+}
+
+static void add_tag(std::string& ies, uint8_t num, const std::string& data) {
+    ies += (char) num;
+    ies += (char) data.length();
+    ies += data;
+}
+
+// A typical WPA2 access point beacon
+static std::string generate_beacon(unsigned int n) {
+    std::string ies;
+
+    add_tag(ies, 0, "bench network " + std::to_string(n));
+    add_tag(ies, 1, std::string("\x82\x84\x8b\x96\x0c\x12\x18\x24", 8));
+    add_tag(ies, 3, std::string(1, (char) (1 + n % 11)));
+    add_tag(ies, 5, std::string("\x00\x01\x00\x00", 4));
+    add_tag(ies, 7, std::string("US \x01\x0b\x1e", 6));
+    add_tag(ies, 42, std::string(1, '\0'));
+    add_tag(ies, 48, std::string("\x01\x00" "\x00\x0f\xac\x04" "\x01\x00" "\x00\x0f\xac\x04"
+                "\x01\x00" "\x00\x0f\xac\x02" "\x0c\x00", 20));
+    add_tag(ies, 50, std::string("\x30\x48\x60\x6c", 4));
+    add_tag(ies, 45, std::string(26, '\x1b'));
+    add_tag(ies, 61, std::string(22, '\x00'));
+    add_tag(ies, 127, std::string("\x04\x00\x08\x00\x00\x00\x00\x40", 8));
+    add_tag(ies, 221, std::string("\x00\x50\xf2\x02\x01\x01\x80\x00\x03\xa4\x00\x00"
+                "\x27\xa4\x00\x00\x42\x43\x5e\x00\x62\x32\x2f\x00", 24));
+    add_tag(ies, 221, std::string("\x00\x50\xf2\x04\x10\x4a\x00\x01\x10\x10\x44\x00"
+                "\x01\x02", 14));
+
+    return ies;
+}
+
+// Beacon IE blocks from a capture file
+static bool load_corpus(const char *fname, std::vector<std::string>& corpus) {
+    char errstr[PCAP_ERRBUF_SIZE];
+    pcap_t *pd = pcap_open_offline(fname, errstr);
+
+    if (pd == NULL) {
+        fprintf(stderr, "unable to open %s: %s\n", fname, errstr);
+        return false;
+    }
+
+    int dlt = pcap_datalink(pd);
+
+    if (dlt != DLT_IEEE802_11 && dlt != DLT_IEEE802_11_RADIO) {
+        fprintf(stderr, "%s is not an 802.11 or radiotap capture\n", fname);
+        pcap_close(pd);
+        return false;
+    }
+
+    struct pcap_pkthdr *hdr;
+    const u_char *data;
+
+    while (pcap_next_ex(pd, &hdr, &data) == 1) {
+        size_t offt = 0;
+
+        if (dlt == DLT_IEEE802_11_RADIO) {
+            if (hdr->caplen < 4)
+                continue;
+
+            offt = data[2] | (data[3] << 8);
+        }
+
+        // Beacons only
+        if (hdr->caplen < offt + BEACON_IE_OFFSET || data[offt] != 0x80)
+            continue;
+
+        std::string ies((const char *) data + offt + BEACON_IE_OFFSET,
+                hdr->caplen - offt - BEACON_IE_OFFSET);
+
+        // Drop frames with an FCS or truncated tags; both parsers would just
+        // stop at them
+        if (!dot11_ie_walker((const uint8_t *) ies.data(), ies.length()).validate())
+            continue;
+
+        corpus.push_back(ies);
+    }
+
+    pcap_close(pd);
+
+    return true;
+}
+
+int main(int argc, char *argv[]) {
+    unsigned int iterations = 200;
+    std::vector<std::string> corpus;
+
+    if (argc > 1)
+        iterations = strtoul(argv[1], NULL, 10);
+
+    if (iterations == 0) {
+        fprintf(stderr, "usage: %s [iterations] [capture.pcap]\n", argv[0]);
+        return 1;
+    }
+
+    if (argc > 2) {
+        if (!load_corpus(argv[2], corpus))
+            return 1;
+
+        if (corpus.size() == 0) {
+            fprintf(stderr, "no usable beacons in %s\n", argv[2]);
+            return 1;
+        }
+    } else {
+        for (unsigned int n = 0; n < 1000; n++)
+            corpus.push_back(generate_beacon(n));
+    }
+
+    size_t corpus_bytes = 0;
+    for (auto& c : corpus)
+        corpus_bytes += c.length();
+
+    printf("%zu beacons, %.1f IE bytes per beacon, %u iterations\n", corpus.size(),
+            (double) corpus_bytes / corpus.size(), iterations);
+
+    uint64_t kaitai_digest = 0, view_digest = 0;
+
+    auto start = std::chrono::steady_clock::now();
+    for (unsigned int i = 0; i < iterations; i++) {
+        for (auto& c : corpus) {
+            try {
+                kaitai_digest += kaitai_walk(c);
+            } catch (const std::exception& e) {
+                // Malformed RSN tag, which makes the digests differ; only
+                // possible with a capture file
+            }
+        }
+    }
+    double kaitai_ns = elapsed_ns(start) / ((double) iterations * corpus.size());
+
+    start = std::chrono::steady_clock::now();
+    for (unsigned int i = 0; i < iterations; i++) {
+        for (auto& c : corpus)
+            view_digest += view_walk(c);
+    }
+    double view_ns = elapsed_ns(start) / ((double) iterations * corpus.size());
+
+    printf("  kaitai streams:   %8.1f ns per beacon\n", kaitai_ns);
+    printf("  dot11_ie_walker:  %8.1f ns per beacon\n", view_ns);
+    printf("  speedup %.2fx, digests %s\n", kaitai_ns / view_ns,
+            kaitai_digest == view_digest ? "match" : "DIFFER");
+
+    return kaitai_digest == view_digest ? 0 : 1;
+}
@@ -19,18 +19,22 @@
 #include "config.h"
 
 #include <stdio.h>
+#include <string.h>
+#include <math.h>
 #include <time.h>
 #include <list>
 #include <map>
 #include <vector>
 #include <algorithm>
 #include <string>
+#include <cmath>
 
 #include "globalregistry.h"
 #include "trackedelement.h"
 #include "macaddr.h"
 #include "entrytracker.h"
 #include "uuid.h"
+#include "endian_magic.h"
 #include "devicetracker_component.h"
 #include "json_adapter.h"
 
@@ -318,6 +322,501 @@ void JsonAdapter::Pack(GlobalRegistry *globalreg, std::ostream &stream,
     }
 }
 
+// Chunked output buffer for the buffered json adapter; values are formatted
+// directly into the buffer, which is handed to the stream in one write whenever
+// it fills up and when the writer goes out of scope
+class FastJsonWriter {
+public:
+    FastJsonWriter(std::ostream &in_stream) :
+        stream(in_stream),
+        pos(0) { }
+
+    ~FastJsonWriter() {
+        flush();
+    }
+
+    void flush() {
+        if (pos != 0)
+            stream.write(buf, pos);
+        pos = 0;
+    }
+
+    inline void put(char c) {
+        if (pos == sizeof(buf))
+            flush();
+        buf[pos++] = c;
+    }
+
+    inline void write(const char *data, size_t len) {
+        if (len > sizeof(buf) - pos) {
+            flush();
+
+            if (len > sizeof(buf)) {
+                stream.write(data, len);
+                return;
+            }
+        }
+
+        memcpy(buf + pos, data, len);
+        pos += len;
+    }
+
+    inline void write(const std::string& str) {
+        write(str.data(), str.length());
+    }
+
+    // Quoted and escaped string; runs of plain characters are copied in one go
+    void write_string(const std::string& str) {
+        static const char hexdigits[] = "0123456789abcdef";
+
+        const char *data = str.data();
+        size_t len = str.length();
+        size_t start = 0;
+
+        put('"');
+
+        for (size_t x = 0; x < len; x++) {
+            unsigned char c = (unsigned char) data[x];
+
+            if (c >= 0x20 && c != '"' && c != '\\')
+                continue;
+
+            write(data + start, x - start);
+            start = x + 1;
+
+            switch (c) {
+                case '"':
+                    write("\\\"", 2);
+                    break;
+                case '\\':
+                    write("\\\\", 2);
+                    break;
+                case '\n':
+                    write("\\n", 2);
+                    break;
+                case '\r':
+                    write("\\r", 2);
+                    break;
+                case '\t':
+                    write("\\t", 2);
+                    break;
+                default:
+                    char esc[6] = { '\\', 'u', '0', '0', 
+                        hexdigits[c >> 4], hexdigits[c & 0x0F] };
+                    write(esc, 6);
+                    break;
+            }
+        }
+
+        write(data + start, len - start);
+
+        put('"');
+    }
+
+    void write_uint(uint64_t v) {
+        char tmp[20];
+        size_t p = sizeof(tmp);
+
+        do {
+            tmp[--p] = '0' + (v % 10);
+            v /= 10;
+        } while (v != 0);
+
+        write(tmp + p, sizeof(tmp) - p);
+    }
+
+    void write_int(int64_t v) {
+        if (v < 0) {
+            put('-');
+            write_uint(~((uint64_t) v) + 1);
+        } else {
+            write_uint((uint64_t) v);
+        }
+    }
+
+    // Fixed notation with 6 decimal places, matching the std::fixed output of 
+    // the standard adapter.  Values which can't be split into integer parts 
+    // exactly (too large, not finite, or too close to a rounding boundary to be
+    // sure which way printf would round them) go through snprintf.
+    void write_double(double v) {
+        double a = fabs(v);
+
+        if (!std::isfinite(v) || a >= 1e15) {
+            write_double_slow(v);
+            return;
+        }
+
+        uint64_t ip = (uint64_t) a;
+        double f = (a - (double) ip) * 1000000.0;
+        uint64_t fp = (uint64_t) f;
+        double rem = f - (double) fp;
+
+        if (fabs(rem - 0.5) < 1e-6) {
+            write_double_slow(v);
+            return;
+        }
+
+        if (rem > 0.5)
+            fp++;
+
+        if (fp >= 1000000) {
+            ip++;
+            fp -= 1000000;
+        }
+
+        if (std::signbit(v))
+            put('-');
+
+        write_uint(ip);
+
+        char tmp[7];
+        tmp[0] = '.';
+        for (int x = 6; x > 0; x--) {
+            tmp[x] = '0' + (fp % 10);
+            fp /= 10;
+        }
+
+        write(tmp, sizeof(tmp));
+    }
+
+    void write_double_slow(double v) {
+        char tmp[512];
+        int l = snprintf(tmp, sizeof(tmp), "%f", v);
+
+        if (l > 0)
+            write(tmp, (size_t) l < sizeof(tmp) ? l : sizeof(tmp) - 1);
+    }
+
+    // Uppercase hex without leading zeroes, padded to at least min_digits
+    void write_hex(uint64_t v, unsigned int min_digits) {
+        static const char hexdigits[] = "0123456789ABCDEF";
+        char tmp[16];
+        size_t p = sizeof(tmp);
+
+        do {
+            tmp[--p] = hexdigits[v & 0x0F];
+            v >>= 4;
+        } while (v != 0 || sizeof(tmp) - p < min_digits);
+
+        write(tmp + p, sizeof(tmp) - p);
+    }
+
+    // Quoted mac, without the mask, in the same format as Mac2String
+    void write_mac(const mac_addr& mac) {
+        static const char hexdigits[] = "0123456789ABCDEF";
+        char tmp[(MAC_LEN_MAX * 3) + 1];
+        size_t p = 0;
+
+        tmp[p++] = '"';
+
+        for (unsigned int x = 0; x < MAC_LEN_MAX; x++) {
+            unsigned int b = mac.index64(mac.longmac, x);
+
+            tmp[p++] = hexdigits[(b >> 4) & 0x0F];
+            tmp[p++] = hexdigits[b & 0x0F];
+
+            if (x != MAC_LEN_MAX - 1)
+                tmp[p++] = ':';
+        }
+
+        tmp[p++] = '"';
+
+        write(tmp, p);
+    }
+
+    // Quoted device key, in the same format as the TrackedDeviceKey stream operator
+    void write_key(const TrackedDeviceKey& key) {
+        put('"');
+        write_hex(kis_hton64(key.get_spkey()), 2);
+        put('_');
+        write_hex(kis_hton64(key.get_dkey()), 1);
+        put('"');
+    }
+
+    void write_bytes(const uint8_t *bytes, size_t len) {
+        static const char hexdigits[] = "0123456789ABCDEF";
+
+        put('"');
+        for (size_t x = 0; x < len; x++) {
+            put(hexdigits[(bytes[x] >> 4) & 0x0F]);
+            put(hexdigits[bytes[x] & 0x0F]);
+        }
+        put('"');
+    }
+
+protected:
+    std::ostream &stream;
+    char buf[8192];
+    size_t pos;
+};
+
+struct FastJsonContext {
+    FastJsonContext(GlobalRegistry *in_globalreg, std::ostream &stream,
+            TrackerElementSerializer::rename_map *in_name_map) :
+        globalreg(in_globalreg),
+        name_map(in_name_map),
+        writer(stream) { }
+
+    GlobalRegistry *globalreg;
+    TrackerElementSerializer::rename_map *name_map;
+    FastJsonWriter writer;
+};
+
+// Field name tokens are looked up once per field per thread; the entrytracker
+// never removes fields so the cached pointers stay valid
+static thread_local std::vector<const std::string *> fastjson_token_cache;
+
+static const std::string *FastJsonFieldToken(GlobalRegistry *globalreg, int id) {
+    if (id < 0)
+        return globalreg->entrytracker->GetFieldJsonToken(id);
+
+    if ((size_t) id < fastjson_token_cache.size() && fastjson_token_cache[id] != NULL)
+        return fastjson_token_cache[id];
+
+    const std::string *token = globalreg->entrytracker->GetFieldJsonToken(id);
+
+    if ((size_t) id >= fastjson_token_cache.size())
+        fastjson_token_cache.resize(id + 1, NULL);
+
+    fastjson_token_cache[id] = token;
+
+    return token;
+}
+
+static const SharedElementSummary *FastJsonFindSummary(FastJsonContext& ctx,
+        const SharedTrackerElement& e) {
+    if (ctx.name_map == NULL)
+        return NULL;
+
+    auto nmi = ctx.name_map->find(e);
+
+    if (nmi == ctx.name_map->end())
+        return NULL;
+
+    return &(nmi->second);
+}
+
+static void FastJsonPack(FastJsonContext& ctx, const SharedTrackerElement& e,
+        const SharedElementSummary *summary) {
+    FastJsonWriter& w = ctx.writer;
+
+    if (e == NULL) {
+        w.put('0');
+        return;
+    }
+
+    // Same pre/post serialization rules as SerializerScope, without re-searching
+    // the rename map or copying the element
+    struct fastjson_scope {
+        fastjson_scope(TrackerElement *in_elem, const SharedElementSummary *in_summary) :
+            elem(in_elem),
+            summary(in_summary) {
+            if (summary != NULL)
+                TrackerElementSerializer::pre_serialize_path(*summary);
+            else
+                elem->pre_serialize();
+        }
+
+        ~fastjson_scope() {
+            if (summary != NULL)
+                TrackerElementSerializer::post_serialize_path(*summary);
+            else
+                elem->post_serialize();
+        }
+
+        TrackerElement *elem;
+        const SharedElementSummary *summary;
+    } scope(e.get(), summary);
+
+    bool first = true;
+
+    switch (e->get_type()) {
+        case TrackerString:
+            w.write_string(e->get_string_ref());
+            break;
+        case TrackerInt8:
+            w.write_int(e->get_int8());
+            break;
+        case TrackerUInt8:
+            w.write_uint(e->get_uint8());
+            break;
+        case TrackerInt16:
+            w.write_int(e->get_int16());
+            break;
+        case TrackerUInt16:
+            w.write_uint(e->get_uint16());
+            break;
+        case TrackerInt32:
+            w.write_int(e->get_int32());
+            break;
+        case TrackerUInt32:
+            w.write_uint(e->get_uint32());
+            break;
+        case TrackerInt64:
+            w.write_int(e->get_int64());
+            break;
+        case TrackerUInt64:
+            w.write_uint(e->get_uint64());
+            break;
+        case TrackerFloat:
+            w.write_double(e->get_float());
+            break;
+        case TrackerDouble:
+            w.write_double(e->get_double());
+            break;
+        case TrackerMac:
+            w.write_mac(e->get_mac());
+            break;
+        case TrackerUuid:
+            w.put('"');
+            w.write(e->get_uuid().UUID2String());
+            w.put('"');
+            break;
+        case TrackerKey:
+            w.write_key(e->get_key());
+            break;
+        case TrackerVector:
+            w.put('[');
+            for (auto& i : *(e->get_vector())) {
+                if (!first)
+                    w.put(',');
+                first = false;
+
+                FastJsonPack(ctx, i, FastJsonFindSummary(ctx, i));
+            }
+            w.put(']');
+            break;
+        case TrackerMap:
+            w.put('{');
+            for (auto& i : *(e->get_map())) {
+                const SharedElementSummary *child_summary = 
+                    FastJsonFindSummary(ctx, i.second);
+                const std::string *local_name = NULL;
+
+                if (!first)
+                    w.put(',');
+                first = false;
+
+                if (i.second != NULL)
+                    local_name = i.second->get_local_name_ptr();
+
+                if (child_summary != NULL && (*child_summary)->rename.length() != 0) {
+                    w.write_string((*child_summary)->rename);
+                    w.write(": ", 2);
+                } else if (local_name != NULL && local_name->length() != 0) {
+                    w.write_string(*local_name);
+                    w.write(": ", 2);
+                } else {
+                    w.write(*FastJsonFieldToken(ctx.globalreg, i.first));
+                }
+
+                FastJsonPack(ctx, i.second, child_summary);
+            }
+            w.put('}');
+            break;
+        case TrackerIntMap:
+            w.put('{');
+            for (auto& i : *(e->get_intmap())) {
+                if (!first)
+                    w.put(',');
+                first = false;
+
+                // Integer dictionary keys in json are still quoted as strings
+                w.put('"');
+                w.write_int(i.first);
+                w.write("\": ", 3);
+
+                FastJsonPack(ctx, i.second, FastJsonFindSummary(ctx, i.second));
+            }
+            w.put('}');
+            break;
+        case TrackerMacMap:
+            w.put('{');
+            for (auto& i : *(e->get_macmap())) {
+                if (!first)
+                    w.put(',');
+                first = false;
+
+                w.write_mac(i.first);
+                w.write(": ", 2);
+
+                FastJsonPack(ctx, i.second, FastJsonFindSummary(ctx, i.second));
+            }
+            w.put('}');
+            break;
+        case TrackerStringMap:
+            w.put('{');
+            for (auto& i : *(e->get_stringmap())) {
+                if (!first)
+                    w.put(',');
+                first = false;
+
+                w.write_string(i.first);
+                w.write(": ", 2);
+
+                FastJsonPack(ctx, i.second, FastJsonFindSummary(ctx, i.second));
+            }
+            w.put('}');
+            break;
+        case TrackerDoubleMap:
+            w.put('{');
+            for (auto& i : *(e->get_doublemap())) {
+                if (!first)
+                    w.put(',');
+                first = false;
+
+                // Double keys are handled as strings in json
+                w.put('"');
+                w.write_double(i.first);
+                w.write("\": ", 3);
+
+                FastJsonPack(ctx, i.second, FastJsonFindSummary(ctx, i.second));
+            }
+            w.put('}');
+            break;
+        case TrackerKeyMap:
+            w.put('{');
+            for (auto& i : *(e->get_keymap())) {
+                if (!first)
+                    w.put(',');
+                first = false;
+
+                w.write_key(i.first);
+                w.write(": ", 2);
+
+                FastJsonPack(ctx, i.second, FastJsonFindSummary(ctx, i.second));
+            }
+            w.put('}');
+            break;
+        case TrackerByteArray:
+            w.write_bytes(e->get_bytearray().get(), e->get_bytearray_size());
+            break;
+        default:
+            break;
+    }
+}
+
+void FastJsonAdapter::Pack(GlobalRegistry *globalreg, std::ostream &stream,
+        SharedTrackerElement e, TrackerElementSerializer::rename_map *name_map) {
+    FastJsonContext ctx(globalreg, stream, name_map);
+
+    FastJsonPack(ctx, e, FastJsonFindSummary(ctx, e));
+}
+
+void FastJsonAdapter::EkSerializer::serialize(SharedTrackerElement in_elem,
+        std::ostream &stream, rename_map *name_map) {
+    FastJsonContext ctx(globalreg, stream, name_map);
+
+    if (in_elem != NULL && in_elem->get_type() == TrackerVector) {
+        for (auto& i : *(in_elem->get_vector())) {
+            FastJsonPack(ctx, i, FastJsonFindSummary(ctx, i));
+            ctx.writer.put('\n');
+        }
+    } else {
+        FastJsonPack(ctx, in_elem, FastJsonFindSummary(ctx, in_elem));
+    }
+}
+
 // An unfortunate duplication of code but overloading the json/prettyjson to also do
 // storage tagging would get a bit out of hand
 void StorageJsonAdapter::Pack(GlobalRegistry *globalreg, std::ostream &stream,
@@ -82,6 +82,41 @@ public:
 
 }
 
+// Buffered JSON adapter.  Produces the same output as the standard JSON adapter,
+// but formats values directly into a fixed chunk buffer which is flushed to the
+// stream as it fills, instead of going through the ostream formatting for every
+// field, and uses the pre-escaped field names from the entrytracker.  This is
+// the serializer used for the json, ekjson, and jcmd REST endpoints, where a
+// full device list can be many megabytes.
+namespace FastJsonAdapter {
+
+void Pack(GlobalRegistry *globalreg, std::ostream &stream, SharedTrackerElement e,
+        TrackerElementSerializer::rename_map *name_map = NULL);
+
+class Serializer : public TrackerElementSerializer {
+public:
+    Serializer(GlobalRegistry *in_globalreg) :
+        TrackerElementSerializer(in_globalreg) { }
+
+    virtual void serialize(SharedTrackerElement in_elem, std::ostream &stream,
+            rename_map *name_map = NULL) {
+        Pack(globalreg, stream, in_elem, name_map);
+    }
+};
+
+// ELK-style variant of the buffered adapter; vectors at the top level are
+// written as one complete object per line
+class EkSerializer : public TrackerElementSerializer {
+public:
+    EkSerializer(GlobalRegistry *in_globalreg) :
+        TrackerElementSerializer(in_globalreg) { }
+
+    virtual void serialize(SharedTrackerElement in_elem, std::ostream &stream,
+            rename_map *name_map = NULL);
+};
+
+}
+
 // "Pretty" JSON adapter.  This will include metadata about the fields, and format
 // it to be human readable.
 namespace PrettyJsonAdapter {
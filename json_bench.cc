@@ -0,0 +1,145 @@
+/* benchmark harness for the JSON serializers
+ *
+ * Builds a set of populated device records (strings, counters, MACs, keys,
+ * frequency maps and packet RRDs, which are the bulk of a device list) and
+ * serializes them as one vector, the way the device list endpoints do, with
+ * the original ostream-based JsonAdapter and with FastJsonAdapter.  The two
+ * outputs are compared so a formatting difference shows up here before it
+ * shows up in the UI.
+ *
+ * # build kismet, then
+ * make json_bench
+ *
+ * ./json_bench [devices] [iterations]
+ *
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <chrono>
+#include <memory>
+#include <sstream>
+#include <string>
+
+#include "globalregistry.h"
+#include "entrytracker.h"
+#include "trackedelement.h"
+#include "devicetracker.h"
+#include "json_adapter.h"
+
+static double elapsed_ns(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start).count();
+}
+
+template<class F>
+static double run(F pack, SharedTrackerElement devvec, unsigned int iterations,
+        std::string& out) {
+    double best = 0;
+
+    for (unsigned int i = 0; i < iterations; i++) {
+        std::stringstream ss;
+
+        auto start = std::chrono::steady_clock::now();
+        pack(ss, devvec);
+        double ns = elapsed_ns(start);
+
+        if (i == 0 || ns < best)
+            best = ns;
+
+        if (i == 0)
+            out = ss.str();
+    }
+
+    return best;
+}
+
+int main(int argc, char *argv[]) {
+    unsigned int num_devices = 2000;
+    unsigned int iterations = 20;
+
+    if (argc > 1)
+        num_devices = strtoul(argv[1], NULL, 10);
+    if (argc > 2)
+        iterations = strtoul(argv[2], NULL, 10);
+
+    if (num_devices == 0 || iterations == 0) {
+        fprintf(stderr, "usage: %s [devices] [iterations]\n", argv[0]);
+        return 1;
+    }
+
+    GlobalRegistry *globalreg = new GlobalRegistry();
+    EntryTracker::create_entrytracker(globalreg);
+
+    time_t now = 1500000000;
+    globalreg->timestamp.tv_sec = now;
+    globalreg->timestamp.tv_usec = 0;
+
+    int device_id =
+        globalreg->entrytracker->RegisterField("kismet.device.base", TrackerMap,
+                "core device record");
+
+    SharedTrackerElement devvec(new TrackerElement(TrackerVector));
+
+    uint64_t r = 0x9E3779B97F4A7C15ULL;
+
+    for (unsigned int d = 0; d < num_devices; d++) {
+        std::shared_ptr<kis_tracked_device_base> dev(new kis_tracked_device_base(globalreg,
+                    device_id));
+
+        r ^= r << 13;
+        r ^= r >> 7;
+        r ^= r << 17;
+
+        mac_addr mac((uint8_t *) &r, 6);
+
+        dev->set_key(TrackedDeviceKey(1, 2, mac));
+        dev->set_macaddr(mac);
+        dev->set_phyname("IEEE802.11");
+        dev->set_devicename("Device \"" + std::to_string(d) + "\" \\ bench");
+        dev->set_type_string("Wi-Fi AP");
+        dev->set_crypt_string("WPA2-PSK");
+        dev->set_first_time(now - (r % 3600));
+        dev->set_last_time(now - (r % 60));
+        dev->set_packets(r % 100000);
+        dev->set_datasize(r % 100000000);
+        dev->set_channel(std::to_string(1 + (r % 11)));
+        dev->set_frequency(2412000 + 5000 * (r % 11));
+        dev->set_manuf("Unknown");
+
+        for (unsigned int f = 0; f < 3; f++)
+            dev->inc_frequency_count(2412000 + 5000 * ((r >> f) % 11));
+
+        // A minute of samples, spread back over the last hour
+        for (unsigned int s = 0; s < 120; s++)
+            dev->get_packets_rrd()->add_sample((r >> (s % 32)) % 50, now - 3600 + s * 30);
+
+        devvec->add_vector(dev);
+    }
+
+    printf("%u devices, best of %u iterations\n", num_devices, iterations);
+
+    std::string json_out, fast_out;
+
+    double json_ns = run([globalreg](std::stringstream& ss, SharedTrackerElement e) {
+                JsonAdapter::Pack(globalreg, ss, e, NULL);
+            }, devvec, iterations, json_out);
+
+    double fast_ns = run([globalreg](std::stringstream& ss, SharedTrackerElement e) {
+                FastJsonAdapter::Pack(globalreg, ss, e, NULL);
+            }, devvec, iterations, fast_out);
+
+    printf("  JsonAdapter:     %10.1f us, %8.1f ns per device, %8.1f MB/sec, %zu bytes\n",
+            json_ns / 1000, json_ns / num_devices,
+            json_out.length() / (json_ns / 1e9) / (1024 * 1024), json_out.length());
+    printf("  FastJsonAdapter: %10.1f us, %8.1f ns per device, %8.1f MB/sec, %zu bytes\n",
+            fast_ns / 1000, fast_ns / num_devices,
+            fast_out.length() / (fast_ns / 1e9) / (1024 * 1024), fast_out.length());
+    printf("  speedup %.2fx, output %s\n", json_ns / fast_ns,
+            json_out == fast_out ? "identical" : "DIFFERS");
+
+    return json_out == fast_out ? 0 : 1;
+}
@@ -24,12 +24,14 @@
 #include "json_adapter.h"
 #include "packetchain.h"
 #include "kis_datasource.h"
+#include "entrytracker.h"
 
 #include "kis_databaselogfile.h"
 
 KisDatabaseLogfile::KisDatabaseLogfile(GlobalRegistry *in_globalreg):
     KisLogfile(in_globalreg, SharedLogBuilder(NULL)), 
-    KisDatabase(in_globalreg, "kismetlog") {
+    KisDatabase(in_globalreg, "kismetlog"),
+    Kis_Net_Httpd_Chain_Stream_Handler(in_globalreg) {
 
     globalreg = in_globalreg;
 
@@ -71,12 +73,65 @@ KisDatabaseLogfile::KisDatabaseLogfile(GlobalRegistry *in_globalreg):
 
     db_enabled = false;
 
+    writer_queue = new mpsc_ringbuf<db_write_record *>(
+            globalreg->kismet_config->FetchOptUInt("kis_log_write_queue", 8192));
+
+    transaction_rows =
+        globalreg->kismet_config->FetchOptUInt("kis_log_transaction_rows", 4096);
+    transaction_ms =
+        globalreg->kismet_config->FetchOptUInt("kis_log_transaction_ms", 2000);
+
+    if (transaction_rows == 0)
+        transaction_rows = 1;
+
+    if (transaction_ms == 0)
+        transaction_ms = 1;
+
+    writer_waiting = false;
+    writer_shutdown = false;
+
+    writer_written = 0;
+    writer_dropped = 0;
+    writer_transactions = 0;
+    writer_lag_total_ns = 0;
+    writer_lag_max_ns = 0;
+    last_writer_drop_warning = 0;
+
+    std::shared_ptr<EntryTracker> entrytracker =
+        Globalreg::FetchMandatoryGlobalAs<EntryTracker>(globalreg, "ENTRY_TRACKER");
+
+    writer_stats_id =
+        entrytracker->RegisterField("kismet.kismetdb.writer_stats", TrackerMap,
+                "kismetdb log writer statistics");
+    writer_stats_depth_id =
+        entrytracker->RegisterField("kismet.kismetdb.queue_depth", TrackerUInt64,
+                "records waiting to be written");
+    writer_stats_size_id =
+        entrytracker->RegisterField("kismet.kismetdb.queue_size", TrackerUInt64,
+                "maximum size of the write queue");
+    writer_stats_written_id =
+        entrytracker->RegisterField("kismet.kismetdb.written", TrackerUInt64,
+                "records written to the log");
+    writer_stats_dropped_id =
+        entrytracker->RegisterField("kismet.kismetdb.dropped", TrackerUInt64,
+                "records dropped because the write queue was full");
+    writer_stats_transactions_id =
+        entrytracker->RegisterField("kismet.kismetdb.transactions", TrackerUInt64,
+                "transactions committed");
+    writer_stats_lag_avg_id =
+        entrytracker->RegisterField("kismet.kismetdb.write_lag_avg_us", TrackerDouble,
+                "average time from queueing to writing a record, in usec");
+    writer_stats_lag_max_id =
+        entrytracker->RegisterField("kismet.kismetdb.write_lag_max_us", TrackerDouble,
+                "maximum time from queueing to writing a record, in usec");
 }
 
 KisDatabaseLogfile::~KisDatabaseLogfile() {
     local_eol_locker dblock(&ds_mutex);
 
     Log_Close();
+
+    delete writer_queue;
 }
 
 bool KisDatabaseLogfile::Log_Open(std::string in_path) {
@@ -101,24 +156,16 @@ bool KisDatabaseLogfile::Log_Open(std::string in_path) {
 	packetchain->RegisterHandler(&KisDatabaseLogfile::packet_handler, this, 
             CHAINPOS_LOGGING, -100);
 
-    db_enabled = true;
-    
-    // Go into transactional mode where we only commit every 10 seconds
-    sqlite3_exec(db, "BEGIN TRANSACTION", NULL, NULL, NULL);
-
-    std::shared_ptr<Timetracker> timetracker = 
-        Globalreg::FetchMandatoryGlobalAs<Timetracker>(globalreg, "TIMETRACKER");
-    transaction_timer = 
-        timetracker->RegisterTimer(SERVER_TIMESLICES_SEC * 10, NULL, 1,
-            [this](int) -> int {
-
-            local_locker lock(&transaction_mutex);
+    // Write-ahead logging lets commits append to the journal instead of 
+    // rewriting pages in place, and normal sync only syncs at checkpoints
+    sqlite3_exec(db, "PRAGMA journal_mode=WAL", NULL, NULL, NULL);
+    sqlite3_exec(db, "PRAGMA synchronous=NORMAL", NULL, NULL, NULL);
 
-            sqlite3_exec(db, "END TRANSACTION", NULL, NULL, NULL);
-            sqlite3_exec(db, "BEGIN TRANSACTION", NULL, NULL, NULL);
+    db_enabled = true;
 
-            return 1;
-        });
+    // Start the writer, which opens the first transaction
+    writer_shutdown = false;
+    writer_thread = std::thread(db_writer_processor, this);
 
     return true;
 }
@@ -128,18 +175,6 @@ void KisDatabaseLogfile::Log_Close() {
 
     set_int_log_open(false);
 
-    // Kill the timer
-    std::shared_ptr<Timetracker> timetracker = 
-        Globalreg::FetchMandatoryGlobalAs<Timetracker>(globalreg, "TIMETRACKER");
-    if (timetracker != NULL)
-        timetracker->RemoveTimer(transaction_timer);
-
-    // End the transaction
-    {
-        local_eol_locker translock(&transaction_mutex);
-        sqlite3_exec(db, "END TRANSACTION", NULL, NULL, NULL);
-    }
-
     db_enabled = false;
 
     std::shared_ptr<Packetchain> packetchain =
@@ -147,6 +182,19 @@ void KisDatabaseLogfile::Log_Close() {
     if (packetchain != NULL) 
         packetchain->RemoveHandler(&KisDatabaseLogfile::packet_handler, CHAINPOS_LOGGING);
 
+    // Stop the writer; it drains the queue and commits the last transaction
+    // on the way out
+    if (writer_thread.joinable()) {
+        writer_shutdown = true;
+        writer_condition.unlock(0);
+        writer_thread.join();
+    }
+
+    // Throw away anything queued after the writer stopped
+    db_write_record *rec;
+    while (writer_queue->pop(rec))
+        delete rec;
+
     {
         local_eol_locker lock(&device_mutex);
         if (device_stmt != NULL)
@@ -561,26 +609,31 @@ int KisDatabaseLogfile::log_devices(TrackerElementVector in_devices) {
     // internal locking state; we don't want a huge device list write to block packet
     // writes for instance
     
-    local_locker lock(&device_mutex);
-
     if (!db_enabled)
         return 0;
 
-    std::string sql;
+    // Serializing the devices is the expensive part, so it's spread across the
+    // devicetracker match threads; only the insert itself holds the device
+    // statement lock.  The worker locks each device while we serialize it.
+    devicetracker_parallel_function_worker fw(globalreg,
+            [this](Devicetracker *, std::shared_ptr<kis_tracked_device_base> d) -> bool {
 
-    std::string phystring;
-    std::string macstring;
-    std::string typestring;
+        std::string phystring = d->get_phyname();
+        std::string macstring = d->get_macaddr().Mac2String();
+        std::string typestring = d->get_type_string();
 
-    for (auto i : in_devices) {
-        sqlite3_reset(device_stmt);
+        std::stringstream sstr;
+
+        // Serialize the device
+        FastJsonAdapter::Pack(globalreg, sstr, d, NULL);
+        std::string streamstring = sstr.str();
+
+        local_locker lock(&device_mutex);
 
-        std::shared_ptr<kis_tracked_device_base> d =
-            std::static_pointer_cast<kis_tracked_device_base>(i);
+        if (!db_enabled)
+            return false;
 
-        phystring = d->get_phyname();
-        macstring = d->get_macaddr().Mac2String();
-        typestring = d->get_type_string();
+        sqlite3_reset(device_stmt);
 
         sqlite3_bind_int(device_stmt, 1, d->get_first_time());
         sqlite3_bind_int(device_stmt, 2, d->get_last_time());
@@ -613,36 +666,22 @@ int KisDatabaseLogfile::log_devices(TrackerElementVector in_devices) {
 
         sqlite3_bind_int(device_stmt, 12, d->get_datasize());
         sqlite3_bind_text(device_stmt, 13, typestring.c_str(), typestring.length(), 0);
-
-        std::stringstream sstr;
-
-        // Serialize the device
-        JsonAdapter::Pack(globalreg, sstr, d, NULL);
-        std::string streamstring = sstr.str();
         sqlite3_bind_text(device_stmt, 14, streamstring.c_str(), streamstring.length(), 0);
 
         sqlite3_step(device_stmt);
-    }
+
+        return false;
+    }, NULL);
+
+    devicetracker->MatchOnDevices(&fw, in_devices);
 
     return 1;
 }
 
 int KisDatabaseLogfile::log_packet(kis_packet *in_pack) {
-    local_locker lock(&packet_mutex);
-    
     if (!db_enabled)
         return 0;
 
-    sqlite3_reset(packet_stmt);
-
-    std::string phystring;
-    std::string macstring;
-    std::string deststring;
-    std::string transstring;
-    std::string keystring;
-    std::string sourceuuidstring;
-    double frequency;
-
     kis_datachunk *chunk = 
         (kis_datachunk *) in_pack->fetch(pack_comp_linkframe);
 
@@ -661,75 +700,57 @@ int KisDatabaseLogfile::log_packet(kis_packet *in_pack) {
     packetchain_comp_datasource *datasrc =
         (packetchain_comp_datasource *) in_pack->fetch(pack_comp_datasource);
 
+    db_write_record *rec = new db_write_record;
+
+    rec->type = db_write_record::rec_packet;
+    rec->ts = in_pack->ts;
+
     if (devinfo != NULL) {
-        phystring = devinfo->devref->get_phyname();
-        keystring = devinfo->devref->get_key().as_string();
+        rec->phyname = devinfo->devref->get_phyname();
+        rec->has_devkey = true;
+        rec->devkey = devinfo->devref->get_key();
     } else {
-        keystring = "0";
-        phystring = "Unknown";
+        rec->phyname = "Unknown";
+        rec->has_devkey = false;
     }
 
     if (commoninfo != NULL) {
-        macstring = commoninfo->source.Mac2String();
-        deststring = commoninfo->dest.Mac2String();
-        transstring = commoninfo->transmitter.Mac2String();
-        frequency = commoninfo->freq_khz;
-    } else {
-        macstring = "00:00:00:00:00:00";
-        deststring = "00:00:00:00:00:00";
-        transstring = "00:00:00:00:00:00";
-        frequency = 0;
-    }
-
-    if (datasrc != NULL) {
-        sourceuuidstring = datasrc->ref_source->get_source_uuid().UUID2String();
+        rec->sourcemac = commoninfo->source;
+        rec->destmac = commoninfo->dest;
+        rec->transmac = commoninfo->transmitter;
+        rec->frequency = commoninfo->freq_khz;
     } else {
-        sourceuuidstring = "00000000-0000-0000-0000-000000000000";
+        rec->frequency = 0;
     }
 
-    sqlite3_bind_int(packet_stmt, 1, in_pack->ts.tv_sec);
-    sqlite3_bind_int(packet_stmt, 2, in_pack->ts.tv_usec);
-
-    sqlite3_bind_text(packet_stmt, 3, phystring.c_str(), phystring.length(), 0);
-    sqlite3_bind_text(packet_stmt, 4, macstring.c_str(), macstring.length(), 0);
-    sqlite3_bind_text(packet_stmt, 5, deststring.c_str(), deststring.length(), 0);
-    sqlite3_bind_text(packet_stmt, 6, transstring.c_str(), transstring.length(), 0);
-    sqlite3_bind_text(packet_stmt, 7, keystring.c_str(), keystring.length(), 0);
-    sqlite3_bind_double(packet_stmt, 8, frequency);
+    if (datasrc != NULL)
+        rec->datasource_uuid = datasrc->ref_source->get_source_uuid();
 
     if (gpsdata != NULL) {
-        sqlite3_bind_int(packet_stmt, 9, gpsdata->lat * 100000);
-        sqlite3_bind_int(packet_stmt, 10, gpsdata->lon * 100000);
+        rec->lat = gpsdata->lat * 100000;
+        rec->lon = gpsdata->lon * 100000;
     } else {
-        sqlite3_bind_int(packet_stmt, 9, 0);
-        sqlite3_bind_int(packet_stmt, 10, 0);
+        rec->lat = 0;
+        rec->lon = 0;
     }
 
-    if (chunk != NULL) {
-        sqlite3_bind_int(packet_stmt, 11, chunk->length);
-    } else {
-        sqlite3_bind_int(packet_stmt, 11, 0);
-    }
-
-    if (radioinfo != NULL) {
-        sqlite3_bind_int(packet_stmt, 12, radioinfo->signal_dbm);
-    } else {
-        sqlite3_bind_int(packet_stmt, 12, 0);
-    }
-
-    sqlite3_bind_text(packet_stmt, 13, sourceuuidstring.c_str(), sourceuuidstring.length(), 0);
+    if (radioinfo != NULL)
+        rec->signal = radioinfo->signal_dbm;
+    else
+        rec->signal = 0;
 
     if (chunk != NULL) {
-        sqlite3_bind_int(packet_stmt, 14, chunk->dlt);
-        sqlite3_bind_blob(packet_stmt, 15, (const char *) chunk->data, chunk->length, 0);
+        rec->length = chunk->length;
+        rec->dlt = chunk->dlt;
+        rec->payload.assign((const char *) chunk->data, chunk->length);
     } else {
-        sqlite3_bind_int(packet_stmt, 14, -1);
-        sqlite3_bind_text(packet_stmt, 15, "", 0, 0);
+        rec->length = 0;
+        rec->dlt = -1;
     }
 
-    sqlite3_bind_int(packet_stmt, 16, in_pack->error);
+    rec->error = in_pack->error;
 
-    sqlite3_step(packet_stmt);
+    queue_record(rec);
 
     return 1;
 }
@@ -737,35 +758,29 @@ int KisDatabaseLogfile::log_packet(kis_packet *in_pack) {
 int KisDatabaseLogfile::log_data(kis_gps_packinfo *gps, struct timeval tv, 
         std::string phystring, mac_addr devmac, uuid datasource_uuid, 
         std::string json) {
-    local_locker lock(&data_mutex);
 
     if (!db_enabled)
         return 0;
 
-    sqlite3_reset(data_stmt);
-
-    std::string macstring = devmac.Mac2String();
-    std::string uuidstring = datasource_uuid.UUID2String();
-
-    sqlite3_bind_int(data_stmt, 1, tv.tv_sec);
-    sqlite3_bind_int(data_stmt, 2, tv.tv_usec);
+    db_write_record *rec = new db_write_record;
 
-    sqlite3_bind_text(data_stmt, 3, phystring.c_str(), phystring.length(), 0);
-    sqlite3_bind_text(data_stmt, 4, macstring.c_str(), macstring.length(), 0);
+    rec->type = db_write_record::rec_data;
+    rec->ts = tv;
+    rec->phyname = phystring;
+    rec->sourcemac = devmac;
+    rec->datasource_uuid = datasource_uuid;
 
     if (gps != NULL) {
-        sqlite3_bind_int(data_stmt, 5, gps->lat * 100000);
-        sqlite3_bind_int(data_stmt, 6, gps->lon * 100000);
+        rec->lat = gps->lat * 100000;
+        rec->lon = gps->lon * 100000;
     } else {
-        sqlite3_bind_int(data_stmt, 5, 0);
-        sqlite3_bind_int(data_stmt, 6, 0);
+        rec->lat = 0;
+        rec->lon = 0;
     }
 
-    sqlite3_bind_text(data_stmt, 7, uuidstring.c_str(), uuidstring.length(), 0);
-
-    sqlite3_bind_text(data_stmt, 8, json.data(), json.length(), 0);
+    rec->payload = json;
 
-    sqlite3_step(data_stmt);
+    queue_record(rec);
 
     return 1;
 }
@@ -872,33 +887,258 @@ int KisDatabaseLogfile::log_alert(std::shared_ptr<tracked_alert> in_alert) {
 int KisDatabaseLogfile::log_snapshot(kis_gps_packinfo *gps, struct timeval tv,
         std::string snaptype, std::string json) {
 
-    local_locker lock(&snapshot_mutex);
-
     if (!db_enabled)
         return 0;
 
+    db_write_record *rec = new db_write_record;
 
-    sqlite3_reset(snapshot_stmt);
-
-    sqlite3_bind_int(snapshot_stmt, 1, tv.tv_sec);
-    sqlite3_bind_int(snapshot_stmt, 2, tv.tv_usec);
+    rec->type = db_write_record::rec_snapshot;
+    rec->ts = tv;
 
     if (gps != NULL) {
-        sqlite3_bind_int(snapshot_stmt, 3, gps->lat * 100000);
-        sqlite3_bind_int(snapshot_stmt, 4, gps->lon * 100000);
+        rec->lat = gps->lat * 100000;
+        rec->lon = gps->lon * 100000;
     } else {
-        sqlite3_bind_int(snapshot_stmt, 3, 0);
-        sqlite3_bind_int(snapshot_stmt, 4, 0);
+        rec->lat = 0;
+        rec->lon = 0;
     }
 
-    sqlite3_bind_text(snapshot_stmt, 5, snaptype.c_str(), snaptype.length(), 0);
-    sqlite3_bind_text(snapshot_stmt, 6, json.data(), json.length(), 0);
+    rec->snaptype = snaptype;
+    rec->payload = json;
 
-    sqlite3_step(snapshot_stmt);
+    queue_record(rec);
 
     return 1;
 }
 
+bool KisDatabaseLogfile::queue_record(db_write_record *in_rec) {
+    in_rec->enqueue_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+
+    if (!writer_queue->push(in_rec)) {
+        delete in_rec;
+
+        writer_dropped++;
+
+        // Warn at most once every 30 seconds; whichever thread wins the
+        // timestamp update raises the message
+        time_t now = time(0);
+        time_t last = last_writer_drop_warning;
+
+        if (now - last > 30 &&
+                last_writer_drop_warning.compare_exchange_strong(last, now)) {
+            _MSG("The kismetdb log writer has fallen behind and is dropping records; "
+                    "the disk may not be fast enough to keep up.  You can change the "
+                    "size of the write queue with 'kis_log_write_queue' in "
+                    "kismet_logging.conf.", MSGFLAG_ERROR);
+        }
+
+        return false;
+    }
+
+    // Only wake the writer if it's gone to sleep; the fence pairs with the 
+    // writer setting the waiting flag before checking the queue
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+
+    if (writer_waiting)
+        writer_condition.unlock(1);
+
+    return true;
+}
+
+void KisDatabaseLogfile::write_packet_record(db_write_record *in_rec) {
+    local_locker lock(&packet_mutex);
+
+    sqlite3_reset(packet_stmt);
+
+    std::string macstring = in_rec->sourcemac.Mac2String();
+    std::string deststring = in_rec->destmac.Mac2String();
+    std::string transstring = in_rec->transmac.Mac2String();
+    std::string keystring = "0";
+    std::string sourceuuidstring = in_rec->datasource_uuid.UUID2String();
+
+    if (in_rec->has_devkey)
+        keystring = in_rec->devkey.as_string();
+
+    sqlite3_bind_int(packet_stmt, 1, in_rec->ts.tv_sec);
+    sqlite3_bind_int(packet_stmt, 2, in_rec->ts.tv_usec);
+
+    sqlite3_bind_text(packet_stmt, 3, in_rec->phyname.c_str(), 
+            in_rec->phyname.length(), 0);
+    sqlite3_bind_text(packet_stmt, 4, macstring.c_str(), macstring.length(), 0);
+    sqlite3_bind_text(packet_stmt, 5, deststring.c_str(), deststring.length(), 0);
+    sqlite3_bind_text(packet_stmt, 6, transstring.c_str(), transstring.length(), 0);
+    sqlite3_bind_text(packet_stmt, 7, keystring.c_str(), keystring.length(), 0);
+    sqlite3_bind_double(packet_stmt, 8, in_rec->frequency);
+
+    sqlite3_bind_int(packet_stmt, 9, in_rec->lat);
+    sqlite3_bind_int(packet_stmt, 10, in_rec->lon);
+
+    sqlite3_bind_int(packet_stmt, 11, in_rec->length);
+    sqlite3_bind_int(packet_stmt, 12, in_rec->signal);
+
+    sqlite3_bind_text(packet_stmt, 13, sourceuuidstring.c_str(), sourceuuidstring.length(), 0);
+
+    sqlite3_bind_int(packet_stmt, 14, in_rec->dlt);
+
+    if (in_rec->dlt != -1)
+        sqlite3_bind_blob(packet_stmt, 15, in_rec->payload.data(), 
+                in_rec->payload.length(), 0);
+    else
+        sqlite3_bind_text(packet_stmt, 15, "", 0, 0);
+
+    sqlite3_bind_int(packet_stmt, 16, in_rec->error);
+
+    sqlite3_step(packet_stmt);
+}
+
+void KisDatabaseLogfile::write_data_record(db_write_record *in_rec) {
+    local_locker lock(&data_mutex);
+
+    sqlite3_reset(data_stmt);
+
+    std::string macstring = in_rec->sourcemac.Mac2String();
+    std::string uuidstring = in_rec->datasource_uuid.UUID2String();
+
+    sqlite3_bind_int(data_stmt, 1, in_rec->ts.tv_sec);
+    sqlite3_bind_int(data_stmt, 2, in_rec->ts.tv_usec);
+
+    sqlite3_bind_text(data_stmt, 3, in_rec->phyname.c_str(), 
+            in_rec->phyname.length(), 0);
+    sqlite3_bind_text(data_stmt, 4, macstring.c_str(), macstring.length(), 0);
+
+    sqlite3_bind_int(data_stmt, 5, in_rec->lat);
+    sqlite3_bind_int(data_stmt, 6, in_rec->lon);
+
+    sqlite3_bind_text(data_stmt, 7, uuidstring.c_str(), uuidstring.length(), 0);
+
+    sqlite3_bind_text(data_stmt, 8, in_rec->payload.data(), in_rec->payload.length(), 0);
+
+    sqlite3_step(data_stmt);
+}
+
+void KisDatabaseLogfile::write_snapshot_record(db_write_record *in_rec) {
+    local_locker lock(&snapshot_mutex);
+
+    sqlite3_reset(snapshot_stmt);
+
+    sqlite3_bind_int(snapshot_stmt, 1, in_rec->ts.tv_sec);
+    sqlite3_bind_int(snapshot_stmt, 2, in_rec->ts.tv_usec);
+
+    sqlite3_bind_int(snapshot_stmt, 3, in_rec->lat);
+    sqlite3_bind_int(snapshot_stmt, 4, in_rec->lon);
+
+    sqlite3_bind_text(snapshot_stmt, 5, in_rec->snaptype.c_str(), 
+            in_rec->snaptype.length(), 0);
+    sqlite3_bind_text(snapshot_stmt, 6, in_rec->payload.data(), 
+            in_rec->payload.length(), 0);
+
+    sqlite3_step(snapshot_stmt);
+}
+
+void KisDatabaseLogfile::db_writer_processor(KisDatabaseLogfile *logfile) {
+    std::vector<db_write_record *> batch;
+
+    batch.reserve(256);
+
+    unsigned int txn_rows = 0;
+    std::chrono::steady_clock::time_point txn_start = std::chrono::steady_clock::now();
+
+    {
+        local_locker lock(&(logfile->transaction_mutex));
+        sqlite3_exec(logfile->db, "BEGIN TRANSACTION", NULL, NULL, NULL);
+    }
+
+    while (1) {
+        batch.clear();
+
+        if (logfile->writer_queue->pop_batch(batch, 256) != 0) {
+            for (auto r : batch) {
+                switch (r->type) {
+                    case db_write_record::rec_packet:
+                        logfile->write_packet_record(r);
+                        break;
+                    case db_write_record::rec_data:
+                        logfile->write_data_record(r);
+                        break;
+                    case db_write_record::rec_snapshot:
+                        logfile->write_snapshot_record(r);
+                        break;
+                }
+            }
+
+            uint64_t now_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now().time_since_epoch()).count();
+
+            for (auto r : batch) {
+                uint64_t lag = 0;
+
+                if (now_ns > r->enqueue_ns)
+                    lag = now_ns - r->enqueue_ns;
+
+                logfile->writer_lag_total_ns += lag;
+
+                if (lag > logfile->writer_lag_max_ns)
+                    logfile->writer_lag_max_ns = lag;
+
+                delete r;
+            }
+
+            logfile->writer_written += batch.size();
+            txn_rows += batch.size();
+        }
+
+        std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        unsigned int txn_ms = 
+            std::chrono::duration_cast<std::chrono::milliseconds>(now - txn_start).count();
+
+        // Commit when the transaction is big enough or old enough
+        if (txn_rows >= logfile->transaction_rows || txn_ms >= logfile->transaction_ms) {
+            local_locker lock(&(logfile->transaction_mutex));
+
+            sqlite3_exec(logfile->db, "END TRANSACTION", NULL, NULL, NULL);
+            sqlite3_exec(logfile->db, "BEGIN TRANSACTION", NULL, NULL, NULL);
+
+            logfile->writer_transactions++;
+
+            txn_rows = 0;
+            txn_ms = 0;
+            txn_start = now;
+        }
+
+        // re-loop in case we have more records
+        if (batch.size() != 0)
+            continue;
+
+        if (logfile->writer_shutdown)
+            break;
+
+        // We have no records; lock our conditional and tell the producers we're
+        // going to sleep, then check one last time so that a record queued while
+        // we were deciding to sleep isn't stranded
+        logfile->writer_condition.lock();
+        logfile->writer_waiting = true;
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+
+        if (!logfile->writer_queue->empty() || logfile->writer_shutdown) {
+            logfile->writer_waiting = false;
+            logfile->writer_condition.unlock();
+            continue;
+        }
+
+        // Sleep until something is queued, or until the transaction is due to
+        // be committed
+        logfile->writer_condition.block_for_ms(logfile->transaction_ms - txn_ms);
+
+        logfile->writer_waiting = false;
+    }
+
+    {
+        local_locker lock(&(logfile->transaction_mutex));
+        sqlite3_exec(logfile->db, "END TRANSACTION", NULL, NULL, NULL);
+    }
+}
+
 int KisDatabaseLogfile::packet_handler(CHAINCALL_PARMS) {
     // Extremely basic shim to our built-in logging
 
@@ -912,6 +1152,14 @@ void KisDatabaseLogfile::Usage(const char *argv0) {
 }
 
 bool KisDatabaseLogfile::Httpd_VerifyPath(const char *path, const char *method) {
+    if (strcmp(method, "GET") != 0)
+        return false;
+
+    if (!Httpd_CanSerialize(path))
+        return false;
+
+    if (Httpd_StripSuffix(path) == "/logging/kismetdb/writer_stats")
+        return true;
 
     return false;
 }
@@ -921,7 +1169,77 @@ int KisDatabaseLogfile::Httpd_CreateStreamResponse(Kis_Net_Httpd *httpd,
             const char *url, const char *method, const char *upload_data,
             size_t *upload_data_size) {
 
-    return 0;
+    if (strcmp(method, "GET") != 0)
+        return MHD_YES;
+
+    if (!Httpd_CanSerialize(url))
+        return MHD_YES;
+
+    if (Httpd_StripSuffix(url) != "/logging/kismetdb/writer_stats")
+        return MHD_YES;
+
+    Kis_Net_Httpd_Buffer_Stream_Aux *saux = 
+        (Kis_Net_Httpd_Buffer_Stream_Aux *) connection->custom_extension;
+
+    BufferHandlerOStringStreambuf *streambuf = 
+        new BufferHandlerOStringStreambuf(saux->get_rbhandler());
+    std::ostream stream(streambuf);
+
+    saux->set_aux(streambuf, 
+            [](Kis_Net_Httpd_Buffer_Stream_Aux *aux) {
+                if (aux->aux != NULL)
+                    delete((BufferHandlerOStreambuf *) (aux->aux));
+            });
+
+    saux->set_sync([](Kis_Net_Httpd_Buffer_Stream_Aux *aux) {
+            if (aux->aux != NULL) {
+                ((BufferHandlerOStringStreambuf *) aux->aux)->pubsync();
+                }
+            });
+
+    SharedTrackerElement stats(new TrackerElement(TrackerMap, writer_stats_id));
+
+    SharedTrackerElement depth(new TrackerElement(TrackerUInt64, writer_stats_depth_id));
+    depth->set((uint64_t) writer_queue->size());
+    stats->add_map(depth);
+
+    SharedTrackerElement size(new TrackerElement(TrackerUInt64, writer_stats_size_id));
+    size->set((uint64_t) writer_queue->capacity());
+    stats->add_map(size);
+
+    uint64_t written = writer_written;
+
+    SharedTrackerElement wr(new TrackerElement(TrackerUInt64, writer_stats_written_id));
+    wr->set(written);
+    stats->add_map(wr);
+
+    SharedTrackerElement dropped(new TrackerElement(TrackerUInt64, writer_stats_dropped_id));
+    dropped->set((uint64_t) writer_dropped);
+    stats->add_map(dropped);
+
+    SharedTrackerElement txns(new TrackerElement(TrackerUInt64, 
+                writer_stats_transactions_id));
+    txns->set((uint64_t) writer_transactions);
+    stats->add_map(txns);
+
+    double avg_us = 0;
+    if (written != 0)
+        avg_us = (double) writer_lag_total_ns / written / 1000;
+
+    SharedTrackerElement lag_avg(new TrackerElement(TrackerDouble, writer_stats_lag_avg_id));
+    lag_avg->set(avg_us);
+    stats->add_map(lag_avg);
+
+    SharedTrackerElement lag_max(new TrackerElement(TrackerDouble, writer_stats_lag_max_id));
+    lag_max->set((double) writer_lag_max_ns / 1000);
+    stats->add_map(lag_max);
+
+    std::shared_ptr<EntryTracker> entrytracker =
+        Globalreg::FetchMandatoryGlobalAs<EntryTracker>(globalreg, "ENTRY_TRACKER");
+
+    entrytracker->Serialize(httpd->GetSuffix(url), stream, stats, NULL);
+
+    return MHD_YES;
 }
 
 int KisDatabaseLogfile::Httpd_PostComplete(Kis_Net_Httpd_Connection *concls) {
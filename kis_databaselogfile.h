@@ -69,6 +69,8 @@
 
 #include <memory>
 #include <string>
+#include <thread>
+#include <atomic>
 
 #include "globalregistry.h"
 #include "kis_mutex.h"
@@ -77,6 +79,7 @@
 #include "alertracker.h"
 #include "logtracker.h"
 #include "packetchain.h"
+#include "mpsc_ringbuf.h"
 
 // This is a bit of a unique case - because so many things plug into this, it has
 // to exist as a global record; we build it like we do any other global record;
@@ -188,10 +191,77 @@ protected:
 
     static int packet_handler(CHAINCALL_PARMS);
 
-    // Keep track of our commit cycles; to avoid thrashing the filesystem with
-    // commit state we run a 10 second tranasction commit loop
+    // Packets, data, and snapshots are written by a dedicated writer thread so
+    // that a slow disk doesn't back up the packet chain.  The logging calls pull
+    // what they need out of the packet into a compact record and push it into a
+    // bounded lock-free queue; formatting macs and uuids, binding, and stepping
+    // the statements is all done by the writer.  If the queue is full the record
+    // is dropped and counted.
+    struct db_write_record {
+        enum record_type {
+            rec_packet, rec_data, rec_snapshot
+        };
+
+        record_type type;
+
+        struct timeval ts;
+        int lat, lon;
+
+        // Packets and data
+        std::string phyname;
+        mac_addr sourcemac;
+        uuid datasource_uuid;
+
+        // Packets only
+        mac_addr destmac, transmac;
+        bool has_devkey;
+        TrackedDeviceKey devkey;
+        double frequency;
+        unsigned int length;
+        int signal;
+        int dlt;
+        int error;
+
+        // Snapshots only
+        std::string snaptype;
+
+        // Raw packet data, or json for data and snapshots
+        std::string payload;
+
+        uint64_t enqueue_ns;
+    };
+
+    bool queue_record(db_write_record *in_rec);
+
+    void write_packet_record(db_write_record *in_rec);
+    void write_data_record(db_write_record *in_rec);
+    void write_snapshot_record(db_write_record *in_rec);
+
+    static void db_writer_processor(KisDatabaseLogfile *logfile);
+
+    std::thread writer_thread;
+    mpsc_ringbuf<db_write_record *> *writer_queue;
+    conditional_locker<int> writer_condition;
+    std::atomic<bool> writer_waiting;
+    std::atomic<bool> writer_shutdown;
+
+    // Transactions are owned by the writer thread, which keeps one open at all
+    // times and commits it after transaction_rows records or transaction_ms,
+    // whichever comes first.  Device, alert, and other writes made directly 
+    // from other threads land in the open transaction.
     kis_recursive_timed_mutex transaction_mutex;
-    int transaction_timer;
+    unsigned int transaction_rows, transaction_ms;
+
+    // Writer statistics; lag is the time from a record being queued to it
+    // being written
+    std::atomic<uint64_t> writer_written, writer_dropped, writer_transactions;
+    std::atomic<uint64_t> writer_lag_total_ns, writer_lag_max_ns;
+    std::atomic<time_t> last_writer_drop_warning;
+
+    int writer_stats_id, writer_stats_depth_id, writer_stats_size_id,
+        writer_stats_written_id, writer_stats_dropped_id, 
+        writer_stats_transactions_id, writer_stats_lag_avg_id, 
+        writer_stats_lag_max_id;
 };
 
 class KisDatabaseLogfileBuilder : public KisLogfileBuilder {
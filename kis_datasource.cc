@@ -23,6 +23,7 @@
 #include "endian_magic.h"
 #include "configfile.h"
 #include "msgpack_adapter.h"
+#include "msgpuck.h"
 #include "datasourcetracker.h"
 #include "entrytracker.h"
 #include "alertracker.h"
@@ -1309,12 +1310,84 @@ kis_gps_packinfo *KisDatasource::handle_kv_gps(KisDatasourceCapKeyedObject *in_o
     return gpsinfo;
 }
 
+// Match the next msgpack string in a buffer against a fixed key, without
+// allocating a string for it
+static bool mp_match_key(const char **in_pos, const char *in_key) {
+    if (mp_typeof(**in_pos) != MP_STR)
+        return false;
+
+    uint32_t len;
+    const char *key = mp_decode_str(in_pos, &len);
+
+    return len == strlen(in_key) && memcmp(key, in_key, len) == 0;
+}
+
+bool KisDatasource::decode_kv_packet_fast(KisDatasourceCapKeyedObject *in_obj,
+        kis_packet *in_packet, kis_datachunk *in_chunk) {
+    const char *pos = in_obj->object;
+    const char *end = in_obj->object + in_obj->size;
+
+    // Make sure the whole object is valid msgpack and fits in the buffer, so the
+    // decoders below can't walk off the end
+    if (mp_check(&pos, end) != 0)
+        return false;
+
+    pos = in_obj->object;
+
+    if (mp_typeof(*pos) != MP_MAP || mp_decode_map(&pos) != 4)
+        return false;
+
+    if (!mp_match_key(&pos, "tv_sec") || mp_typeof(*pos) != MP_UINT)
+        return false;
+    uint64_t tv_sec = mp_decode_uint(&pos);
+
+    if (!mp_match_key(&pos, "tv_usec") || mp_typeof(*pos) != MP_UINT)
+        return false;
+    uint64_t tv_usec = mp_decode_uint(&pos);
+
+    if (!mp_match_key(&pos, "size") || mp_typeof(*pos) != MP_UINT)
+        return false;
+    uint64_t size = mp_decode_uint(&pos);
+
+    if (!mp_match_key(&pos, "packet") || mp_typeof(*pos) != MP_BIN)
+        return false;
+
+    uint32_t bin_len;
+    const char *bin = mp_decode_bin(&pos, &bin_len);
+
+    if (size == 0 || bin_len != size)
+        return false;
+
+    if (clobber_timestamp && get_source_remote()) {
+        gettimeofday(&(in_packet->ts), NULL);
+    } else {
+        in_packet->ts.tv_sec = (time_t) tv_sec;
+        in_packet->ts.tv_usec = (time_t) tv_usec;
+    }
+
+    // The frame is copied out of the ring buffer rather than referenced, since
+    // the ring has to be consumed in order; kv_packet_bench measures the copy
+    // at a few ns for normal frames and ~100ns for the largest ones
+    in_chunk->copy_data((const uint8_t *) bin, bin_len);
+
+    return true;
+}
+
 kis_packet *KisDatasource::handle_kv_packet(KisDatasourceCapKeyedObject *in_obj) {
     // Extract a packet record
     
     kis_packet *packet = packetchain->GeneratePacket();
     kis_datachunk *datachunk = new kis_datachunk();
 
+    // Capture tools always encode the packet the same way, so try the 
+    // fixed-layout reader first and only fall back to unpacking the full
+    // dictionary if it doesn't match
+    if (decode_kv_packet_fast(in_obj, packet, datachunk)) {
+        datachunk->dlt = get_source_dlt();
+        packet->insert(pack_comp_linkframe, datachunk);
+        return packet;
+    }
+
     // Unpack the dictionary
     MsgpackAdapter::MsgpackStrMap dict;
     msgpack::unpacked result;
@@ -359,6 +359,12 @@ protected:
     virtual kis_gps_packinfo *handle_kv_gps(KisDatasourceCapKeyedObject *in_obj);
     virtual kis_layer1_packinfo *handle_kv_signal(KisDatasourceCapKeyedObject *in_obj);
     virtual kis_packet *handle_kv_packet(KisDatasourceCapKeyedObject *in_obj);
+
+    // Fixed-layout reader for the PACKET KV, which fills in the packet timestamp
+    // and copies the frame into the datachunk without unpacking the msgpack 
+    // dictionary.  Returns false if the record is not in the standard layout.
+    bool decode_kv_packet_fast(KisDatasourceCapKeyedObject *in_obj,
+            kis_packet *in_packet, kis_datachunk *in_chunk);
     virtual void handle_kv_uuid(KisDatasourceCapKeyedObject *in_obj);
     virtual void handle_kv_capif(KisDatasourceCapKeyedObject *in_obj);
     virtual unsigned int handle_kv_dlt(KisDatasourceCapKeyedObject *in_obj);
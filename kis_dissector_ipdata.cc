@@ -38,9 +38,12 @@ Kis_Dissector_IPdata::Kis_Dissector_IPdata(GlobalRegistry *in_globalreg) {
 
 	globalreg->InsertGlobal("DISSECTOR_IPDATA", shared_ptr<Kis_Dissector_IPdata>(this));
 
-	globalreg->packetchain->RegisterHandler(&ipdata_packethook, this,
+	int hook_id = globalreg->packetchain->RegisterHandler(&ipdata_packethook, this,
 		 									CHAINPOS_DATADISSECT, -100);
 
+	// Only the packet and the (locked) alert tracker are touched
+	globalreg->packetchain->SetHandlerParallelSafe(hook_id, CHAINPOS_DATADISSECT);
+
 	pack_comp_basicdata = 
 		globalreg->packetchain->RegisterPacketComponent("BASICDATA");
 
@@ -26,6 +26,7 @@
 #include "messagebus.h"
 #include "packet.h"
 #include "packetchain.h"
+#include "crc32.h"
 
 #include "kis_datasource.h"
 
@@ -42,6 +43,9 @@ Kis_DLT_PPI::Kis_DLT_PPI(GlobalRegistry *in_globalreg) :
 
 	globalreg->InsertGlobal("DLT_PPI", shared_ptr<Kis_DLT_PPI>(this));
 
+    // PPI decoding only touches the packet it's given
+    globalreg->packetchain->SetHandlerParallelSafe(chainid, CHAINPOS_POSTCAP);
+
 	_MSG("Registering support for DLT_PPI packet header decoding", MSGFLAG_INFO);
 }
 
@@ -295,27 +299,22 @@ int Kis_DLT_PPI::HandlePacket(kis_packet *in_pack) {
 		in_pack->insert(pack_comp_checksum, fcschunk);
 	}
 
-    // We've put the FCS in the fcschunk, so we just call the datasource FCS function
+    // Validate the FCS ourselves, as long as the frame wasn't truncated to fit
+    // in a packet
     if (datasrc != NULL && datasrc->ref_source != NULL && fcschunk != NULL &&
-            fcschunk->checksum_valid) {
-        datasrc->ref_source->checksum_packet(in_pack);
-    }
-
-#if 0
-	if (capsrc != NULL && capsrc->ref_source->FetchValidateCRC() && fcschunk != NULL) {
-		// Compare it and flag the packet
+            fcschunk->checksum_valid && 
+            decapchunk->length == linkchunk->length - ph_len - applyfcs) {
 		uint32_t calc_crc =
-			crc32_le_80211(globalreg->crc32_table, decapchunk->data, 
-						   decapchunk->length);
+			crc32_80211(decapchunk->data, decapchunk->length);
+        uint32_t flipped_crc = kis_swap32(calc_crc);
 
-		if (memcmp(fcschunk->checksum_ptr, &calc_crc, 4)) {
-			in_pack->error = 1;
+        // compare both representations
+		if (memcmp(fcschunk->checksum_ptr, &calc_crc, 4) &&
+            memcmp(fcschunk->checksum_ptr, &flipped_crc, 4)) {
 			fcschunk->checksum_valid = 0;
-		} else {
-			fcschunk->checksum_valid = 1;
+			in_pack->error = 1;
 		}
 	}
-#endif
 
 
 	return 1;
@@ -26,6 +26,7 @@
 #include "messagebus.h"
 #include "packet.h"
 #include "packetchain.h"
+#include "crc32.h"
 
 #if defined(SYS_OPENBSD) || defined(SYS_NETBSD)
 #include <net80211/ieee80211.h>
@@ -73,9 +74,12 @@ Kis_DLT_Radiotap::Kis_DLT_Radiotap(GlobalRegistry *in_globalreg) :
 
 	globalreg->InsertGlobal("DLT_RADIOTAP", shared_ptr<Kis_DLT_Radiotap>(this));
 
-	_MSG("Registering support for DLT_RADIOTAP packet header decoding", MSGFLAG_INFO);
+    // Radiotap decoding only touches the packet it's given
+    globalreg->packetchain->SetHandlerParallelSafe(chainid, CHAINPOS_POSTCAP);
 
-    crc32_init_table_80211(crc32_table);
+	_MSG("Registering support for DLT_RADIOTAP packet header decoding", MSGFLAG_INFO);
+    _MSG("Validating 802.11 FCS with the " + std::string(crc32_80211_engine()) + 
+            " CRC32 engine", MSGFLAG_INFO);
 }
 
 Kis_DLT_Radiotap::~Kis_DLT_Radiotap() {
@@ -125,10 +129,6 @@ Kis_DLT_Radiotap::~Kis_DLT_Radiotap() {
 #define BITNO_2(x) (((x) & 2) ? 1 : 0)
 #define BIT(n)	(1 << n)
 int Kis_DLT_Radiotap::HandlePacket(kis_packet *in_pack) {
-    static int packnum = 0;
-
-    packnum++;
-
 	kis_datachunk *decapchunk = 
 		(kis_datachunk *) in_pack->fetch(pack_comp_decap);
 
@@ -428,18 +428,17 @@ int Kis_DLT_Radiotap::HandlePacket(kis_packet *in_pack) {
 	if (datasrc != NULL && datasrc->ref_source != NULL && fcschunk != NULL &&
             fcschunk->checksum_valid) {
 
-        // fprintf(stderr, "debug - radiotap - %d %x\n", packnum, *(fcschunk->checksum_ptr) & 0xFFFFFFFF); 
+        // fprintf(stderr, "debug - radiotap - %x\n", *(fcschunk->checksum_ptr) & 0xFFFFFFFF); 
 
 		// Compare it and flag the packet
 		uint32_t calc_crc =
-			crc32_le_80211(globalreg->crc32_table, decapchunk->data, 
-						   decapchunk->length);
+			crc32_80211(decapchunk->data, decapchunk->length);
         uint32_t flipped_crc = kis_swap32(calc_crc);
 
         // compare both representations
 		if (memcmp(fcschunk->checksum_ptr, &calc_crc, 4) &&
             memcmp(fcschunk->checksum_ptr, &flipped_crc, 4)) {
-            // fprintf(stderr, "debug - radiotap - %d invalid crc from %s\n", packnum, datasrc->ref_source->get_source_name().c_str());
+            // fprintf(stderr, "debug - radiotap - invalid crc from %s\n", datasrc->ref_source->get_source_name().c_str());
 			fcschunk->checksum_valid = 0;
 		} else {
             // fprintf(stderr, "debug - radiotap - crc valid\n");
@@ -450,7 +449,7 @@ int Kis_DLT_Radiotap::HandlePacket(kis_packet *in_pack) {
     // If we've validated the FCS and know this packet is junk, flag it at the
     // packet level
     if (fcschunk != NULL && fcschunk->checksum_valid == 0) {
-        // fprintf(stderr, "debug - setting packet in error %d\n", packnum);
+        // fprintf(stderr, "debug - setting packet in error\n");
         in_pack->error = 1;
     }
 
@@ -463,47 +462,3 @@ int Kis_DLT_Radiotap::HandlePacket(kis_packet *in_pack) {
 #undef BITNO_2
 #undef BIT
 
-// Taken from the BBN USRP 802.11 encoding code
-unsigned int Kis_DLT_Radiotap::update_crc32_80211(unsigned int crc, const unsigned char *data,
-        int len, unsigned int poly) {
-	int i, j;
-	unsigned short ch;
-
-	for ( i = 0; i < len; ++i) {
-		ch = data[i];
-		for (j = 0; j < 8; ++j) {
-			if ((crc ^ ch) & 0x0001) {
-				crc = (crc >> 1) ^ poly;
-			} else {
-				crc = (crc >> 1);
-			}
-			ch >>= 1;
-		}
-	}
-	return crc;
-}
-
-void Kis_DLT_Radiotap::crc32_init_table_80211(unsigned int *crc32_table) {
-	int i;
-	unsigned char c;
-
-	for (i = 0; i < 256; ++i) {
-		c = (unsigned char) i;
-		crc32_table[i] = update_crc32_80211(0, &c, 1, IEEE_802_3_CRC32_POLY);
-	}
-}
-
-unsigned int Kis_DLT_Radiotap::crc32_le_80211(unsigned int *crc32_table, 
-        const unsigned char *buf, int len) {
-	int i;
-	unsigned int crc = 0xFFFFFFFF;
-
-	for (i = 0; i < len; ++i) {
-		crc = (crc >> 8) ^ crc32_table[(crc ^ buf[i]) & 0xFF];
-	}
-
-	crc ^= 0xFFFFFFFF;
-
-	return crc;
-}
-
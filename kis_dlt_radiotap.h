@@ -40,14 +40,6 @@ public:
 	virtual int HandlePacket(kis_packet *in_pack);
 
 	~Kis_DLT_Radiotap();
-
-protected:
-    unsigned int update_crc32_80211(unsigned int crc, const unsigned char *data,
-            int len, unsigned int poly);
-    void crc32_init_table_80211(unsigned int *crc32_table);
-    unsigned int crc32_le_80211(unsigned int *crc32_table, const unsigned char *buf, int len);
-
-    unsigned int crc32_table[256];
 };
 
 #endif
@@ -0,0 +1,142 @@
+/*
+    This file is part of Kismet
+
+    Kismet is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Kismet is distributed in the hope that it will be useful,
+      but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Kismet; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "config.h"
+
+#include "kis_httpd_route.h"
+#include "util.h"
+
+Kis_Net_Httpd_Route_Trie::Kis_Net_Httpd_Route_Trie() {
+    num_routes = 0;
+}
+
+bool Kis_Net_Httpd_Route_Trie::add_route(const std::string& in_pattern,
+        Kis_Net_Httpd_Handler *in_handler) {
+    std::vector<std::string> tokens = StrTokenize(in_pattern, "/");
+
+    // Patterns are absolute
+    if (tokens.size() == 0 || tokens[0] != "")
+        return false;
+
+    node *n = &root;
+    route r;
+
+    r.handler = in_handler;
+
+    for (size_t x = 1; x < tokens.size(); x++) {
+        const std::string& seg = tokens[x];
+
+        if (seg.length() > 1 && seg[0] == '*') {
+            // Wildcards swallow the rest of the url, so must be last
+            if (x != tokens.size() - 1)
+                return false;
+
+            r.param_names.push_back(seg.substr(1));
+            n->wildcard_routes.push_back(r);
+            num_routes++;
+
+            return true;
+        }
+
+        if (seg.length() > 1 && seg[0] == ':') {
+            r.param_names.push_back(seg.substr(1));
+
+            if (n->param == NULL)
+                n->param.reset(new node());
+
+            n = n->param.get();
+
+            continue;
+        }
+
+        auto li = n->literal.find(seg);
+
+        if (li == n->literal.end()) {
+            node *c = new node();
+            n->literal.emplace(seg, std::unique_ptr<node>(c));
+            n = c;
+        } else {
+            n = li->second.get();
+        }
+    }
+
+    n->routes.push_back(r);
+    num_routes++;
+
+    return true;
+}
+
+void Kis_Net_Httpd_Route_Trie::match(const std::vector<std::string>& in_tokenurl,
+        std::vector<Kis_Net_Httpd_Route_Trie::candidate>& out_candidates) const {
+    if (in_tokenurl.size() == 0 || in_tokenurl[0] != "")
+        return;
+
+    std::vector<std::string> captured;
+
+    match_node(&root, in_tokenurl, 1, captured, out_candidates);
+}
+
+void Kis_Net_Httpd_Route_Trie::match_node(const node *in_node,
+        const std::vector<std::string>& in_tokenurl, size_t in_pos,
+        std::vector<std::string>& captured,
+        std::vector<Kis_Net_Httpd_Route_Trie::candidate>& out_candidates) const {
+
+    if (in_pos == in_tokenurl.size()) {
+        for (const auto& r : in_node->routes)
+            add_candidate(r, captured, out_candidates);
+
+        return;
+    }
+
+    auto li = in_node->literal.find(in_tokenurl[in_pos]);
+
+    if (li != in_node->literal.end())
+        match_node(li->second.get(), in_tokenurl, in_pos + 1, captured, out_candidates);
+
+    if (in_node->param != NULL) {
+        captured.push_back(in_tokenurl[in_pos]);
+        match_node(in_node->param.get(), in_tokenurl, in_pos + 1, captured,
+                out_candidates);
+        captured.pop_back();
+    }
+
+    if (in_node->wildcard_routes.size() != 0) {
+        std::vector<std::string> rest(in_tokenurl.begin() + in_pos, in_tokenurl.end());
+
+        captured.push_back(StrJoin(rest, "/"));
+
+        for (const auto& r : in_node->wildcard_routes)
+            add_candidate(r, captured, out_candidates);
+
+        captured.pop_back();
+    }
+}
+
+void Kis_Net_Httpd_Route_Trie::add_candidate(const route& in_route,
+        const std::vector<std::string>& in_captured,
+        std::vector<Kis_Net_Httpd_Route_Trie::candidate>& out_candidates) const {
+    candidate c;
+
+    c.handler = in_route.handler;
+
+    for (size_t x = 0; x < in_route.param_names.size() && x < in_captured.size(); x++)
+        c.params[in_route.param_names[x]] = in_captured[x];
+
+    out_candidates.push_back(c);
+}
+
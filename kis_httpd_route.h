@@ -0,0 +1,128 @@
+/*
+    This file is part of Kismet
+
+    Kismet is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Kismet is distributed in the hope that it will be useful,
+      but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Kismet; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#ifndef __KIS_HTTPD_ROUTE_H__
+#define __KIS_HTTPD_ROUTE_H__
+
+#include "config.h"
+
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+/* Route trie for dispatching HTTP requests
+ *
+ * Handlers register the path patterns they serve, split on '/'.  Each
+ * segment of a pattern is one of:
+ *
+ *   devices      literal segment
+ *   :key         any single segment, captured as 'key'
+ *   *path        one or more trailing segments, captured as 'path'; only
+ *                valid as the last segment
+ *
+ * so '/devices/by-key/:key/:file' matches '/devices/by-key/1234_5678/device.json'
+ * with key='1234_5678' and file='device.json'.
+ *
+ * A url is split once and walked down the trie, which only finds the
+ * handlers which could possibly serve it; those handlers still get the final
+ * say through Httpd_VerifyRoute, since most of them check that the device,
+ * phy, etc in the url actually exists.
+ */
+
+class Kis_Net_Httpd_Handler;
+
+// A url split into segments, and the parameters captured by the route which
+// matched it
+class Kis_Net_Httpd_Route_Match {
+public:
+    // The url split on '/' exactly as StrTokenize(url, "/") splits it, so
+    // tokenurl[0] is the empty string before the leading slash
+    std::vector<std::string> tokenurl;
+
+    // Parameters captured by the matched route
+    std::map<std::string, std::string> params;
+
+    // Fetch a captured parameter, or an empty string
+    std::string get_param(const std::string& in_name) const {
+        auto pi = params.find(in_name);
+
+        if (pi == params.end())
+            return "";
+
+        return pi->second;
+    }
+};
+
+class Kis_Net_Httpd_Route_Trie {
+public:
+    class candidate {
+    public:
+        Kis_Net_Httpd_Handler *handler;
+        std::map<std::string, std::string> params;
+    };
+
+    Kis_Net_Httpd_Route_Trie();
+
+    // Add a route; returns false if the pattern is malformed
+    bool add_route(const std::string& in_pattern, Kis_Net_Httpd_Handler *in_handler);
+
+    // Find every route which matches a split url, most specific first:
+    // literal segments are preferred over parameters, and parameters over
+    // trailing wildcards.  Routes which are equally specific are returned in
+    // the order they were added.
+    void match(const std::vector<std::string>& in_tokenurl,
+            std::vector<candidate>& out_candidates) const;
+
+    size_t size() const {
+        return num_routes;
+    }
+
+protected:
+    class route {
+    public:
+        Kis_Net_Httpd_Handler *handler;
+
+        // Names of the captured parameters, in the order they're captured
+        std::vector<std::string> param_names;
+    };
+
+    class node {
+    public:
+        std::map<std::string, std::unique_ptr<node> > literal;
+        std::unique_ptr<node> param;
+
+        // Routes which end at this node, and routes which end in a
+        // wildcard matching the rest of the url from this node
+        std::vector<route> routes;
+        std::vector<route> wildcard_routes;
+    };
+
+    void match_node(const node *in_node, const std::vector<std::string>& in_tokenurl,
+            size_t in_pos, std::vector<std::string>& captured,
+            std::vector<candidate>& out_candidates) const;
+
+    void add_candidate(const route& in_route, const std::vector<std::string>& in_captured,
+            std::vector<candidate>& out_candidates) const;
+
+    node root;
+    size_t num_routes;
+};
+
+#endif
+
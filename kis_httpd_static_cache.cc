@@ -0,0 +1,512 @@
+/*
+    This file is part of Kismet
+
+    Kismet is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Kismet is distributed in the hope that it will be useful,
+      but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Kismet; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <zlib.h>
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#define HAVE_STATIC_CACHE_INOTIFY 1
+#endif
+
+#include "kis_httpd_static_cache.h"
+#include "messagebus.h"
+#include "util.h"
+#include "crc32.h"
+
+#ifdef HAVE_STATIC_CACHE_INOTIFY
+#define STATIC_CACHE_WATCH_MASK (IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | \
+        IN_CREATE | IN_DELETE | IN_ONLYDIR)
+#endif
+
+// Files are compressed as small as possible when a directory is loaded; files
+// changed while we run are reloaded from the main loop, so are compressed
+// quickly instead
+#define STATIC_CACHE_GZIP_LOAD      Z_BEST_COMPRESSION
+#define STATIC_CACHE_GZIP_UPDATE    Z_BEST_SPEED
+
+// Compress a body with gzip framing; returns false if compression failed
+static bool static_cache_gzip(const std::string& in_data, std::string& out_data,
+        int in_level) {
+    z_stream zs;
+
+    memset(&zs, 0, sizeof(z_stream));
+
+    if (deflateInit2(&zs, in_level, Z_DEFLATED, 15 + 16, 8,
+                Z_DEFAULT_STRATEGY) != Z_OK)
+        return false;
+
+    out_data.resize(deflateBound(&zs, in_data.length()) + 32);
+
+    zs.next_in = (Bytef *) in_data.data();
+    zs.avail_in = in_data.length();
+    zs.next_out = (Bytef *) &(out_data[0]);
+    zs.avail_out = out_data.length();
+
+    if (deflate(&zs, Z_FINISH) != Z_STREAM_END) {
+        deflateEnd(&zs);
+        out_data.clear();
+        return false;
+    }
+
+    out_data.resize(zs.total_out);
+
+    deflateEnd(&zs);
+
+    return true;
+}
+
+// Formats which are already compressed and not worth compressing again
+static bool static_cache_precompressed(std::string in_path) {
+    static const char *suffixes[] = {
+        "png", "jpg", "jpeg", "gif", "ico", "woff", "woff2", "gz", "zip",
+        "pcap", "pcapng", NULL
+    };
+
+    size_t dpos = in_path.rfind('.');
+
+    if (dpos == std::string::npos)
+        return false;
+
+    std::string suffix = StrLower(in_path.substr(dpos + 1));
+
+    for (unsigned int i = 0; suffixes[i] != NULL; i++) {
+        if (suffix == suffixes[i])
+            return true;
+    }
+
+    return false;
+}
+
+Kis_Httpd_Static_Cache::Kis_Httpd_Static_Cache(GlobalRegistry *in_globalreg,
+        size_t in_max_size) :
+    globalreg(in_globalreg),
+    enabled(false),
+    max_size(in_max_size),
+    cur_size(0),
+    inotify_fd(-1) {
+
+#ifdef HAVE_STATIC_CACHE_INOTIFY
+    if ((inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) < 0) {
+        _MSG("Could not watch the static web content for changes (" +
+                kis_strerror_r(errno) + "), static content will be served from "
+                "disk", MSGFLAG_ERROR);
+        return;
+    }
+
+    enabled = true;
+#endif
+}
+
+Kis_Httpd_Static_Cache::~Kis_Httpd_Static_Cache() {
+    clear();
+
+    if (inotify_fd >= 0)
+        close(inotify_fd);
+}
+
+void Kis_Httpd_Static_Cache::add_dir(std::string in_url_prefix, std::string in_path) {
+    if (!enabled)
+        return;
+
+    char *base_realpath = realpath(in_path.c_str(), NULL);
+
+    if (base_realpath == NULL)
+        return;
+
+    std::string base(base_realpath);
+    free(base_realpath);
+
+    if (in_url_prefix.length() == 0 || in_url_prefix[in_url_prefix.length() - 1] != '/')
+        in_url_prefix += "/";
+
+    unsigned int dir_index;
+
+    {
+        local_locker lock(&cache_mutex);
+        dir_index = static_dirs.size();
+        static_dirs.push_back(std::make_pair(in_url_prefix, base));
+    }
+
+    scan_dir(dir_index, in_url_prefix, base, STATIC_CACHE_GZIP_LOAD);
+
+    local_locker lock(&cache_mutex);
+
+    unsigned int num_cached = 0;
+
+    for (auto u : url_map) {
+        if (!u.second->on_disk)
+            num_cached++;
+    }
+
+    _MSG("Cached " + UIntToString(num_cached) + " static web files (" +
+            UIntToString(cur_size / 1024) + "KB)", MSGFLAG_INFO);
+}
+
+void Kis_Httpd_Static_Cache::clear() {
+    local_locker lock(&cache_mutex);
+
+#ifdef HAVE_STATIC_CACHE_INOTIFY
+    for (auto w : watch_map)
+        inotify_rm_watch(inotify_fd, w.first);
+#endif
+
+    watch_map.clear();
+    url_map.clear();
+    static_dirs.clear();
+    cur_size = 0;
+}
+
+void Kis_Httpd_Static_Cache::rescan() {
+    std::vector<std::pair<std::string, std::string> > dirs;
+
+    {
+        local_locker lock(&cache_mutex);
+
+#ifdef HAVE_STATIC_CACHE_INOTIFY
+        for (auto w : watch_map)
+            inotify_rm_watch(inotify_fd, w.first);
+#endif
+
+        watch_map.clear();
+        url_map.clear();
+        cur_size = 0;
+
+        dirs = static_dirs;
+    }
+
+    for (unsigned int i = 0; i < dirs.size(); i++)
+        scan_dir(i, dirs[i].first, dirs[i].second, STATIC_CACHE_GZIP_UPDATE);
+}
+
+std::shared_ptr<Kis_Httpd_Static_Cache::cache_entry>
+    Kis_Httpd_Static_Cache::find(std::string in_url) {
+
+    local_locker lock(&cache_mutex);
+
+    auto ui = url_map.find(in_url);
+
+    if (ui == url_map.end() || ui->second->on_disk)
+        return NULL;
+
+    return ui->second;
+}
+
+void Kis_Httpd_Static_Cache::scan_dir(unsigned int in_dir_index, std::string in_url_path,
+        std::string in_fs_path, int in_gzip_level) {
+#ifdef HAVE_STATIC_CACHE_INOTIFY
+    // Watch the directory before we list it, so that nothing added while we
+    // scan is missed
+    int wd = inotify_add_watch(inotify_fd, in_fs_path.c_str(), STATIC_CACHE_WATCH_MASK);
+
+    if (wd >= 0) {
+        local_locker lock(&cache_mutex);
+
+        watched_dir w;
+        w.dir_index = in_dir_index;
+        w.url_path = in_url_path;
+        w.fs_path = in_fs_path;
+
+        watch_map[wd] = w;
+    }
+#endif
+
+    DIR *dir = opendir(in_fs_path.c_str());
+
+    if (dir == NULL)
+        return;
+
+    struct dirent *de;
+    struct stat sbuf;
+
+    while ((de = readdir(dir)) != NULL) {
+        if (strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0)
+            continue;
+
+        std::string fs_path = in_fs_path + "/" + de->d_name;
+
+        // Don't follow symlinked directories, so a link can't send us in a
+        // loop; symlinked files are checked when they're loaded
+        if (lstat(fs_path.c_str(), &sbuf) < 0)
+            continue;
+
+        if (S_ISDIR(sbuf.st_mode)) {
+            scan_dir(in_dir_index, in_url_path + de->d_name + "/", fs_path,
+                    in_gzip_level);
+            continue;
+        }
+
+        load_file(in_dir_index, in_url_path + de->d_name, fs_path, in_gzip_level);
+    }
+
+    closedir(dir);
+}
+
+void Kis_Httpd_Static_Cache::load_file(unsigned int in_dir_index, std::string in_url,
+        std::string in_fs_path, int in_gzip_level) {
+    std::string base;
+
+    {
+        local_locker lock(&cache_mutex);
+
+        if (in_dir_index >= static_dirs.size())
+            return;
+
+        base = static_dirs[in_dir_index].second;
+    }
+
+    // Make sure symlinks resolve inside the served path
+    char *file_realpath = realpath(in_fs_path.c_str(), NULL);
+
+    if (file_realpath == NULL)
+        return;
+
+    std::string base_dir = base + "/";
+    bool inside = (strncmp(file_realpath, base_dir.c_str(), base_dir.length()) == 0);
+
+    free(file_realpath);
+
+    if (!inside)
+        return;
+
+    int fd = open(in_fs_path.c_str(), O_RDONLY | O_CLOEXEC);
+
+    if (fd < 0)
+        return;
+
+    struct stat sbuf;
+
+    if (fstat(fd, &sbuf) < 0 || !S_ISREG(sbuf.st_mode)) {
+        close(fd);
+        return;
+    }
+
+    // Skip files we already have
+    {
+        local_locker lock(&cache_mutex);
+
+        auto ui = url_map.find(in_url);
+
+        if (ui != url_map.end() && ui->second->dir_index == in_dir_index &&
+                ui->second->mtime == sbuf.st_mtime && ui->second->size == sbuf.st_size) {
+            close(fd);
+            return;
+        }
+    }
+
+    std::shared_ptr<cache_entry> entry(new cache_entry());
+
+    entry->dir_index = in_dir_index;
+    entry->fs_path = in_fs_path;
+    entry->mtime = sbuf.st_mtime;
+    entry->size = sbuf.st_size;
+
+    // Files too large to ever fit aren't read at all
+    entry->on_disk = (size_t) sbuf.st_size > max_size;
+
+    if (entry->on_disk) {
+        close(fd);
+    } else {
+        entry->raw.resize(sbuf.st_size);
+
+        size_t pos = 0;
+
+        while (pos < entry->raw.length()) {
+            ssize_t r = read(fd, &(entry->raw[pos]), entry->raw.length() - pos);
+
+            if (r < 0 && errno == EINTR)
+                continue;
+
+            if (r <= 0)
+                break;
+
+            pos += r;
+        }
+
+        close(fd);
+
+        // Changed under us; we'll get another event when the writer is done
+        if (pos != entry->raw.length())
+            return;
+
+        if (!static_cache_precompressed(in_fs_path)) {
+            if (!static_cache_gzip(entry->raw, entry->gzip, in_gzip_level) ||
+                    entry->gzip.length() >= entry->raw.length())
+                entry->gzip.clear();
+        }
+
+        char etag[64];
+        snprintf(etag, 64, "\"%lx-%lx-%08x\"", (unsigned long) entry->size,
+                (unsigned long) entry->mtime,
+                crc32_80211((const uint8_t *) entry->raw.data(), entry->raw.length()));
+        entry->etag = etag;
+
+        char lastmod[64];
+        struct tm tmstruct;
+        gmtime_r(&(entry->mtime), &tmstruct);
+        strftime(lastmod, 64, "%a, %d %b %Y %H:%M:%S GMT", &tmstruct);
+        entry->last_modified = lastmod;
+    }
+
+    size_t entry_size = entry->raw.length() + entry->gzip.length();
+
+    local_locker lock(&cache_mutex);
+
+    auto ui = url_map.find(in_url);
+
+    if (ui != url_map.end()) {
+        // An earlier static dir provides this url
+        if (ui->second->dir_index < in_dir_index)
+            return;
+
+        cur_size -= ui->second->raw.length() + ui->second->gzip.length();
+        url_map.erase(ui);
+    }
+
+    // Doesn't fit; keep the entry so the url is still served from this dir's
+    // file on disk, and not from a later dir's cached copy
+    if (cur_size + entry_size > max_size) {
+        std::string().swap(entry->raw);
+        std::string().swap(entry->gzip);
+        entry->on_disk = true;
+        entry_size = 0;
+    }
+
+    cur_size += entry_size;
+    url_map[in_url] = entry;
+}
+
+void Kis_Httpd_Static_Cache::remove_url(unsigned int in_dir_index, std::string in_url) {
+    local_locker lock(&cache_mutex);
+
+    auto ui = url_map.find(in_url);
+
+    if (ui == url_map.end() || ui->second->dir_index != in_dir_index)
+        return;
+
+    cur_size -= ui->second->raw.length() + ui->second->gzip.length();
+    url_map.erase(ui);
+}
+
+void Kis_Httpd_Static_Cache::remove_url_prefix(unsigned int in_dir_index,
+        std::string in_url_prefix) {
+    local_locker lock(&cache_mutex);
+
+    auto ui = url_map.lower_bound(in_url_prefix);
+
+    while (ui != url_map.end() && ui->first.compare(0, in_url_prefix.length(),
+                in_url_prefix) == 0) {
+        if (ui->second->dir_index != in_dir_index) {
+            ++ui;
+            continue;
+        }
+
+        cur_size -= ui->second->raw.length() + ui->second->gzip.length();
+        ui = url_map.erase(ui);
+    }
+}
+
+bool Kis_Httpd_Static_Cache::MergePollFds(std::vector<struct pollfd>& out_fds) {
+    if (inotify_fd < 0)
+        return true;
+
+    struct pollfd pfd;
+    pfd.fd = inotify_fd;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+
+    out_fds.push_back(pfd);
+
+    return true;
+}
+
+void Kis_Httpd_Static_Cache::PollFd(int in_fd, bool in_read,
+        bool in_write __attribute__((unused))) {
+#ifdef HAVE_STATIC_CACHE_INOTIFY
+    if (inotify_fd < 0 || in_fd != inotify_fd || !in_read)
+        return;
+
+    char buf[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+    ssize_t len;
+    bool overflow = false;
+
+    while ((len = read(inotify_fd, buf, sizeof(buf))) > 0) {
+        for (char *ptr = buf; ptr < buf + len;
+                ptr += sizeof(struct inotify_event) + ((struct inotify_event *) ptr)->len) {
+            struct inotify_event *ev = (struct inotify_event *) ptr;
+
+            if (ev->mask & IN_Q_OVERFLOW) {
+                overflow = true;
+                continue;
+            }
+
+            watched_dir w;
+
+            {
+                local_locker lock(&cache_mutex);
+
+                auto wi = watch_map.find(ev->wd);
+
+                if (wi == watch_map.end())
+                    continue;
+
+                // The directory itself is gone
+                if (ev->mask & IN_IGNORED) {
+                    watch_map.erase(wi);
+                    continue;
+                }
+
+                w = wi->second;
+            }
+
+            if (ev->len == 0)
+                continue;
+
+            std::string url = w.url_path + ev->name;
+            std::string fs_path = w.fs_path + "/" + ev->name;
+
+            if (ev->mask & IN_ISDIR) {
+                if (ev->mask & (IN_CREATE | IN_MOVED_TO))
+                    scan_dir(w.dir_index, url + "/", fs_path, STATIC_CACHE_GZIP_UPDATE);
+                else if (ev->mask & (IN_DELETE | IN_MOVED_FROM))
+                    remove_url_prefix(w.dir_index, url + "/");
+            } else {
+                if (ev->mask & (IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE))
+                    load_file(w.dir_index, url, fs_path, STATIC_CACHE_GZIP_UPDATE);
+                else if (ev->mask & (IN_DELETE | IN_MOVED_FROM))
+                    remove_url(w.dir_index, url);
+            }
+        }
+    }
+
+    // We lost events; start over
+    if (overflow)
+        rescan();
+#endif
+}
+
@@ -0,0 +1,129 @@
+/*
+    This file is part of Kismet
+
+    Kismet is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Kismet is distributed in the hope that it will be useful,
+      but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Kismet; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#ifndef __KIS_HTTPD_STATIC_CACHE_H__
+#define __KIS_HTTPD_STATIC_CACHE_H__
+
+#include "config.h"
+
+#include <time.h>
+
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "globalregistry.h"
+#include "kis_mutex.h"
+#include "pollable.h"
+
+/* In-memory cache of the static web UI files
+ *
+ * Every file under the registered static directories is loaded when the
+ * directory is registered, along with a gzip-compressed copy when that is
+ * smaller, so that UI requests never touch the disk.  Each file gets an ETag
+ * and Last-Modified time so browsers can revalidate with a conditional GET.
+ *
+ * The directories are watched with inotify, and files are reloaded or dropped
+ * as they change; the watch descriptor is serviced from the main select loop,
+ * so files reloaded there are compressed with a cheaper level than the initial
+ * load.  Files which don't fit in the cache are recorded as served from disk,
+ * so they still take precedence over the same url in a later directory.
+ */
+
+class Kis_Httpd_Static_Cache : public Pollable {
+public:
+    class cache_entry {
+    public:
+        // Index of the static dir this came from; earlier dirs win when two
+        // dirs provide the same url
+        unsigned int dir_index;
+
+        std::string fs_path;
+
+        std::string raw;
+        std::string gzip;
+
+        std::string etag;
+        std::string last_modified;
+
+        time_t mtime;
+        off_t size;
+
+        // Too large to cache; the url is served from disk
+        bool on_disk;
+    };
+
+    Kis_Httpd_Static_Cache(GlobalRegistry *in_globalreg, size_t in_max_size);
+    virtual ~Kis_Httpd_Static_Cache();
+
+    // Is the cache usable on this system
+    bool get_enabled() {
+        return enabled;
+    }
+
+    // Load a static directory into the cache and start watching it
+    void add_dir(std::string in_url_prefix, std::string in_path);
+
+    // Drop every directory and file
+    void clear();
+
+    // Find a cached file by url, or NULL if it isn't cached or has to be
+    // served from disk
+    std::shared_ptr<cache_entry> find(std::string in_url);
+
+    // Pollable
+    virtual bool MergePollFds(std::vector<struct pollfd>& out_fds);
+    virtual void PollFd(int in_fd, bool in_read, bool in_write);
+
+protected:
+    class watched_dir {
+    public:
+        unsigned int dir_index;
+        std::string url_path;
+        std::string fs_path;
+    };
+
+    void scan_dir(unsigned int in_dir_index, std::string in_url_path,
+            std::string in_fs_path, int in_gzip_level);
+    void load_file(unsigned int in_dir_index, std::string in_url, std::string in_fs_path,
+            int in_gzip_level);
+    void remove_url(unsigned int in_dir_index, std::string in_url);
+    void remove_url_prefix(unsigned int in_dir_index, std::string in_url_prefix);
+    void rescan();
+
+    GlobalRegistry *globalreg;
+
+    kis_recursive_timed_mutex cache_mutex;
+
+    bool enabled;
+
+    size_t max_size;
+    size_t cur_size;
+
+    // Registered static dirs, in order; the resolved real path of each
+    std::vector<std::pair<std::string, std::string> > static_dirs;
+
+    std::map<std::string, std::shared_ptr<cache_entry> > url_map;
+
+    int inotify_fd;
+    std::map<int, watched_dir> watch_map;
+};
+
+#endif
+
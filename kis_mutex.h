@@ -29,8 +29,12 @@
 
 #include "config.h"
 
+#include <stdint.h>
+
 #include <mutex>
 #include <chrono>
+#include <atomic>
+#include <stdexcept>
 
 // Seconds a lock is allowed to be held before throwing a timeout error
 #define KIS_THREAD_DEADLOCK_TIMEOUT     30
@@ -73,6 +77,10 @@ public:
         return true;
     }
 
+    bool try_lock() {
+        return pthread_mutex_trylock(&mutex) == 0;
+    }
+
     void lock() {
         pthread_mutex_lock(&mutex);
     }
@@ -136,6 +144,39 @@ protected:
     kis_recursive_timed_mutex *cpplock;
 };
 
+// Act as a scoped locker on a mutex, like local_locker, but count how often the
+// lock is taken and how often it was already held by another thread when we 
+// tried; used to instrument heavily shared locks
+class local_counting_locker {
+public:
+    local_counting_locker(kis_recursive_timed_mutex *in, 
+            std::atomic<uint64_t> *in_locks, std::atomic<uint64_t> *in_contended) {
+        cpplock = in;
+
+        (*in_locks)++;
+
+        if (cpplock->try_lock())
+            return;
+
+        (*in_contended)++;
+
+#ifdef DISABLE_MUTEX_TIMEOUT
+        cpplock->lock();
+#else
+        if (!cpplock->try_lock_for(std::chrono::seconds(KIS_THREAD_DEADLOCK_TIMEOUT))) {
+            throw(std::runtime_error("deadlocked thread: mutex not available w/in timeout"));
+        }
+#endif
+    }
+
+    ~local_counting_locker() {
+        cpplock->unlock();
+    }
+
+protected:
+    kis_recursive_timed_mutex *cpplock;
+};
+
 // Locks for the duration of scope, but only locks on demand
 class local_demand_locker {
 public:
@@ -44,12 +44,16 @@
 #include "base64.h"
 #include "entrytracker.h"
 #include "kis_httpd_websession.h"
+#include "kis_httpd_static_cache.h"
+#include "pollabletracker.h"
 
 Kis_Net_Httpd::Kis_Net_Httpd(GlobalRegistry *in_globalreg) {
     globalreg = in_globalreg;
 
     running = false;
 
+    generator_shutdown = false;
+
     use_ssl = false;
     cert_pem = NULL;
     cert_key = NULL;
@@ -61,6 +65,22 @@ Kis_Net_Httpd::Kis_Net_Httpd(GlobalRegistry *in_globalreg) {
 
     http_port = globalreg->kismet_config->FetchOptUInt("httpd_port", 2501);
 
+    // Cache the static files in RAM, if we can watch them for changes
+    size_t static_cache_sz = 
+        globalreg->kismet_config->FetchOptUInt("httpd_static_cache_size", 32);
+
+    if (static_cache_sz != 0) {
+        static_cache = 
+            std::make_shared<Kis_Httpd_Static_Cache>(globalreg, static_cache_sz * 1024 * 1024);
+
+        if (static_cache->get_enabled()) {
+            Globalreg::FetchMandatoryGlobalAs<PollableTracker>(globalreg, 
+                    "POLLABLETRACKER")->RegisterPollable(static_cache);
+        } else {
+            static_cache.reset();
+        }
+    }
+
     string http_data_dir, http_aux_data_dir;
 
     http_data_dir = globalreg->kismet_config->FetchOpt("httpd_home");
@@ -104,6 +124,36 @@ Kis_Net_Httpd::Kis_Net_Httpd(GlobalRegistry *in_globalreg) {
     session_timeout = 
         globalreg->kismet_config->FetchOptUInt("httpd_session_timeout", 7200);
 
+    http_threads = 
+        globalreg->kismet_config->FetchOptUInt("httpd_threads", 8);
+
+#ifdef HAVE_MHD_SUSPEND_RESUME
+    use_thread_pool = http_threads != 0;
+#else
+    if (http_threads != 0)
+        _MSG("This libmicrohttpd does not support suspending connections; "
+                "ignoring httpd_threads and running one thread per connection.",
+                MSGFLAG_INFO);
+
+    use_thread_pool = false;
+#endif
+
+    generator_threads =
+        globalreg->kismet_config->FetchOptUInt("httpd_generator_threads", 4);
+
+    if (generator_threads == 0) {
+        _MSG("httpd_generator_threads must be at least 1, using 1", MSGFLAG_ERROR);
+        generator_threads = 1;
+    }
+
+    compression_level = 
+        globalreg->kismet_config->FetchOptUInt("httpd_compression_level", 1);
+
+    if (compression_level > 9) {
+        _MSG("httpd_compression_level must be between 0 and 9, using 9", MSGFLAG_ERROR);
+        compression_level = 9;
+    }
+
     use_ssl = globalreg->kismet_config->FetchOptBoolean("httpd_ssl", false);
     pem_path = globalreg->kismet_config->FetchOpt("httpd_ssl_cert");
     key_path = globalreg->kismet_config->FetchOpt("httpd_ssl_key");
@@ -117,6 +167,7 @@ Kis_Net_Httpd::Kis_Net_Httpd(GlobalRegistry *in_globalreg) {
     RegisterMimeType("json", "application/json");
     RegisterMimeType("ekjson", "application/json");
     RegisterMimeType("pcap", "application/vnd.tcpdump.pcap");
+    RegisterMimeType("kcol", "application/octet-stream");
 
     vector<string> mimeopts = globalreg->kismet_config->FetchOptVec("httpd_mime");
     for (unsigned int i = 0; i < mimeopts.size(); i++) {
@@ -197,6 +248,8 @@ Kis_Net_Httpd::~Kis_Net_Httpd() {
 
     // Wipe out all handlers
     handler_vec.erase(handler_vec.begin(), handler_vec.end());
+    route_vec.clear();
+    std::atomic_store(&routes, shared_ptr<route_table>());
 
     if (running)
         StopHttpd();
@@ -206,6 +259,13 @@ Kis_Net_Httpd::~Kis_Net_Httpd() {
     }
 
     session_map.clear();
+
+    if (static_cache != NULL) {
+        shared_ptr<PollableTracker> pollabletracker =
+            Globalreg::FetchGlobalAs<PollableTracker>(globalreg, "POLLABLETRACKER");
+        if (pollabletracker != NULL)
+            pollabletracker->RemovePollable(static_cache);
+    }
 }
 
 void Kis_Net_Httpd::RegisterSessionHandler(shared_ptr<Kis_Httpd_Websession> in_session) {
@@ -278,12 +338,17 @@ void Kis_Net_Httpd::RegisterStaticDir(string in_prefix, string in_path) {
     local_locker lock(&controller_mutex);
 
     static_dir_vec.push_back(static_dir(in_prefix, in_path));
+
+    if (static_cache != NULL)
+        static_cache->add_dir(in_prefix, in_path);
 }
 
 void Kis_Net_Httpd::RegisterHandler(Kis_Net_Httpd_Handler *in_handler) {
     local_locker lock(&controller_mutex);
 
     handler_vec.push_back(in_handler);
+
+    RebuildRoutes();
 }
 
 void Kis_Net_Httpd::RemoveHandler(Kis_Net_Httpd_Handler *in_handler) {
@@ -295,6 +360,85 @@ void Kis_Net_Httpd::RemoveHandler(Kis_Net_Httpd_Handler *in_handler) {
             break;
         }
     }
+
+    for (auto ri = route_vec.begin(); ri != route_vec.end(); ) {
+        if (ri->second == in_handler)
+            ri = route_vec.erase(ri);
+        else
+            ++ri;
+    }
+
+    RebuildRoutes();
+}
+
+void Kis_Net_Httpd::RegisterRoute(string in_pattern, Kis_Net_Httpd_Handler *in_handler) {
+    local_locker lock(&controller_mutex);
+
+    Kis_Net_Httpd_Route_Trie check;
+
+    if (!check.add_route(in_pattern, in_handler)) {
+        _MSG("Ignoring invalid HTTP route '" + in_pattern + "'", MSGFLAG_ERROR);
+        return;
+    }
+
+    route_vec.push_back(std::make_pair(in_pattern, in_handler));
+
+    RebuildRoutes();
+}
+
+void Kis_Net_Httpd::RebuildRoutes() {
+    local_locker lock(&controller_mutex);
+
+    shared_ptr<route_table> table(new route_table());
+
+    std::set<Kis_Net_Httpd_Handler *> routed;
+
+    for (auto r : route_vec) {
+        // Only route to handlers which are still registered
+        if (std::find(handler_vec.begin(), handler_vec.end(), r.second) == 
+                handler_vec.end())
+            continue;
+
+        table->trie.add_route(r.first, r.second);
+        routed.insert(r.second);
+    }
+
+    for (auto h : handler_vec) {
+        if (routed.find(h) == routed.end())
+            table->unrouted.push_back(h);
+    }
+
+    std::atomic_store(&routes, table);
+}
+
+Kis_Net_Httpd_Handler *Kis_Net_Httpd::FindHandler(const char *url, const char *method,
+        Kis_Net_Httpd_Route_Match& match) {
+    shared_ptr<route_table> table = std::atomic_load(&routes);
+
+    match.tokenurl = StrTokenize(url, "/");
+    match.params.clear();
+
+    if (table == NULL)
+        return NULL;
+
+    vector<Kis_Net_Httpd_Route_Trie::candidate> candidates;
+    table->trie.match(match.tokenurl, candidates);
+
+    for (auto c : candidates) {
+        match.params = c.params;
+
+        if (c.handler->Httpd_VerifyRoute(url, method, match))
+            return c.handler;
+    }
+
+    match.params.clear();
+
+    for (auto h : table->unrouted) {
+        if (h->Httpd_VerifyPath(url, method))
+            return h;
+    }
+
+    return NULL;
 }
 
 int Kis_Net_Httpd::StartHttpd() {
@@ -334,17 +478,35 @@ int Kis_Net_Httpd::StartHttpd() {
     }
 
 
+    // Either a fixed pool of event loop threads which suspend streaming
+    // connections while they wait for data, or the legacy thread per connection
+    unsigned int mhd_flags = MHD_USE_THREAD_PER_CONNECTION;
+    unsigned int mhd_pool_sz = 0;
+
+#ifdef HAVE_MHD_SUSPEND_RESUME
+    if (use_thread_pool) {
+        mhd_flags = KIS_MHD_INTERNAL_THREAD | KIS_MHD_SUSPEND_RESUME;
+
+        if (MHD_is_feature_supported(MHD_FEATURE_EPOLL) == MHD_YES)
+            mhd_flags |= KIS_MHD_EPOLL;
+
+        mhd_pool_sz = http_threads;
+    }
+#endif
+
     if (!use_ssl) {
-        microhttpd = MHD_start_daemon(MHD_USE_THREAD_PER_CONNECTION,
+        microhttpd = MHD_start_daemon(mhd_flags,
                 http_port, NULL, NULL, 
                 &http_request_handler, this, 
                 MHD_OPTION_NOTIFY_COMPLETED, &http_request_completed, NULL,
+                MHD_OPTION_THREAD_POOL_SIZE, mhd_pool_sz,
                 MHD_OPTION_END); 
     } else {
-        microhttpd = MHD_start_daemon(MHD_USE_THREAD_PER_CONNECTION | MHD_USE_SSL,
+        microhttpd = MHD_start_daemon(mhd_flags | MHD_USE_SSL,
                 http_port, NULL, NULL, &http_request_handler, this, 
                 MHD_OPTION_HTTPS_MEM_KEY, cert_key,
                 MHD_OPTION_HTTPS_MEM_CERT, cert_pem,
+                MHD_OPTION_THREAD_POOL_SIZE, mhd_pool_sz,
                 MHD_OPTION_END); 
     }
 
@@ -360,7 +522,19 @@ int Kis_Net_Httpd::StartHttpd() {
 
     running = true;
 
-    _MSG("Started http server on port " + UIntToString(http_port), MSGFLAG_INFO);
+    {
+        std::lock_guard<std::mutex> lk(generator_mutex);
+        generator_shutdown = false;
+
+        for (unsigned int x = 0; x < generator_threads; x++)
+            generator_pool.push_back(std::thread(&Kis_Net_Httpd::generator_processor, this));
+    }
+
+    if (use_thread_pool)
+        _MSG("Started http server on port " + UIntToString(http_port) + " with " +
+                UIntToString(http_threads) + " threads", MSGFLAG_INFO);
+    else
+        _MSG("Started http server on port " + UIntToString(http_port), MSGFLAG_INFO);
 
     return 1;
 }
@@ -369,14 +543,47 @@ int Kis_Net_Httpd::StopHttpd() {
     local_locker lock(&controller_mutex);
 
     handler_vec.clear();
+    route_vec.clear();
+    std::atomic_store(&routes, shared_ptr<route_table>());
+
     static_dir_vec.clear();
 
+    if (static_cache != NULL)
+        static_cache->clear();
+
     if (microhttpd != NULL) {
         // Formerly we quiesced the httpd daemon but that api seemed to have
         // problems on some builds; now we silence the panic handler and 
         // shut down the daemon
         
         running = false;
+
+        // Let the generator pool drain; anything already queued runs, and
+        // suspended requests are resumed as their handlers finish
+        {
+            std::lock_guard<std::mutex> lk(generator_mutex);
+            generator_shutdown = true;
+        }
+
+        generator_cv.notify_all();
+
+        for (auto& t : generator_pool)
+            t.join();
+
+        generator_pool.clear();
+
+        // Hand any parked streams back to the daemon so it can close them
+        {
+            local_locker slock(&suspend_mutex);
+
+            for (auto s : suspended_streams) {
+                s->suspended = false;
+                MHD_resume_connection(s->mhd_connection);
+            }
+
+            suspended_streams.clear();
+        }
+
         MHD_stop_daemon(microhttpd);
         return 1;
     }
@@ -384,6 +591,145 @@ int Kis_Net_Httpd::StopHttpd() {
     return 0;
 }
 
+bool Kis_Net_Httpd::SuspendStream(Kis_Net_Httpd_Buffer_Stream_Aux *in_aux) {
+#ifdef HAVE_MHD_SUSPEND_RESUME
+    local_locker lock(&suspend_mutex);
+
+    // Check again under the lock so we can't miss a wakeup from the generator
+    if (in_aux->get_rbhandler()->GetReadBufferUsed() || in_aux->get_in_error())
+        return false;
+
+    in_aux->suspended = true;
+    suspended_streams.insert(in_aux);
+
+    MHD_suspend_connection(in_aux->mhd_connection);
+
+    return true;
+#else
+    return false;
+#endif
+}
+
+void Kis_Net_Httpd::ResumeStream(Kis_Net_Httpd_Buffer_Stream_Aux *in_aux) {
+#ifdef HAVE_MHD_SUSPEND_RESUME
+    local_locker lock(&suspend_mutex);
+
+    if (!in_aux->suspended)
+        return;
+
+    in_aux->suspended = false;
+    suspended_streams.erase(in_aux);
+
+    MHD_resume_connection(in_aux->mhd_connection);
+#endif
+}
+
+void Kis_Net_Httpd_Job::run() {
+    {
+        std::lock_guard<std::mutex> lk(job_mutex);
+
+        if (state == JOB_CANCELLED)
+            return;
+
+        state = JOB_RUNNING;
+    }
+
+    fn();
+
+    std::lock_guard<std::mutex> lk(job_mutex);
+    fn = nullptr;
+    state = JOB_DONE;
+    job_cv.notify_all();
+}
+
+void Kis_Net_Httpd_Job::cancel_or_wait() {
+    std::unique_lock<std::mutex> lk(job_mutex);
+
+    if (state == JOB_QUEUED) {
+        state = JOB_CANCELLED;
+        return;
+    }
+
+    job_cv.wait(lk, [this]() { return state != JOB_RUNNING; });
+}
+
+void Kis_Net_Httpd::generator_processor() {
+    while (1) {
+        shared_ptr<Kis_Net_Httpd_Job> job;
+
+        {
+            std::unique_lock<std::mutex> lk(generator_mutex);
+
+            generator_cv.wait(lk, [this]() {
+                    return generator_shutdown || generator_queue.size() != 0;
+                    });
+
+            // Only exit once the queue is drained, so nothing queued before
+            // the shutdown is left waiting
+            if (generator_queue.size() == 0)
+                return;
+
+            job = generator_queue.front();
+            generator_queue.pop_front();
+        }
+
+        job->run();
+    }
+}
+
+shared_ptr<Kis_Net_Httpd_Job> Kis_Net_Httpd::QueueJob(std::function<void ()> in_fn) {
+    shared_ptr<Kis_Net_Httpd_Job> job(new Kis_Net_Httpd_Job(in_fn));
+
+    {
+        std::lock_guard<std::mutex> lk(generator_mutex);
+
+        if (!generator_shutdown && generator_pool.size() != 0) {
+            generator_queue.push_back(job);
+            generator_cv.notify_one();
+            return job;
+        }
+    }
+
+    // No pool to run it on (the server is stopping); run it here
+    job->run();
+
+    return job;
+}
+
+bool Kis_Net_Httpd::QueueAsyncRequest(Kis_Net_Httpd_Connection *connection,
+        std::function<void ()> in_fn) {
+#ifdef HAVE_MHD_SUSPEND_RESUME
+    // A thread per connection is free to block
+    if (!use_thread_pool || connection == NULL)
+        return false;
+
+    std::lock_guard<std::mutex> lk(generator_mutex);
+
+    if (generator_shutdown || generator_pool.size() == 0)
+        return false;
+
+    connection->async_state = Kis_Net_Httpd_Connection::ASYNC_RUNNING;
+
+    // The connection stays suspended until the handler finishes, at which
+    // point microhttpd calls the request handler again to send the response
+    MHD_suspend_connection(connection->connection);
+
+    connection->job.reset(new Kis_Net_Httpd_Job([connection, in_fn]() {
+                in_fn();
+
+                connection->async_state = Kis_Net_Httpd_Connection::ASYNC_COMPLETE;
+                MHD_resume_connection(connection->connection);
+                }));
+
+    generator_queue.push_back(connection->job);
+    generator_cv.notify_one();
+
+    return true;
+#else
+    return false;
+#endif
+}
+
 void Kis_Net_Httpd::MHD_Panic(void *cls, const char *file, unsigned int line,
         const char *reason) {
     Kis_Net_Httpd *httpd = (Kis_Net_Httpd *) cls;
@@ -493,23 +839,9 @@ int Kis_Net_Httpd::http_request_handler(void *cls, struct MHD_Connection *connec
         }
     } 
     
-    Kis_Net_Httpd_Handler *handler = NULL;
-
-    
-    {
-        local_locker conclock(&(kishttpd->controller_mutex));
-        /* Find a handler that can handle this path & method */
-        for (unsigned int i = 0; i < kishttpd->handler_vec.size(); i++) {
-            Kis_Net_Httpd_Handler *h = kishttpd->handler_vec[i];
-
-            if (h->Httpd_VerifyPath(url, method)) {
-                handler = h;
-                break;
-            }
-        }
-    }
-
-    // If we don't have a connection state, make one
+    // If we don't have a connection state, make one and find the handler; 
+    // microhttpd calls us several times per request, but the handler only
+    // needs to be found once
     if (*ptr == NULL) {
         concls = new Kis_Net_Httpd_Connection();
         // fprintf(stderr, "debug - allocated new connection state %p\n", concls);
@@ -517,7 +849,7 @@ int Kis_Net_Httpd::http_request_handler(void *cls, struct MHD_Connection *connec
         *ptr = (void *) concls;
 
         concls->httpd = kishttpd;
-        concls->httpdhandler = handler;
+        concls->httpdhandler = kishttpd->FindHandler(url, method, concls->route);
         concls->session = s;
         concls->httpcode = MHD_HTTP_OK;
         concls->url = string(url);
@@ -549,6 +881,8 @@ int Kis_Net_Httpd::http_request_handler(void *cls, struct MHD_Connection *connec
         concls = (Kis_Net_Httpd_Connection *) *ptr;
     }
 
+    Kis_Net_Httpd_Handler *handler = concls->httpdhandler;
+
     if (handler == NULL) {
         // Try to check a static url
         if (handle_static_file(cls, concls, url, method) < 0) {
@@ -628,6 +962,11 @@ void Kis_Net_Httpd::http_request_completed(void *cls __attribute__((unused)),
     if (con_info == NULL)
         return;
 
+    // microhttpd can finish the request before freeing the response; make sure
+    // a generator doesn't start (or is done) before the connection goes away
+    if (con_info->job != NULL)
+        con_info->job->cancel_or_wait();
+
     // Lock and shut it down
     {
         std::lock_guard<std::mutex> lk(con_info->connection_mutex);
@@ -656,6 +995,64 @@ static void free_callback(void *cls) {
     fclose(file);
 }
 
+// Holds a reference to a cached file for as long as the response needs it, in
+// case the cache replaces the file mid-response
+class static_cache_response {
+public:
+    std::shared_ptr<Kis_Httpd_Static_Cache::cache_entry> entry;
+    const std::string *body;
+};
+
+static ssize_t static_cache_reader(void *cls, uint64_t pos, char *buf, size_t max) {
+    static_cache_response *resp = (static_cache_response *) cls;
+
+    if (pos >= resp->body->length())
+        return MHD_CONTENT_READER_END_OF_STREAM;
+
+    size_t len = std::min(max, (size_t) (resp->body->length() - pos));
+    memcpy(buf, resp->body->data() + pos, len);
+
+    return len;
+}
+
+static void static_cache_free(void *cls) {
+    delete (static_cache_response *) cls;
+}
+
+// Does the client already have this version of the file
+static bool static_cache_not_modified(struct MHD_Connection *connection,
+        std::shared_ptr<Kis_Httpd_Static_Cache::cache_entry> entry) {
+    const char *inm = MHD_lookup_connection_value(connection, MHD_HEADER_KIND,
+            MHD_HTTP_HEADER_IF_NONE_MATCH);
+
+    if (inm != NULL) {
+        if (strcmp(inm, "*") == 0)
+            return true;
+
+        for (auto t : StrTokenize(inm, ",")) {
+            string tag = StrStrip(t);
+
+            // Weak validators compare the same for a GET
+            if (tag.find("W/") == 0)
+                tag = tag.substr(2);
+
+            if (tag == entry->etag)
+                return true;
+        }
+
+        // If-None-Match takes priority over If-Modified-Since
+        return false;
+    }
+
+    const char *ims = MHD_lookup_connection_value(connection, MHD_HEADER_KIND,
+            MHD_HTTP_HEADER_IF_MODIFIED_SINCE);
+
+    if (ims != NULL && entry->last_modified == ims)
+        return true;
+
+    return false;
+}
+
 string Kis_Net_Httpd::GetMimeType(string ext) {
     std::map<string, string>::iterator mi = mime_type_map.find(ext);
     if (mi != mime_type_map.end()) {
@@ -678,6 +1075,82 @@ int Kis_Net_Httpd::handle_static_file(void *cls, Kis_Net_Httpd_Connection *conne
     if (surl[surl.length() - 1] == '/')
         surl += "index.html";
 
+    if (kishttpd->static_cache != NULL) {
+        auto entry = kishttpd->static_cache->find(surl);
+
+        if (entry != NULL) {
+            struct MHD_Response *response;
+            int code = MHD_HTTP_OK;
+            bool gzip = false;
+
+            if (static_cache_not_modified(connection->connection, entry)) {
+                code = MHD_HTTP_NOT_MODIFIED;
+                response = MHD_create_response_from_buffer(0, NULL, 
+                        MHD_RESPMEM_PERSISTENT);
+            } else {
+                static_cache_response *resp = new static_cache_response();
+
+                resp->entry = entry;
+                resp->body = &(entry->raw);
+
+                if (entry->gzip.length() != 0 && 
+                        ClientAcceptsEncoding(connection->connection, "gzip")) {
+                    resp->body = &(entry->gzip);
+                    gzip = true;
+                }
+
+                response = MHD_create_response_from_callback(resp->body->length(), 
+                        32 * 1024, &static_cache_reader, resp, &static_cache_free);
+
+                if (response == NULL)
+                    delete resp;
+            }
+
+            if (response == NULL)
+                return -1;
+
+            if (connection->session != NULL) {
+                std::stringstream cookiestr;
+
+                cookiestr << KIS_SESSION_COOKIE << "=";
+                cookiestr << connection->session->sessionid;
+                cookiestr << "; Path=/";
+
+                MHD_add_response_header(response, MHD_HTTP_HEADER_SET_COOKIE, 
+                        cookiestr.str().c_str());
+            }
+
+            MHD_add_response_header(response, "ETag", entry->etag.c_str());
+            MHD_add_response_header(response, "Last-Modified", 
+                    entry->last_modified.c_str());
+
+            if (entry->gzip.length() != 0)
+                MHD_add_response_header(response, "Vary", "Accept-Encoding");
+
+            if (gzip)
+                MHD_add_response_header(response, "Content-Encoding", "gzip");
+
+            string mime = kishttpd->GetMimeType(GetSuffix(surl));
+
+            if (mime != "") {
+                MHD_add_response_header(response, "Content-Type", mime.c_str());
+            } else {
+                MHD_add_response_header(response, "Content-Type", "text/plain");
+            }
+
+            MHD_add_response_header(response, "Access-Control-Allow-Origin", "*");
+
+            // Let the browser keep a copy, but always revalidate it with the
+            // ETag so a changed UI is picked up at once
+            MHD_add_response_header(response, "Cache-Control", "no-cache");
+
+            MHD_queue_response(connection->connection, code, response);
+            MHD_destroy_response(response);
+
+            return 1;
+        }
+    }
+
     local_locker lock(&(kishttpd->controller_mutex));
 
     for (auto sd : kishttpd->static_dir_vec) {
@@ -857,6 +1330,70 @@ int Kis_Net_Httpd::SendHttpResponse(Kis_Net_Httpd *httpd,
     return MHD_YES;
 }
 
+bool Kis_Net_Httpd::ClientAcceptsEncoding(struct MHD_Connection *connection,
+        std::string in_encoding) {
+    const char *accept = MHD_lookup_connection_value(connection, MHD_HEADER_KIND, 
+            MHD_HTTP_HEADER_ACCEPT_ENCODING);
+
+    if (accept == NULL)
+        return false;
+
+    for (auto enc : StrTokenize(accept, ",")) {
+        vector<string> params = StrTokenize(enc, ";");
+
+        if (params.size() == 0)
+            continue;
+
+        string name = StrLower(StrStrip(params[0]));
+
+        if (name != in_encoding && name != "*")
+            continue;
+
+        // Explicitly refused with q=0
+        for (unsigned int p = 1; p < params.size(); p++) {
+            string q = StrStrip(params[p]);
+
+            if (q.find("q=") == 0 && atof(q.substr(2).c_str()) == 0)
+                return false;
+        }
+
+        return true;
+    }
+
+    return false;
+}
+
+string Kis_Net_Httpd::NegotiateCompression(Kis_Net_Httpd_Connection *connection,
+        const char *url) {
+    if (compression_level == 0)
+        return "";
+
+    // Only compress text and serialized data; pcap and other binary streams
+    // gain little and shouldn't pay for it
+    string suffix = GetSuffix(url);
+    string mime = GetMimeType(suffix);
+
+    if (mime != "") {
+        if (mime.find("text/") != 0 && mime != "application/json" && 
+                mime != "application/javascript" && mime != "image/svg+xml")
+            return "";
+    } else {
+        shared_ptr<EntryTracker> entrytracker =
+            Globalreg::FetchGlobalAs<EntryTracker>(globalreg, "ENTRY_TRACKER");
+
+        if (entrytracker == NULL || !entrytracker->CanSerialize(suffix))
+            return "";
+    }
+
+    if (ClientAcceptsEncoding(connection->connection, "gzip"))
+        return "gzip";
+
+    if (ClientAcceptsEncoding(connection->connection, "deflate"))
+        return "deflate";
+
+    return "";
+}
+
 int Kis_Net_Httpd::SendStandardHttpResponse(Kis_Net_Httpd *httpd,
         Kis_Net_Httpd_Connection *connection, const char *url) {
     AppendHttpSession(httpd, connection);
@@ -894,6 +1431,11 @@ void Kis_Net_Httpd_Handler::Bind_Httpd_Server(GlobalRegistry *in_globalreg) {
     }
 }
 
+void Kis_Net_Httpd_Handler::Httpd_RegisterRoute(string in_pattern) {
+    if (httpd != NULL)
+        httpd->RegisterRoute(in_pattern, this);
+}
+
 bool Kis_Net_Httpd_Handler::Httpd_CanSerialize(string path) {
     return entrytracker->CanSerialize(httpd->GetSuffix(path));
 }
@@ -912,31 +1454,60 @@ bool Kis_Net_Httpd_CPPStream_Handler::Httpd_Serialize(string path,
     return entrytracker->Serialize(httpd->GetSuffix(path), stream, e, name_map);
 }
 
+int Kis_Net_Httpd_CPPStream_Handler::send_stream_response(Kis_Net_Httpd *httpd,
+        Kis_Net_Httpd_Connection *connection, const char *url,
+        std::stringstream &stream) {
+
+    // A handler run off the server thread couldn't queue the login rejection
+    // itself
+    if (connection->auth_reject)
+        return MHD_queue_basic_auth_fail_response(connection->connection,
+                "Kismet Admin", connection->response);
+
+    if (connection->response == NULL) {
+        connection->response = 
+            MHD_create_response_from_buffer(stream.str().length(),
+                    (void *) stream.str().data(), MHD_RESPMEM_MUST_COPY);
+
+        return httpd->SendStandardHttpResponse(httpd, connection, url);
+    }
+    
+    return MHD_YES;
+}
+
 int Kis_Net_Httpd_CPPStream_Handler::Httpd_HandleGetRequest(Kis_Net_Httpd *httpd, 
         Kis_Net_Httpd_Connection *connection,
         const char *url, const char *method, const char *upload_data,
         size_t *upload_data_size) {
 
-    std::stringstream stream;
-    int ret;
-
     if (connection != NULL)
         std::lock_guard<std::mutex> lk(connection->connection_mutex);
 
-    Httpd_CreateStreamResponse(httpd, connection, url, method, upload_data,
-            upload_data_size, stream);
+    // Called again once the handler has finished on the generator pool
+    if (connection->async_state == Kis_Net_Httpd_Connection::ASYNC_COMPLETE)
+        return send_stream_response(httpd, connection, url, connection->response_stream);
 
-    if (connection->response == NULL) {
-        connection->response = 
-            MHD_create_response_from_buffer(stream.str().length(),
-                    (void *) stream.str().data(), MHD_RESPMEM_MUST_COPY);
+    // Handlers can block (opening sources, waiting on capture helpers), so when 
+    // the server threads are shared, run them on the generator pool with the 
+    // connection suspended
+    std::string url_s(url), method_s(method);
 
-        ret = httpd->SendStandardHttpResponse(httpd, connection, url);
+    if (httpd->QueueAsyncRequest(connection, 
+                [this, httpd, connection, url_s, method_s]() {
+                    size_t upload_sz = 0;
 
-        return ret;
-    }
-    
-    return MHD_YES;
+                    Httpd_CreateStreamResponse(httpd, connection, url_s.c_str(),
+                            method_s.c_str(), NULL, &upload_sz, 
+                            connection->response_stream);
+                }))
+        return MHD_YES;
+
+    std::stringstream stream;
+
+    Httpd_CreateStreamResponse(httpd, connection, url, method, upload_data,
+            upload_data_size, stream);
+
+    return send_stream_response(httpd, connection, url, stream);
 }
 
 int Kis_Net_Httpd_CPPStream_Handler::Httpd_HandlePostRequest(Kis_Net_Httpd *httpd, 
@@ -948,18 +1519,17 @@ int Kis_Net_Httpd_CPPStream_Handler::Httpd_HandlePostRequest(Kis_Net_Httpd *http
     if (connection != NULL)
         std::lock_guard<std::mutex> lk(connection->connection_mutex);
 
-    Httpd_PostComplete(connection);
+    if (connection->async_state == Kis_Net_Httpd_Connection::ASYNC_COMPLETE)
+        return send_stream_response(httpd, connection, url, connection->response_stream);
 
-    if (connection->response == NULL) {
-        connection->response = 
-            MHD_create_response_from_buffer(connection->response_stream.str().length(),
-                    (void *) connection->response_stream.str().data(), 
-                    MHD_RESPMEM_MUST_COPY);
+    if (httpd->QueueAsyncRequest(connection, [this, connection]() {
+                Httpd_PostComplete(connection);
+                }))
+        return MHD_YES;
 
-        return httpd->SendStandardHttpResponse(httpd, connection, url);
-    } 
+    Httpd_PostComplete(connection);
 
-    return MHD_YES;
+    return send_stream_response(httpd, connection, url, connection->response_stream);
 }
 
 
@@ -1013,8 +1583,13 @@ bool Kis_Net_Httpd::HasValidSession(Kis_Net_Httpd_Connection *connection,
             MHD_create_response_from_buffer(respstr.length(),
                     (void *) respstr.c_str(), MHD_RESPMEM_MUST_COPY);
 
-        MHD_queue_basic_auth_fail_response(connection->connection,
-                "Kismet Admin", connection->response);
+        // Responses can't be queued while the connection is suspended; the
+        // rejection is sent when it resumes
+        if (connection->async_state == Kis_Net_Httpd_Connection::ASYNC_RUNNING)
+            connection->auth_reject = true;
+        else
+            MHD_queue_basic_auth_fail_response(connection->connection,
+                    "Kismet Admin", connection->response);
     }
 
     return false;
@@ -1126,6 +1701,18 @@ Kis_Net_Httpd_Buffer_Stream_Aux::Kis_Net_Httpd_Buffer_Stream_Aux(
     httpd_stream_handler = in_handler;
     httpd_connection = in_httpd_connection;
     ringbuf_handler = in_ringbuf_handler;
+
+    httpd = NULL;
+    mhd_connection = NULL;
+
+    if (httpd_connection != NULL) {
+        httpd = httpd_connection->httpd;
+        mhd_connection = httpd_connection->connection;
+    }
+
+    suspendable = httpd != NULL && mhd_connection != NULL && 
+        httpd->FetchUsingThreadPool();
+    suspended = false;
     aux = in_aux;
     free_aux_cb = in_free_aux;
 
@@ -1134,6 +1721,10 @@ Kis_Net_Httpd_Buffer_Stream_Aux::Kis_Net_Httpd_Buffer_Stream_Aux(
 
     in_error = false;
 
+    compress = false;
+    zflush_pending = false;
+    zfinished = false;
+
     // If the buffer encounters an error, unlock the variable and set the error state
     ringbuf_handler->SetProtocolErrorCb([this]() {
             trigger_error();
@@ -1164,6 +1755,38 @@ Kis_Net_Httpd_Buffer_Stream_Aux::~Kis_Net_Httpd_Buffer_Stream_Aux() {
         ringbuf_handler->RemoveWriteBufferInterface();
         ringbuf_handler->SetProtocolErrorCb(NULL);
     }
+
+    if (compress)
+        deflateEnd(&zstream);
+}
+
+bool Kis_Net_Httpd_Buffer_Stream_Aux::enable_compression(int in_level, bool in_gzip) {
+    memset(&zstream, 0, sizeof(z_stream));
+
+    // 15 bits of window, plus 16 to wrap in a gzip header instead of zlib
+    if (deflateInit2(&zstream, in_level, Z_DEFLATED, in_gzip ? 31 : 15, 8,
+                Z_DEFAULT_STRATEGY) != Z_OK)
+        return false;
+
+    compress = true;
+
+    return true;
+}
+
+void Kis_Net_Httpd_Buffer_Stream_Aux::trigger_error() {
+    // Scope so we're done with our mutex by the time we release the conditional
+    // locker
+    local_demand_locker lock(&error_mutex);
+    lock.lock();
+    in_error = true;
+    lock.unlock();
+
+    // Unlock the conditional locker
+    cl->unlock(0);
+
+    // Wake the connection so it can flush and end the stream
+    if (suspendable)
+        httpd->ResumeStream(this);
 }
 
 void Kis_Net_Httpd_Buffer_Stream_Aux::BufferAvailable(size_t in_amt) {
@@ -1172,6 +1795,10 @@ void Kis_Net_Httpd_Buffer_Stream_Aux::BufferAvailable(size_t in_amt) {
     // re-lock and block
     // fprintf(stderr, "debug - knmh - unlocking %lu\n", in_amt);
     cl->unlock(1);
+
+    // If the connection is parked, hand it back to the event loop
+    if (suspendable)
+        httpd->ResumeStream(this);
 }
 
 void Kis_Net_Httpd_Buffer_Stream_Aux::block_until_data() {
@@ -1222,9 +1849,11 @@ ssize_t Kis_Net_Httpd_Buffer_Stream_Handler::buffer_event_cb(void *cls, uint64_t
 
     while (read_sz == 0) {
         // We get called as soon as the webserver has either a) processed our request
-        // or b) sent what we gave it; we need to hold the thread until we
-        // get more data in the buf, so we block until we have data
-        stream_aux->block_until_data();
+        // or b) sent what we gave it; when running a thread per connection we
+        // hold the thread until we get more data in the buf.  Event loop threads
+        // are shared, so there we suspend the connection instead of blocking.
+        if (!stream_aux->get_suspendable())
+            stream_aux->block_until_data();
 
         read_sz = rbh->ZeroCopyPeekWriteBufferData((void **) &zbuf, max);
 
@@ -1236,6 +1865,15 @@ ssize_t Kis_Net_Httpd_Buffer_Stream_Handler::buffer_event_cb(void *cls, uint64_t
                 stream_aux->get_buffer_event_mutex()->unlock();
                 return MHD_CONTENT_READER_END_OF_STREAM;
             }
+
+            // Park the connection; it's resumed by the generator writing more
+            // data or failing, and MHD calls us again.  If data snuck in first,
+            // go around and read it.
+            if (stream_aux->get_suspendable() && 
+                    stream_aux->httpd->SuspendStream(stream_aux)) {
+                stream_aux->get_buffer_event_mutex()->unlock();
+                return 0;
+            }
         }
     }
 
@@ -1251,13 +1889,96 @@ ssize_t Kis_Net_Httpd_Buffer_Stream_Handler::buffer_event_cb(void *cls, uint64_t
     return (ssize_t) read_sz;
 }
 
+ssize_t Kis_Net_Httpd_Buffer_Stream_Handler::buffer_compress_event_cb(void *cls, 
+        uint64_t pos __attribute__((unused)), char *buf, size_t max) {
+    Kis_Net_Httpd_Buffer_Stream_Aux *stream_aux = (Kis_Net_Httpd_Buffer_Stream_Aux *) cls;
+
+    stream_aux->get_buffer_event_mutex()->lock();
+
+    shared_ptr<BufferHandlerGeneric> rbh = stream_aux->get_rbhandler();
+    z_stream *zs = &(stream_aux->zstream);
+
+    zs->next_out = (Bytef *) buf;
+    zs->avail_out = max;
+
+    // Deflate directly from the buffer into the microhttpd buffer until we 
+    // have some output to hand back
+    while (zs->avail_out == max) {
+        if (stream_aux->zfinished) {
+            stream_aux->get_buffer_event_mutex()->unlock();
+            return MHD_CONTENT_READER_END_OF_STREAM;
+        }
+
+        // Don't block a connection thread while compressed data is still held 
+        // by deflate; flush it out first
+        if (!stream_aux->get_suspendable() && !stream_aux->zflush_pending)
+            stream_aux->block_until_data();
+
+        unsigned char *zbuf;
+        size_t read_sz = rbh->ZeroCopyPeekWriteBufferData((void **) &zbuf, 64 * 1024);
+
+        if (read_sz != 0) {
+            zs->next_in = (Bytef *) zbuf;
+            zs->avail_in = read_sz;
+
+            deflate(zs, Z_NO_FLUSH);
+
+            rbh->PeekFreeWriteBufferData(zbuf);
+            rbh->ConsumeWriteBufferData(read_sz - zs->avail_in);
+
+            zs->next_in = NULL;
+            zs->avail_in = 0;
+
+            stream_aux->zflush_pending = true;
+
+            continue;
+        }
+
+        rbh->PeekFreeWriteBufferData(zbuf);
+
+        // The generator is done; finish the compressed stream, which may take
+        // several calls to drain
+        if (stream_aux->get_in_error()) {
+            int r = deflate(zs, Z_FINISH);
+
+            if (r == Z_STREAM_END || (r != Z_OK && r != Z_BUF_ERROR))
+                stream_aux->zfinished = true;
+
+            continue;
+        }
+
+        // The generator is waiting on something; push out what we have so 
+        // far so that live streams aren't held in the compressor.  The flush
+        // is complete once deflate leaves room in the output.
+        if (stream_aux->zflush_pending) {
+            deflate(zs, Z_SYNC_FLUSH);
+
+            if (zs->avail_out != 0)
+                stream_aux->zflush_pending = false;
+
+            continue;
+        }
+
+        if (stream_aux->get_suspendable() && 
+                stream_aux->httpd->SuspendStream(stream_aux)) {
+            stream_aux->get_buffer_event_mutex()->unlock();
+            return 0;
+        }
+    }
+
+    stream_aux->get_buffer_event_mutex()->unlock();
+
+    return (ssize_t) (max - zs->avail_out);
+}
+
 static void free_buffer_aux_callback(void *cls) {
     Kis_Net_Httpd_Buffer_Stream_Aux *aux = (Kis_Net_Httpd_Buffer_Stream_Aux *) cls;
 
     // fprintf(stderr, "debug - free aux callback %p\n", cls);
 
-    // Wait for the thread to complete
-    aux->generator_thread.join();
+    // Make sure the generator isn't going to start, or has finished
+    if (aux->generator_job != NULL)
+        aux->generator_job->cancel_or_wait();
 
     // fprintf(stderr, "debug - generator unlocked %p\n", cls);
 
@@ -1270,6 +1991,28 @@ static void free_buffer_aux_callback(void *cls) {
     delete(aux);
 }
 
+struct MHD_Response *Kis_Net_Httpd_Buffer_Stream_Handler::create_stream_response(
+        Kis_Net_Httpd *httpd, Kis_Net_Httpd_Connection *connection,
+        Kis_Net_Httpd_Buffer_Stream_Aux *aux, const char *url) {
+    string encoding = httpd->NegotiateCompression(connection, url);
+
+    if (encoding == "" || 
+            !aux->enable_compression(httpd->FetchCompressionLevel(), encoding == "gzip"))
+        return MHD_create_response_from_callback(MHD_SIZE_UNKNOWN, 32 * 1024,
+                &buffer_event_cb, aux, &free_buffer_aux_callback);
+
+    struct MHD_Response *response =
+        MHD_create_response_from_callback(MHD_SIZE_UNKNOWN, 32 * 1024,
+                &buffer_compress_event_cb, aux, &free_buffer_aux_callback);
+
+    if (response != NULL) {
+        MHD_add_response_header(response, "Content-Encoding", encoding.c_str());
+        MHD_add_response_header(response, "Vary", "Accept-Encoding");
+    }
+
+    return response;
+}
+
 int Kis_Net_Httpd_Buffer_Stream_Handler::Httpd_HandleGetRequest(Kis_Net_Httpd *httpd, 
         Kis_Net_Httpd_Connection *connection,
         const char *url, const char *method, const char *upload_data,
@@ -1285,21 +2028,20 @@ int Kis_Net_Httpd_Buffer_Stream_Handler::Httpd_HandleGetRequest(Kis_Net_Httpd *h
             new Kis_Net_Httpd_Buffer_Stream_Aux(this, connection, rbh, NULL, NULL);
         connection->custom_extension = aux;
 
-        // Set up a locker to make sure the thread is up and running
-        conditional_locker<int> cl;
-        cl.lock();
-
-        // Run it in its own thread and set up the connection streaming object; we MUST pass
-        // the aux as a direct pointer because the microhttpd backend can delete the 
-        // connection BEFORE calling our cleanup on our response!
-        aux->generator_thread =
-            std::thread([this, &cl, aux, httpd, connection, url, method, upload_data, upload_data_size]{
-                // Unlock the thread as soon as we've spawned it
-                cl.unlock(1);
-
+        // Run the generator on the server pool and set up the connection streaming 
+        // object; we MUST pass the aux as a direct pointer because the microhttpd 
+        // backend can delete the connection BEFORE calling our cleanup on our 
+        // response!  The url and upload size belong to microhttpd and only live 
+        // for this call, so the generator gets its own copies.
+        std::string url_s(url), method_s(method);
+        size_t upload_sz = *upload_data_size;
+
+        aux->generator_job = connection->job =
+            httpd->QueueJob([this, aux, httpd, connection, url_s, method_s, 
+                    upload_data, upload_sz]() mutable {
                 int r = 
-                    Httpd_CreateStreamResponse(httpd, connection, url, method, upload_data,
-                        upload_data_size);
+                    Httpd_CreateStreamResponse(httpd, connection, url_s.c_str(),
+                            method_s.c_str(), upload_data, &upload_sz);
 
                 // Trigger 'error' when the function is complete, causing us to finish 
                 // the stream
@@ -1309,11 +2051,7 @@ int Kis_Net_Httpd_Buffer_Stream_Handler::Httpd_HandleGetRequest(Kis_Net_Httpd *h
                 }
                 });
 
-        cl.block_until();
-
-        connection->response = 
-            MHD_create_response_from_callback(MHD_SIZE_UNKNOWN, 32 * 1024,
-                    &buffer_event_cb, aux, &free_buffer_aux_callback);
+        connection->response = create_stream_response(httpd, connection, aux, url);
 
         return httpd->SendStandardHttpResponse(httpd, connection, url);
     }
@@ -1339,19 +2077,11 @@ int Kis_Net_Httpd_Buffer_Stream_Handler::Httpd_HandlePostRequest(Kis_Net_Httpd *
 
         // fprintf(stderr, "debug - made post aux %p\n", aux);
 
-        // Call the post complete and populate our stream;
-        // Run it in its own thread and set up the connection streaming object; we MUST pass
-        // the aux as a direct pointer because the microhttpd backend can delete the 
-        // connection BEFORE calling our cleanup on our response!
-        //
-        // Set up a locker to make sure the thread is up and running
-        conditional_locker<int> cl;
-        cl.lock();
-
-        aux->generator_thread =
-            std::thread([this, &cl, aux, connection] {
-                cl.unlock(1);
-
+        // Call the post complete and populate our stream on the server pool; we 
+        // MUST pass the aux as a direct pointer because the microhttpd backend can 
+        // delete the connection BEFORE calling our cleanup on our response!
+        aux->generator_job = connection->job =
+            httpd->QueueJob([this, aux, connection] {
                 int r = Httpd_PostComplete(connection);
 
                 // Trigger 'error' when the function is complete, causing us to finish 
@@ -1362,11 +2092,7 @@ int Kis_Net_Httpd_Buffer_Stream_Handler::Httpd_HandlePostRequest(Kis_Net_Httpd *
                 }
                 });
 
-        cl.block_until();
-
-        connection->response = 
-            MHD_create_response_from_callback(MHD_SIZE_UNKNOWN, 32 * 1024,
-                    &buffer_event_cb, aux, &free_buffer_aux_callback);
+        connection->response = create_stream_response(httpd, connection, aux, url);
 
         return httpd->SendStandardHttpResponse(httpd, connection, url);
     }
@@ -26,11 +26,18 @@
 #include <list>
 #include <map>
 #include <vector>
+#include <set>
 #include <algorithm>
 #include <string>
 #include <sstream>
 #include <microhttpd.h>
 #include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <zlib.h>
 
 #include "globalregistry.h"
 #include "kis_mutex.h"
@@ -38,13 +45,63 @@
 #include "ringbuf2.h"
 #include "chainbuf.h"
 #include "buffer_handler.h"
+#include "kis_httpd_route.h"
+
+// libmicrohttpd renamed the event loop flags in 0.9.55; map them to whichever
+// names the installed library provides.  Suspending connections needs 0.9.34
+// or newer; older libraries are always run thread-per-connection.
+#if defined(MHD_VERSION) && MHD_VERSION >= 0x00093400
+#define HAVE_MHD_SUSPEND_RESUME 1
+#if MHD_VERSION >= 0x00095500
+#define KIS_MHD_INTERNAL_THREAD     MHD_USE_INTERNAL_POLLING_THREAD
+#define KIS_MHD_EPOLL               MHD_USE_EPOLL
+#define KIS_MHD_SUSPEND_RESUME      MHD_ALLOW_SUSPEND_RESUME
+#else
+#define KIS_MHD_INTERNAL_THREAD     MHD_USE_SELECT_INTERNALLY
+#define KIS_MHD_EPOLL               MHD_USE_EPOLL_LINUX_ONLY
+#define KIS_MHD_SUSPEND_RESUME      MHD_USE_SUSPEND_RESUME
+#endif
+#endif
 
 class Kis_Net_Httpd;
 class Kis_Net_Httpd_Session;
 class Kis_Net_Httpd_Connection;
+class Kis_Net_Httpd_Buffer_Stream_Aux;
 
 class EntryTracker;
 
+// A unit of work run on the server generator pool.  Stream generators and
+// request handlers which may take a while run here instead of on a thread of
+// their own or on a server thread.
+//
+// Whoever queued the job can cancel it if it hasn't started, or wait for it
+// to finish if it has; the job keeps its own state so it can be abandoned by
+// a connection which is going away.
+class Kis_Net_Httpd_Job {
+public:
+    Kis_Net_Httpd_Job(std::function<void ()> in_fn) :
+        fn(in_fn),
+        state(JOB_QUEUED) { }
+
+    const static int JOB_QUEUED = 0;
+    const static int JOB_RUNNING = 1;
+    const static int JOB_DONE = 2;
+    const static int JOB_CANCELLED = 3;
+
+    // Run the job unless it was cancelled first; called by the pool
+    void run();
+
+    // Cancel the job if it hasn't started, otherwise wait for it to finish
+    void cancel_or_wait();
+
+protected:
+    std::function<void ()> fn;
+
+    std::mutex job_mutex;
+    std::condition_variable job_cv;
+    int state;
+};
+
 // Basic request handler from MHD
 class Kis_Net_Httpd_Handler {
 public:
@@ -71,6 +128,19 @@ public:
     // Can this handler process this request?
     virtual bool Httpd_VerifyPath(const char *path, const char *method) = 0;
 
+    // Can this handler process a request which matched one of its routes?
+    // Handlers which register routes can override this to use the pre-split
+    // url and captured parameters instead of parsing the path again.
+    virtual bool Httpd_VerifyRoute(const char *path, const char *method,
+            const Kis_Net_Httpd_Route_Match& match __attribute__((unused))) {
+        return Httpd_VerifyPath(path, method);
+    }
+
+    // Register a path pattern this handler serves with the server route
+    // table; see kis_httpd_route.h.  Handlers which don't register any routes
+    // are asked about every url which no route claims.
+    void Httpd_RegisterRoute(string in_pattern);
+
     // Shortcut to checking if the serializer can handle this, since most
     // endpoints will be implementing serialization
     virtual bool Httpd_CanSerialize(string path);
@@ -167,6 +237,11 @@ public:
     virtual bool Httpd_Serialize(string path, std::stringstream &stream,
             SharedTrackerElement e, 
             TrackerElementSerializer::rename_map *name_map = NULL);
+
+protected:
+    // Queue the response a handler generated
+    int send_stream_response(Kis_Net_Httpd *httpd, Kis_Net_Httpd_Connection *connection,
+            const char *url, std::stringstream &stream);
 };
 
 // Fallback handler to report that we can't serve static files
@@ -236,6 +311,11 @@ public:
     // buf to have data available to write.
     static ssize_t buffer_event_cb(void *cls, uint64_t pos, char *buf, size_t max);
 
+    // As buffer_event_cb, but deflates the buffer into the response for 
+    // clients which accept a compressed encoding
+    static ssize_t buffer_compress_event_cb(void *cls, uint64_t pos, char *buf, 
+            size_t max);
+
     virtual void Httpd_Set_Buffer_Size(size_t in_sz) {
         k_n_h_r_ringbuf_size = in_sz;
     }
@@ -243,6 +323,12 @@ public:
 protected:
     virtual shared_ptr<BufferHandlerGeneric> allocate_buffer() = 0;
 
+    // Create the microhttpd response for a stream, compressed if the client
+    // and content allow it
+    struct MHD_Response *create_stream_response(Kis_Net_Httpd *httpd,
+            Kis_Net_Httpd_Connection *connection, 
+            Kis_Net_Httpd_Buffer_Stream_Aux *aux, const char *url);
+
     size_t k_n_h_r_ringbuf_size;
 };
 
@@ -296,18 +382,7 @@ public:
         return in_error;
     }
 
-    void trigger_error() {
-        // Scope so we're done with our mutex by the time we release the conditional
-        // locker
-        local_demand_locker lock(&error_mutex);
-        lock.lock();
-        in_error = true;
-        lock.unlock();
-
-        // Unlock the conditional locker
-        cl->unlock(0);
-
-    }
+    void trigger_error();
 
     void set_aux(void *in_aux, 
             function<void (Kis_Net_Httpd_Buffer_Stream_Aux *)> in_free_aux) {
@@ -340,11 +415,18 @@ public:
     // session)
     void block_until_data();
 
+    // Compress the stream with deflate, wrapped in gzip or zlib framing
+    bool enable_compression(int in_level, bool in_gzip);
+
     // Get the buffer event mutex
     kis_recursive_timed_mutex *get_buffer_event_mutex() {
         return &buffer_event_mutex;
     }
 
+    // Can we suspend the connection instead of blocking a server thread while
+    // we wait for data?
+    bool get_suspendable() { return suspendable; }
+
 public:
     kis_recursive_timed_mutex aux_mutex;
     kis_recursive_timed_mutex error_mutex;
@@ -356,6 +438,15 @@ public:
     // kis httpd connection we belong to
     Kis_Net_Httpd_Connection *httpd_connection;
 
+    // Server and MHD connection, kept so the stream can be suspended and resumed
+    Kis_Net_Httpd *httpd;
+    struct MHD_Connection *mhd_connection;
+
+    // Is the server running a worker pool, and are we currently parked waiting
+    // for data?  suspended is protected by the server suspend_mutex
+    bool suspendable;
+    bool suspended;
+
     // Buffer handler
     shared_ptr<BufferHandlerGeneric> ringbuf_handler;
 
@@ -365,8 +456,8 @@ public:
     // Are we in error?
     bool in_error;
 
-    // Possible worker thread for processing the buffer fill
-    std::thread generator_thread;
+    // Generator filling the buffer, queued on the server generator pool
+    shared_ptr<Kis_Net_Httpd_Job> generator_job;
 
     // Additional arbitrary data - Used by the buffer streamer to store the
     // buffer processor, and by the CPP Streamer to store the streambuf
@@ -378,6 +469,16 @@ public:
     // Sync function; called to make sure the buffer is flushed and fully synced 
     // prior to flagging it complete
     function<void (Kis_Net_Httpd_Buffer_Stream_Aux *)> sync_cb;
+
+    // Compression state, if the response is compressed; only touched from
+    // the buffer event callback
+    bool compress;
+    z_stream zstream;
+
+    // Has data gone into the compressor since the last flush, and has the
+    // compressed stream been finished
+    bool zflush_pending;
+    bool zfinished;
     
 };
 
@@ -393,6 +494,11 @@ public:
     const static int CONNECTION_GET = 0;
     const static int CONNECTION_POST = 1;
 
+    // Handlers can be run off the server thread with the connection suspended
+    const static int ASYNC_NONE = 0;
+    const static int ASYNC_RUNNING = 1;
+    const static int ASYNC_COMPLETE = 2;
+
     Kis_Net_Httpd_Connection() {
         httpcode = 200;
         postprocessor = NULL;
@@ -404,6 +510,8 @@ public:
         connection = NULL;
         response = NULL;
         custom_extension = NULL;
+        async_state = ASYNC_NONE;
+        auth_reject = false;
     }
 
     // response generated by post
@@ -448,6 +556,18 @@ public:
     // Custom arbitrary value inserted by other processors
     void *custom_extension;
 
+    // Is the handler running off the server thread, and did it reject the
+    // login; responses can only be queued once the connection is resumed
+    int async_state;
+    bool auth_reject;
+
+    // Generator or handler queued on the generator pool for this request
+    shared_ptr<Kis_Net_Httpd_Job> job;
+
+    // URL split into path segments, and any parameters captured by the route
+    // which dispatched it
+    Kis_Net_Httpd_Route_Match route;
+
     // Integrity locker
     std::mutex connection_mutex;
 };
@@ -468,6 +588,7 @@ public:
 };
 
 class Kis_Httpd_Websession;
+class Kis_Httpd_Static_Cache;
 
 class Kis_Net_Httpd : public LifetimeGlobal {
 public:
@@ -496,6 +617,14 @@ public:
     void RegisterHandler(Kis_Net_Httpd_Handler *in_handler);
     void RemoveHandler(Kis_Net_Httpd_Handler *in_handler);
 
+    // Route a path pattern to a registered handler
+    void RegisterRoute(string in_pattern, Kis_Net_Httpd_Handler *in_handler);
+
+    // Find the handler for a request, filling in the split url and route
+    // parameters; returns NULL if nothing handles it
+    Kis_Net_Httpd_Handler *FindHandler(const char *url, const char *method,
+            Kis_Net_Httpd_Route_Match& match);
+
     static string GetSuffix(string url);
     static string StripSuffix(string url);
 
@@ -531,6 +660,37 @@ public:
     static int SendStandardHttpResponse(Kis_Net_Httpd *httpd,
             Kis_Net_Httpd_Connection *connection, const char *url);
 
+    // Are we running a bounded pool of event loop threads instead of a thread
+    // per connection?
+    bool FetchUsingThreadPool() { return use_thread_pool; }
+
+    // Compression level for streamed responses, 0 if disabled
+    unsigned int FetchCompressionLevel() { return compression_level; }
+
+    // Does the client accept a content encoding
+    static bool ClientAcceptsEncoding(struct MHD_Connection *connection,
+            std::string in_encoding);
+
+    // Pick the content encoding for a streamed response; empty for none
+    string NegotiateCompression(Kis_Net_Httpd_Connection *connection, const char *url);
+
+    // Park a stream connection until the generator has more data; returns
+    // false if data or an error arrived in the meantime and the caller should
+    // read again instead
+    bool SuspendStream(Kis_Net_Httpd_Buffer_Stream_Aux *in_aux);
+
+    // Wake a parked stream connection; harmless if it isn't suspended
+    void ResumeStream(Kis_Net_Httpd_Buffer_Stream_Aux *in_aux);
+
+    // Queue work on the generator pool
+    shared_ptr<Kis_Net_Httpd_Job> QueueJob(std::function<void ()> in_fn);
+
+    // Suspend a connection and run its handler on the generator pool, resuming
+    // the connection when the handler finishes; returns false if connections
+    // can't be suspended and the handler should be run directly
+    bool QueueAsyncRequest(Kis_Net_Httpd_Connection *connection,
+            std::function<void ()> in_fn);
+
     // Catch MHD panics and try to close more elegantly
     static void MHD_Panic(void *cls, const char *file, unsigned int line,
             const char *reason);
@@ -545,6 +705,23 @@ protected:
     struct MHD_Daemon *microhttpd;
     std::vector<Kis_Net_Httpd_Handler *> handler_vec;
 
+    // Registered route patterns
+    std::vector<std::pair<string, Kis_Net_Httpd_Handler *> > route_vec;
+
+    // Routes compiled from the registered patterns, plus the handlers with
+    // no routes which have to be asked about every url.  Rebuilt under the 
+    // controller mutex whenever a handler or route is added or removed, and
+    // swapped in atomically so requests can dispatch without locking.
+    class route_table {
+    public:
+        Kis_Net_Httpd_Route_Trie trie;
+        std::vector<Kis_Net_Httpd_Handler *> unrouted;
+    };
+
+    shared_ptr<route_table> routes;
+
+    void RebuildRoutes();
+
     string conf_username, conf_password;
 
     bool use_ssl;
@@ -553,6 +730,29 @@ protected:
 
     bool running;
 
+    // Number of event loop threads; 0 runs a thread per connection
+    unsigned int http_threads;
+
+    unsigned int compression_level;
+    bool use_thread_pool;
+
+    // Streams parked waiting on their generators, woken on shutdown
+    kis_recursive_timed_mutex suspend_mutex;
+    std::set<Kis_Net_Httpd_Buffer_Stream_Aux *> suspended_streams;
+
+    // Bounded pool running stream generators and slow handlers; generators
+    // write into growable or dropping buffers and never wait on the client,
+    // so a job holds a pool thread only as long as it takes to produce its
+    // output
+    void generator_processor();
+
+    unsigned int generator_threads;
+    std::vector<std::thread> generator_pool;
+    std::mutex generator_mutex;
+    std::condition_variable generator_cv;
+    std::deque<shared_ptr<Kis_Net_Httpd_Job> > generator_queue;
+    bool generator_shutdown;
+
     std::map<string, string> mime_type_map;
 
     class static_dir {
@@ -568,6 +768,9 @@ protected:
 
     vector<static_dir> static_dir_vec;
 
+    // In-memory copy of the static files, if enabled
+    shared_ptr<Kis_Httpd_Static_Cache> static_cache;
+
     kis_recursive_timed_mutex controller_mutex;
 
     // Handle the requests and dispatch to controllers
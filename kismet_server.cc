@@ -230,8 +230,8 @@ void SpindownKismet(shared_ptr<PollableTracker> pollabletracker) {
     shared_ptr<Devicetracker> devicetracker =
         Globalreg::FetchGlobalAs<Devicetracker>(globalregistry, "DEVICE_TRACKER");
     if (devicetracker != NULL) {
-        devicetracker->store_all_devices();
-        devicetracker->databaselog_write_all_devices();
+        devicetracker->store_devices();
+        devicetracker->databaselog_write_devices();
     }
 
     // Shutdown everything
@@ -243,9 +243,6 @@ void SpindownKismet(shared_ptr<PollableTracker> pollabletracker) {
     if (daemonize == 0)
         fprintf(stderr, "\n*** KISMET IS SHUTTING DOWN ***\n");
     time_t shutdown_target = time(0) + 2;
-    int max_fd = 0;
-    fd_set rset, wset;
-    struct timeval tm;
 
     sigset_t mask, oldmask;
     sigemptyset(&mask);
@@ -253,10 +250,6 @@ void SpindownKismet(shared_ptr<PollableTracker> pollabletracker) {
     sigaddset(&mask, SIGCHLD);
 
     while (1) {
-        FD_ZERO(&rset);
-        FD_ZERO(&wset);
-        max_fd = 0;
-
         if (globalregistry->fatal_condition) {
             break;
         }
@@ -265,13 +258,8 @@ void SpindownKismet(shared_ptr<PollableTracker> pollabletracker) {
             break;
         }
 
-        // Collect all the pollable descriptors
-        max_fd = pollabletracker->MergePollableFds(&rset, &wset);
-
-        tm.tv_sec = 0;
-        tm.tv_usec = 100000;
-
-        if (select(max_fd + 1, &rset, &wset, NULL, &tm) < 0) {
+        // Wait for any pollable descriptors
+        if (pollabletracker->WaitPollableEvents() < 0) {
             if (errno != EINTR && errno != EAGAIN) {
                 break;
             }
@@ -280,7 +268,7 @@ void SpindownKismet(shared_ptr<PollableTracker> pollabletracker) {
         // Block signals while doing io loops */
         sigprocmask(SIG_BLOCK, &mask, &oldmask);
 
-        pollabletracker->ProcessPollableSelect(rset, wset);
+        pollabletracker->ProcessPollableEvents();
 
         sigprocmask(SIG_UNBLOCK, &mask, &oldmask);
 
@@ -717,10 +705,6 @@ int main(int argc, char *argv[], char *envp[]) {
     // Set up usage functions
     globalregistry->RegisterUsageFunc(Devicetracker::usage);
 
-    int max_fd = 0;
-    fd_set rset, wset;
-    struct timeval tm;
-
     const int nlwc = globalregistry->getopt_long_num++;
     const int dwc = globalregistry->getopt_long_num++;
     const int npwc = globalregistry->getopt_long_num++;
@@ -855,14 +839,14 @@ int main(int argc, char *argv[], char *envp[]) {
 
     // Base serializers
     entrytracker->RegisterSerializer("msgpack", shared_ptr<TrackerElementSerializer>(new MsgpackAdapter::Serializer(globalregistry)));
-    entrytracker->RegisterSerializer("json", shared_ptr<TrackerElementSerializer>(new JsonAdapter::Serializer(globalregistry)));
-    entrytracker->RegisterSerializer("ekjson", shared_ptr<TrackerElementSerializer>(new EkJsonAdapter::Serializer(globalregistry)));
+    entrytracker->RegisterSerializer("json", shared_ptr<TrackerElementSerializer>(new FastJsonAdapter::Serializer(globalregistry)));
+    entrytracker->RegisterSerializer("ekjson", shared_ptr<TrackerElementSerializer>(new FastJsonAdapter::EkSerializer(globalregistry)));
     entrytracker->RegisterSerializer("prettyjson", shared_ptr<TrackerElementSerializer>(new PrettyJsonAdapter::Serializer(globalregistry)));
     entrytracker->RegisterSerializer("storagejson", shared_ptr<TrackerElementSerializer>(new StorageJsonAdapter::Serializer(globalregistry)));
 
     // cmd is msgpack, jcmd is json (for now?)
     entrytracker->RegisterSerializer("cmd", shared_ptr<TrackerElementSerializer>(new MsgpackAdapter::Serializer(globalregistry)));
-    entrytracker->RegisterSerializer("jcmd", shared_ptr<TrackerElementSerializer>(new JsonAdapter::Serializer(globalregistry)));
+    entrytracker->RegisterSerializer("jcmd", shared_ptr<TrackerElementSerializer>(new FastJsonAdapter::Serializer(globalregistry)));
 
 
     if (daemonize) {
@@ -1047,15 +1031,10 @@ int main(int argc, char *argv[], char *envp[]) {
             break;
         }
 
-        max_fd = pollabletracker->MergePollableFds(&rset, &wset);
-
-        tm.tv_sec = 0;
-        tm.tv_usec = 100000;
-
-        if (select(max_fd + 1, &rset, &wset, NULL, &tm) < 0) {
+        if (pollabletracker->WaitPollableEvents() < 0) {
             if (errno != EINTR && errno != EAGAIN) {
-                fprintf(stderr, "Main select failed: %s\n", strerror(errno));
-                snprintf(errstr, STATUS_MAX, "Main select loop failed: %s",
+                fprintf(stderr, "Main event loop failed: %s\n", strerror(errno));
+                snprintf(errstr, STATUS_MAX, "Main event loop failed: %s",
                          strerror(errno));
                 CatchShutdown(-1);
             }
@@ -1066,7 +1045,7 @@ int main(int argc, char *argv[], char *envp[]) {
 
         globalregistry->timetracker->Tick();
 
-        pollabletracker->ProcessPollableSelect(rset, wset);
+        pollabletracker->ProcessPollableEvents();
 
         sigprocmask(SIG_UNBLOCK, &mask, &oldmask);
 
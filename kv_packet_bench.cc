@@ -0,0 +1,177 @@
+/* benchmark harness for the PACKET KV decoder
+ *
+ * Encodes PACKET records with the same encode_kv_capdata(...) the capture
+ * tools use, then times decoding them three ways:
+ *
+ *  - the generic msgpack unpack into a string map (the fallback path in
+ *    KisDatasource::handle_kv_packet)
+ *  - the fixed-layout msgpuck walk used by KisDatasource::decode_kv_packet_fast,
+ *    without touching the frame
+ *  - the fixed-layout walk plus the single copy of the frame into a reused
+ *    buffer, which is what the datasource does today
+ *
+ * The difference between the last two is the cost of the frame copy the
+ * datasource keeps.
+ *
+ * # build kismet, then
+ * make kv_packet_bench
+ *
+ * ./kv_packet_bench [iterations]
+ *
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>
+
+#include <chrono>
+#include <map>
+#include <string>
+
+#include <msgpack.hpp>
+
+extern "C" {
+#include "msgpuck.h"
+#include "simple_datasource_proto.h"
+simple_cap_proto_kv_t *encode_kv_capdata(struct timeval in_ts,
+        uint32_t in_pack_sz, uint8_t *in_pack);
+}
+
+// Same key comparison as kis_datasource.cc
+static bool mp_match_key(const char **in_pos, const char *in_key) {
+    if (mp_typeof(**in_pos) != MP_STR)
+        return false;
+
+    uint32_t len;
+    const char *key = mp_decode_str(in_pos, &len);
+
+    return len == strlen(in_key) && memcmp(key, in_key, len) == 0;
+}
+
+// Mirror of the layout checks in KisDatasource::decode_kv_packet_fast
+static bool decode_fast(const char *in_obj, size_t in_sz, struct timeval *ts,
+        const char **bin, uint32_t *bin_len) {
+    const char *pos = in_obj;
+
+    if (mp_check(&pos, in_obj + in_sz) != 0)
+        return false;
+
+    pos = in_obj;
+
+    if (mp_typeof(*pos) != MP_MAP || mp_decode_map(&pos) != 4)
+        return false;
+
+    if (!mp_match_key(&pos, "tv_sec") || mp_typeof(*pos) != MP_UINT)
+        return false;
+    ts->tv_sec = (time_t) mp_decode_uint(&pos);
+
+    if (!mp_match_key(&pos, "tv_usec") || mp_typeof(*pos) != MP_UINT)
+        return false;
+    ts->tv_usec = (time_t) mp_decode_uint(&pos);
+
+    if (!mp_match_key(&pos, "size") || mp_typeof(*pos) != MP_UINT)
+        return false;
+    uint64_t size = mp_decode_uint(&pos);
+
+    if (!mp_match_key(&pos, "packet") || mp_typeof(*pos) != MP_BIN)
+        return false;
+
+    *bin = mp_decode_bin(&pos, bin_len);
+
+    return size != 0 && *bin_len == size;
+}
+
+static double elapsed_ns(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char *argv[]) {
+    unsigned int iterations = 1000000;
+
+    if (argc > 1)
+        iterations = strtoul(argv[1], NULL, 10);
+
+    const unsigned int sizes[] = { 64, 256, 1500, 4000, 8192 };
+
+    // Keep the optimizer from discarding the decodes
+    volatile uint64_t sink = 0;
+
+    printf("%8s %14s %14s %14s %10s\n", "frame", "msgpack ns", "fixed ns",
+            "fixed+copy ns", "copy %");
+
+    for (auto sz : sizes) {
+        uint8_t *frame = new uint8_t[sz];
+        for (unsigned int x = 0; x < sz; x++)
+            frame[x] = (uint8_t) (x * 7);
+
+        struct timeval ts;
+        ts.tv_sec = 1500000000;
+        ts.tv_usec = 123456;
+
+        simple_cap_proto_kv_t *kv = encode_kv_capdata(ts, sz, frame);
+        const char *obj = (const char *) kv->object;
+        size_t obj_sz = ntohl(kv->header.obj_sz);
+
+        uint8_t *copybuf = new uint8_t[8192];
+
+        // Generic decoder
+        auto start = std::chrono::steady_clock::now();
+        for (unsigned int i = 0; i < iterations; i++) {
+            msgpack::unpacked result;
+            msgpack::unpack(result, obj, obj_sz);
+            std::map<std::string, msgpack::object> dict =
+                result.get().as<std::map<std::string, msgpack::object> >();
+            msgpack::object_bin bin = dict["packet"].via.bin;
+            sink += dict["tv_sec"].as<uint64_t>() + bin.size;
+        }
+        double generic_ns = elapsed_ns(start) / iterations;
+
+        // Fixed layout without the copy
+        start = std::chrono::steady_clock::now();
+        for (unsigned int i = 0; i < iterations; i++) {
+            struct timeval dts;
+            const char *bin;
+            uint32_t bin_len;
+
+            if (!decode_fast(obj, obj_sz, &dts, &bin, &bin_len)) {
+                fprintf(stderr, "fast decode failed\n");
+                exit(1);
+            }
+
+            sink += dts.tv_sec + bin_len + (uint8_t) bin[bin_len - 1];
+        }
+        double fixed_ns = elapsed_ns(start) / iterations;
+
+        // Fixed layout plus the frame copy
+        start = std::chrono::steady_clock::now();
+        for (unsigned int i = 0; i < iterations; i++) {
+            struct timeval dts;
+            const char *bin;
+            uint32_t bin_len;
+
+            if (!decode_fast(obj, obj_sz, &dts, &bin, &bin_len)) {
+                fprintf(stderr, "fast decode failed\n");
+                exit(1);
+            }
+
+            memcpy(copybuf, bin, bin_len);
+
+            sink += dts.tv_sec + bin_len + copybuf[bin_len - 1];
+        }
+        double copy_ns = elapsed_ns(start) / iterations;
+
+        printf("%8u %14.1f %14.1f %14.1f %9.1f%%\n", sz, generic_ns, fixed_ns,
+                copy_ns, copy_ns > 0 ? ((copy_ns - fixed_ns) / copy_ns) * 100 : 0);
+
+        delete[] copybuf;
+        free(kv);
+        delete[] frame;
+    }
+
+    return 0;
+}
+
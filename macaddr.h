@@ -41,6 +41,7 @@
 #include <string>
 #include <vector>
 #include <map>
+#include <functional>
 #include <sstream>
 #include <iomanip>
 
@@ -328,6 +329,17 @@ struct mac_addr {
 
 };
 
+// Hash a mac by its masked value, for use in unordered containers.  Only fully
+// masked macs hash consistently with the masked equality operator; masked 
+// searches need to use a macmap instead.
+namespace std {
+    template<> struct hash<mac_addr> {
+        std::size_t operator()(const mac_addr& m) const {
+            return std::hash<uint64_t>()(m.longmac & m.longmask);
+        }
+    };
+}
+
 
 // A templated container for storing groups of masked mac addresses.  A stl-map 
 // will work for single macs, but we need this for smart mask matching on 
@@ -0,0 +1,168 @@
+/*
+    This file is part of Kismet
+
+    Kismet is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Kismet is distributed in the hope that it will be useful,
+      but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Kismet; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#ifndef __MPSC_RINGBUF_H__
+#define __MPSC_RINGBUF_H__
+
+#include "config.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <atomic>
+#include <vector>
+
+/* Bounded lock-free multi-producer / single-consumer ring
+ *
+ * Any number of threads may push() at once without taking a lock; exactly one
+ * thread may pop() or pop_batch().  Each slot carries a sequence number which
+ * tells producers and the consumer whose turn it is to use the slot, so that a
+ * producer which has claimed a slot but not yet filled it is never read early.
+ *
+ * The size is rounded up to the next power of two.  When the ring is full,
+ * push() fails instead of blocking; it is up to the caller to decide what to
+ * do with the data it could not queue.
+ */
+
+template<class T>
+class mpsc_ringbuf {
+public:
+    mpsc_ringbuf(size_t in_size) {
+        ring_size = 1;
+        while (ring_size < in_size)
+            ring_size <<= 1;
+
+        ring_mask = ring_size - 1;
+
+        slots = new ring_slot[ring_size];
+
+        for (size_t x = 0; x < ring_size; x++)
+            slots[x].sequence.store(x, std::memory_order_relaxed);
+
+        enqueue_pos.store(0, std::memory_order_relaxed);
+        dequeue_pos.store(0, std::memory_order_relaxed);
+    }
+
+    ~mpsc_ringbuf() {
+        delete[] slots;
+    }
+
+    // Push a record into the ring from any thread; returns false if the ring
+    // is full
+    bool push(const T& in_data) {
+        ring_slot *slot;
+        size_t pos = enqueue_pos.load(std::memory_order_relaxed);
+
+        while (1) {
+            slot = &slots[pos & ring_mask];
+
+            size_t seq = slot->sequence.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t) seq - (intptr_t) pos;
+
+            if (diff == 0) {
+                // The slot is free; try to claim it
+                if (enqueue_pos.compare_exchange_weak(pos, pos + 1,
+                            std::memory_order_relaxed))
+                    break;
+            } else if (diff < 0) {
+                // The consumer hasn't freed this slot yet, so we're full
+                return false;
+            } else {
+                // Another producer beat us to this slot
+                pos = enqueue_pos.load(std::memory_order_relaxed);
+            }
+        }
+
+        slot->data = in_data;
+        slot->sequence.store(pos + 1, std::memory_order_release);
+
+        return true;
+    }
+
+    // Pop a single record; consumer thread only.  Returns false if the ring is
+    // empty
+    bool pop(T& out_data) {
+        size_t pos = dequeue_pos.load(std::memory_order_relaxed);
+        ring_slot *slot = &slots[pos & ring_mask];
+
+        size_t seq = slot->sequence.load(std::memory_order_acquire);
+
+        if ((intptr_t) seq - (intptr_t) (pos + 1) < 0)
+            return false;
+
+        out_data = slot->data;
+
+        // Hand the slot back to the producers for the next lap of the ring
+        slot->sequence.store(pos + ring_size, std::memory_order_release);
+        dequeue_pos.store(pos + 1, std::memory_order_relaxed);
+
+        return true;
+    }
+
+    // Pop up to in_max records into out_vec, consumer thread only.  Returns the
+    // number of records added.
+    size_t pop_batch(std::vector<T>& out_vec, size_t in_max) {
+        size_t num = 0;
+        T data;
+
+        while (num < in_max && pop(data)) {
+            out_vec.push_back(data);
+            num++;
+        }
+
+        return num;
+    }
+
+    // Approximate number of records in the ring; it may be out of date by the
+    // time the caller looks at it, but is safe to call from any thread
+    size_t size() {
+        size_t head = enqueue_pos.load(std::memory_order_relaxed);
+        size_t tail = dequeue_pos.load(std::memory_order_relaxed);
+
+        if (head < tail)
+            return 0;
+
+        return head - tail;
+    }
+
+    bool empty() {
+        return size() == 0;
+    }
+
+    size_t capacity() {
+        return ring_size;
+    }
+
+protected:
+    struct ring_slot {
+        std::atomic<size_t> sequence;
+        T data;
+    };
+
+    ring_slot *slots;
+    size_t ring_size;
+    size_t ring_mask;
+
+    // Keep the producer and consumer positions on their own cache lines so
+    // they don't bounce between the cores
+    alignas(64) std::atomic<size_t> enqueue_pos;
+    alignas(64) std::atomic<size_t> dequeue_pos;
+};
+
+#endif
+
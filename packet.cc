@@ -51,6 +51,10 @@ kis_packet::kis_packet(GlobalRegistry *in_globalreg) {
 }
 
 kis_packet::~kis_packet() {
+    reset();
+}
+
+void kis_packet::reset() {
 	// Delete everything we contain when we die.  I hope whomever put
 	// it there expected this.
 	for (unsigned int y = 0; y < MAX_PACKET_COMPONENTS; y++) {
@@ -66,6 +70,13 @@ kis_packet::~kis_packet() {
 
 		content_vec[y] = NULL;
 	}
+
+    ts.tv_sec = 0;
+    ts.tv_usec = 0;
+
+	error = 0;
+	filtered = 0;
+    duplicate = 0;
 }
    
 void kis_packet::insert(const unsigned int index, packet_component *data) {
@@ -100,3 +111,80 @@ void kis_packet::erase(const unsigned int index) {
 	}
 }
 
+
+const unsigned int kis_frame_pool::class_sizes[kis_frame_pool::num_classes] = {
+    250, 500, 1500, MAX_PACKET_LEN
+};
+
+kis_frame_pool::frame_class kis_frame_pool::classes[kis_frame_pool::num_classes];
+std::atomic<unsigned int> kis_frame_pool::max_pooled(1024);
+
+uint8_t *kis_frame_pool::allocate(unsigned int in_length, int *out_class) {
+    for (unsigned int c = 0; c < num_classes; c++) {
+        if (in_length > class_sizes[c])
+            continue;
+
+        frame_class *fc = &(classes[c]);
+
+        *out_class = c;
+
+        {
+            std::lock_guard<std::mutex> lk(fc->mutex);
+
+            if (fc->free_list.size() != 0) {
+                uint8_t *buf = fc->free_list.back();
+                fc->free_list.pop_back();
+                fc->hits++;
+                return buf;
+            }
+        }
+
+        fc->misses++;
+        return new uint8_t[class_sizes[c]];
+    }
+
+    // Too big to pool
+    *out_class = -1;
+    return new uint8_t[in_length];
+}
+
+void kis_frame_pool::release(uint8_t *in_data, int in_class) {
+    if (in_class < 0 || in_class >= (int) num_classes) {
+        delete[] in_data;
+        return;
+    }
+
+    frame_class *fc = &(classes[in_class]);
+
+    {
+        std::lock_guard<std::mutex> lk(fc->mutex);
+
+        if (fc->free_list.size() < max_pooled) {
+            fc->free_list.push_back(in_data);
+            return;
+        }
+    }
+
+    delete[] in_data;
+}
+
+void kis_frame_pool::set_max_pooled(unsigned int in_max) {
+    max_pooled = in_max;
+}
+
+void kis_frame_pool::get_stats(unsigned int in_class, uint64_t *hits, 
+        uint64_t *misses, uint64_t *pooled) {
+    if (in_class >= num_classes) {
+        *hits = *misses = *pooled = 0;
+        return;
+    }
+
+    frame_class *fc = &(classes[in_class]);
+
+    std::lock_guard<std::mutex> lk(fc->mutex);
+
+    *hits = fc->hits;
+    *misses = fc->misses;
+    *pooled = fc->free_list.size();
+}
+
@@ -32,6 +32,8 @@
 #include <string>
 #include <vector>
 #include <map>
+#include <atomic>
+#include <mutex>
 
 #include "globalregistry.h"
 #include "macaddr.h"
@@ -84,6 +86,10 @@ public:
 
 	kis_packet(GlobalRegistry *in_globalreg);
     ~kis_packet();
+
+    // Destroy all the components and clear the packet state so that it can be
+    // recycled by the packet pool
+    void reset();
    
     void insert(const unsigned int index, packet_component *data);
     void *fetch(const unsigned int index) const;
@@ -168,6 +174,37 @@ protected:
 
 };
 
+// Recycling pool of frame buffers, in size classes matching the packet size
+// RRD bins.  Frame data copied into a datachunk is drawn from the pool and
+// returned when the chunk is destroyed, so that steady-state packet processing
+// doesn't allocate and free a buffer for every frame.
+class kis_frame_pool {
+public:
+    static const unsigned int num_classes = 4;
+    static const unsigned int class_sizes[num_classes];
+
+    // Get a buffer of at least in_length bytes; out_class is set to the size
+    // class it came from, or -1 if it was too large to be pooled
+    static uint8_t *allocate(unsigned int in_length, int *out_class);
+    static void release(uint8_t *in_data, int in_class);
+
+    // Maximum number of free buffers held per size class
+    static void set_max_pooled(unsigned int in_max);
+
+    static void get_stats(unsigned int in_class, uint64_t *hits, uint64_t *misses,
+            uint64_t *pooled);
+
+protected:
+    struct frame_class {
+        std::mutex mutex;
+        std::vector<uint8_t *> free_list;
+        std::atomic<uint64_t> hits, misses;
+    };
+
+    static frame_class classes[num_classes];
+    static std::atomic<unsigned int> max_pooled;
+};
+
 // Arbitrary data chunk, decapsulated from the link headers
 class kis_datachunk : public packet_component {
 public:
@@ -176,6 +213,8 @@ public:
 	int dlt;
 	uint16_t source_id;
 	bool self_data;
+    // Frame pool size class of our data, or -1 if it was allocated directly
+    int pool_class;
    
     kis_datachunk() {
 		self_destruct = 1; // Our delete() handles everything
@@ -183,22 +222,20 @@ public:
         data = NULL;
         length = 0;
 		source_id = 0;
+        pool_class = -1;
     }
 
     virtual ~kis_datachunk() {
-		if (data != NULL && self_data) {
-			delete[] data;
-		}
+        release_data();
         length = 0;
     }
 
 	// Default to copy=true; it's always safe to copy, it's not always safe not to
 	virtual void set_data(uint8_t *in_data, unsigned int in_length, bool copy = true) {
-		if (data != NULL && self_data)
-			delete[] data;
+        release_data();
 
 		if (copy) {
-			data = new uint8_t[in_length];
+			data = kis_frame_pool::allocate(in_length, &pool_class);
 			memcpy(data, in_data, in_length);
 			self_data = true;
 		} else {
@@ -210,16 +247,30 @@ public:
 	}
 
     virtual void copy_data(const uint8_t *in_data, unsigned int in_length) {
-		if (data != NULL && self_data)
-			delete[] data;
+        release_data();
 
-        data = new uint8_t[in_length];
+        data = kis_frame_pool::allocate(in_length, &pool_class);
         memcpy(data, in_data, in_length);
         self_data = true;
 
 		length = in_length;
 
     }
+
+protected:
+    // Free our data if we own it, returning it to the frame pool if it came
+    // from there
+    void release_data() {
+		if (data != NULL && self_data) {
+            if (pool_class >= 0)
+                kis_frame_pool::release(data, pool_class);
+            else
+                delete[] data;
+		}
+
+        data = NULL;
+        pool_class = -1;
+    }
 };
 
 class kis_packet_checksum : public kis_datachunk {
@@ -30,6 +30,7 @@
 #include "configfile.h"
 #include "packetchain.h"
 #include "alertracker.h"
+#include "kis_datasource.h"
 
 class SortLinkPriority {
 public:
@@ -46,7 +47,8 @@ Packetchain::Packetchain() {
 	exit(-1);
 }
 
-Packetchain::Packetchain(GlobalRegistry *in_globalreg) {
+Packetchain::Packetchain(GlobalRegistry *in_globalreg) :
+    Kis_Net_Httpd_CPPStream_Handler(in_globalreg) {
     globalreg = in_globalreg;
     next_componentid = 1;
 	next_handlerid = 1;
@@ -60,6 +62,99 @@ Packetchain::Packetchain(GlobalRegistry *in_globalreg) {
         globalreg->kismet_config->FetchOptUInt("packet_backlog_limit", 8192);
 
     packetchain_shutdown = false;
+    packet_backlog = 0;
+
+    // Size the queue to hold everything up to the drop limit; with no drop limit
+    // we still need a bound, so pick a generous one
+    if (packet_queue_drop != 0)
+        packet_queue = new mpsc_ringbuf<packet_queue_entry>(packet_queue_drop + 1);
+    else
+        packet_queue = new mpsc_ringbuf<packet_queue_entry>(65536);
+
+    packet_thread_waiting = false;
+    packet_queue_processed = 0;
+    packet_queue_dropped = 0;
+    packet_queue_latency_total_ns = 0;
+    packet_queue_latency_max_ns = 0;
+
+    packet_stats_id =
+        entrytracker->RegisterField("kismet.packetchain.packet_stats", TrackerMap,
+                "packet queue statistics");
+    packet_stats_depth_id =
+        entrytracker->RegisterField("kismet.packetchain.queue_depth", TrackerUInt64,
+                "packets waiting in the packet queue");
+    packet_stats_size_id =
+        entrytracker->RegisterField("kismet.packetchain.queue_size", TrackerUInt64,
+                "maximum size of the packet queue");
+    packet_stats_backlog_id =
+        entrytracker->RegisterField("kismet.packetchain.backlog", TrackerUInt64,
+                "packets queued or being processed");
+    packet_stats_processed_id =
+        entrytracker->RegisterField("kismet.packetchain.processed", TrackerUInt64,
+                "packets taken from the queue for processing");
+    packet_stats_dropped_id =
+        entrytracker->RegisterField("kismet.packetchain.dropped", TrackerUInt64,
+                "packets dropped because the queue was full");
+    packet_stats_latency_avg_id =
+        entrytracker->RegisterField("kismet.packetchain.enqueue_latency_avg_us", 
+                TrackerDouble, "average time from enqueue to processing, in usec");
+    packet_stats_latency_max_id =
+        entrytracker->RegisterField("kismet.packetchain.enqueue_latency_max_us", 
+                TrackerDouble, "maximum time from enqueue to processing, in usec");
+
+    packet_pool_max =
+        globalreg->kismet_config->FetchOptUInt("packet_pool_size", 1024);
+    packet_pool_hits = 0;
+    packet_pool_misses = 0;
+
+    kis_frame_pool::set_max_pooled(packet_pool_max);
+
+    pool_stats_id =
+        entrytracker->RegisterField("kismet.packetchain.pool_stats", TrackerMap,
+                "packet and frame buffer pool statistics");
+    pool_packets_id =
+        entrytracker->RegisterField("kismet.packetchain.pool.packets", TrackerMap,
+                "packet pool");
+    pool_frames_id =
+        entrytracker->RegisterField("kismet.packetchain.pool.frames", TrackerVector,
+                "frame buffer pools, by size class");
+    pool_frame_id =
+        entrytracker->RegisterField("kismet.packetchain.pool.frame_class", TrackerMap,
+                "frame buffer pool");
+    pool_size_id =
+        entrytracker->RegisterField("kismet.packetchain.pool.size", TrackerUInt64,
+                "size of pooled frame buffers, in bytes");
+    pool_hits_id =
+        entrytracker->RegisterField("kismet.packetchain.pool.hits", TrackerUInt64,
+                "allocations satisfied from the pool");
+    pool_misses_id =
+        entrytracker->RegisterField("kismet.packetchain.pool.misses", TrackerUInt64,
+                "allocations which could not be satisfied from the pool");
+    pool_free_id =
+        entrytracker->RegisterField("kismet.packetchain.pool.free", TrackerUInt64,
+                "unused objects currently held in the pool");
+
+    pack_comp_datasrc = RegisterPacketComponent("KISDATASRC");
+
+    packet_thread_count =
+        globalreg->kismet_config->FetchOptUInt("packet_threads", 1);
+
+    if (packet_thread_count > 1) {
+        _MSG("Processing packets with " + UIntToString(packet_thread_count) + 
+                " dissection threads", MSGFLAG_INFO);
+
+        handoff_condition.lock();
+        handoff_thread = std::thread(packet_handoff_processor, this);
+
+        for (unsigned int x = 0; x < packet_thread_count; x++) {
+            packet_worker *worker = new packet_worker();
+            worker->worker_condition.lock();
+            packet_workers.push_back(worker);
+        }
+
+        for (unsigned int x = 0; x < packet_thread_count; x++) 
+            packet_workers[x]->thread = std::thread(packet_worker_processor, this, x);
+    }
 
     // Lock the packet conditional
     packet_condition.lock();
@@ -70,12 +165,72 @@ Packetchain::Packetchain(GlobalRegistry *in_globalreg) {
 Packetchain::~Packetchain() {
     {
         // Tell the packet thread we're dying and unlock it
-        local_locker qlock(&packetqueue_mutex);
         packetchain_shutdown = true;
         packet_condition.unlock();
         packet_thread.join();
     }
 
+    // Packets still queued when the packet thread stopped are never going to
+    // be processed; they aren't returned to the pool, since the rest of the
+    // server may already be gone by now, just deleted
+    {
+        packet_queue_entry e;
+
+        while (packet_queue->pop(e))
+            delete e.packet;
+    }
+
+    delete packet_queue;
+
+    // Shut down the workers and the hand-off thread; the shutdown flag is
+    // already set so they exit as soon as they're woken up
+    for (auto w : packet_workers) {
+        {
+            local_locker wlock(&(w->worker_mutex));
+            w->worker_condition.unlock();
+        }
+
+        w->thread.join();
+
+        // Every handoff in a worker queue is also in the hand-off queue, which
+        // owns it
+        while (!w->worker_queue.empty())
+            w->worker_queue.pop();
+
+        delete w;
+    }
+    packet_workers.clear();
+
+    if (handoff_thread.joinable()) {
+        {
+            local_locker hlock(&handoff_mutex);
+            handoff_condition.unlock();
+        }
+
+        handoff_thread.join();
+    }
+
+    {
+        local_locker hlock(&handoff_mutex);
+
+        while (!handoff_queue.empty()) {
+            packet_handoff *handoff = handoff_queue.front();
+            handoff_queue.pop();
+
+            delete handoff->packet;
+            delete handoff;
+        }
+    }
+
+    {
+        local_locker plock(&packetpool_mutex);
+
+        for (auto p : packet_pool)
+            delete p;
+
+        packet_pool.clear();
+    }
+
     {
         local_eol_locker lock(&packetchain_mutex);
 
@@ -173,8 +328,25 @@ string Packetchain::FetchPacketComponentName(int in_id) {
 }
 
 kis_packet *Packetchain::GeneratePacket() {
+    kis_packet *newpack = NULL;
+
+    // Recycle a packet if we have one
+    {
+        local_locker plock(&packetpool_mutex);
+
+        if (packet_pool.size() != 0) {
+            newpack = packet_pool.back();
+            packet_pool.pop_back();
+            packet_pool_hits++;
+        }
+    }
+
+    if (newpack == NULL) {
+        newpack = new kis_packet(globalreg);
+        packet_pool_misses++;
+    }
+
     local_locker lock(&packetchain_mutex);
-    kis_packet *newpack = new kis_packet(globalreg);
     pc_link *pcl;
 
     // Run the frame through the genesis chain incase anything
@@ -202,128 +374,261 @@ kis_packet *Packetchain::GeneratePacket() {
     return newpack;
 }
 
+void Packetchain::RunChain(std::vector<Packetchain::pc_link *>& in_chain, 
+        kis_packet *in_pack) {
+    for (auto pcl : in_chain) {
+        if (pcl->callback != NULL)
+            pcl->callback(globalreg, pcl->auxdata, in_pack);
+        else if (pcl->l_callback != NULL)
+            pcl->l_callback(in_pack);
+    }
+}
+
+void Packetchain::RunWorkerChain(std::vector<Packetchain::pc_link *>& in_chain, 
+        kis_packet *in_pack) {
+    for (auto pcl : in_chain) {
+        if (pcl->parallel_safe) {
+            if (pcl->callback != NULL)
+                pcl->callback(globalreg, pcl->auxdata, in_pack);
+            else if (pcl->l_callback != NULL)
+                pcl->l_callback(in_pack);
+
+            continue;
+        }
+
+        local_locker hlock(&(pcl->handler_mutex));
+
+        if (pcl->callback != NULL)
+            pcl->callback(globalreg, pcl->auxdata, in_pack);
+        else if (pcl->l_callback != NULL)
+            pcl->l_callback(in_pack);
+    }
+}
+
+void Packetchain::CompletePacket(kis_packet *in_pack) {
+    RunChain(classifier_chain, in_pack);
+    RunChain(tracker_chain, in_pack);
+    RunChain(logging_chain, in_pack);
+
+    DestroyPacket(in_pack);
+
+    packet_backlog--;
+}
+
+void Packetchain::DispatchPacket(kis_packet *in_pack) {
+    // Shard by datasource so that packets from a single source are always
+    // dissected in order by the same worker
+    unsigned int shard = 0;
+
+    packetchain_comp_datasource *datasrc =
+        (packetchain_comp_datasource *) in_pack->fetch(pack_comp_datasrc);
+
+    if (datasrc != NULL && datasrc->ref_source != NULL)
+        shard = datasrc->ref_source->get_source_number() % packet_workers.size();
+
+    packet_handoff *handoff = new packet_handoff();
+    handoff->packet = in_pack;
+    handoff->complete = false;
+
+    // Reserve our place in the hand-off queue before the worker sees the packet,
+    // so the final stages run in the order the packets were queued
+    {
+        local_locker hlock(&handoff_mutex);
+        handoff_queue.push(handoff);
+    }
+
+    packet_worker *worker = packet_workers[shard];
+
+    {
+        local_locker wlock(&(worker->worker_mutex));
+        worker->worker_queue.push(handoff);
+        worker->worker_condition.unlock();
+    }
+}
+
 void Packetchain::packet_queue_processor(Packetchain *packetchain) {
-    kis_packet *packet = NULL;
-    local_demand_locker queue_lock(&(packetchain->packetqueue_mutex));
-    local_demand_locker chain_lock(&(packetchain->packetchain_mutex));
+    std::vector<packet_queue_entry> batch;
 
-    while (1) {
-        queue_lock.lock();
+    batch.reserve(64);
 
+    while (1) {
         // Are we shutting down?
         if (packetchain->packetchain_shutdown)
             return;
-      
-        if (packetchain->packet_queue.size() != 0) {
-            // Get the next packet
-            packet = packetchain->packet_queue.front();
-            packetchain->packet_queue.pop();
 
-            // Unlock the queue while we process that packet
-            queue_lock.unlock();
+        batch.clear();
 
-            // Lock the  packet chain itself because we need to have consistent
-            // packet chain vectors
-            
-            for (auto pcl : packetchain->postcap_chain) {
-                if (pcl->callback != NULL)
-                    pcl->callback(packetchain->globalreg, pcl->auxdata, packet);
-                else if (pcl->l_callback != NULL)
-                    pcl->l_callback(packet);
-            }
+        if (packetchain->packet_queue->pop_batch(batch, 64) != 0) {
+            uint64_t now = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now().time_since_epoch()).count();
 
-            for (auto pcl : packetchain->llcdissect_chain) {
-                if (pcl->callback != NULL)
-                    pcl->callback(packetchain->globalreg, pcl->auxdata, packet);
-                else if (pcl->l_callback != NULL)
-                    pcl->l_callback(packet);
-            }
+            for (auto e : batch) {
+                uint64_t latency = 0;
 
-            for (auto pcl : packetchain->decrypt_chain) {
-                if (pcl->callback != NULL)
-                    pcl->callback(packetchain->globalreg, pcl->auxdata, packet);
-                else if (pcl->l_callback != NULL)
-                    pcl->l_callback(packet);
-            }
+                if (now > e.enqueue_ns)
+                    latency = now - e.enqueue_ns;
 
-            for (auto pcl : packetchain->datadissect_chain) {
-                if (pcl->callback != NULL)
-                    pcl->callback(packetchain->globalreg, pcl->auxdata, packet);
-                else if (pcl->l_callback != NULL)
-                    pcl->l_callback(packet);
-            }
+                packetchain->packet_queue_latency_total_ns += latency;
 
-            for (auto pcl : packetchain->classifier_chain) {
-                if (pcl->callback != NULL)
-                    pcl->callback(packetchain->globalreg, pcl->auxdata, packet);
-                else if (pcl->l_callback != NULL)
-                    pcl->l_callback(packet);
+                if (latency > packetchain->packet_queue_latency_max_ns)
+                    packetchain->packet_queue_latency_max_ns = latency;
             }
 
-            for (auto pcl : packetchain->tracker_chain) {
-                if (pcl->callback != NULL)
-                    pcl->callback(packetchain->globalreg, pcl->auxdata, packet);
-                else if (pcl->l_callback != NULL)
-                    pcl->l_callback(packet);
-            }
+            packetchain->packet_queue_processed += batch.size();
 
-            for (auto pcl : packetchain->logging_chain) {
-                if (pcl->callback != NULL)
-                    pcl->callback(packetchain->globalreg, pcl->auxdata, packet);
-                else if (pcl->l_callback != NULL)
-                    pcl->l_callback(packet);
-            }
+            for (auto e : batch) {
+                if (packetchain->packet_workers.size() != 0) {
+                    packetchain->DispatchPacket(e.packet);
+                    continue;
+                }
 
-            packetchain->DestroyPacket(packet);
+                packetchain->RunChain(packetchain->postcap_chain, e.packet);
+                packetchain->RunChain(packetchain->llcdissect_chain, e.packet);
+                packetchain->RunChain(packetchain->decrypt_chain, e.packet);
+                packetchain->RunChain(packetchain->datadissect_chain, e.packet);
+
+                packetchain->CompletePacket(e.packet);
+            }
 
             // re-loop in case we have more packets
+            continue;
+        } 
+
+        // We have no packets; lock our conditional and tell the producers we're
+        // going to sleep, then check one last time so that a packet queued while
+        // we were deciding to sleep isn't stranded
+        packetchain->packet_condition.lock();
+        packetchain->packet_thread_waiting = true;
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+
+        if (!packetchain->packet_queue->empty() || packetchain->packetchain_shutdown) {
+            packetchain->packet_thread_waiting = false;
+            packetchain->packet_condition.unlock();
+            continue;
+        }
+
+        // Block until something pokes the conditional locker
+        packetchain->packet_condition.block_until();
+
+        packetchain->packet_thread_waiting = false;
+    }
+}
+
+void Packetchain::packet_worker_processor(Packetchain *packetchain, 
+        unsigned int in_worker) {
+    packet_worker *worker = packetchain->packet_workers[in_worker];
+    packet_handoff *handoff = NULL;
+    local_demand_locker queue_lock(&(worker->worker_mutex));
+
+    while (1) {
+        queue_lock.lock();
+
+        if (packetchain->packetchain_shutdown)
+            return;
+
+        if (worker->worker_queue.size() != 0) {
+            handoff = worker->worker_queue.front();
+            worker->worker_queue.pop();
+
+            queue_lock.unlock();
+
+            packetchain->RunWorkerChain(packetchain->postcap_chain, handoff->packet);
+            packetchain->RunWorkerChain(packetchain->llcdissect_chain, handoff->packet);
+            packetchain->RunWorkerChain(packetchain->decrypt_chain, handoff->packet);
+            packetchain->RunWorkerChain(packetchain->datadissect_chain, handoff->packet);
+
+            // Mark it complete and wake up the hand-off thread in case it was
+            // waiting on this packet
+            {
+                local_locker hlock(&(packetchain->handoff_mutex));
+                handoff->complete = true;
+                packetchain->handoff_condition.unlock();
+            }
+
             continue;
         } else {
-            // We have no packets, lock our conditional until something queues 
-            // a new packet and fall out of the selector
-            packetchain->packet_condition.lock();
+            worker->worker_condition.lock();
         }
 
-        // No packets; fall through to blocking until we have them
         queue_lock.unlock();
 
+        worker->worker_condition.block_until();
+    }
+}
 
-        // Block until something pokes the conditional locker
-        packetchain->packet_condition.block_until();
+void Packetchain::packet_handoff_processor(Packetchain *packetchain) {
+    packet_handoff *handoff = NULL;
+    local_demand_locker queue_lock(&(packetchain->handoff_mutex));
+
+    while (1) {
+        queue_lock.lock();
+
+        if (packetchain->packetchain_shutdown)
+            return;
+
+        // Only the oldest packet can be completed, even if later packets have
+        // already been dissected by other workers
+        if (packetchain->handoff_queue.size() != 0 &&
+                packetchain->handoff_queue.front()->complete) {
+            handoff = packetchain->handoff_queue.front();
+            packetchain->handoff_queue.pop();
+
+            queue_lock.unlock();
+
+            packetchain->CompletePacket(handoff->packet);
+            delete handoff;
+
+            continue;
+        } else {
+            packetchain->handoff_condition.lock();
+        }
+
+        queue_lock.unlock();
+
+        packetchain->handoff_condition.block_until();
     }
 }
 
 int Packetchain::ProcessPacket(kis_packet *in_pack) {
-    local_locker qlock(&packetqueue_mutex);
-
-    if (packet_queue.size() > packet_queue_warning &&
+    // Raise the queue and drop warnings at most once every 30 seconds; multiple
+    // sources can hit this at once so only the thread which wins the timestamp
+    // update raises the alert
+    if (packet_backlog > packet_queue_warning &&
             packet_queue_warning != 0) {
-        time_t offt = time(0) - last_packet_queue_user_warning;
-
-        if (offt > 30) {
-            last_packet_queue_user_warning = time(0);
+        time_t now = time(0);
+        time_t last = last_packet_queue_user_warning;
 
+        if (now - last > 30 && 
+                last_packet_queue_user_warning.compare_exchange_strong(last, now)) {
             shared_ptr<Alertracker> alertracker =
                 Globalreg::FetchMandatoryGlobalAs<Alertracker>(globalreg, "ALERTTRACKER");
             alertracker->RaiseOneShot("PACKETQUEUE", 
-                    "The packet queue has a backlog of " + IntToString(packet_queue.size()) + 
+                    "The packet queue has a backlog of " + UIntToString(packet_backlog) + 
                     " packets; if you have multiple data sources it's possible that your "
                     "system is not fast enough.  Kismet will continue to process "
                     "packets, this may be a momentary spike in packet load.", -1);
         }
     }
 
-    if (packet_queue_drop != 0 && packet_queue.size() > packet_queue_drop) {
-        time_t offt = time(0) - last_packet_drop_user_warning;
+    packet_queue_entry entry;
+    entry.packet = in_pack;
+    entry.enqueue_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+
+    if ((packet_queue_drop != 0 && packet_backlog > packet_queue_drop) ||
+            !packet_queue->push(entry)) {
+        packet_queue_dropped++;
 
-        if (offt > 30) {
-            last_packet_drop_user_warning = time(0);
+        time_t now = time(0);
+        time_t last = last_packet_drop_user_warning;
 
+        if (now - last > 30 &&
+                last_packet_drop_user_warning.compare_exchange_strong(last, now)) {
             shared_ptr<Alertracker> alertracker =
                 Globalreg::FetchMandatoryGlobalAs<Alertracker>(globalreg, "ALERTTRACKER");
             alertracker->RaiseOneShot("PACKETLOST", 
                     "Kismet has started to drop packets; the packet queue has a backlog "
-                    "of " + IntToString(packet_queue.size()) + " packets.  Your system "
+                    "of " + UIntToString(packet_backlog) + " packets.  Your system "
                     "may not be fast enough to process the number of packets being seen. "
                     "You change this behavior in 'kismet_memory.conf'.", -1);
         }
@@ -332,9 +637,14 @@ int Packetchain::ProcessPacket(kis_packet *in_pack) {
         return 1;
     }
 
-    packet_queue.push(in_pack);
+    packet_backlog++;
 
-    packet_condition.unlock();
+    // Only wake the packet thread if it has gone to sleep; the fence pairs with
+    // the packet thread setting the waiting flag before checking the queue
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+
+    if (packet_thread_waiting)
+        packet_condition.unlock();
 
     return 1;
 }
@@ -352,6 +662,18 @@ void Packetchain::DestroyPacket(kis_packet *in_pack) {
         (*(pcl->callback))(globalreg, pcl->auxdata, in_pack);
     }
 
+    // Clear out the components and return it to the pool, if there's room
+    in_pack->reset();
+
+    {
+        local_locker plock(&packetpool_mutex);
+
+        if (packet_pool.size() < packet_pool_max) {
+            packet_pool.push_back(in_pack);
+            return;
+        }
+    }
+
 	delete in_pack;
 }
 
@@ -368,6 +690,7 @@ int Packetchain::RegisterIntHandler(pc_callback in_cb, void *in_aux,
     link->l_callback = in_l_cb;
     link->auxdata = in_aux;
 	link->id = next_handlerid++;
+    link->parallel_safe = false;
             
     switch (in_chain) {
         case CHAINPOS_GENESIS:
@@ -444,6 +767,39 @@ int Packetchain::RegisterHandler(function<int (kis_packet *)> in_cb, int in_chai
     return RegisterIntHandler(NULL, NULL, in_cb, in_chain, in_prio);
 }
 
+int Packetchain::SetHandlerParallelSafe(int in_id, int in_chain) {
+    local_locker lock(&packetchain_mutex);
+
+    std::vector<Packetchain::pc_link *> *chain = NULL;
+
+    switch (in_chain) {
+        case CHAINPOS_POSTCAP:
+            chain = &postcap_chain;
+            break;
+        case CHAINPOS_LLCDISSECT:
+            chain = &llcdissect_chain;
+            break;
+        case CHAINPOS_DECRYPT:
+            chain = &decrypt_chain;
+            break;
+        case CHAINPOS_DATADISSECT:
+            chain = &datadissect_chain;
+            break;
+        default:
+            // Every other chain is only ever run from a single thread
+            return -1;
+    }
+
+    for (auto pcl : *chain) {
+        if (pcl->id == in_id) {
+            pcl->parallel_safe = true;
+            return 1;
+        }
+    }
+
+    return -1;
+}
+
 int Packetchain::RemoveHandler(int in_id, int in_chain) {
 	unsigned int x;
 
@@ -618,3 +974,134 @@ int Packetchain::RemoveHandler(pc_callback in_cb, int in_chain) {
     return 1;
 }
 
+
+bool Packetchain::Httpd_VerifyPath(const char *path, const char *method) {
+    if (strcmp(method, "GET") != 0)
+        return false;
+
+    if (!Httpd_CanSerialize(path))
+        return false;
+
+    std::string stripped = Httpd_StripSuffix(path);
+
+    if (stripped == "/packetchain/packet_stats")
+        return true;
+
+    if (stripped == "/packetchain/pool_stats")
+        return true;
+
+    return false;
+}
+
+void Packetchain::Httpd_CreateStreamResponse(
+        Kis_Net_Httpd *httpd __attribute__((unused)),
+        Kis_Net_Httpd_Connection *connection __attribute__((unused)),
+        const char *path, const char *method, 
+        const char *upload_data __attribute__((unused)),
+        size_t *upload_data_size __attribute__((unused)), 
+        std::stringstream &stream) {
+
+    if (strcmp(method, "GET") != 0)
+        return;
+
+    if (!Httpd_CanSerialize(path))
+        return;
+
+    std::string stripped = Httpd_StripSuffix(path);
+
+    if (stripped == "/packetchain/pool_stats") {
+        SharedTrackerElement stats(new TrackerElement(TrackerMap, pool_stats_id));
+
+        SharedTrackerElement packets(new TrackerElement(TrackerMap, pool_packets_id));
+        stats->add_map(packets);
+
+        SharedTrackerElement hits(new TrackerElement(TrackerUInt64, pool_hits_id));
+        hits->set((uint64_t) packet_pool_hits);
+        packets->add_map(hits);
+
+        SharedTrackerElement misses(new TrackerElement(TrackerUInt64, pool_misses_id));
+        misses->set((uint64_t) packet_pool_misses);
+        packets->add_map(misses);
+
+        SharedTrackerElement pooled(new TrackerElement(TrackerUInt64, pool_free_id));
+        {
+            local_locker plock(&packetpool_mutex);
+            pooled->set((uint64_t) packet_pool.size());
+        }
+        packets->add_map(pooled);
+
+        SharedTrackerElement frames(new TrackerElement(TrackerVector, pool_frames_id));
+        stats->add_map(frames);
+
+        for (unsigned int c = 0; c < kis_frame_pool::num_classes; c++) {
+            uint64_t f_hits, f_misses, f_pooled;
+
+            kis_frame_pool::get_stats(c, &f_hits, &f_misses, &f_pooled);
+
+            SharedTrackerElement frame(new TrackerElement(TrackerMap, pool_frame_id));
+
+            SharedTrackerElement size(new TrackerElement(TrackerUInt64, pool_size_id));
+            size->set((uint64_t) kis_frame_pool::class_sizes[c]);
+            frame->add_map(size);
+
+            SharedTrackerElement fhits(new TrackerElement(TrackerUInt64, pool_hits_id));
+            fhits->set(f_hits);
+            frame->add_map(fhits);
+
+            SharedTrackerElement fmisses(new TrackerElement(TrackerUInt64, pool_misses_id));
+            fmisses->set(f_misses);
+            frame->add_map(fmisses);
+
+            SharedTrackerElement fpooled(new TrackerElement(TrackerUInt64, pool_free_id));
+            fpooled->set(f_pooled);
+            frame->add_map(fpooled);
+
+            frames->add_vector(frame);
+        }
+
+        Httpd_Serialize(path, stream, stats);
+        return;
+    }
+
+    if (stripped != "/packetchain/packet_stats")
+        return;
+
+    SharedTrackerElement stats(new TrackerElement(TrackerMap, packet_stats_id));
+
+    SharedTrackerElement depth(new TrackerElement(TrackerUInt64, packet_stats_depth_id));
+    depth->set((uint64_t) packet_queue->size());
+    stats->add_map(depth);
+
+    SharedTrackerElement size(new TrackerElement(TrackerUInt64, packet_stats_size_id));
+    size->set((uint64_t) packet_queue->capacity());
+    stats->add_map(size);
+
+    SharedTrackerElement backlog(new TrackerElement(TrackerUInt64, packet_stats_backlog_id));
+    backlog->set((uint64_t) packet_backlog);
+    stats->add_map(backlog);
+
+    uint64_t processed = packet_queue_processed;
+
+    SharedTrackerElement proc(new TrackerElement(TrackerUInt64, packet_stats_processed_id));
+    proc->set(processed);
+    stats->add_map(proc);
+
+    SharedTrackerElement dropped(new TrackerElement(TrackerUInt64, packet_stats_dropped_id));
+    dropped->set((uint64_t) packet_queue_dropped);
+    stats->add_map(dropped);
+
+    double avg_us = 0;
+    if (processed != 0)
+        avg_us = (double) packet_queue_latency_total_ns / processed / 1000;
+
+    SharedTrackerElement lat_avg(new TrackerElement(TrackerDouble, packet_stats_latency_avg_id));
+    lat_avg->set(avg_us);
+    stats->add_map(lat_avg);
+
+    SharedTrackerElement lat_max(new TrackerElement(TrackerDouble, packet_stats_latency_max_id));
+    lat_max->set((double) packet_queue_latency_max_ns / 1000);
+    stats->add_map(lat_max);
+
+    Httpd_Serialize(path, stream, stats);
+}
+
@@ -35,9 +35,12 @@
 #include <functional>
 #include <queue>
 #include <thread>
+#include <atomic>
 
 #include "globalregistry.h"
 #include "kis_mutex.h"
+#include "kis_net_microhttpd.h"
+#include "mpsc_ringbuf.h"
 #include "packet.h"
 
 
@@ -47,6 +50,20 @@
  * They are then processed by the packet consumption thread(s) via the registered
  * chain handlers.
  *
+ * By default a single thread runs every chain in order.  When packet_threads
+ * is set above 1 in the config, the POST-CAPTURE through DATA-DISSECT chains
+ * are run by a pool of worker threads, with packets sharded across the workers
+ * by the datasource they arrived on so that the ordering of packets from any
+ * single source is preserved.  Dissected packets are handed back, in the order
+ * they were originally queued, to a single thread which runs the CLASSIFIER,
+ * TRACKER, and LOGGING chains.
+ *
+ * Handlers in the dissection chains are assumed NOT to be safe to run on
+ * several packets at once; unless a handler has been flagged with
+ * SetHandlerParallelSafe(...) its calls are serialized across the workers by
+ * a per-handler lock.  Only flag a handler once any state it shares between
+ * packets (caches, counters, tables) is protected.
+ *
  * Once being inserted into the packet chain, the packet pointer may no longer be
  * considered valid by the generating thread.
  *
@@ -90,7 +107,7 @@
 
 class kis_packet;
 
-class Packetchain : public LifetimeGlobal {
+class Packetchain : public Kis_Net_Httpd_CPPStream_Handler, public LifetimeGlobal {
 public:
     static std::shared_ptr<Packetchain> create_packetchain(GlobalRegistry *in_globalreg) {
         std::shared_ptr<Packetchain> mon(new Packetchain(in_globalreg));
@@ -127,6 +144,11 @@ public:
         std::function<int (kis_packet *)> l_callback;
         void *auxdata;
 		int id;
+
+        // Handler may be run on several dissection workers at once; if not,
+        // calls from the workers are serialized by the handler mutex
+        std::atomic<bool> parallel_safe;
+        kis_recursive_timed_mutex handler_mutex;
     } pc_link;
 
     // Register a callback, aux data, a chain to put it in, and the priority 
@@ -135,11 +157,42 @@ public:
     int RemoveHandler(pc_callback in_cb, int in_chain);
 	int RemoveHandler(int in_id, int in_chain);
 
+    // Flag a dissection handler as safe to run on several packets at once
+    // when running multiple packet threads
+    int SetHandlerParallelSafe(int in_id, int in_chain);
+
+    // HTTP api for the packet queue statistics
+    virtual bool Httpd_VerifyPath(const char *path, const char *method);
+
+    virtual void Httpd_CreateStreamResponse(Kis_Net_Httpd *httpd,
+            Kis_Net_Httpd_Connection *connection,
+            const char *url, const char *method, const char *upload_data,
+            size_t *upload_data_size, std::stringstream &stream);
+
 protected:
     GlobalRegistry *globalreg;
 
     static void packet_queue_processor(Packetchain *packetchain);
 
+    // Parallel dissection workers and the ordered classifier/tracker/logging thread
+    static void packet_worker_processor(Packetchain *packetchain, unsigned int in_worker);
+    static void packet_handoff_processor(Packetchain *packetchain);
+
+    // Run a packet through all the handlers of a chain
+    void RunChain(std::vector<Packetchain::pc_link *>& in_chain, kis_packet *in_pack);
+
+    // Run a dissection chain from a worker thread, serializing any handlers
+    // which are not flagged as parallel-safe
+    void RunWorkerChain(std::vector<Packetchain::pc_link *>& in_chain, kis_packet *in_pack);
+
+    // Hand a packet off to a dissection worker, used by the queue processor
+    // when running multiple packet threads
+    void DispatchPacket(kis_packet *in_pack);
+
+    // Final stages of processing, which are always run in the order packets were
+    // queued; dispatches the remaining chains and destroys the packet
+    void CompletePacket(kis_packet *in_pack);
+
     // Common function for both insertion methods
     int RegisterIntHandler(pc_callback in_cb, void *in_aux, 
             std::function<int (kis_packet *)> in_l_cb, 
@@ -167,16 +220,74 @@ protected:
     // Whole packet-chain mutex
     kis_recursive_timed_mutex packetchain_mutex;
 
-    // Packet queue management
+    // Packet queue management; packets are pushed into a lock-free ring by any
+    // number of datasource threads and drained in batches by the packet thread.
+    // The conditional is only poked when the packet thread has declared that it
+    // is going to sleep, so producers normally never touch a lock.
+    struct packet_queue_entry {
+        kis_packet *packet;
+        uint64_t enqueue_ns;
+    };
+
     std::thread packet_thread;
-    kis_recursive_timed_mutex packetqueue_mutex;
+    mpsc_ringbuf<packet_queue_entry> *packet_queue;
     conditional_locker<int> packet_condition;
-    std::queue<kis_packet *> packet_queue;
-    bool packetchain_shutdown;
+    std::atomic<bool> packet_thread_waiting;
+    std::atomic<bool> packetchain_shutdown;
+
+    // Queue statistics; the latency is the time a packet waited between being
+    // enqueued and being picked up by the packet thread
+    std::atomic<uint64_t> packet_queue_processed, packet_queue_dropped;
+    std::atomic<uint64_t> packet_queue_latency_total_ns, packet_queue_latency_max_ns;
+
+    int packet_stats_id, packet_stats_depth_id, packet_stats_size_id, 
+        packet_stats_backlog_id, packet_stats_processed_id, packet_stats_dropped_id,
+        packet_stats_latency_avg_id, packet_stats_latency_max_id;
+
+    // Number of packets queued or being processed by any packet thread; this is
+    // what the warning and drop limits are compared against
+    std::atomic<unsigned int> packet_backlog;
+
+    // A packet in flight between the dissection workers and the ordered
+    // classifier/tracker/logging stages
+    struct packet_handoff {
+        kis_packet *packet;
+        std::atomic<bool> complete;
+    };
+
+    // Dissection worker, with its own queue of packets
+    struct packet_worker {
+        std::thread thread;
+        kis_recursive_timed_mutex worker_mutex;
+        conditional_locker<int> worker_condition;
+        std::queue<packet_handoff *> worker_queue;
+    };
+
+    unsigned int packet_thread_count;
+    std::vector<packet_worker *> packet_workers;
+
+    // Datasource component used to shard packets across workers
+    int pack_comp_datasrc;
+
+    // Ordered hand-off from the workers to the final stages
+    std::thread handoff_thread;
+    kis_recursive_timed_mutex handoff_mutex;
+    conditional_locker<int> handoff_condition;
+    std::queue<packet_handoff *> handoff_queue;
+
+    // Recycled packets; packets keep their component vector when they're
+    // returned to the pool so it doesn't need to be re-allocated
+    kis_recursive_timed_mutex packetpool_mutex;
+    std::vector<kis_packet *> packet_pool;
+    unsigned int packet_pool_max;
+    std::atomic<uint64_t> packet_pool_hits, packet_pool_misses;
+
+    int pool_stats_id, pool_packets_id, pool_frames_id, pool_frame_id,
+        pool_size_id, pool_hits_id, pool_misses_id, pool_free_id;
 
     // Warning and discard levels for packet queue being full
     unsigned int packet_queue_warning, packet_queue_drop;
-    time_t last_packet_queue_user_warning, last_packet_drop_user_warning;
+    std::atomic<time_t> last_packet_queue_user_warning, last_packet_drop_user_warning;
 };
 
 #endif
@@ -281,11 +281,16 @@ Kis_80211_Phy::Kis_80211_Phy(GlobalRegistry *in_globalreg,
 	packetchain->RegisterHandler(&CommonClassifierDot11, this,
             CHAINPOS_CLASSIFIER, -100);
 
-	packetchain->RegisterHandler(&phydot11_packethook_wep, this,
+	int wep_id = packetchain->RegisterHandler(&phydot11_packethook_wep, this,
             CHAINPOS_DECRYPT, -100);
-	packetchain->RegisterHandler(&phydot11_packethook_dot11, this,
+	int dot11_id = packetchain->RegisterHandler(&phydot11_packethook_dot11, this,
             CHAINPOS_LLCDISSECT, -100);
 
+    // The dissector and decryptor lock the duplicate table, wep keys, and IE
+    // cache, so they can run on multiple packet threads
+    packetchain->SetHandlerParallelSafe(wep_id, CHAINPOS_DECRYPT);
+    packetchain->SetHandlerParallelSafe(dot11_id, CHAINPOS_LLCDISSECT);
+
 	packetchain->RegisterHandler(&phydot11_packethook_dot11tracker, this,
 											CHAINPOS_TRACKER, 100);
 
@@ -329,6 +334,22 @@ Kis_80211_Phy::Kis_80211_Phy(GlobalRegistry *in_globalreg,
                 shared_ptr<dot11_tracked_ssid_alert>(new dot11_tracked_ssid_alert(globalreg, 0)),
                 "ssid alert");
 
+    ie_cache_id =
+        entrytracker->RegisterField("phy80211.ie_cache", TrackerMap,
+                "shared cache of dissected IE tags");
+    ie_cache_size_id =
+        entrytracker->RegisterField("phy80211.ie_cache.size", TrackerUInt64,
+                "IE tag sets currently cached");
+    ie_cache_max_id =
+        entrytracker->RegisterField("phy80211.ie_cache.max_size", TrackerUInt64,
+                "maximum number of IE tag sets cached");
+    ie_cache_hits_id =
+        entrytracker->RegisterField("phy80211.ie_cache.hits", TrackerUInt64,
+                "IE tag sets found in the cache");
+    ie_cache_misses_id =
+        entrytracker->RegisterField("phy80211.ie_cache.misses", TrackerUInt64,
+                "IE tag sets which had to be dissected");
+
 	// Register the dissector alerts
 	alert_netstumbler_ref = 
 		alertracker->ActivateConfiguredAlert("NETSTUMBLER", 
@@ -646,6 +667,12 @@ Kis_80211_Phy::Kis_80211_Phy(GlobalRegistry *in_globalreg,
     }
     recent_packet_checksum_pos = 0;
 
+    // Set up the shared IE cache
+    size_t ie_cache_sz =
+        globalreg->kismet_config->FetchOptUInt("dot11_ie_cache_size", 1024);
+    if (ie_cache_sz != 0)
+        ie_cache.reset(new dot11_ie_cache(ie_cache_sz));
+
     // Parse the ssid regex options
     auto apspoof_lines = globalreg->kismet_config->FetchOptVec("apspoof");
 
@@ -773,7 +800,10 @@ int Kis_80211_Phy::LoadWepkeys() {
         keyinfo->len = len;
         memcpy(keyinfo->key, key, sizeof(unsigned char) * WEPKEY_MAX);
 
-        wepkeys.insert(bssid_mac, keyinfo);
+        {
+            local_locker lock(&wepkey_mutex);
+            wepkeys.insert(bssid_mac, keyinfo);
+        }
 
 		_MSG("Using key '" + rawkey + "' for BSSID " + bssid_mac.Mac2String(),
 			 MSGFLAG_INFO);
@@ -954,6 +984,8 @@ void Kis_80211_Phy::AddWepKey(mac_addr bssid, uint8_t *key, unsigned int len,
 
     memcpy(winfo->key, key, len);
 
+    local_locker lock(&wepkey_mutex);
+
     // Replace exiting ones
 	if (wepkeys.find(winfo->bssid) != wepkeys.end()) {
 		delete wepkeys[winfo->bssid];
@@ -1825,6 +1857,8 @@ int Kis_80211_Phy::TrackerDot11(kis_packet *in_pack) {
                     }
 
                     eapoldot11->set_wpa_present_handshake(keymask);
+
+                    eapolbase->update_modtime();
                 }
             }
 
@@ -1978,6 +2012,8 @@ int Kis_80211_Phy::TrackerDot11(kis_packet *in_pack) {
                                     ss.str() + ")");
                         }
                     }
+
+                    targetbase->update_modtime();
                 }
             }
         }
@@ -2049,6 +2085,11 @@ int Kis_80211_Phy::TrackerDot11(kis_packet *in_pack) {
                 dot11info->channel, al);
     }
 
+    // UpdateCommonDevice bumped the modification sequence before any of the
+    // dot11 changes above; bump it again while we still hold the device, so a
+    // view or flush which caught the device in between sees it as modified
+    basedev->update_modtime();
+
     /*
     if (basedev->get_type_string().length() == 0) {
         fprintf(stderr, "debug - unclassed device as of packet %d typeset %lu\n", packetnum, basedev->get_basic_type_set());
@@ -2240,6 +2281,10 @@ string Kis_80211_Phy::CryptToString(uint64_t cryptset) {
 
 bool Kis_80211_Phy::Httpd_VerifyPath(const char *path, const char *method) {
     if (strcmp(method, "GET") == 0) {
+        if (Httpd_CanSerialize(path) &&
+                Httpd_StripSuffix(path) == "/phy/phy80211/ie_cache")
+            return true;
+
         vector<string> tokenurl = StrTokenize(path, "/");
 
         // we care about
@@ -2390,6 +2435,36 @@ void Kis_80211_Phy::Httpd_CreateStreamResponse(Kis_Net_Httpd *httpd,
         return;
     }
 
+    if (Httpd_CanSerialize(url) && Httpd_StripSuffix(url) == "/phy/phy80211/ie_cache") {
+        uint64_t hits = 0, misses = 0, size = 0, max_size = 0;
+
+        if (ie_cache != NULL) {
+            ie_cache->get_stats(&hits, &misses, &size);
+            max_size = ie_cache->get_max_size();
+        }
+
+        SharedTrackerElement stats(new TrackerElement(TrackerMap, ie_cache_id));
+
+        SharedTrackerElement e_size(new TrackerElement(TrackerUInt64, ie_cache_size_id));
+        e_size->set(size);
+        stats->add_map(e_size);
+
+        SharedTrackerElement e_max(new TrackerElement(TrackerUInt64, ie_cache_max_id));
+        e_max->set(max_size);
+        stats->add_map(e_max);
+
+        SharedTrackerElement e_hits(new TrackerElement(TrackerUInt64, ie_cache_hits_id));
+        e_hits->set(hits);
+        stats->add_map(e_hits);
+
+        SharedTrackerElement e_misses(new TrackerElement(TrackerUInt64, ie_cache_misses_id));
+        e_misses->set(misses);
+        stats->add_map(e_misses);
+
+        Httpd_Serialize(url, stream, stats);
+        return;
+    }
+
     vector<string> tokenurl = StrTokenize(url, "/");
 
     // /phy/phy80211/by-key/[key]/pcap/[mac]-handshake.pcap
@@ -27,6 +27,7 @@
 #include <time.h>
 #include <list>
 #include <map>
+#include <unordered_map>
 #include <vector>
 #include <algorithm>
 #include <string>
@@ -45,6 +46,7 @@
 #include "devicetracker_component.h"
 #include "kis_net_microhttpd.h"
 #include "phy_80211_httpd_pcap.h"
+#include "phy_80211_ie.h"
 
 #include "kaitai/kaitaistream.h"
 #include "kaitai_parsers/wpaeap.h"
@@ -164,6 +166,7 @@ class dot11_packinfo : public packet_component {
 
             beacon_interval = 0;
 
+            maxrate = 0;
         }
 
         // Corrupt 802.11 frame
@@ -260,6 +263,93 @@ class dot11_packinfo : public packet_component {
         // VHT isn't specially enumerated, it just factors into max speed
 };
 
+// Results of dissecting a set of IE tags
+//
+// Every AP in an ESS tends to advertise an identical set of IE tags, and each
+// AP repeats the same set in every beacon, so the parsed results are kept in a
+// bounded LRU keyed by the checksum of the IE block and the frame subtype.  The
+// raw tags are kept as well and compared on a hit, since the checksum alone is
+// too weak to trust.
+class dot11_ie_cache_record {
+public:
+    // Take the IE fields from a freshly dissected packet; ie_cryptset holds
+    // only the crypt bits which came from the IE tags
+    void capture(dot11_packinfo *in_packinfo, uint64_t in_ie_cryptset);
+
+    // Fill in the IE fields of a packet
+    void apply(dot11_packinfo *in_packinfo) const;
+
+    std::string ie_data;
+    uint8_t subtype;
+
+    std::string ssid;
+    int ssid_len;
+    int ssid_blank;
+    uint32_t ssid_csum;
+
+    uint64_t cryptset;
+    std::string channel;
+    std::string beacon_info;
+
+    std::string dot11d_country;
+    std::vector<dot11_packinfo_dot11d_entry> dot11d_vec;
+
+    uint8_t wps;
+    std::string wps_manuf;
+    std::string wps_device_name;
+    std::string wps_model_name;
+    std::string wps_model_number;
+    std::string wps_serial_number;
+
+    std::shared_ptr<dot11_ie_11_qbss_t> qbss;
+    std::shared_ptr<dot11_ie_54_mobility_t> dot11r_mobility;
+    std::shared_ptr<dot11_ie_61_ht_t> dot11ht;
+    std::shared_ptr<dot11_ie_192_vht_operation_t> dot11vht;
+    std::shared_ptr<dot11_ie_221_dji_droneid_t> droneid;
+
+    double maxrate;
+    std::vector<std::string> basic_rates;
+    std::vector<std::string> extended_rates;
+    std::vector<std::string> mcs_rates;
+};
+
+class dot11_ie_cache {
+public:
+    dot11_ie_cache(size_t in_max_size);
+
+    // Find a record for an IE block, or NULL
+    std::shared_ptr<dot11_ie_cache_record> find(uint32_t in_csum, uint8_t in_subtype,
+            const uint8_t *in_data, size_t in_len);
+
+    // Add a record, pushing out the least recently used record if we're full
+    void insert(uint32_t in_csum, std::shared_ptr<dot11_ie_cache_record> in_rec);
+
+    void get_stats(uint64_t *ret_hits, uint64_t *ret_misses, uint64_t *ret_size);
+
+    size_t get_max_size() {
+        return max_size;
+    }
+
+protected:
+    typedef std::list<std::pair<uint64_t, std::shared_ptr<dot11_ie_cache_record> > >
+        lru_list;
+
+    uint64_t make_key(uint32_t in_csum, uint8_t in_subtype, size_t in_len) {
+        return ((uint64_t) in_csum << 32) | ((uint64_t) (in_len & 0xFFFFFF) << 8) |
+            in_subtype;
+    }
+
+    kis_recursive_timed_mutex cache_mutex;
+
+    size_t max_size;
+
+    // Most recently used at the front
+    lru_list lru;
+    std::unordered_map<uint64_t, lru_list::iterator> lru_map;
+
+    uint64_t hits, misses;
+};
+
 class dot11_tracked_eapol : public tracker_component {
 public:
     dot11_tracked_eapol(GlobalRegistry *in_globalreg, int in_id) :
@@ -1310,6 +1400,13 @@ public:
     // Expects an existing dot11 packet with the basic type intact, interprets
     // IE tags to the best of our ability
     int PacketDot11IEdissector(kis_packet *in_pack, dot11_packinfo *in_dot11info);
+    // Walks and interprets a block of IE tags; clears cacheable if the results
+    // depend on more than the tags themselves (such as raising an alert)
+    int PacketDot11IEparse(kis_packet *in_pack, dot11_packinfo *in_dot11info,
+            const uint8_t *in_data, size_t in_len, bool& cacheable);
+    // Interprets the WPS data elements of a MS WPS vendor IE, starting after
+    // the OUI type
+    int PacketDot11WPSdissector(dot11_ie_view in_wps, dot11_packinfo *in_dot11info);
 
     // Special decoders, not called as part of a chain
 
@@ -1366,11 +1463,19 @@ protected:
     std::shared_ptr<Packetchain> packetchain;
     std::shared_ptr<Timetracker> timetracker;
 
-    // Checksum of recent packets for duplication filtering
+    // Checksum of recent packets for duplication filtering; the dissector may
+    // run on several packet threads at once so the table is locked
+    kis_recursive_timed_mutex recent_packet_mutex;
     uint32_t *recent_packet_checksums;
     size_t recent_packet_checksums_sz;
     unsigned int recent_packet_checksum_pos;
 
+    // Shared cache of dissected IE tags, NULL if disabled
+    unique_ptr<dot11_ie_cache> ie_cache;
+
+    int ie_cache_id, ie_cache_size_id, ie_cache_max_id, ie_cache_hits_id,
+        ie_cache_misses_id;
+
     void HandleSSID(shared_ptr<kis_tracked_device_base> basedev, 
             shared_ptr<dot11_tracked_device> dot11dev,
             kis_packet *in_pack,
@@ -1436,6 +1541,7 @@ protected:
     // Are we allowed to send wepkeys to the client (server config)
     int client_wepkey_allowed;
     // Map of wepkeys to BSSID (or bssid masks)
+    kis_recursive_timed_mutex wepkey_mutex;
     macmap<dot11_wep_key *> wepkeys;
 
     // Generated WEP identity / base
@@ -36,26 +36,17 @@
 #include "packetchain.h"
 #include "alertracker.h"
 #include "configfile.h"
+#include "phy_80211_ie.h"
 
 #include "kaitai/kaitaistream.h"
 #include "kaitai_parsers/wpaeap.h"
 #include "kaitai_parsers/dot11_action.h"
-#include "kaitai_parsers/dot11_ie.h"
-#include "kaitai_parsers/dot11_ie_7_country.h"
 #include "kaitai_parsers/dot11_ie_11_qbss.h"
-#include "kaitai_parsers/dot11_ie_45_ht.h"
-#include "kaitai_parsers/dot11_ie_48_rsn.h"
-#include "kaitai_parsers/dot11_ie_48_rsn_partial.h"
 #include "kaitai_parsers/dot11_ie_52_rmm_neighbor.h"
 #include "kaitai_parsers/dot11_ie_54_mobility.h"
 #include "kaitai_parsers/dot11_ie_61_ht.h"
-#include "kaitai_parsers/dot11_ie_133_cisco_ccx.h"
-#include "kaitai_parsers/dot11_ie_191_vht_capabilities.h"
 #include "kaitai_parsers/dot11_ie_192_vht_operation.h"
-#include "kaitai_parsers/dot11_ie_221_vendor.h"
 #include "kaitai_parsers/dot11_ie_221_dji_droneid.h"
-#include "kaitai_parsers/dot11_ie_221_ms_wmm.h"
-#include "kaitai_parsers/dot11_ie_221_ms_wps.h"
 
 // Handy little global so that it only has to do the ascii->mac_addr transform once
 mac_addr broadcast_mac = "FF:FF:FF:FF:FF:FF";
@@ -269,17 +260,61 @@ int Kis_80211_Phy::WPAKeyMgtConv(uint8_t mgt_index) {
     return ret;
 }
 
+// Name of a basic or extended rate, and the rate in mbit (or 0 for the HT 
+// selector and unknown rates)
+static const char *Dot11RateName(uint8_t rate, double *mbit) {
+    switch (rate) {
+        case 0x02: *mbit = 1; return "1";
+        case 0x03: *mbit = 1.5; return "1.5";
+        case 0x04: *mbit = 2; return "2";
+        case 0x05: *mbit = 2.5; return "2.5";
+        case 0x06: *mbit = 3; return "3";
+        case 0x09: *mbit = 4.5; return "4.5";
+        case 0x0B: *mbit = 5.5; return "5.5";
+        case 0x0C: *mbit = 6; return "6";
+        case 0x12: *mbit = 9; return "9";
+        case 0x16: *mbit = 11; return "11";
+        case 0x18: *mbit = 12; return "12";
+        case 0x1B: *mbit = 13.5; return "13.5";
+        case 0x24: *mbit = 18; return "18";
+        case 0x2C: *mbit = 22; return "22";
+        case 0x30: *mbit = 24; return "24";
+        case 0x36: *mbit = 27; return "27";
+        case 0x42: *mbit = 33; return "33";
+        case 0x48: *mbit = 36; return "36";
+        case 0x60: *mbit = 48; return "48";
+        case 0x6C: *mbit = 54; return "54";
+        case 0x82: *mbit = 1; return "1B";
+        case 0x83: *mbit = 1.5; return "1.5B";
+        case 0x84: *mbit = 2; return "2B";
+        case 0x85: *mbit = 2.5; return "2.5B";
+        case 0x86: *mbit = 3; return "3B";
+        case 0x89: *mbit = 4.5; return "4.5B";
+        case 0x8B: *mbit = 5.5; return "5.5B";
+        case 0x8C: *mbit = 6; return "6B";
+        case 0x92: *mbit = 9; return "9B";
+        case 0x96: *mbit = 11; return "11B";
+        case 0x98: *mbit = 12; return "12B";
+        case 0x9B: *mbit = 13.5; return "13.5B";
+        case 0xA4: *mbit = 18; return "18B";
+        case 0xAC: *mbit = 22; return "22B";
+        case 0xB0: *mbit = 24; return "24B";
+        case 0xB6: *mbit = 27; return "27B";
+        case 0xC2: *mbit = 33; return "33B";
+        case 0xC8: *mbit = 36; return "36B";
+        case 0xE0: *mbit = 48; return "48B";
+        case 0xEC: *mbit = 54; return "54B";
+        case 0xFF: *mbit = 0; return "HT";
+        default: *mbit = 0; return "UNK";
+    }
+}
+
 // This needs to be optimized and it needs to not use casting to do its magic
 int Kis_80211_Phy::PacketDot11dissector(kis_packet *in_pack) {
-    static int debugpcknum = 0;
-
     if (in_pack->error) {
         return 0;
     }
 
-    debugpcknum++;
-    // printf("debug - packet %d\n", debugpcknum);
-
     // Extract data, bail if it doesn't exist, make a local copy of what we're
     // inserting into the frame.
     dot11_packinfo *packinfo;
@@ -301,19 +336,23 @@ int Kis_80211_Phy::PacketDot11dissector(kis_packet *in_pack) {
     // Compare the checksum and see if we've recently seen this exact packet
     uint32_t chunk_csum = Adler32Checksum((const char *) chunk->data, chunk->length);
 
-    for (unsigned int c = 0; c < recent_packet_checksums_sz; c++) {
-        if (recent_packet_checksums[c] == 0)
-            break;
+    {
+        local_locker dlock(&recent_packet_mutex);
 
-        if (recent_packet_checksums[c] == chunk_csum) {
-            in_pack->filtered = 1;
-            in_pack->duplicate = 1;
-            return 0;
+        for (unsigned int c = 0; c < recent_packet_checksums_sz; c++) {
+            if (recent_packet_checksums[c] == 0)
+                break;
+
+            if (recent_packet_checksums[c] == chunk_csum) {
+                in_pack->filtered = 1;
+                in_pack->duplicate = 1;
+                return 0;
+            }
         }
-    }
 
-    recent_packet_checksums[(recent_packet_checksum_pos++ % recent_packet_checksums_sz)] = 
-        chunk_csum;
+        recent_packet_checksums[(recent_packet_checksum_pos++ % recent_packet_checksums_sz)] = 
+            chunk_csum;
+    }
 
     // Flat-out dump if it's not big enough to be 80211, don't even bother making a
     // packinfo record for it because we're completely broken
@@ -1160,6 +1199,138 @@ eap_end:
     return 1;
 }
 
+void dot11_ie_cache_record::capture(dot11_packinfo *in_packinfo, uint64_t in_ie_cryptset) {
+    ssid = in_packinfo->ssid;
+    ssid_len = in_packinfo->ssid_len;
+    ssid_blank = in_packinfo->ssid_blank;
+    ssid_csum = in_packinfo->ssid_csum;
+
+    cryptset = in_ie_cryptset;
+    channel = in_packinfo->channel;
+    beacon_info = in_packinfo->beacon_info;
+
+    dot11d_country = in_packinfo->dot11d_country;
+    dot11d_vec = in_packinfo->dot11d_vec;
+
+    wps = in_packinfo->wps;
+    wps_manuf = in_packinfo->wps_manuf;
+    wps_device_name = in_packinfo->wps_device_name;
+    wps_model_name = in_packinfo->wps_model_name;
+    wps_model_number = in_packinfo->wps_model_number;
+    wps_serial_number = in_packinfo->wps_serial_number;
+
+    qbss = in_packinfo->qbss;
+    dot11r_mobility = in_packinfo->dot11r_mobility;
+    dot11ht = in_packinfo->dot11ht;
+    dot11vht = in_packinfo->dot11vht;
+    droneid = in_packinfo->droneid;
+
+    maxrate = in_packinfo->maxrate;
+    basic_rates = in_packinfo->basic_rates;
+    extended_rates = in_packinfo->extended_rates;
+    mcs_rates = in_packinfo->mcs_rates;
+}
+
+void dot11_ie_cache_record::apply(dot11_packinfo *in_packinfo) const {
+    in_packinfo->ssid = ssid;
+    in_packinfo->ssid_len = ssid_len;
+    in_packinfo->ssid_blank = ssid_blank;
+    in_packinfo->ssid_csum = ssid_csum;
+
+    in_packinfo->cryptset |= cryptset;
+    in_packinfo->channel = channel;
+    in_packinfo->beacon_info = beacon_info;
+
+    in_packinfo->dot11d_country = dot11d_country;
+    in_packinfo->dot11d_vec = dot11d_vec;
+
+    in_packinfo->wps |= wps;
+    in_packinfo->wps_manuf = wps_manuf;
+    in_packinfo->wps_device_name = wps_device_name;
+    in_packinfo->wps_model_name = wps_model_name;
+    in_packinfo->wps_model_number = wps_model_number;
+    in_packinfo->wps_serial_number = wps_serial_number;
+
+    // The kaitai records are never modified once parsed, so every packet
+    // with the same tags can share them
+    in_packinfo->qbss = qbss;
+    in_packinfo->dot11r_mobility = dot11r_mobility;
+    in_packinfo->dot11ht = dot11ht;
+    in_packinfo->dot11vht = dot11vht;
+    in_packinfo->droneid = droneid;
+
+    if (in_packinfo->maxrate < maxrate)
+        in_packinfo->maxrate = maxrate;
+    in_packinfo->basic_rates = basic_rates;
+    in_packinfo->extended_rates = extended_rates;
+    in_packinfo->mcs_rates = mcs_rates;
+}
+
+dot11_ie_cache::dot11_ie_cache(size_t in_max_size) :
+    max_size(in_max_size),
+    hits(0),
+    misses(0) { }
+
+std::shared_ptr<dot11_ie_cache_record> dot11_ie_cache::find(uint32_t in_csum,
+        uint8_t in_subtype, const uint8_t *in_data, size_t in_len) {
+    local_locker lock(&cache_mutex);
+
+    auto mi = lru_map.find(make_key(in_csum, in_subtype, in_len));
+
+    if (mi == lru_map.end()) {
+        misses++;
+        return NULL;
+    }
+
+    std::shared_ptr<dot11_ie_cache_record> rec = mi->second->second;
+
+    // Same checksum and length but different tags
+    if (rec->subtype != in_subtype || rec->ie_data.length() != in_len ||
+            memcmp(rec->ie_data.data(), in_data, in_len) != 0) {
+        misses++;
+        return NULL;
+    }
+
+    hits++;
+
+    // Move to the front of the list
+    lru.splice(lru.begin(), lru, mi->second);
+
+    return rec;
+}
+
+void dot11_ie_cache::insert(uint32_t in_csum, std::shared_ptr<dot11_ie_cache_record> in_rec) {
+    local_locker lock(&cache_mutex);
+
+    uint64_t key = make_key(in_csum, in_rec->subtype, in_rec->ie_data.length());
+
+    auto mi = lru_map.find(key);
+
+    // Replace a colliding record
+    if (mi != lru_map.end()) {
+        mi->second->second = in_rec;
+        lru.splice(lru.begin(), lru, mi->second);
+        return;
+    }
+
+    lru.push_front(std::make_pair(key, in_rec));
+    lru_map[key] = lru.begin();
+
+    while (lru.size() > max_size) {
+        lru_map.erase(lru.back().first);
+        lru.pop_back();
+    }
+}
+
+void dot11_ie_cache::get_stats(uint64_t *ret_hits, uint64_t *ret_misses, 
+        uint64_t *ret_size) {
+    local_locker lock(&cache_mutex);
+
+    *ret_hits = hits;
+    *ret_misses = misses;
+    *ret_size = lru.size();
+}
+
 int Kis_80211_Phy::PacketDot11IEdissector(kis_packet *in_pack, dot11_packinfo *packinfo) {
     // If we can't have IE tags at all
     if (packinfo->type != packet_management || !(
@@ -1185,16 +1356,59 @@ int Kis_80211_Phy::PacketDot11IEdissector(kis_packet *in_pack, dot11_packinfo *p
     if (chunk->dlt != KDLT_IEEE802_11)
         return 0;
 
-    membuf tags_membuf((char *) &(chunk->data[packinfo->header_offset]), 
-            (char *) &(chunk->data[chunk->length]));
-    std::istream istream_ietags(&tags_membuf);
+    if (packinfo->header_offset > chunk->length) {
+        fprintf(stderr, "debug - IE tags corrupt\n");
+        packinfo->corrupt = 1;
+        return -1;
+    }
 
-    std::shared_ptr<dot11_ie_t> ietags;
+    const uint8_t *ie_data = &(chunk->data[packinfo->header_offset]);
+    size_t ie_len = chunk->length - packinfo->header_offset;
 
-    try {
-        kaitai::kstream stream_ietags(&istream_ietags);
-        ietags.reset(new dot11_ie_t(&stream_ietags));
-    } catch (const std::exception& e) {
+    // Frames without a checksummed set of tags can't be looked up
+    if (ie_cache == NULL || packinfo->ietag_csum == 0 || packinfo->corrupt) {
+        bool cacheable;
+        return PacketDot11IEparse(in_pack, packinfo, ie_data, ie_len, cacheable);
+    }
+
+    std::shared_ptr<dot11_ie_cache_record> rec =
+        ie_cache->find(packinfo->ietag_csum, packinfo->subtype, ie_data, ie_len);
+
+    if (rec != NULL) {
+        rec->apply(packinfo);
+        return 1;
+    }
+
+    // Dissect with no crypt bits set so we know which ones came from the tags
+    uint64_t pre_cryptset = packinfo->cryptset;
+    packinfo->cryptset = 0;
+
+    bool cacheable = true;
+    int r = PacketDot11IEparse(in_pack, packinfo, ie_data, ie_len, cacheable);
+
+    uint64_t ie_cryptset = packinfo->cryptset;
+    packinfo->cryptset |= pre_cryptset;
+
+    if (r > 0 && cacheable && !packinfo->corrupt) {
+        rec = std::make_shared<dot11_ie_cache_record>();
+        rec->ie_data.assign((const char *) ie_data, ie_len);
+        rec->subtype = packinfo->subtype;
+        rec->capture(packinfo, ie_cryptset);
+        ie_cache->insert(packinfo->ietag_csum, rec);
+    }
+
+    return r;
+}
+
+int Kis_80211_Phy::PacketDot11IEparse(kis_packet *in_pack, dot11_packinfo *packinfo,
+        const uint8_t *in_data, size_t in_len, bool& cacheable) {
+    cacheable = true;
+
+    // Walk the tags in place; a tag which runs off the end of the frame means
+    // the whole set of tags is corrupt, so check that before we look at any
+    dot11_ie_walker walker(in_data, in_len);
+
+    if (!walker.validate()) {
         fprintf(stderr, "debug - IE tags corrupt\n");
         packinfo->corrupt = 1;
         return -1;
@@ -1207,21 +1421,21 @@ int Kis_80211_Phy::PacketDot11IEdissector(kis_packet *in_pack, dot11_packinfo *p
     bool seen_mcsrates = false;
     unsigned int wmmtspec_responses = 0;
 
-    for (auto ie_tag : *(ietags->tags())) {
-        std::stringstream tag_stream(ie_tag->tag_data());
-        kaitai::kstream ks(&tag_stream);
+    uint8_t tag_num;
+    dot11_ie_view tag;
 
+    while (walker.next(tag_num, tag)) {
         // IE 0 SSID
-        if (ie_tag->tag_num() == 0) {
+        if (tag_num == 0) {
             if (seen_ssid) {
                 fprintf(stderr, "debug - multiple SSID ie tags?\n");
             }
 
             seen_ssid = true;
 
-            packinfo->ssid_len = ie_tag->tag_data().length();
+            packinfo->ssid_len = tag.length();
             packinfo->ssid_csum =
-                Adler32Checksum(ie_tag->tag_data().data(), ie_tag->tag_data().length());
+                Adler32Checksum((const char *) tag.get_data(), tag.length());
 
             if (packinfo->ssid_len == 0) {
                 packinfo->ssid_blank = true;
@@ -1229,10 +1443,10 @@ int Kis_80211_Phy::PacketDot11IEdissector(kis_packet *in_pack, dot11_packinfo *p
             }
 
             if (packinfo->ssid_len <= DOT11_PROTO_SSID_LEN) {
-                if (ie_tag->tag_data().find_first_not_of('\0') == string::npos) {
+                if (tag.all_zero()) {
                     packinfo->ssid_blank = true;
                 } else {
-                    packinfo->ssid = MungeToPrintable(ie_tag->tag_data().data());
+                    packinfo->ssid = MungeToPrintable((const char *) tag.get_data(), tag.length(), 1);
                 }
             } else { 
                 _ALERT(alert_longssid_ref, in_pack, packinfo,
@@ -1249,8 +1463,8 @@ int Kis_80211_Phy::PacketDot11IEdissector(kis_packet *in_pack, dot11_packinfo *p
 
         // IE 1 Basic Rates
         // IE 50 Extended Rates
-        if (ie_tag->tag_num() == 1 || ie_tag->tag_num() == 50) {
-            if (ie_tag->tag_num() == 1) {
+        if (tag_num == 1 || tag_num == 50) {
+            if (tag_num == 1) {
                 if (seen_basicrates) {
                     fprintf(stderr, "debug - seen multiple basicrates?\n");
                 }
@@ -1258,7 +1472,7 @@ int Kis_80211_Phy::PacketDot11IEdissector(kis_packet *in_pack, dot11_packinfo *p
                 seen_basicrates = true;
             }
 
-            if (ie_tag->tag_num() == 50) {
+            if (tag_num == 50) {
                 if (seen_extendedrates) {
                     fprintf(stderr, "debug - seen multiple extendedrates?\n");
                 }
@@ -1266,7 +1480,7 @@ int Kis_80211_Phy::PacketDot11IEdissector(kis_packet *in_pack, dot11_packinfo *p
                 seen_extendedrates = true;
             }
 
-            if (ie_tag->tag_data().find("\x75\xEB\x49") != string::npos) {
+            if (tag.contains("\x75\xEB\x49", 3)) {
                 _ALERT(alert_msfdlinkrate_ref, in_pack, packinfo,
                         "MSF-style poisoned rate field in beacon for network " +
                         packinfo->bssid_mac.Mac2String() + ", exploit attempt "
@@ -1277,143 +1491,14 @@ int Kis_80211_Phy::PacketDot11IEdissector(kis_packet *in_pack, dot11_packinfo *p
             }
 
             std::vector<std::string> basicrates;
-            for (uint8_t r : ie_tag->tag_data()) {
-                std::string rate;
-
-                switch (r) {
-                    case 0x02:
-                        rate = "1";
-                        break;
-                    case 0x03:
-                        rate = "1.5";
-                        break;
-                    case 0x04:
-                        rate = "2";
-                        break;
-                    case 0x05:
-                        rate = "2.5";
-                        break;
-                    case 0x06:
-                        rate = "3";
-                        break;
-                    case 0x09:
-                        rate = "4.5";
-                        break;
-                    case 0x0B:
-                        rate = "5.5";
-                        break;
-                    case 0x0C:
-                        rate = "6";
-                        break;
-                    case 0x12:
-                        rate = "9";
-                        break;
-                    case 0x16:
-                        rate = "11";
-                        break;
-                    case 0x18:
-                        rate = "12";
-                        break;
-                    case 0x1B:
-                        rate = "13.5";
-                        break;
-                    case 0x24:
-                        rate = "18";
-                        break;
-                    case 0x2C:
-                        rate = "22";
-                        break;
-                    case 0x30:
-                        rate = "24";
-                        break;
-                    case 0x36:
-                        rate = "27";
-                        break;
-                    case 0x42:
-                        rate = "33";
-                        break;
-                    case 0x48:
-                        rate = "36";
-                        break;
-                    case 0x60:
-                        rate = "48";
-                        break;
-                    case 0x6C:
-                        rate = "54";
-                        break;
-                    case 0x82:
-                        rate = "1B";
-                        break;
-                    case 0x83:
-                        rate = "1.5B";
-                        break;
-                    case 0x84:
-                        rate = "2B";
-                        break;
-                    case 0x85:
-                        rate = "2.5B";
-                        break;
-                    case 0x86:
-                        rate = "3B";
-                        break;
-                    case 0x89:
-                        rate = "4.5B";
-                        break;
-                    case 0x8B:
-                        rate = "5.5B";
-                        break;
-                    case 0x8C:
-                        rate = "6B";
-                        break;
-                    case 0x92:
-                        rate = "9B";
-                        break;
-                    case 0x96:
-                        rate = "11B";
-                        break;
-                    case 0x98:
-                        rate = "12B";
-                        break;
-                    case 0x9B:
-                        rate = "13.5B";
-                        break;
-                    case 0xA4:
-                        rate = "18B";
-                        break;
-                    case 0xAC:
-                        rate = "22B";
-                        break;
-                    case 0xB0:
-                        rate = "24B";
-                        break;
-                    case 0xB6:
-                        rate = "27B";
-                        break;
-                    case 0xC2:
-                        rate = "33B";
-                        break;
-                    case 0xC8:
-                        rate = "36B";
-                        break;
-                    case 0xE0:
-                        rate = "48B";
-                        break;
-                    case 0xEC:
-                        rate = "54B";
-                        break;
-                    case 0xFF:
-                        rate = "HT";
-                        break;
-                    default:
-                        rate = "UNK";
-                        break;
-                }
+            basicrates.reserve(tag.length());
 
+            for (size_t ri = 0; ri < tag.length(); ri++) {
                 double m;
-                if (sscanf(rate.c_str(), "%lf", &m) == 1) {
-                    if (packinfo->maxrate < m)
-                        packinfo->maxrate = m;
-                }
+                const char *rate = Dot11RateName(tag[ri], &m);
+
+                if (packinfo->maxrate < m)
+                    packinfo->maxrate = m;
 
                 basicrates.push_back(rate);
             }
@@ -1423,46 +1508,48 @@ int Kis_80211_Phy::PacketDot11IEdissector(kis_packet *in_pack, dot11_packinfo *p
         }
 
         // IE 3 channel
-        if (ie_tag->tag_num() == 3) {
-            if (ie_tag->tag_data().length() != 1) {
+        if (tag_num == 3) {
+            if (tag.length() != 1) {
                 fprintf(stderr, "debug - corrupt channel tag\n");
                 packinfo->corrupt = 1;
                 return -1;
             }
                 
-            packinfo->channel = UIntToString((uint8_t) (ie_tag->tag_data()[0]));
+            packinfo->channel = UIntToString(tag[0]);
             continue;
         }
 
-        // IE 7 802.11d
-        if (ie_tag->tag_num() == 7) {
-            try {
-                std::shared_ptr<dot11_ie_7_country_t> dot11d(new dot11_ie_7_country_t(&ks));
-
-                packinfo->dot11d_country = MungeToPrintable(dot11d->country_code());
+        // IE 7 802.11d; 2 byte country, 1 byte environment, and 3 byte channel
+        // triplets, with an optional pad byte at the end
+        if (tag_num == 7) {
+            // Corrupt dot11 isn't a fatal condition
+            if (tag.length() < 3)
+                continue;
 
-                for (auto c : *(dot11d->country_list())) {
-                    dot11_packinfo_dot11d_entry ri;
+            packinfo->dot11d_country = 
+                MungeToPrintable((const char *) tag.get_data(), 2, 1);
 
-                    ri.startchan = c->first_channel();
-                    ri.numchan = c->num_channels();
-                    ri.txpower = c->max_power();
+            for (size_t ci = 3; ci + 3 <= tag.length(); ci += 3) {
+                dot11_packinfo_dot11d_entry ri;
 
-                    packinfo->dot11d_vec.push_back(ri);
-                }
+                ri.startchan = tag[ci];
+                ri.numchan = tag[ci + 1];
+                ri.txpower = tag[ci + 2];
 
-            } catch (const std::exception& e) {
-                // Corrupt dot11 isn't a fatal condition
-                // fprintf(stderr, "debug - corrupt dot11d: %s\n", e.what());
-                continue;
+                packinfo->dot11d_vec.push_back(ri);
             }
 
             continue;
         }
 
         // IE 11 QBSS
-        if (ie_tag->tag_num() == 11) {
+        if (tag_num == 11) {
             try {
+                membuf tag_membuf((char *) tag.get_data(), 
+                        (char *) tag.get_data() + tag.length());
+                std::istream tag_istream(&tag_membuf);
+                kaitai::kstream ks(&tag_istream);
+
                 std::shared_ptr<dot11_ie_11_qbss_t> qbss(new dot11_ie_11_qbss_t(&ks));
                 packinfo->qbss = qbss;
             } catch (const std::exception& e) {
@@ -1474,150 +1561,160 @@ int Kis_80211_Phy::PacketDot11IEdissector(kis_packet *in_pack, dot11_packinfo *p
             continue;
         }
 
-        if (ie_tag->tag_num() == 45) {
+        // IE 45 HT capabilities; 2 byte capabilities, 1 byte ampdu, 16 byte
+        // mcs set, 2 byte extended capabilities, 4 byte txbf, 1 byte asel
+        if (tag_num == 45) {
             if (seen_mcsrates) {
                 fprintf(stderr, "debug - duplicate ie45 mcs rates\n");
             } 
 
             seen_mcsrates = true;
 
+            if (tag.length() < 26) {
+                fprintf(stderr, "debug -corrupt HT\n");
+                packinfo->corrupt = 1;
+                return -1;
+            }
+
             std::vector<std::string> mcsrates;
 
-            try {
-                std::shared_ptr<dot11_ie_45_ht_t> ht(new dot11_ie_45_ht_t(&ks));
+            uint16_t ht_caps = tag.u16le(0);
 
-                std::stringstream mcsstream;
+            // See if we support 40mhz channels and aren't 40mhz intolerant
+            bool ch40 = ((ht_caps & 0x02) && !(ht_caps & 0x4000));
 
-                // See if we support 40mhz channels and aren't 40mhz intolerant
-                bool ch40 = (ht->ht_cap_40mhz_channel() && !ht->ht_cap_40mhz_intolerant());
+            bool gi20 = (ht_caps & 0x20);
+            bool gi40 = (ht_caps & 0x40);
 
-                bool gi20 = ht->ht_cap_20mhz_shortgi();
-                bool gi40 = ht->ht_cap_40mhz_shortgi();
+            uint8_t mcs_byte;
+            uint8_t mcs_offt = 0;
 
-                uint8_t mcs_byte;
-                uint8_t mcs_offt = 0;
+            char mcsname[16];
 
-                for (int x = 0; x < 4; x++) {
-                    mcs_byte = ht->mcs()->rx_mcs()[x];
-                    for (int i = 0; i < 8; i++) {
-                        if (mcs_byte & (1 << i)) {
-                            int mcsindex = mcs_offt + i;
-                            if (mcsindex < 0 || mcsindex > MCS_MAX) 
-                                continue;
+            for (int x = 0; x < 4; x++) {
+                // RX MCS bitmask follows the capabilities and ampdu bytes
+                mcs_byte = tag[3 + x];
 
-                            if (mcsindex == 32) {
-                                if (ch40) {
-                                    mcsstream.str("");
-                                    mcsstream << "MCS" << mcsindex << "(" <<
-                                        "HTDUP" << ")";
-                                    mcsrates.push_back(mcsstream.str());
-                                }
+                for (int i = 0; i < 8; i++) {
+                    if (mcs_byte & (1 << i)) {
+                        int mcsindex = mcs_offt + i;
+                        if (mcsindex < 0 || mcsindex > MCS_MAX) 
+                            continue;
 
-                                continue;
+                        if (mcsindex == 32) {
+                            if (ch40) {
+                                snprintf(mcsname, sizeof(mcsname), "MCS%d(HTDUP)", 
+                                        mcsindex);
+                                mcsrates.push_back(mcsname);
                             }
 
-                            double rate;
-
-                            mcsstream.str("");
-                            mcsstream << "MCS" << mcsindex;
+                            continue;
+                        }
 
-                            if (ch40 && gi40) {
-                                rate = mcs_table[mcsindex][CH40GI400];
-                            } else if (ch40) {
-                                rate = mcs_table[mcsindex][CH40GI800];
-                            } else if (gi20) {
-                                rate = mcs_table[mcsindex][CH20GI400];
-                            } else {
-                                rate = mcs_table[mcsindex][CH20GI800];
-                            }
+                        double rate;
 
-                            if (packinfo->maxrate < rate)
-                                packinfo->maxrate = rate;
+                        snprintf(mcsname, sizeof(mcsname), "MCS%d", mcsindex);
 
-                            mcsrates.push_back(mcsstream.str());
+                        if (ch40 && gi40) {
+                            rate = mcs_table[mcsindex][CH40GI400];
+                        } else if (ch40) {
+                            rate = mcs_table[mcsindex][CH40GI800];
+                        } else if (gi20) {
+                            rate = mcs_table[mcsindex][CH20GI400];
+                        } else {
+                            rate = mcs_table[mcsindex][CH20GI800];
                         }
-                    }
 
-                    mcs_offt += 8;
+                        if (packinfo->maxrate < rate)
+                            packinfo->maxrate = rate;
+
+                        mcsrates.push_back(mcsname);
+                    }
                 }
 
-            } catch (const std::exception& e) {
-                fprintf(stderr, "debug -corrupt HT\n");
-                packinfo->corrupt = 1;
-                return -1;
+                mcs_offt += 8;
             }
 
             packinfo->mcs_rates = mcsrates;
             continue;
         }
 
-        // IE 48, RSN
-        if (ie_tag->tag_num() == 48) {
+        // IE 48, RSN; 2 byte version, 4 byte group cipher, counted list of 4
+        // byte pairwise ciphers, counted list of 4 byte key management suites.
+        // The last byte of each cipher or suite is the type.
+        if (tag_num == 48) {
             bool rsn_invalid = false;
 
-            try {
-                std::shared_ptr<dot11_ie_48_rsn_t> rsn(new dot11_ie_48_rsn_t(&ks));
+            size_t pairwise_offt = 8;
+            size_t akm_offt = 0;
+            unsigned int pairwise_count = 0;
+            unsigned int akm_count = 0;
+
+            if (tag.length() < 8) {
+                rsn_invalid = true;
+            } else {
+                pairwise_count = tag.u16le(6);
+                akm_offt = pairwise_offt + (pairwise_count * 4);
+
+                if (akm_offt + 2 > tag.length()) {
+                    rsn_invalid = true;
+                } else {
+                    akm_count = tag.u16le(akm_offt);
+                    akm_offt += 2;
 
+                    if (akm_offt + (akm_count * 4) > tag.length())
+                        rsn_invalid = true;
+                }
+            }
+
+            if (!rsn_invalid) {
                 // TODO - don't aggregate these in the future
 
                 // Merge the group cipher
-                packinfo->cryptset |= 
-                    WPACipherConv(rsn->group_cipher()->cipher_type());
+                packinfo->cryptset |= WPACipherConv(tag[5]);
 
                 // Merge the unicast ciphers
-                for (auto i : *(rsn->pairwise_ciphers())) {
-                    packinfo->cryptset |= WPACipherConv(i->cipher_type());
-                }
+                for (unsigned int i = 0; i < pairwise_count; i++) 
+                    packinfo->cryptset |= WPACipherConv(tag[pairwise_offt + (i * 4) + 3]);
 
                 // Merge the authkey types
-                for (auto i : *(rsn->akm_ciphers())) {
-                    packinfo->cryptset |= WPAKeyMgtConv(i->management_type());
-                }
+                for (unsigned int i = 0; i < akm_count; i++) 
+                    packinfo->cryptset |= WPAKeyMgtConv(tag[akm_offt + (i * 4) + 3]);
 
                 // Set version flag - this is probably wrong but keep it 
                 // for now
                 packinfo->cryptset |= crypt_version_wpa2;
-
-            } catch (const std::exception& e) {
-                rsn_invalid = true;
+            } else {
                 packinfo->corrupt = 1;
-            }
-
-            // Re-parse using the limited RSN object to see if we're 
-            // getting hit with something that looks like
-            // https://pleasestopnamingvulnerabilities.com/
-            // CVE-2017-9714
-            if (rsn_invalid) {
-                std::stringstream rsn_stream(ie_tag->tag_data());
 
-                try {
-                    kaitai::kstream ks(&rsn_stream);
-                    std::shared_ptr<dot11_ie_48_rsn_partial_t> rsn(new dot11_ie_48_rsn_partial_t(&ks));
-
-                    if (rsn->pairwise_count() > 1024) {
-                        alertracker->RaiseAlert(alert_atheros_rsnloop_ref, 
-                                in_pack,
-                                packinfo->bssid_mac, packinfo->source_mac, 
-                                packinfo->dest_mac, packinfo->other_mac,
-                                packinfo->channel,
-                                "Invalid 802.11i RSN IE seen with extremely "
-                                "large number of pairwise ciphers; this may "
-                                "be an attack against Atheros drivers per "
-                                "CVE-2017-9714 and "
-                                "https://pleasestopnamingvulnerabilities.com/");
-                    }
-
-                } catch (const std::exception& e) {
-                    // Do nothing with the secondary error; we already know
-                    // something is wrong we're just trying to extract the
-                    // better errors
+                // See if we're getting hit with something that looks like
+                // https://pleasestopnamingvulnerabilities.com/
+                // CVE-2017-9714
+                if (tag.length() >= 8 && pairwise_count > 1024) {
+                    alertracker->RaiseAlert(alert_atheros_rsnloop_ref, 
+                            in_pack,
+                            packinfo->bssid_mac, packinfo->source_mac, 
+                            packinfo->dest_mac, packinfo->other_mac,
+                            packinfo->channel,
+                            "Invalid 802.11i RSN IE seen with extremely "
+                            "large number of pairwise ciphers; this may "
+                            "be an attack against Atheros drivers per "
+                            "CVE-2017-9714 and "
+                            "https://pleasestopnamingvulnerabilities.com/");
                 }
             }
+
+            continue;
         }
 
         // IE 54 Mobility
-        if (ie_tag->tag_num() == 54) {
+        if (tag_num == 54) {
             try {
+                membuf tag_membuf((char *) tag.get_data(), 
+                        (char *) tag.get_data() + tag.length());
+                std::istream tag_istream(&tag_membuf);
+                kaitai::kstream ks(&tag_istream);
+
                 std::shared_ptr<dot11_ie_54_mobility_t> mobility(new dot11_ie_54_mobility_t(&ks));
                 packinfo->dot11r_mobility = mobility;
             } catch (const std::exception& e) {
@@ -1628,8 +1725,13 @@ int Kis_80211_Phy::PacketDot11IEdissector(kis_packet *in_pack, dot11_packinfo *p
         }
 
         // IE 61 HT
-        if (ie_tag->tag_num() == 61) {
+        if (tag_num == 61) {
             try {
+                membuf tag_membuf((char *) tag.get_data(), 
+                        (char *) tag.get_data() + tag.length());
+                std::istream tag_istream(&tag_membuf);
+                kaitai::kstream ks(&tag_istream);
+
                 std::shared_ptr<dot11_ie_61_ht_t> ht(new dot11_ie_61_ht_t(&ks));
                 packinfo->dot11ht = ht;
             } catch (const std::exception& e) {
@@ -1641,99 +1743,112 @@ int Kis_80211_Phy::PacketDot11IEdissector(kis_packet *in_pack, dot11_packinfo *p
             continue;
         }
 
-        // IE 133 CISCO CCX
-        if (ie_tag->tag_num() == 133) {
-            try {
-                std::shared_ptr<dot11_ie_133_cisco_ccx_t> ccx1(new dot11_ie_133_cisco_ccx_t(&ks));
-                packinfo->beacon_info = MungeToPrintable(ccx1->ap_name());
-            } catch (const std::exception& e) {
-                fprintf(stderr, "debug - ccx error %s\n", e.what());
+        // IE 133 CISCO CCX; 10 unknown bytes, a 16 byte null-padded AP name,
+        // 1 byte station count, 3 unknown bytes
+        if (tag_num == 133) {
+            if (tag.length() < 30) {
+                fprintf(stderr, "debug - ccx error, tag too short\n");
                 continue;
             }
 
+            packinfo->beacon_info = 
+                MungeToPrintable((const char *) tag.get_data() + 10, 16, 1);
+
             continue;
         }
 
-        // IE 191 VHT Capabilities
-        if (ie_tag->tag_num() == 191) {
-            try {
-                std::shared_ptr<dot11_ie_191_vht_capabilities_t> vhtc(new dot11_ie_191_vht_capabilities_t(&ks));
+        // IE 191 VHT Capabilities; 4 byte capabilities, then the rx mcs map
+        if (tag_num == 191) {
+            // Don't consider this a corrupt packet just because we didn't parse it
+            if (tag.length() < 12) {
+                fprintf(stderr, "debug - vht 191 error, tag too short\n");
+                continue;
+            }
 
-                bool gi80 = vhtc->vht_cap_80mhz_shortgi();
-                bool gi160 = vhtc->vht_cap_160mhz_shortgi();
-                bool supp160 = vhtc->vht_cap_160mhz_supported();
+            uint32_t vht_caps = tag.u32le(0);
+            uint16_t rx_mcs_map = tag.u16le(4);
 
-                int stream = -1;
-                unsigned int mcs = 0;
-                unsigned int gi = 0;
+            bool gi80 = (vht_caps & 0x20);
+            bool gi160 = (vht_caps & 0x40);
+            bool supp160 = (vht_caps & 0x0C);
 
-                if (supp160) {
-                    if (gi160) {
-                        gi = CH160GI400;
-                    } else {
-                        gi = CH160GI800;
-                    }
+            unsigned int rx_mcs_s1 = (rx_mcs_map & 0x03);
+            unsigned int rx_mcs_s2 = (rx_mcs_map & 0x0C) >> 2;
+            unsigned int rx_mcs_s3 = (rx_mcs_map & 0x30) >> 4;
+            unsigned int rx_mcs_s4 = (rx_mcs_map & 0xC0) >> 6;
+
+            int stream = -1;
+            unsigned int mcs = 0;
+            unsigned int gi = 0;
+
+            if (supp160) {
+                if (gi160) {
+                    gi = CH160GI400;
                 } else {
-                    if (gi80) {
-                        gi = CH80GI400;
-                    } else {
-                        gi = CH80GI800;
-                    }
+                    gi = CH160GI800;
                 }
-
-                // Count back from stream 4 looking for the highest MCS setting
-                if (vhtc->rx_mcs_s4() == 2) {
-                    stream = 3;
-                    mcs = 9;
-                } else if (vhtc->rx_mcs_s4() == 1) {
-                    stream = 3;
-                    mcs = 7;
-                } else if (vhtc->rx_mcs_s3() == 2) {
-                    stream = 2;
-                    mcs = 9;
-                } else if (vhtc->rx_mcs_s3() == 1) {
-                    stream = 2;
-                    mcs = 7;
-                } else if (vhtc->rx_mcs_s2() == 2) {
-                    stream = 1;
-                    mcs = 9;
-                } else if (vhtc->rx_mcs_s2() == 1) {
-                    stream = 1;
-                    mcs = 7;
-                } else if (vhtc->rx_mcs_s1() == 2) {
-                    stream = 0;
-                    mcs = 9;
-                } else if (vhtc->rx_mcs_s1() == 1) {
-                    stream = 0;
-                    mcs = 7;
+            } else {
+                if (gi80) {
+                    gi = CH80GI400;
+                } else {
+                    gi = CH80GI800;
                 }
+            }
 
-                // What?  Invalid steam index
-                if (stream < 0 || stream > 3) {
-                    continue;
-                }
+            // Count back from stream 4 looking for the highest MCS setting
+            if (rx_mcs_s4 == 2) {
+                stream = 3;
+                mcs = 9;
+            } else if (rx_mcs_s4 == 1) {
+                stream = 3;
+                mcs = 7;
+            } else if (rx_mcs_s3 == 2) {
+                stream = 2;
+                mcs = 9;
+            } else if (rx_mcs_s3 == 1) {
+                stream = 2;
+                mcs = 7;
+            } else if (rx_mcs_s2 == 2) {
+                stream = 1;
+                mcs = 9;
+            } else if (rx_mcs_s2 == 1) {
+                stream = 1;
+                mcs = 7;
+            } else if (rx_mcs_s1 == 2) {
+                stream = 0;
+                mcs = 9;
+            } else if (rx_mcs_s1 == 1) {
+                stream = 0;
+                mcs = 7;
+            }
 
-                // Get the index
-                int mcsofft = (stream * 10) + mcs;
-                if (mcsofft < 0 || mcsofft > VHT_MCS_MAX)
-                    continue;
+            // What?  Invalid steam index
+            if (stream < 0 || stream > 3) {
+                continue;
+            }
 
-                double speed = vht_mcs_table[mcsofft][gi];
+            // Get the index
+            int mcsofft = (stream * 10) + mcs;
+            if (mcsofft < 0 || mcsofft > VHT_MCS_MAX)
+                continue;
 
-                if (packinfo->maxrate < speed)
-                    packinfo->maxrate = speed;
+            double speed = vht_mcs_table[mcsofft][gi];
 
-            } catch (const std::exception& e) {
-                fprintf(stderr, "debug - vht 191 error %s\n", e.what());
-                // Don't consider this a corrupt packet just because we didn't parse it
+            if (packinfo->maxrate < speed)
+                packinfo->maxrate = speed;
 
-            }
+            continue;
         }
 
 
         // IE 192 VHT Operation
-        if (ie_tag->tag_num() == 192) {
+        if (tag_num == 192) {
             try {
+                membuf tag_membuf((char *) tag.get_data(), 
+                        (char *) tag.get_data() + tag.length());
+                std::istream tag_istream(&tag_membuf);
+                kaitai::kstream ks(&tag_istream);
+
                 std::shared_ptr<dot11_ie_192_vht_operation_t> vht(new dot11_ie_192_vht_operation_t(&ks));
                 packinfo->dot11vht = vht;
             } catch (const std::exception& e) {
@@ -1744,107 +1859,94 @@ int Kis_80211_Phy::PacketDot11IEdissector(kis_packet *in_pack, dot11_packinfo *p
             continue;
         }
 
-        if (ie_tag->tag_num() == 221) {
-            try {
-                std::shared_ptr<dot11_ie_221_vendor_t> vendor(new dot11_ie_221_vendor_t(&ks));
+        // IE 221 vendor; 3 byte OUI, then the vendor data, which for most 
+        // vendors starts with a 1 byte type
+        if (tag_num == 221) {
+            if (tag.length() < 3) {
+                fprintf(stderr, "debug - 221 ie tag corrupt, no OUI\n");
+                packinfo->corrupt = 1;
+                return -1;
+            }
 
-                // Match mis-sized WMM
-                if (packinfo->subtype == packet_sub_beacon &&
-                        vendor->vendor_oui_int() == 0x0050f2 &&
-                        vendor->vendor_oui_type() == 2 &&
-                        ie_tag->tag_data().length() > 24) {
+            uint32_t vendor_oui = tag.u24be(0);
+            dot11_ie_view vendor_data = tag.sub(3);
 
-                    string al = "IEEE80211 Access Point BSSID " + 
-                        packinfo->bssid_mac.Mac2String() + " sent association "
-                        "response with an invalid WMM length; this may "
-                        "indicate attempts to exploit driver vulnerabilities "
-                        "such as BroadPwn";
+            if (vendor_oui == 0x0050f2 && vendor_data.length() < 1) {
+                fprintf(stderr, "debug - 221 ie tag corrupt, no MS OUI type\n");
+                packinfo->corrupt = 1;
+                return -1;
+            }
 
-                    alertracker->RaiseAlert(alert_wmm_ref, in_pack, 
-                            packinfo->bssid_mac, packinfo->source_mac, 
-                            packinfo->dest_mac, packinfo->other_mac, 
-                            packinfo->channel, al);
-                }
+            // Match mis-sized WMM
+            if (packinfo->subtype == packet_sub_beacon &&
+                    vendor_oui == 0x0050f2 && vendor_data[0] == 2 &&
+                    tag.length() > 24) {
 
-                // Count wmmtspec frames; per
-                // CVE-2017-11013 
-                // https://pleasestopnamingvulnerabilities.com/
-                if (packinfo->subtype == packet_sub_association_resp &&
-                        vendor->vendor_oui_int() == 0x0050f2 &&
-                        vendor->vendor_oui_type() == 2) {
-                    std::stringstream wmmstream(vendor->vendor_tag()->vendor_data());
-                    kaitai::kstream kds(&wmmstream);
-                    dot11_ie_221_ms_wmm_t wmm(&kds);
-
-                    if (wmm.wme_subtype() == 0x02) {
-                        wmmtspec_responses++;
-                    }
+                string al = "IEEE80211 Access Point BSSID " + 
+                    packinfo->bssid_mac.Mac2String() + " sent association "
+                    "response with an invalid WMM length; this may "
+                    "indicate attempts to exploit driver vulnerabilities "
+                    "such as BroadPwn";
 
-                }
+                alertracker->RaiseAlert(alert_wmm_ref, in_pack, 
+                        packinfo->bssid_mac, packinfo->source_mac, 
+                        packinfo->dest_mac, packinfo->other_mac, 
+                        packinfo->channel, al);
 
-                // Overflow of responses
-                if (wmmtspec_responses > 4) {
-                    string al = "IEEE80211 Access Point BSSID " + 
-                        packinfo->bssid_mac.Mac2String() + " sent association "
-                        "response with more than 4 WMM-TSPEC responses; this "
-                        "may be attempt to exploit embedded Atheros drivers using "
-                        "CVE-2017-11013";
+                cacheable = false;
+            }
 
-                    alertracker->RaiseAlert(alert_atheros_wmmtspec_ref, in_pack, 
-                            packinfo->bssid_mac, packinfo->source_mac, 
-                            packinfo->dest_mac, packinfo->other_mac, 
-                            packinfo->channel, al);
-                }
+            // Count wmmtspec frames; per
+            // CVE-2017-11013 
+            // https://pleasestopnamingvulnerabilities.com/
+            // The WMM subtype follows the MS OUI type
+            if (packinfo->subtype == packet_sub_association_resp &&
+                    vendor_oui == 0x0050f2 && vendor_data[0] == 2 &&
+                    vendor_data.length() >= 2 && vendor_data[1] == 0x02) {
+                wmmtspec_responses++;
+            }
+
+            // Overflow of responses
+            if (wmmtspec_responses > 4) {
+                string al = "IEEE80211 Access Point BSSID " + 
+                    packinfo->bssid_mac.Mac2String() + " sent association "
+                    "response with more than 4 WMM-TSPEC responses; this "
+                    "may be attempt to exploit embedded Atheros drivers using "
+                    "CVE-2017-11013";
 
+                alertracker->RaiseAlert(alert_atheros_wmmtspec_ref, in_pack, 
+                        packinfo->bssid_mac, packinfo->source_mac, 
+                        packinfo->dest_mac, packinfo->other_mac, 
+                        packinfo->channel, al);
 
-                // Look for DJI DroneID OUIs
-                if (vendor->vendor_oui_int() == 0x263712) {
-                    std::stringstream dronestream(vendor->vendor_tag()->vendor_data());
-                    kaitai::kstream kds(&dronestream);
+                cacheable = false;
+            }
+
+            // Look for DJI DroneID OUIs
+            if (vendor_oui == 0x263712) {
+                try {
+                    membuf drone_membuf((char *) vendor_data.get_data(),
+                            (char *) vendor_data.get_data() + vendor_data.length());
+                    std::istream drone_istream(&drone_membuf);
+                    kaitai::kstream kds(&drone_istream);
 
                     std::shared_ptr<dot11_ie_221_dji_droneid_t> droneid(new dot11_ie_221_dji_droneid_t(&kds));
 
                     packinfo->droneid = droneid;
+                } catch (const std::exception &e) {
+                    fprintf(stderr, "debug - 221 ie tag corrupt %s\n", e.what());
+                    packinfo->corrupt = 1;
+                    return -1;
                 }
+            }
 
-                // Look for WPS MS
-                if (vendor->vendor_oui_int() == 0x0050f2 && vendor->vendor_oui_type() == 0x04) {
-                    std::stringstream wpsstream(vendor->vendor_tag()->vendor_data());
-                    kaitai::kstream wpss(&wpsstream);
-
-                    std::shared_ptr<dot11_ie_221_ms_wps_t> wps(new dot11_ie_221_ms_wps_t(&wpss));
-
-                    for (auto wpselem : *(wps->wps_element())) {
-                        if (wpselem->wps_de_type() == dot11_ie_221_ms_wps_t::wps_de_element_t::WPS_DE_TYPES_STATE) {
-                            dot11_ie_221_ms_wps_t::wps_de_state_t *state = (dot11_ie_221_ms_wps_t::wps_de_state_t *) wpselem->wps_de_content();
-
-                            if (state->wps_state_configured()) {
-                                packinfo->wps |= DOT11_WPS_CONFIGURED;
-                            } else {
-                                packinfo->wps |= DOT11_WPS_NOT_CONFIGURED;
-                            }
-                        } else if (wpselem->wps_de_type() == dot11_ie_221_ms_wps_t::wps_de_element_t::WPS_DE_TYPES_DEVICE_NAME) {
-                            dot11_ie_221_ms_wps_t::wps_de_rawstr_t *str = (dot11_ie_221_ms_wps_t::wps_de_rawstr_t *) wpselem->wps_de_content();
-                            packinfo->wps_device_name = MungeToPrintable(str->raw_str());
-                        } else if (wpselem->wps_de_type() == dot11_ie_221_ms_wps_t::wps_de_element_t::WPS_DE_TYPES_MANUF) {
-                            dot11_ie_221_ms_wps_t::wps_de_rawstr_t *str = (dot11_ie_221_ms_wps_t::wps_de_rawstr_t *) wpselem->wps_de_content();
-                            packinfo->wps_manuf = MungeToPrintable(str->raw_str());
-                        } else if (wpselem->wps_de_type() == dot11_ie_221_ms_wps_t::wps_de_element_t::WPS_DE_TYPES_MODEL) {
-                            dot11_ie_221_ms_wps_t::wps_de_rawstr_t *str = (dot11_ie_221_ms_wps_t::wps_de_rawstr_t *) wpselem->wps_de_content();
-                            packinfo->wps_model_name = MungeToPrintable(str->raw_str());
-                        } else if (wpselem->wps_de_type() == dot11_ie_221_ms_wps_t::wps_de_element_t::WPS_DE_TYPES_MODEL_NUM) {
-                            dot11_ie_221_ms_wps_t::wps_de_rawstr_t *str = (dot11_ie_221_ms_wps_t::wps_de_rawstr_t *) wpselem->wps_de_content();
-                            packinfo->wps_model_number = MungeToPrintable(str->raw_str());
-                        } else if (wpselem->wps_de_type() == dot11_ie_221_ms_wps_t::wps_de_element_t::WPS_DE_TYPES_SERIAL) {
-                            dot11_ie_221_ms_wps_t::wps_de_rawstr_t *str = (dot11_ie_221_ms_wps_t::wps_de_rawstr_t *) wpselem->wps_de_content();
-                            packinfo->wps_serial_number = MungeToPrintable(str->raw_str());
-                        }
-                    }
+            // Look for WPS MS
+            if (vendor_oui == 0x0050f2 && vendor_data[0] == 0x04) {
+                if (PacketDot11WPSdissector(vendor_data.sub(1), packinfo) < 0) {
+                    fprintf(stderr, "debug - 221 ie tag corrupt, invalid WPS\n");
+                    packinfo->corrupt = 1;
+                    return -1;
                 }
-            } catch (const std::exception &e) {
-                fprintf(stderr, "debug - 221 ie tag corrupt %s\n", e.what());
-                packinfo->corrupt = 1;
-                return -1;
             }
 
             continue;
@@ -1941,6 +2043,66 @@ int Kis_80211_Phy::PacketDot11IEdissector(kis_packet *in_pack, dot11_packinfo *p
 
 }
 
+int Kis_80211_Phy::PacketDot11WPSdissector(dot11_ie_view in_wps, 
+        dot11_packinfo *packinfo) {
+    // WPS data elements are a 2 byte type, 2 byte length, and the content; make
+    // sure they all fit before we take anything from them
+    size_t offt = 0;
+
+    while (offt < in_wps.length()) {
+        if (offt + 4 > in_wps.length())
+            return -1;
+
+        offt += 4 + in_wps.u16be(offt + 2);
+
+        if (offt > in_wps.length())
+            return -1;
+    }
+
+    offt = 0;
+
+    while (offt < in_wps.length()) {
+        uint16_t de_type = in_wps.u16be(offt);
+        uint16_t de_len = in_wps.u16be(offt + 2);
+        dot11_ie_view de(in_wps.get_data() + offt + 4, de_len);
+
+        offt += 4 + de_len;
+
+        switch (de_type) {
+            case 0x1044:
+                // WPS state, 1 is unconfigured and 2 is configured
+                if (de.length() < 1)
+                    return -1;
+
+                if (de[0] == 0x02) {
+                    packinfo->wps |= DOT11_WPS_CONFIGURED;
+                } else {
+                    packinfo->wps |= DOT11_WPS_NOT_CONFIGURED;
+                }
+                break;
+            case 0x1011:
+                packinfo->wps_device_name = MungeToPrintable((const char *) de.get_data(), de.length(), 1);
+                break;
+            case 0x1021:
+                packinfo->wps_manuf = MungeToPrintable((const char *) de.get_data(), de.length(), 1);
+                break;
+            case 0x1023:
+                packinfo->wps_model_name = MungeToPrintable((const char *) de.get_data(), de.length(), 1);
+                break;
+            case 0x1024:
+                packinfo->wps_model_number = MungeToPrintable((const char *) de.get_data(), de.length(), 1);
+                break;
+            case 0x1042:
+                packinfo->wps_serial_number = MungeToPrintable((const char *) de.get_data(), de.length(), 1);
+                break;
+            default:
+                break;
+        }
+    }
+
+    return 1;
+}
+
 kis_datachunk *Kis_80211_Phy::DecryptWEP(dot11_packinfo *in_packinfo,
                                                kis_datachunk *in_chunk,
                                                unsigned char *in_key, int in_key_len,
@@ -2105,7 +2267,10 @@ int Kis_80211_Phy::PacketWepDecryptor(kis_packet *in_pack) {
     if (chunk->dlt != KDLT_IEEE802_11)
         return 0;
 
-    // Bail if we can't find a key match
+    // Bail if we can't find a key match; the key stays locked while we use it
+    // since the decrypt counters are shared between packet threads
+    local_locker wlock(&wepkey_mutex);
+
     macmap<dot11_wep_key *>::iterator bwmitr = wepkeys.find(packinfo->bssid_mac);
     if (bwmitr == wepkeys.end())
         return 0;
@@ -0,0 +1,168 @@
+/*
+    This file is part of Kismet
+
+    Kismet is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Kismet is distributed in the hope that it will be useful,
+      but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Kismet; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#ifndef __PHY_80211_IE_H__
+#define __PHY_80211_IE_H__
+
+#include "config.h"
+
+#include <stdint.h>
+#include <string.h>
+
+/* Zero-copy access to 802.11 IE tags
+ *
+ * Beacons are the bulk of most captures, and the IE tags are the bulk of a
+ * beacon.  Instead of copying the tagged parameters into a stream and then
+ * copying each tag into a stream of its own, the walker steps over the raw
+ * frame and hands out views which point directly into the packet data.
+ *
+ * Views don't own the data, and are only valid for as long as the packet
+ * chunk they were taken from.
+ */
+
+// Bounded view of a run of bytes in a packet.  Accessors don't check the
+// length; callers check length() before reading fixed fields.
+class dot11_ie_view {
+public:
+    dot11_ie_view() :
+        data(NULL),
+        len(0) { }
+
+    dot11_ie_view(const uint8_t *in_data, size_t in_len) :
+        data(in_data),
+        len(in_len) { }
+
+    const uint8_t *get_data() const {
+        return data;
+    }
+
+    size_t length() const {
+        return len;
+    }
+
+    uint8_t operator[](size_t offt) const {
+        return data[offt];
+    }
+
+    // View of the bytes from offt onwards, or an empty view if offt is past
+    // the end
+    dot11_ie_view sub(size_t offt) const {
+        if (offt >= len)
+            return dot11_ie_view();
+
+        return dot11_ie_view(data + offt, len - offt);
+    }
+
+    uint16_t u16le(size_t offt) const {
+        return (uint16_t) (data[offt] | (data[offt + 1] << 8));
+    }
+
+    uint16_t u16be(size_t offt) const {
+        return (uint16_t) ((data[offt] << 8) | data[offt + 1]);
+    }
+
+    uint32_t u24be(size_t offt) const {
+        return ((uint32_t) data[offt] << 16) | ((uint32_t) data[offt + 1] << 8) |
+            (uint32_t) data[offt + 2];
+    }
+
+    uint32_t u32le(size_t offt) const {
+        return (uint32_t) data[offt] | ((uint32_t) data[offt + 1] << 8) |
+            ((uint32_t) data[offt + 2] << 16) | ((uint32_t) data[offt + 3] << 24);
+    }
+
+    // Is every byte zero
+    bool all_zero() const {
+        for (size_t x = 0; x < len; x++)
+            if (data[x] != 0)
+                return false;
+
+        return true;
+    }
+
+    // Does the view contain a sequence of bytes
+    bool contains(const char *needle, size_t needle_len) const {
+        if (needle_len == 0 || needle_len > len)
+            return false;
+
+        for (size_t x = 0; x + needle_len <= len; x++) {
+            if (data[x] == (uint8_t) needle[0] &&
+                    memcmp(data + x, needle, needle_len) == 0)
+                return true;
+        }
+
+        return false;
+    }
+
+protected:
+    const uint8_t *data;
+    size_t len;
+};
+
+// Walk the tag, length, value list of an IE block
+class dot11_ie_walker {
+public:
+    dot11_ie_walker(const uint8_t *in_data, size_t in_len) :
+        data(in_data),
+        len(in_len),
+        offt(0) { }
+
+    // Check that every tag fits inside the block, without consuming anything
+    bool validate() const {
+        size_t o = 0;
+
+        while (o < len) {
+            if (o + 2 > len)
+                return false;
+
+            o += 2 + data[o + 1];
+
+            if (o > len)
+                return false;
+        }
+
+        return true;
+    }
+
+    // Get the next tag; returns false at the end of the block or if the next
+    // tag runs off the end of it
+    bool next(uint8_t& tag_num, dot11_ie_view& tag) {
+        if (offt + 2 > len)
+            return false;
+
+        size_t tag_len = data[offt + 1];
+
+        if (offt + 2 + tag_len > len)
+            return false;
+
+        tag_num = data[offt];
+        tag = dot11_ie_view(data + offt + 2, tag_len);
+
+        offt += 2 + tag_len;
+
+        return true;
+    }
+
+protected:
+    const uint8_t *data;
+    size_t len;
+    size_t offt;
+};
+
+#endif
+
@@ -171,6 +171,9 @@ int Kis_Bluetooth_Phy::PacketTrackerBluetooth(CHAINCALL_PARMS) {
         sv.push_back(tu);
     }
 
+    // Mark the device modified now that the bluetooth record is complete
+    basedev->update_modtime();
+
     return 0;
 }
 
@@ -361,6 +361,9 @@ bool Kis_RTL433_Phy::json_to_rtl(struct JSON_value *json) {
         _MSG(info, MSGFLAG_INFO);
     }
 
+    // Mark the device modified now that the sensor record is complete
+    basedev->update_modtime();
+
     return true;
 }
 
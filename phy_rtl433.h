@@ -82,17 +82,13 @@ public:
     }
 
     // Simple average
-    static int64_t combine_vector(SharedTrackerElement e) {
-        TrackerElementVector v(e);
-
+    static int64_t combine_vector(const int64_t *v, size_t sz) {
         int64_t avg = 0;
         int64_t avg_c = 0;
 
-        for (TrackerElementVector::iterator i = v.begin(); i != v.end(); ++i)  {
-            int64_t v = GetTrackerValue<int64_t>(*i);
-
-            if (v != default_val()) {
-                avg += GetTrackerValue<int64_t>(*i);
+        for (size_t i = 0; i < sz; i++)  {
+            if (v[i] != default_val()) {
+                avg += v[i];
                 avg_c++;
             }
         }
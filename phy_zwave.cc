@@ -191,6 +191,9 @@ bool Kis_Zwave_Phy::json_to_record(struct JSON_value *json) {
                 MSGFLAG_INFO);
     }
 
+    // Mark the device modified now that the Z-Wave record is complete
+    basedev->update_modtime();
+
     return true;
 }
 
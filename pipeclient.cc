@@ -81,31 +81,32 @@ bool PipeClient::FetchConnected() {
     return read_fd > -1 || write_fd > -1;
 }
 
-int PipeClient::MergeSet(int in_max_fd, fd_set *out_rset, fd_set *out_wset) {
+bool PipeClient::MergePollFds(std::vector<struct pollfd>& out_fds) {
     local_locker lock(&pipe_lock);
 
-    int max_fd = in_max_fd;
+    struct pollfd pfd;
+    pfd.revents = 0;
 
     // If we have data waiting to be written, fill it in
     if (write_fd > -1 && handler->GetWriteBufferUsed()) {
-        FD_SET(write_fd, out_wset);
-        if (write_fd > in_max_fd)
-            max_fd = write_fd;
+        pfd.fd = write_fd;
+        pfd.events = POLLOUT;
+        out_fds.push_back(pfd);
     }
 
     // If we have room to read set the readfd, otherwise skip it for now
     if (read_fd > -1) {
         if (handler->GetReadBufferAvailable() > 0) {
-            if (max_fd < read_fd)
-                max_fd = read_fd;
-            FD_SET(read_fd, out_rset);
+            pfd.fd = read_fd;
+            pfd.events = POLLIN;
+            out_fds.push_back(pfd);
         }
     }
 
-    return max_fd;
+    return true;
 }
 
-int PipeClient::Poll(fd_set& in_rset, fd_set& in_wset) {
+void PipeClient::PollFd(int in_fd, bool in_read, bool in_write) {
     local_locker lock(&pipe_lock);
 
     stringstream msg;
@@ -116,7 +117,7 @@ int PipeClient::Poll(fd_set& in_rset, fd_set& in_wset) {
 
     // fprintf(stderr, "debug - pipeclient - poll rfd %d wfd %d\n", read_fd, write_fd);
 
-    if (read_fd > -1 && FD_ISSET(read_fd, &in_rset)) {
+    if (read_fd > -1 && in_fd == read_fd && in_read) {
         // Allocate the biggest buffer we can fit in the ring, read as much
         // as we can at once.
        
@@ -141,7 +142,7 @@ int PipeClient::Poll(fd_set& in_rset, fd_set& in_wset) {
                     ClosePipes();
 
                     // fprintf(stderr, "debug - pipeclient - returning from poll\n");
-                    return 0;
+                    return;
                 } else {
                     // Jump out of read loop
                     handler->CommitReadBufferData(buf, 0);
@@ -156,7 +157,7 @@ int PipeClient::Poll(fd_set& in_rset, fd_set& in_wset) {
                     // Die if we couldn't insert all our data, the error is already going
                     // upstream.
                     ClosePipes();
-                    return 0;
+                    return;
                 }
             }
 
@@ -164,7 +165,7 @@ int PipeClient::Poll(fd_set& in_rset, fd_set& in_wset) {
         }
     }
 
-    if (write_fd > -1 && FD_ISSET(write_fd, &in_wset) && 
+    if (write_fd > -1 && in_fd == write_fd && in_write && 
             (len = handler->GetWriteBufferUsed()) > 0) {
         // Peek the data into our buffer
         ret = handler->ZeroCopyPeekWriteBufferData((void **) &buf, len);
@@ -180,7 +181,7 @@ int PipeClient::Poll(fd_set& in_rset, fd_set& in_wset) {
                 ClosePipes();
                 // Push the error upstream
                 handler->BufferError(msg.str());
-                return 0;
+                return;
             }
         } else {
             // Consume whatever we managed to write
@@ -190,8 +191,6 @@ int PipeClient::Poll(fd_set& in_rset, fd_set& in_wset) {
 
         // delete[] buf;
     }
-
-    return 0;
 }
 
 void PipeClient::ClosePipes() {
@@ -21,18 +21,46 @@
 
 #include "config.h"
 
+#include <poll.h>
 #include <sys/time.h>
 #include <sys/types.h>
 #include <unistd.h>
 
+#include <vector>
+
 #include "globalregistry.h"
 
 // Basic pollable object that anything that gets fed into the select()
 // loop in main() should be descended from
 class Pollable {
 public:
-	virtual int MergeSet(int in_max_fd, fd_set *out_rset, fd_set *out_wset) = 0;
-	virtual int Poll(fd_set& in_rset, fd_set& in_wset) = 0;
+	// Pollables which merge their descriptors into the select() sets each loop.
+	// An fd_set can't hold descriptors past FD_SETSIZE, so new pollables should
+	// use MergePollFds instead.
+	virtual int MergeSet(int in_max_fd, fd_set *out_rset __attribute__((unused)),
+			fd_set *out_wset __attribute__((unused))) {
+		return in_max_fd;
+	}
+
+	virtual int Poll(fd_set& in_rset __attribute__((unused)), 
+			fd_set& in_wset __attribute__((unused))) {
+		return 0;
+	}
+
+	// Pollables which add the descriptors they're waiting on to a set of
+	// pollfds each loop, with the events they want; they are called with PollFd
+	// for each one which is ready.  Returns false if the pollable merges
+	// fd_sets with MergeSet instead.
+	virtual bool MergePollFds(std::vector<struct pollfd>& out_fds __attribute__((unused))) {
+		return false;
+	}
+
+	// Pollables which watch descriptors directly with PollableTracker::WatchFd,
+	// or merge them with MergePollFds, are called for each of those descriptors
+	// which is ready, instead of finding them in the fd_sets passed to Poll
+	virtual void PollFd(int in_fd __attribute__((unused)), 
+			bool in_read __attribute__((unused)), 
+			bool in_write __attribute__((unused))) { }
 };
 
 #endif
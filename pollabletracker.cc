@@ -16,16 +16,100 @@
     Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
 */
 
+#include "config.h"
+
+#include <errno.h>
+#include <string.h>
+
+#include <algorithm>
+
 #include "pollabletracker.h"
+#include "messagebus.h"
+#include "util.h"
+
+#ifdef HAVE_POLLABLE_EPOLL
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#endif
+
+// Interval of the main loop tick, in ms
+#define POLLABLE_TICK_MS    100
 
 PollableTracker::PollableTracker(GlobalRegistry *in_globalreg) {
     globalreg = in_globalreg;
 
+    FD_ZERO(&merge_rset);
+    FD_ZERO(&merge_wset);
+    merge_max_fd = 0;
+
+    warned_fd_setsize = false;
+
+#ifdef HAVE_POLLABLE_EPOLL
+    timer_fd = -1;
+    wake_fd = -1;
+    num_epoll_events = 0;
+
+    epoll_events.resize(256);
+
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+
+    if (epoll_fd < 0) {
+        _MSG("Unable to create epoll instance, falling back to select(): " +
+                kis_strerror_r(errno), MSGFLAG_ERROR);
+        return;
+    }
+
+    struct epoll_event ev;
+
+    // Periodic tick for the main loop, so the wait doesn't need a timeout
+    timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+
+    if (timer_fd >= 0) {
+        struct itimerspec its;
+
+        its.it_interval.tv_sec = 0;
+        its.it_interval.tv_nsec = POLLABLE_TICK_MS * 1000000L;
+        its.it_value = its.it_interval;
+
+        memset(&ev, 0, sizeof(struct epoll_event));
+        ev.events = EPOLLIN;
+        ev.data.fd = timer_fd;
+
+        if (timerfd_settime(timer_fd, 0, &its, NULL) < 0 ||
+                epoll_ctl(epoll_fd, EPOLL_CTL_ADD, timer_fd, &ev) < 0) {
+            close(timer_fd);
+            timer_fd = -1;
+        }
+    }
+
+    wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+    if (wake_fd >= 0) {
+        memset(&ev, 0, sizeof(struct epoll_event));
+        ev.events = EPOLLIN;
+        ev.data.fd = wake_fd;
+
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, wake_fd, &ev) < 0) {
+            close(wake_fd);
+            wake_fd = -1;
+        }
+    }
+#endif
 }
 
 PollableTracker::~PollableTracker() {
     local_eol_locker lock(&pollable_mutex);
 
+#ifdef HAVE_POLLABLE_EPOLL
+    if (timer_fd >= 0)
+        close(timer_fd);
+
+    if (wake_fd >= 0)
+        close(wake_fd);
+
+    if (epoll_fd >= 0)
+        close(epoll_fd);
+#endif
 }
 
 void PollableTracker::RegisterPollable(shared_ptr<Pollable> in_pollable) {
@@ -51,14 +135,112 @@ void PollableTracker::Maintenance() {
             }
         }
     }
+
     remove_vec.clear();
 
     for (auto i = add_vec.begin(); i != add_vec.end(); ++i) {
         pollable_vec.push_back(*i);
     }
+
     add_vec.clear();
 }
 
+bool PollableTracker::CanWatchFds() {
+#ifdef HAVE_POLLABLE_EPOLL
+    return epoll_fd >= 0;
+#else
+    return false;
+#endif
+}
+
+bool PollableTracker::WatchFd(int in_fd, Pollable *in_pollable, bool in_read, bool in_write) {
+#ifdef HAVE_POLLABLE_EPOLL
+    local_locker lock(&pollable_mutex);
+
+    if (epoll_fd < 0 || in_fd < 0)
+        return false;
+
+    uint32_t events = (in_read ? EPOLLIN : 0) | (in_write ? EPOLLOUT : 0);
+
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(struct epoll_event));
+    ev.events = events;
+    ev.data.fd = in_fd;
+
+    auto wi = watch_map.find(in_fd);
+
+    if (wi == watch_map.end()) {
+        if (events != 0 && epoll_ctl(epoll_fd, EPOLL_CTL_ADD, in_fd, &ev) < 0)
+            return false;
+
+        watched_fd w;
+        w.pollable = in_pollable;
+        w.events = events;
+
+        watch_map.emplace(in_fd, w);
+
+        return true;
+    }
+
+    wi->second.pollable = in_pollable;
+
+    if (wi->second.events == events)
+        return true;
+
+    // Descriptors which aren't waiting for anything are taken out of epoll
+    // entirely, otherwise a hangup would be reported on every wakeup while the
+    // pollable isn't able to do anything about it
+    int r;
+
+    if (events == 0)
+        r = epoll_ctl(epoll_fd, EPOLL_CTL_DEL, in_fd, &ev);
+    else if (wi->second.events == 0)
+        r = epoll_ctl(epoll_fd, EPOLL_CTL_ADD, in_fd, &ev);
+    else
+        r = epoll_ctl(epoll_fd, EPOLL_CTL_MOD, in_fd, &ev);
+
+    if (r < 0)
+        return false;
+
+    wi->second.events = events;
+
+    return true;
+#else
+    return false;
+#endif
+}
+
+void PollableTracker::UnwatchFd(int in_fd __attribute__((unused))) {
+#ifdef HAVE_POLLABLE_EPOLL
+    local_locker lock(&pollable_mutex);
+
+    auto wi = watch_map.find(in_fd);
+
+    if (wi == watch_map.end())
+        return;
+
+    if (wi->second.events != 0 && epoll_fd >= 0) {
+        struct epoll_event ev;
+        memset(&ev, 0, sizeof(struct epoll_event));
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, in_fd, &ev);
+    }
+
+    watch_map.erase(wi);
+#endif
+}
+
+void PollableTracker::Wakeup() {
+#ifdef HAVE_POLLABLE_EPOLL
+    if (wake_fd >= 0) {
+        uint64_t one = 1;
+
+        if (write(wake_fd, &one, sizeof(uint64_t)) < 0) {
+            // Counter is already pending, which wakes us just the same
+        }
+    }
+#endif
+}
+
 int PollableTracker::MergePollableFds(fd_set *rset, fd_set *wset) {
     local_locker lock(&pollable_mutex);
 
@@ -69,15 +251,34 @@ int PollableTracker::MergePollableFds(fd_set *rset, fd_set *wset) {
     FD_ZERO(rset);
     FD_ZERO(wset);
 
+    merge_fds.clear();
+    merge_fd_pollables.clear();
+
     for (auto i = pollable_vec.begin(); i != pollable_vec.end(); ++i) {
-        max_fd = (*i)->MergeSet(max_fd, rset, wset);
+        size_t first = merge_fds.size();
+
+        if ((*i)->MergePollFds(merge_fds)) {
+            for (size_t f = first; f < merge_fds.size(); f++)
+                merge_fds[f].revents = 0;
+
+            merge_fd_pollables.resize(merge_fds.size(), *i);
+            continue;
+        }
+
+        // Pollables return -1 when they're in error; don't let that lose the
+        // descriptors merged so far
+        int m = (*i)->MergeSet(max_fd, rset, wset);
+
+        if (m > max_fd)
+            max_fd = m;
     }
 
     return max_fd;
 }
 
-int PollableTracker::ProcessPollableSelect(fd_set rset, fd_set wset) {
+int PollableTracker::ProcessPollableSelect(fd_set& rset, fd_set& wset) {
     local_locker lock(&pollable_mutex);
+
     int r;
     int num = 0;
 
@@ -93,3 +294,225 @@ int PollableTracker::ProcessPollableSelect(fd_set rset, fd_set wset) {
     return num;
 }
 
+int PollableTracker::ProcessPollableFds() {
+    local_locker lock(&pollable_mutex);
+
+    int num = 0;
+
+    Maintenance();
+
+    shared_ptr<Pollable> last;
+    bool removed = false;
+
+    for (size_t i = 0; i < merge_fds.size(); i++) {
+        struct pollfd *p = &(merge_fds[i]);
+
+        // Pollables removed since the descriptors were merged may have closed
+        // them already
+        if (merge_fd_pollables[i] != last) {
+            last = merge_fd_pollables[i];
+            removed = std::find(pollable_vec.begin(), pollable_vec.end(), last) ==
+                pollable_vec.end();
+        }
+
+        if (removed)
+            continue;
+
+        bool rd = (p->events & POLLIN) &&
+            (p->revents & (POLLIN | POLLHUP | POLLERR | POLLNVAL));
+        bool wr = (p->events & POLLOUT) &&
+            (p->revents & (POLLOUT | POLLHUP | POLLERR | POLLNVAL));
+
+        p->revents = 0;
+
+        if (!rd && !wr)
+            continue;
+
+        merge_fd_pollables[i]->PollFd(p->fd, rd, wr);
+
+        num++;
+    }
+
+    return num;
+}
+
+int PollableTracker::WaitPollableEvents() {
+    merge_max_fd = MergePollableFds(&merge_rset, &merge_wset);
+
+#ifdef HAVE_POLLABLE_EPOLL
+    if (epoll_fd >= 0) {
+        num_epoll_events = 0;
+
+        // Wait on the merged descriptors and the epoll descriptor together; the
+        // set of merging pollables is small, so it's cheaper to hand the whole
+        // set to poll() than to keep it in sync with epoll
+        wait_pollfds.clear();
+
+        struct pollfd pfd;
+        pfd.fd = epoll_fd;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+        wait_pollfds.push_back(pfd);
+
+        wait_pollfds.insert(wait_pollfds.end(), merge_fds.begin(), merge_fds.end());
+
+        for (int fd = 0; fd <= merge_max_fd; fd++) {
+            pfd.fd = fd;
+            pfd.events = 0;
+
+            if (FD_ISSET(fd, &merge_rset))
+                pfd.events |= POLLIN;
+            if (FD_ISSET(fd, &merge_wset))
+                pfd.events |= POLLOUT;
+
+            if (pfd.events != 0)
+                wait_pollfds.push_back(pfd);
+        }
+
+        int r = poll(wait_pollfds.data(), wait_pollfds.size(),
+                timer_fd >= 0 ? -1 : POLLABLE_TICK_MS);
+
+        if (r < 0) {
+            for (auto& p : wait_pollfds)
+                p.revents = 0;
+
+            return -1;
+        }
+
+        for (size_t i = 0; i < merge_fds.size(); i++)
+            merge_fds[i].revents = wait_pollfds[i + 1].revents;
+
+        if (wait_pollfds[0].revents & POLLIN) {
+            num_epoll_events =
+                epoll_wait(epoll_fd, epoll_events.data(), epoll_events.size(), 0);
+
+            if (num_epoll_events < 0) {
+                num_epoll_events = 0;
+
+                if (errno != EINTR)
+                    return -1;
+            }
+        }
+
+        return r;
+    }
+#endif
+
+    // select() can only take descriptors below FD_SETSIZE; anything past that
+    // would be written off the end of the set
+    for (auto& p : merge_fds) {
+        if (p.fd < 0)
+            continue;
+
+        if (p.fd >= FD_SETSIZE) {
+            if (!warned_fd_setsize) {
+                _MSG("Descriptor " + IntToString(p.fd) + " is past the limit of " +
+                        IntToString(FD_SETSIZE) + " which can be handled by select(); "
+                        "it will not be polled.", MSGFLAG_ERROR);
+                warned_fd_setsize = true;
+            }
+
+            continue;
+        }
+
+        if (p.events & POLLIN)
+            FD_SET(p.fd, &merge_rset);
+        if (p.events & POLLOUT)
+            FD_SET(p.fd, &merge_wset);
+
+        if (merge_max_fd < p.fd)
+            merge_max_fd = p.fd;
+    }
+
+    struct timeval tm;
+
+    tm.tv_sec = 0;
+    tm.tv_usec = POLLABLE_TICK_MS * 1000;
+
+    int r = select(merge_max_fd + 1, &merge_rset, &merge_wset, NULL, &tm);
+
+    if (r < 0) {
+        FD_ZERO(&merge_rset);
+        FD_ZERO(&merge_wset);
+    }
+
+    for (auto& p : merge_fds) {
+        if (p.fd < 0 || p.fd >= FD_SETSIZE)
+            continue;
+
+        if ((p.events & POLLIN) && FD_ISSET(p.fd, &merge_rset))
+            p.revents |= POLLIN;
+        if ((p.events & POLLOUT) && FD_ISSET(p.fd, &merge_wset))
+            p.revents |= POLLOUT;
+    }
+
+    return r;
+}
+
+int PollableTracker::ProcessPollableEvents() {
+    int num = ProcessPollableFds();
+
+#ifdef HAVE_POLLABLE_EPOLL
+    if (epoll_fd >= 0) {
+        local_locker lock(&pollable_mutex);
+
+        fd_set rset, wset;
+
+        FD_ZERO(&rset);
+        FD_ZERO(&wset);
+
+        // Report the descriptors merged into fd_sets the way select() would 
+        // have; they follow the epoll descriptor and the merged pollfds
+        for (size_t i = 1 + merge_fds.size(); i < wait_pollfds.size(); i++) {
+            struct pollfd *p = &(wait_pollfds[i]);
+
+            if ((p->events & POLLIN) && (p->revents & (POLLIN | POLLHUP | POLLERR)))
+                FD_SET(p->fd, &rset);
+
+            if ((p->events & POLLOUT) && (p->revents & (POLLOUT | POLLERR)))
+                FD_SET(p->fd, &wset);
+        }
+
+        num += ProcessPollableSelect(rset, wset);
+
+        for (int i = 0; i < num_epoll_events; i++) {
+            int fd = epoll_events[i].data.fd;
+            uint32_t ev = epoll_events[i].events;
+
+            if (fd == timer_fd || fd == wake_fd) {
+                uint64_t count;
+
+                if (read(fd, &count, sizeof(uint64_t)) < 0) {
+                    // Already drained
+                }
+
+                continue;
+            }
+
+            // Pollables can unwatch descriptors while handling earlier events
+            auto wi = watch_map.find(fd);
+
+            if (wi == watch_map.end())
+                continue;
+
+            bool rd = (wi->second.events & EPOLLIN) &&
+                (ev & (EPOLLIN | EPOLLHUP | EPOLLERR));
+            bool wr = (wi->second.events & EPOLLOUT) &&
+                (ev & (EPOLLOUT | EPOLLHUP | EPOLLERR));
+
+            if (!rd && !wr)
+                continue;
+
+            wi->second.pollable->PollFd(fd, rd, wr);
+
+            num++;
+        }
+
+        num_epoll_events = 0;
+
+        return num;
+    }
+#endif
+
+    return num + ProcessPollableSelect(merge_rset, merge_wset);
+}
@@ -22,24 +22,44 @@
 #include "config.h"
 
 #include <vector>
+#include <unordered_map>
 
 #include "kis_mutex.h"
 #include "pollable.h"
 #include "globalregistry.h"
 
+#ifdef __linux__
+#define HAVE_POLLABLE_EPOLL 1
+#include <sys/epoll.h>
+#endif
+
 /* Pollable subsystem tracker
  *
- * Monitors pollable events and wraps them into a single select() loop
+ * Monitors pollable events and wraps them into a single event loop
  * and handles erroring out sources after their events have been processed.
  *
  * Add/remove from the pollable vector is handled asynchronously to protect the
  * integrity of the pollable object itself and the internal pollable vectors;
  * adds and removes are synced at the next descriptor or poll event.
+ *
+ * On Linux the loop is built around epoll.  Pollables which handle many
+ * descriptors, like the TCP server, register them directly with WatchFd and
+ * are only called for the descriptors which are ready, so an idle connection
+ * costs nothing per wakeup and descriptors aren't limited by FD_SETSIZE.
+ * Pollables with a few descriptors merge them each loop with MergePollFds,
+ * and are waited on alongside the epoll descriptor.  The main loop tick comes
+ * from a timerfd instead of the wait timeout.
+ *
+ * Elsewhere the loop falls back to select(), and WatchFd is unavailable.
+ * Merged descriptors past FD_SETSIZE can't be selected, and are skipped.
+ *
+ * Pollables which merge fd_sets with MergeSet are still supported, but are
+ * limited to descriptors below FD_SETSIZE everywhere.
  */
 
 class PollableTracker : public LifetimeGlobal {
 public:
-    static shared_ptr<PollableTracker> 
+    static shared_ptr<PollableTracker>
         create_pollabletracker(GlobalRegistry *in_globalreg) {
         shared_ptr<PollableTracker> mon(new PollableTracker(in_globalreg));
         in_globalreg->RegisterLifetimeGlobal(mon);
@@ -61,19 +81,36 @@ public:
     // to remove themselves once their tasks are complete.
     void RemovePollable(shared_ptr<Pollable> in_pollable);
 
-    // populate the FD sets for polling, populates rset and wset
+    // Wait until a pollable has a descriptor ready, or for the next main loop
+    // tick (100ms)
     //
     // returns:
-    // 0+   Maxmimum FD to be passed to select()
-    // -1   Error
-    int MergePollableFds(fd_set *rset, fd_set *wset);
-   
-    // Poll each item in a set
+    // 0+   Number of ready descriptors
+    // -1   Error, with errno set
+    int WaitPollableEvents();
+
+    // Poll the items which are ready after WaitPollableEvents
     //
     // returns:
     // 0+   Number of pollable items processed
     // -1   Error
-    int ProcessPollableSelect(fd_set rset, fd_set wset);
+    int ProcessPollableEvents();
+
+    // Watch a descriptor directly, calling PollFd on the pollable when it is
+    // ready; calling again for a watched descriptor changes the events.  The
+    // pollable must unwatch the descriptor before closing it.
+    //
+    // Returns false if descriptors can't be watched directly on this system,
+    // in which case the pollable must merge them each loop instead.
+    bool WatchFd(int in_fd, Pollable *in_pollable, bool in_read, bool in_write);
+    void UnwatchFd(int in_fd);
+
+    // Can descriptors be watched directly
+    bool CanWatchFds();
+
+    // Wake the loop from another thread, so that pollables get a chance to
+    // update what they're waiting for
+    void Wakeup();
 
 protected:
     GlobalRegistry *globalreg;
@@ -85,6 +122,48 @@ protected:
     vector<shared_ptr<Pollable> > remove_vec;
 
     void Maintenance();
+
+    // Descriptors merged into fd_sets by pollables, and the max descriptor
+    fd_set merge_rset, merge_wset;
+    int merge_max_fd;
+
+    // Descriptors merged as pollfds, and the pollable each one belongs to
+    std::vector<struct pollfd> merge_fds;
+    std::vector<shared_ptr<Pollable> > merge_fd_pollables;
+
+    // Have we complained about a merged descriptor we can't select()
+    bool warned_fd_setsize;
+
+    // populate the FD sets and pollfds for polling from the merging pollables
+    int MergePollableFds(fd_set *rset, fd_set *wset);
+
+    // Poll each merging pollable with a set of ready descriptors
+    int ProcessPollableSelect(fd_set& rset, fd_set& wset);
+
+    // Call each pollable with its ready merged pollfds
+    int ProcessPollableFds();
+
+#ifdef HAVE_POLLABLE_EPOLL
+    int epoll_fd;
+    int timer_fd;
+    int wake_fd;
+
+    class watched_fd {
+    public:
+        Pollable *pollable;
+        uint32_t events;
+    };
+
+    std::unordered_map<int, watched_fd> watch_map;
+
+    // The epoll descriptor, the merged pollfds, and then the descriptors merged
+    // into fd_sets, as handed to poll()
+    std::vector<struct pollfd> wait_pollfds;
+
+    std::vector<struct epoll_event> epoll_events;
+    int num_epoll_events;
+#endif
 };
 
 #endif
+
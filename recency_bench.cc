@@ -0,0 +1,301 @@
+/* benchmark harness for the device recency index
+ *
+ * Replays the per-packet last_time update the device tracker does for every
+ * packet, from several packet threads at once, against:
+ *
+ *  - a single recency index behind one lock, taken for every packet (how the
+ *    index was first added)
+ *  - one recency index per device shard, behind the shard lock, which is only
+ *    taken when a device's indexed time actually moves forward; the indexed
+ *    time is atomic so it can be checked without the lock (how
+ *    Devicetracker::update_last_time works now)
+ *
+ * and then times a last-time query against both, which for the sharded index
+ * includes merging the shards back into last_time order.
+ *
+ * # build kismet, then
+ * make recency_bench
+ *
+ * ./recency_bench [threads] [devices] [packets per thread] [packets per second]
+ *
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <limits>
+#include <map>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "kis_mutex.h"
+
+struct bench_device {
+    bench_device(uint64_t in_id) : id(in_id), last_time(0), recency_time(0) { }
+
+    kis_recursive_timed_mutex device_mutex;
+    uint64_t id;
+    time_t last_time;
+    std::atomic<time_t> recency_time;
+};
+
+typedef std::map<std::pair<time_t, uint64_t>, std::shared_ptr<bench_device> > recency_map;
+
+struct bench_shard {
+    bench_shard() : lock_count(0), contended_count(0) { }
+
+    kis_recursive_timed_mutex mutex;
+    recency_map recency_index;
+    std::atomic<uint64_t> lock_count;
+    std::atomic<uint64_t> contended_count;
+};
+
+static const unsigned int num_shards = 16;
+
+// Single index, locked for every update
+struct global_index {
+    global_index() : lock_count(0), contended_count(0) { }
+
+    void index(std::shared_ptr<bench_device> d) {
+        local_locker lock(&mutex);
+        recency_index.emplace(std::make_pair(d->last_time, d->id), d);
+    }
+
+    void update(std::shared_ptr<bench_device> d, time_t in_time) {
+        local_counting_locker lock(&mutex, &lock_count, &contended_count);
+
+        if (d->last_time >= in_time)
+            return;
+
+        recency_index.erase(std::make_pair(d->last_time, d->id));
+        d->last_time = in_time;
+        recency_index.emplace(std::make_pair(in_time, d->id), d);
+    }
+
+    size_t since(time_t in_ts, std::vector<std::shared_ptr<bench_device> >& ret) {
+        local_locker lock(&mutex);
+
+        auto ri = recency_index.upper_bound(std::make_pair(in_ts,
+                    std::numeric_limits<uint64_t>::max()));
+
+        for (; ri != recency_index.end(); ++ri)
+            ret.push_back(ri->second);
+
+        return ret.size();
+    }
+
+    kis_recursive_timed_mutex mutex;
+    recency_map recency_index;
+    std::atomic<uint64_t> lock_count;
+    std::atomic<uint64_t> contended_count;
+};
+
+// Sharded index, only locked when last_time moves
+struct sharded_index {
+    bench_shard *shard(std::shared_ptr<bench_device> d) {
+        return &shards[std::hash<uint64_t>()(d->id) % num_shards];
+    }
+
+    void index(std::shared_ptr<bench_device> d) {
+        bench_shard *s = shard(d);
+        local_locker lock(&(s->mutex));
+        d->recency_time = d->last_time;
+        s->recency_index.emplace(std::make_pair(d->recency_time.load(), d->id), d);
+    }
+
+    void update(std::shared_ptr<bench_device> d, time_t in_time) {
+        if (d->recency_time >= in_time)
+            return;
+
+        bench_shard *s = shard(d);
+        local_counting_locker lock(&(s->mutex), &(s->lock_count), &(s->contended_count));
+
+        time_t last_time = d->recency_time;
+
+        if (last_time >= in_time)
+            return;
+
+        s->recency_index.erase(std::make_pair(last_time, d->id));
+        d->last_time = in_time;
+        d->recency_time = in_time;
+        s->recency_index.emplace(std::make_pair(in_time, d->id), d);
+    }
+
+    size_t since(time_t in_ts, std::vector<std::shared_ptr<bench_device> >& ret) {
+        // Same merge of the shard runs as Devicetracker::FetchDevicesSince
+        std::unique_ptr<local_locker> locks[num_shards];
+
+        typedef std::pair<recency_map::iterator, recency_map::iterator> recent_run;
+        std::vector<recent_run> runs;
+
+        for (unsigned int x = 0; x < num_shards; x++) {
+            locks[x].reset(new local_locker(&(shards[x].mutex)));
+
+            auto ri = shards[x].recency_index.upper_bound(std::make_pair(in_ts,
+                        std::numeric_limits<uint64_t>::max()));
+
+            if (ri != shards[x].recency_index.end())
+                runs.push_back(recent_run(ri, shards[x].recency_index.end()));
+        }
+
+        auto later = [](const recent_run& a, const recent_run& b) {
+            return b.first->first < a.first->first;
+        };
+
+        std::make_heap(runs.begin(), runs.end(), later);
+
+        while (!runs.empty()) {
+            std::pop_heap(runs.begin(), runs.end(), later);
+
+            recent_run& r = runs.back();
+
+            ret.push_back(r.first->second);
+
+            if (++r.first == r.second)
+                runs.pop_back();
+            else
+                std::push_heap(runs.begin(), runs.end(), later);
+        }
+
+        return ret.size();
+    }
+
+    uint64_t lock_count() {
+        uint64_t c = 0;
+        for (unsigned int x = 0; x < num_shards; x++)
+            c += shards[x].lock_count;
+        return c;
+    }
+
+    uint64_t contended_count() {
+        uint64_t c = 0;
+        for (unsigned int x = 0; x < num_shards; x++)
+            c += shards[x].contended_count;
+        return c;
+    }
+
+    bench_shard shards[num_shards];
+};
+
+static double elapsed_ns(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start).count();
+}
+
+// Each packet thread sees its own devices (packets are sharded across the
+// packet threads by source), with the packet clock advancing by a second
+// every pps packets
+template<class I>
+double run(I& index, std::vector<std::shared_ptr<bench_device> >& devices,
+        unsigned int num_threads, unsigned int num_packets, unsigned int pps) {
+    std::vector<std::thread> threads;
+
+    auto start = std::chrono::steady_clock::now();
+
+    for (unsigned int t = 0; t < num_threads; t++) {
+        threads.push_back(std::thread([&index, &devices, t, num_threads, num_packets, pps]() {
+            size_t per_thread = devices.size() / num_threads;
+            size_t base = t * per_thread;
+            uint64_t r = 0x9E3779B97F4A7C15ULL * (t + 1);
+
+            for (unsigned int p = 0; p < num_packets; p++) {
+                r ^= r << 13;
+                r ^= r >> 7;
+                r ^= r << 17;
+
+                std::shared_ptr<bench_device> d = devices[base + (r % per_thread)];
+                time_t ts = 1500000000 + (p / pps);
+
+                local_locker devlock(&(d->device_mutex));
+                index.update(d, ts);
+            }
+        }));
+    }
+
+    for (auto& t : threads)
+        t.join();
+
+    return elapsed_ns(start) / ((double) num_packets * num_threads);
+}
+
+int main(int argc, char *argv[]) {
+    unsigned int num_threads = 4;
+    unsigned int num_devices = 20000;
+    unsigned int num_packets = 2000000;
+    unsigned int pps = 10000;
+
+    if (argc > 1)
+        num_threads = strtoul(argv[1], NULL, 10);
+    if (argc > 2)
+        num_devices = strtoul(argv[2], NULL, 10);
+    if (argc > 3)
+        num_packets = strtoul(argv[3], NULL, 10);
+    if (argc > 4)
+        pps = strtoul(argv[4], NULL, 10);
+
+    if (num_threads == 0 || num_devices < num_threads || pps == 0) {
+        fprintf(stderr, "usage: %s [threads] [devices] [packets per thread] "
+                "[packets per second]\n", argv[0]);
+        return 1;
+    }
+
+    std::vector<std::shared_ptr<bench_device> > global_devs, sharded_devs;
+
+    global_index gi;
+    sharded_index si;
+
+    for (unsigned int d = 0; d < num_devices; d++) {
+        global_devs.push_back(std::make_shared<bench_device>(d));
+        gi.index(global_devs.back());
+
+        sharded_devs.push_back(std::make_shared<bench_device>(d));
+        si.index(sharded_devs.back());
+    }
+
+    printf("%u threads, %u devices, %u packets per thread, %u packets/sec per thread\n",
+            num_threads, num_devices, num_packets, pps);
+
+    double g_ns = run(gi, global_devs, num_threads, num_packets, pps);
+    double s_ns = run(si, sharded_devs, num_threads, num_packets, pps);
+
+    printf("  single index, lock per packet:  %8.1f ns per packet, %llu locks, "
+            "%llu contended\n", g_ns, (unsigned long long) gi.lock_count.load(),
+            (unsigned long long) gi.contended_count.load());
+    printf("  sharded index, lock on advance: %8.1f ns per packet, %llu locks, "
+            "%llu contended\n", s_ns, (unsigned long long) si.lock_count(),
+            (unsigned long long) si.contended_count());
+
+    // Last-time query for the final 60 seconds of packets
+    time_t since = 1500000000 + (num_packets / pps) - 60;
+
+    unsigned int queries = 100;
+    size_t g_found = 0, s_found = 0;
+
+    auto start = std::chrono::steady_clock::now();
+    for (unsigned int q = 0; q < queries; q++) {
+        std::vector<std::shared_ptr<bench_device> > ret;
+        g_found = gi.since(since, ret);
+    }
+    double gq_us = elapsed_ns(start) / queries / 1000;
+
+    start = std::chrono::steady_clock::now();
+    for (unsigned int q = 0; q < queries; q++) {
+        std::vector<std::shared_ptr<bench_device> > ret;
+        s_found = si.since(since, ret);
+    }
+    double sq_us = elapsed_ns(start) / queries / 1000;
+
+    printf("last-time query, %zu / %zu devices\n", g_found, s_found);
+    printf("  single index:                   %8.1f us\n", gq_us);
+    printf("  sharded index, merged:          %8.1f us\n", sq_us);
+
+    return 0;
+}
+
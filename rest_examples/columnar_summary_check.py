@@ -0,0 +1,242 @@
+#!/usr/bin/env python
+
+"""
+Check that the columnar device endpoint returns the same values as the
+summarized device list.
+
+The same field specification is sent to /devices/summary/devices.json and
+/devices/columnar/devices.kcol, the KCOL stream is decoded, and every column
+of every device is compared against the summarized record of the same device.
+
+Devices which were updated between the two requests are skipped, since their
+values are expected to differ.  RRD vectors are fast-forwarded to the time of
+the request, so if a request crosses a second boundary they may legitimately
+differ; the comparison is retried a few times before reporting a mismatch.
+
+Exits 0 if the endpoints agree, 1 otherwise.
+"""
+
+from __future__ import print_function
+
+import argparse
+import json
+import struct
+import sys
+
+import requests
+
+# Fields which only exist while a device is being serialized (the RRD vectors)
+# are the interesting ones; plain fields make sure the rows line up.
+default_fields = [
+    "kismet.device.base.macaddr",
+    "kismet.device.base.phyname",
+    "kismet.device.base.channel",
+    "kismet.device.base.frequency",
+    "kismet.device.base.packets.total",
+    "kismet.device.base.signal/kismet.common.signal.last_signal",
+    ["kismet.device.base.packets.rrd/kismet.common.rrd.minute_vec", "minute_vec"],
+    ["kismet.device.base.packets.rrd/kismet.common.rrd.hour_vec", "hour_vec"],
+    ["kismet.device.base.datasize.rrd/kismet.common.rrd.minute_vec", "data_minute_vec"],
+    "kismet.device.base.seenby",
+]
+
+# Always requested, to match rows and detect devices which changed between
+# the requests
+key_field = "kismet.device.base.key"
+time_field = "kismet.device.base.last_time"
+
+fixed_types = {
+    1: ("<b", 1), 2: ("<B", 1), 3: ("<h", 2), 4: ("<H", 2),
+    5: ("<i", 4), 6: ("<I", 4), 7: ("<q", 8), 8: ("<Q", 8),
+    9: ("<f", 4), 10: ("<d", 8),
+}
+
+def field_name(f):
+    """ Name of a field in the summarized record and the column name """
+    if isinstance(f, list):
+        return f[1]
+    return f.split("/")[-1]
+
+def decode_kcol(blob):
+    """ Decode a KCOL stream into a list of (name, [values]) columns """
+    if blob[0:4] != b"KCOL":
+        raise ValueError("Not a KCOL stream")
+
+    (version, ncols, nrows) = struct.unpack_from("<IIQ", blob, 4)
+    if version != 1:
+        raise ValueError("Unknown KCOL version {}".format(version))
+
+    pos = 20
+    descs = []
+    for c in range(ncols):
+        (ctype, namelen) = struct.unpack_from("<BI", blob, pos)
+        pos += 5
+        name = blob[pos:pos + namelen].decode("utf-8")
+        pos += namelen
+        (blocklen,) = struct.unpack_from("<Q", blob, pos)
+        pos += 8
+        descs.append((ctype, name, blocklen))
+
+    columns = []
+    for (ctype, name, blocklen) in descs:
+        block = blob[pos:pos + blocklen]
+        pos += blocklen
+
+        bitmap_len = (nrows + 7) // 8
+        bitmap = bytearray(block[0:bitmap_len])
+        valid = [(bitmap[r // 8] >> (r % 8)) & 1 for r in range(nrows)]
+
+        values = [None] * nrows
+
+        if ctype in fixed_types:
+            (fmt, sz) = fixed_types[ctype]
+            for r in range(nrows):
+                if valid[r]:
+                    values[r] = struct.unpack_from(fmt, block, bitmap_len + r * sz)[0]
+        elif ctype == 11:
+            for r in range(nrows):
+                if valid[r]:
+                    m = bytearray(block[bitmap_len + r * 6:bitmap_len + r * 6 + 6])
+                    values[r] = ":".join("{:02X}".format(b) for b in m)
+        elif ctype == 12:
+            # The uuid block is stored in host order; kismet servers are
+            # little-endian in practice
+            for r in range(nrows):
+                if valid[r]:
+                    u = struct.unpack_from("<IHHH6B", block, bitmap_len + r * 16)
+                    values[r] = "{:08x}-{:04x}-{:04x}-{:04x}-{}".format(
+                            u[0], u[1], u[2], u[3],
+                            "".join("{:02x}".format(b) for b in u[4:]))
+        elif ctype in (0, 19, 254):
+            offsets = struct.unpack_from("<{}Q".format(nrows + 1), block, bitmap_len)
+            data = block[bitmap_len + (nrows + 1) * 8:]
+            for r in range(nrows):
+                if not valid[r]:
+                    continue
+                v = data[offsets[r]:offsets[r + 1]]
+                if ctype == 0:
+                    values[r] = v.decode("utf-8")
+                elif ctype == 254:
+                    values[r] = json.loads(v.decode("utf-8"))
+                else:
+                    values[r] = bytearray(v)
+        elif ctype != 255:
+            raise ValueError("Unknown column type {} for {}".format(ctype, name))
+
+        columns.append((name, values))
+
+    return columns
+
+def same_value(a, b):
+    """ Compare a summarized value and a column value """
+    if isinstance(a, float) or isinstance(b, float):
+        try:
+            return abs(float(a) - float(b)) <= 1e-5 * max(1.0, abs(float(a)))
+        except (TypeError, ValueError):
+            return False
+
+    if isinstance(a, dict) and isinstance(b, dict):
+        if set(a.keys()) != set(b.keys()):
+            return False
+        return all(same_value(a[k], b[k]) for k in a)
+
+    if isinstance(a, list) and isinstance(b, list):
+        if len(a) != len(b):
+            return False
+        return all(same_value(x, y) for (x, y) in zip(a, b))
+
+    if isinstance(b, bytearray):
+        return False
+
+    if hasattr(a, "upper") and hasattr(b, "upper"):
+        # MAC addresses may carry a mask in the summary
+        if len(b) == 17 and a.upper().startswith(b.upper()):
+            return True
+        return a.upper() == b.upper()
+
+    return a == b
+
+def compare(session, uri, fields):
+    """ Run one comparison, returning (devices compared, list of mismatches) """
+    request = {"fields": [key_field, time_field] + fields}
+    postdata = {"json": json.dumps(request)}
+
+    r = session.post("{}/devices/summary/devices.json".format(uri), data=postdata)
+    r.raise_for_status()
+    summary = {}
+    for d in r.json():
+        summary[d[field_name(key_field)]] = d
+
+    r = session.post("{}/devices/columnar/devices.kcol".format(uri), data=postdata)
+    r.raise_for_status()
+    columns = decode_kcol(r.content)
+
+    names = [c[0] for c in columns]
+    expected = [field_name(f) for f in request["fields"]]
+    if names != expected:
+        return (0, ["column names {} do not match fields {}".format(names, expected)])
+
+    keys = columns[0][1]
+    times = columns[1][1]
+
+    compared = 0
+    mismatches = []
+
+    for (row, key) in enumerate(keys):
+        if key not in summary:
+            # Device created after the summary request
+            continue
+
+        sd = summary[key]
+
+        if sd.get(field_name(time_field)) != times[row]:
+            continue
+
+        compared += 1
+
+        for (name, values) in columns[2:]:
+            sv = sd.get(name)
+            cv = values[row]
+
+            if sv is None and cv is None:
+                continue
+
+            if not same_value(sv, cv):
+                mismatches.append("{} {}: summary {} columnar {}".format(key, name,
+                    json.dumps(sv), json.dumps(cv) if not isinstance(cv, bytearray) else repr(cv)))
+
+    return (compared, mismatches)
+
+def main():
+    parser = argparse.ArgumentParser(description='Compare columnar and summarized device values')
+
+    parser.add_argument('--uri', action="store", dest="uri", default="http://localhost:2501")
+    parser.add_argument('--user', action="store", dest="user")
+    parser.add_argument('--password', action="store", dest="password")
+    parser.add_argument('--retries', action="store", dest="retries", type=int, default=3)
+    parser.add_argument('--field', action="append", dest="fields",
+            help="field path to compare, may be repeated; defaults to a set including the RRD vectors")
+
+    results = parser.parse_args()
+
+    fields = results.fields if results.fields else default_fields
+
+    session = requests.Session()
+    if results.user is not None:
+        session.auth = (results.user, results.password)
+
+    for attempt in range(results.retries):
+        (compared, mismatches) = compare(session, results.uri, fields)
+
+        if len(mismatches) == 0:
+            print("OK: {} devices, {} fields match".format(compared, len(fields)))
+            return 0
+
+    print("FAIL: {} mismatches across {} devices".format(len(mismatches), compared))
+    for m in mismatches:
+        print("  " + m)
+
+    return 1
+
+if __name__ == "__main__":
+    sys.exit(main())
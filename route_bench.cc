@@ -0,0 +1,270 @@
+/* benchmark harness for HTTP request dispatch
+ *
+ * Registers a set of handlers serving the usual Kismet REST endpoints and
+ * dispatches a mix of UI requests to them two ways:
+ *
+ *  - the old linear scan, asking every handler in turn whether it can serve
+ *    the url; each handler splits and checks the url itself
+ *  - the route trie, splitting the url once and asking only the handlers
+ *    whose routes match, the way Kis_Net_Httpd::FindHandler does now
+ *
+ * Both have to pick the same handler for every request.
+ *
+ * # build kismet, then
+ * make route_bench
+ *
+ * ./route_bench [requests]
+ *
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "globalregistry.h"
+#include "entrytracker.h"
+#include "util.h"
+#include "kis_httpd_route.h"
+#include "kis_net_microhttpd.h"
+
+static double elapsed_ns(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start).count();
+}
+
+// A handler serving a fixed set of endpoint patterns
+class bench_handler : public Kis_Net_Httpd_Handler {
+public:
+    bench_handler(GlobalRegistry *in_globalreg, const std::vector<std::string>& in_patterns) :
+        Kis_Net_Httpd_Handler(in_globalreg),
+        patterns(in_patterns) {
+
+        for (auto p : patterns)
+            tokenized_patterns.push_back(StrTokenize(p, "/"));
+    }
+
+    virtual int Httpd_HandleGetRequest(Kis_Net_Httpd *httpd __attribute__((unused)),
+            Kis_Net_Httpd_Connection *connection __attribute__((unused)),
+            const char *url __attribute__((unused)),
+            const char *method __attribute__((unused)),
+            const char *upload_data __attribute__((unused)),
+            size_t *upload_data_size __attribute__((unused))) {
+        return MHD_NO;
+    }
+
+    virtual int Httpd_HandlePostRequest(Kis_Net_Httpd *httpd __attribute__((unused)),
+            Kis_Net_Httpd_Connection *connection __attribute__((unused)),
+            const char *url __attribute__((unused)),
+            const char *method __attribute__((unused)),
+            const char *upload_data __attribute__((unused)),
+            size_t *upload_data_size __attribute__((unused))) {
+        return MHD_NO;
+    }
+
+    // As handlers checked urls before routes: split the url and compare it to
+    // each endpoint
+    virtual bool Httpd_VerifyPath(const char *path, const char *method) {
+        if (strcmp(method, "GET") != 0)
+            return false;
+
+        std::vector<std::string> tokenurl = StrTokenize(path, "/");
+
+        for (auto& p : tokenized_patterns) {
+            if (pattern_matches(p, tokenurl))
+                return true;
+        }
+
+        return false;
+    }
+
+    // The route already matched the url
+    virtual bool Httpd_VerifyRoute(const char *path __attribute__((unused)),
+            const char *method,
+            const Kis_Net_Httpd_Route_Match& match __attribute__((unused))) {
+        return strcmp(method, "GET") == 0;
+    }
+
+    std::vector<std::string> patterns;
+
+protected:
+    static bool pattern_matches(const std::vector<std::string>& in_pattern,
+            const std::vector<std::string>& in_tokenurl) {
+        for (size_t i = 0; i < in_pattern.size(); i++) {
+            if (in_pattern[i].length() != 0 && in_pattern[i][0] == '*')
+                return in_tokenurl.size() > i;
+
+            if (i >= in_tokenurl.size())
+                return false;
+
+            if (in_pattern[i].length() != 0 && in_pattern[i][0] == ':')
+                continue;
+
+            if (in_pattern[i] != in_tokenurl[i])
+                return false;
+        }
+
+        return in_pattern.size() == in_tokenurl.size();
+    }
+
+    std::vector<std::vector<std::string> > tokenized_patterns;
+};
+
+int main(int argc, char *argv[]) {
+    unsigned int num_requests = 1000000;
+
+    if (argc > 1)
+        num_requests = strtoul(argv[1], NULL, 10);
+
+    if (num_requests == 0) {
+        fprintf(stderr, "usage: %s [requests]\n", argv[0]);
+        return 1;
+    }
+
+    GlobalRegistry *globalreg = new GlobalRegistry();
+    EntryTracker::create_entrytracker(globalreg);
+
+    // Endpoints of the server and phy handlers, in the order they register
+    const std::vector<std::vector<std::string> > endpoints = {
+        { "/system/status.json", "/system/timestamp.json", "/system/tracked_fields.html" },
+        { "/session/check_session", "/session/check_setup_ok", "/session/set_password" },
+        { "/dynamic.js" },
+        { "/messagebus/all_messages.json", "/messagebus/last-time/:ts/messages.json" },
+        { "/channels/channels.json" },
+        { "/gps/location.json", "/gps/all_gps.json", "/gps/drivers.json" },
+        { "/packetchain/packet_stats.json" },
+        { "/alerts/all_alerts.json", "/alerts/definitions.json",
+            "/alerts/last-time/:ts/alerts.json" },
+        { "/plugins/all_plugins.json" },
+        { "/streams/all_streams.json", "/streams/by-id/:id/stream_info.json",
+            "/streams/by-id/:id/close_stream.cmd" },
+        { "/logging/drivers.json", "/logging/active.json",
+            "/logging/by-class/:class/start.cmd", "/logging/by-uuid/:uuid/stop.cmd" },
+        { "/datasource/all_sources.json", "/datasource/types.json",
+            "/datasource/defaults.json", "/datasource/add_source.cmd",
+            "/datasource/by-uuid/:uuid/source.json",
+            "/datasource/by-uuid/:uuid/set_channel.cmd" },
+        { "/datasource/pcap/by-uuid/:uuid/packets.pcapng", "/pcap/all_packets.pcapng" },
+        { "/devices/all_devices.ekjson", "/devices/:file", "/phy/:file",
+            "/devices/summary/:file", "/devices/columnar/:file",
+            "/devices/by-key/:key/:file", "/devices/by-key/:key/:file/*path",
+            "/devices/by-mac/:mac/:file", "/devices/by-phy/:phy/:file",
+            "/devices/last-time/:ts/:file" },
+        { "/devices/pcap/by-key/:key/packets.pcapng" },
+        { "/phy/phy80211/ssids/views/ssids.json",
+            "/phy/phy80211/by-key/:key/pcap/:file",
+            "/phy/phy80211/clients-of/:key/clients.json",
+            "/phy/phy80211/related-to/:key/devices.json",
+            "/phy/phy80211/handshake/:mac/:file" },
+        { "/phy/phybluetooth/manuf.json" },
+        { "/phy/RTL433/post_sensor_json.cmd" },
+        { "/phy/ZWAVE/post_zwave_json.cmd" },
+        { "/phy/phy_uav_drone/manuf-matchers.json",
+            "/phy/phy_uav_drone/add_drone_match.cmd" },
+        { "/logging/kismetdb/pcap/:file" },
+        { "/storage/by-key/:key/:file" },
+    };
+
+    // What the UI fetches, weighted to the device list and device detail
+    const std::vector<std::string> urls = {
+        "/system/status.json",
+        "/devices/last-time/1500000000/devices.json",
+        "/devices/summary/devices.json",
+        "/devices/by-key/4202770D00000000_3C4ABF1E1C00/device.json",
+        "/devices/by-key/4202770D00000000_3C4ABF1E1C00/device.json/kismet.device.base.packets.rrd",
+        "/messagebus/last-time/1500000000/messages.json",
+        "/alerts/last-time/1500000000/alerts.json",
+        "/channels/channels.json",
+        "/gps/location.json",
+        "/datasource/all_sources.json",
+        "/phy/phy80211/clients-of/4202770D00000000_3C4ABF1E1C00/clients.json",
+        "/session/check_session",
+        "/storage/by-key/4202770D00000000_3C4ABF1E1C00/notes.json",
+        "/devices/summary/devices.json",
+        "/devices/last-time/1500000000/devices.json",
+        "/no/such/endpoint.json",
+    };
+
+    std::vector<std::shared_ptr<bench_handler> > handlers;
+    Kis_Net_Httpd_Route_Trie trie;
+
+    for (auto e : endpoints) {
+        std::shared_ptr<bench_handler> h(new bench_handler(globalreg, e));
+        handlers.push_back(h);
+
+        for (auto p : e)
+            trie.add_route(p, h.get());
+    }
+
+    printf("%zu handlers, %zu routes, %u requests\n", handlers.size(), trie.size(),
+            num_requests);
+
+    std::vector<Kis_Net_Httpd_Handler *> linear_found(urls.size(), NULL);
+    std::vector<Kis_Net_Httpd_Handler *> trie_found(urls.size(), NULL);
+
+    auto start = std::chrono::steady_clock::now();
+
+    for (unsigned int r = 0; r < num_requests; r++) {
+        size_t u = r % urls.size();
+        Kis_Net_Httpd_Handler *found = NULL;
+
+        for (auto h : handlers) {
+            if (h->Httpd_VerifyPath(urls[u].c_str(), "GET")) {
+                found = h.get();
+                break;
+            }
+        }
+
+        linear_found[u] = found;
+    }
+
+    double linear_ns = elapsed_ns(start) / num_requests;
+
+    start = std::chrono::steady_clock::now();
+
+    for (unsigned int r = 0; r < num_requests; r++) {
+        size_t u = r % urls.size();
+        Kis_Net_Httpd_Handler *found = NULL;
+
+        Kis_Net_Httpd_Route_Match match;
+        std::vector<Kis_Net_Httpd_Route_Trie::candidate> candidates;
+
+        match.tokenurl = StrTokenize(urls[u], "/");
+        trie.match(match.tokenurl, candidates);
+
+        for (auto c : candidates) {
+            match.params = c.params;
+
+            if (c.handler->Httpd_VerifyRoute(urls[u].c_str(), "GET", match)) {
+                found = c.handler;
+                break;
+            }
+        }
+
+        trie_found[u] = found;
+    }
+
+    double trie_ns = elapsed_ns(start) / num_requests;
+
+    unsigned int mismatched = 0;
+
+    for (size_t u = 0; u < urls.size(); u++) {
+        if (linear_found[u] != trie_found[u]) {
+            fprintf(stderr, "dispatch mismatch for %s\n", urls[u].c_str());
+            mismatched++;
+        }
+    }
+
+    printf("  linear scan: %8.1f ns per request\n", linear_ns);
+    printf("  route trie:  %8.1f ns per request\n", trie_ns);
+    printf("  speedup %.2fx, dispatch %s\n", linear_ns / trie_ns,
+            mismatched == 0 ? "matches" : "DIFFERS");
+
+    return mismatched != 0;
+}
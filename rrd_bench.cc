@@ -0,0 +1,149 @@
+/* benchmark harness for tracked RRDs
+ *
+ * Measures the heap held by a set of RRDs with their buckets stored in the
+ * fixed arrays, against the same buckets held as a vector of tracked
+ * elements (which is what the RRDs used to keep at all times, and what they
+ * now only build while being serialized), and the cost of add_sample(...)
+ * for a per-packet update pattern.
+ *
+ * # build kismet, then
+ * make rrd_bench
+ *
+ * ./rrd_bench [rrds] [samples]
+ *
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <malloc.h>
+
+#include <chrono>
+#include <memory>
+#include <vector>
+
+#include "globalregistry.h"
+#include "entrytracker.h"
+#include "trackedelement.h"
+#include "tracked_rrd.h"
+
+static size_t heap_used() {
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+    return mallinfo2().uordblks;
+#else
+    return 0;
+#endif
+}
+
+static double elapsed_ns(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char *argv[]) {
+    unsigned int num_rrds = 10000;
+    unsigned int num_samples = 10000000;
+
+    if (argc > 1)
+        num_rrds = strtoul(argv[1], NULL, 10);
+    if (argc > 2)
+        num_samples = strtoul(argv[2], NULL, 10);
+
+    GlobalRegistry *globalreg = new GlobalRegistry();
+    EntryTracker::create_entrytracker(globalreg);
+
+    int rrd_id =
+        globalreg->entrytracker->RegisterField("bench.rrd", TrackerMap, "rrd");
+    int minute_rrd_id =
+        globalreg->entrytracker->RegisterField("bench.minute_rrd", TrackerMap, "minute rrd");
+
+    // Warm up the field registration so it isn't counted
+    {
+        std::shared_ptr<kis_tracked_rrd<> > r(new kis_tracked_rrd<>(globalreg, rrd_id));
+        std::shared_ptr<kis_tracked_minute_rrd<> > m(new kis_tracked_minute_rrd<>(globalreg,
+                    minute_rrd_id));
+    }
+
+    std::vector<std::shared_ptr<kis_tracked_rrd<> > > rrds;
+    std::vector<std::shared_ptr<kis_tracked_minute_rrd<> > > minute_rrds;
+    rrds.reserve(num_rrds);
+    minute_rrds.reserve(num_rrds);
+
+    size_t heap_start = heap_used();
+
+    for (unsigned int i = 0; i < num_rrds; i++)
+        rrds.push_back(std::make_shared<kis_tracked_rrd<> >(globalreg, rrd_id));
+
+    size_t heap_rrd = heap_used();
+
+    for (unsigned int i = 0; i < num_rrds; i++)
+        minute_rrds.push_back(std::make_shared<kis_tracked_minute_rrd<> >(globalreg,
+                    minute_rrd_id));
+
+    size_t heap_minute = heap_used();
+
+    // The same buckets as tracked element vectors
+    int second_id = globalreg->entrytracker->GetFieldId("kismet.common.rrd.second");
+    std::vector<SharedTrackerElement> vecs;
+    vecs.reserve(num_rrds * 3);
+
+    int64_t vals[60] = { 0 };
+
+    for (unsigned int i = 0; i < num_rrds; i++) {
+        for (unsigned int v = 0; v < 3; v++) {
+            SharedTrackerElement e(new TrackerElement(TrackerVector));
+            kis_tracked_rrd_fill_vector(e, vals, v == 2 ? 24 : 60, second_id);
+            vecs.push_back(e);
+        }
+    }
+
+    size_t heap_vec = heap_used();
+
+    printf("%u RRDs\n", num_rrds);
+    printf("  full rrd, bucket arrays:     %8.1f bytes per rrd\n",
+            (double) (heap_rrd - heap_start) / num_rrds);
+    printf("  minute rrd, bucket arrays:   %8.1f bytes per rrd\n",
+            (double) (heap_minute - heap_rrd) / num_rrds);
+    printf("  full rrd buckets as vectors: %8.1f bytes per rrd (in addition)\n",
+            (double) (heap_vec - heap_minute) / num_rrds);
+
+    vecs.clear();
+
+    // Per-packet pattern: a burst of samples each second to the same rrd
+    std::shared_ptr<kis_tracked_rrd<> > rrd = rrds[0];
+    std::shared_ptr<kis_tracked_minute_rrd<> > mrrd = minute_rrds[0];
+
+    time_t now = 1500000000;
+
+    auto start = std::chrono::steady_clock::now();
+    for (unsigned int i = 0; i < num_samples; i++)
+        rrd->add_sample(1, now + (i / 100));
+    double rrd_ns = elapsed_ns(start) / num_samples;
+
+    start = std::chrono::steady_clock::now();
+    for (unsigned int i = 0; i < num_samples; i++)
+        mrrd->add_sample(1, now + (i / 100));
+    double mrrd_ns = elapsed_ns(start) / num_samples;
+
+    // What a scoped lock around each sample would add
+    kis_recursive_timed_mutex mutex;
+    start = std::chrono::steady_clock::now();
+    for (unsigned int i = 0; i < num_samples; i++) {
+        local_locker lock(&mutex);
+    }
+    double lock_ns = elapsed_ns(start) / num_samples;
+
+    printf("%u samples\n", num_samples);
+    printf("  full rrd add_sample:         %8.1f ns\n", rrd_ns);
+    printf("  minute rrd add_sample:       %8.1f ns\n", mrrd_ns);
+    printf("  local_locker lock + unlock:  %8.1f ns\n", lock_ns);
+
+    rrds.clear();
+    minute_rrds.clear();
+
+    globalreg->DeleteLifetimeGlobals();
+
+    return 0;
+}
+
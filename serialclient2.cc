@@ -119,35 +119,40 @@ bool SerialClientV2::FetchConnected() {
     return device_fd > -1;
 }
 
-int SerialClientV2::MergeSet(int in_max_fd, fd_set *out_rset, fd_set *out_wset) {
+bool SerialClientV2::MergePollFds(std::vector<struct pollfd>& out_fds) {
     if (device_fd < 0)
-        return in_max_fd;
+        return true;
+
+    struct pollfd pfd;
+    pfd.fd = device_fd;
+    pfd.events = 0;
+    pfd.revents = 0;
 
     // If we have data waiting to be written, fill it in
     if (handler->GetWriteBufferUsed())
-        FD_SET(device_fd, out_wset);
+        pfd.events |= POLLOUT;
 
     // We always want to read data if we have any space
     if (handler->GetReadBufferAvailable() > 0)
-        FD_SET(device_fd, out_rset);
+        pfd.events |= POLLIN;
 
-    if (in_max_fd < device_fd)
-        return device_fd;
+    if (pfd.events != 0)
+        out_fds.push_back(pfd);
 
-    return in_max_fd;
+    return true;
 }
 
-int SerialClientV2::Poll(fd_set& in_rset, fd_set& in_wset) {
+void SerialClientV2::PollFd(int in_fd, bool in_read, bool in_write) {
     stringstream msg;
 
     uint8_t *buf;
     size_t len;
     ssize_t ret, iret;
 
-    if (device_fd < 0)
-        return 0;
+    if (device_fd < 0 || in_fd != device_fd)
+        return;
 
-    if (FD_ISSET(device_fd, &in_rset)) {
+    if (in_read) {
         // Allocate the biggest buffer we can fit in the ring, read as much
         // as we can at once.
         
@@ -170,7 +175,7 @@ int SerialClientV2::Poll(fd_set& in_rset, fd_set& in_wset) {
                     handler->BufferError(msg.str());
 
                     Close();
-                    return 0;
+                    return;
                 } else {
                     handler->CommitReadBufferData(buf, 0);
                     break;
@@ -183,7 +188,7 @@ int SerialClientV2::Poll(fd_set& in_rset, fd_set& in_wset) {
                     // Die if we couldn't insert all our data, the error is already going
                     // upstream.
                     Close();
-                    return 0;
+                    return;
                 }
             }
 
@@ -191,7 +196,7 @@ int SerialClientV2::Poll(fd_set& in_rset, fd_set& in_wset) {
         }
     }
 
-    if (FD_ISSET(device_fd, &in_wset)) {
+    if (in_write) {
         len = handler->GetWriteBufferUsed();
 
         // Peek the data into our buffer
@@ -207,7 +212,7 @@ int SerialClientV2::Poll(fd_set& in_rset, fd_set& in_wset) {
                 handler->BufferError(msg.str());
 
                 Close();
-                return 0;
+                return;
             }
         } else {
             // Consume whatever we managed to write
@@ -217,8 +222,6 @@ int SerialClientV2::Poll(fd_set& in_rset, fd_set& in_wset) {
 
         delete[] buf;
     }
-
-    return 0;
 }
 
 void SerialClientV2::Close() {
@@ -48,8 +48,8 @@ public:
     void Close();
 
     // Pollable interface
-    virtual int MergeSet(int in_max_fd, fd_set *out_rset, fd_set *out_wset);
-    virtual int Poll(fd_set& in_rset, fd_set& in_wset);
+    virtual bool MergePollFds(std::vector<struct pollfd>& out_fds);
+    virtual void PollFd(int in_fd, bool in_read, bool in_write);
 
     bool FetchConnected();
 
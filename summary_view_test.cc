@@ -0,0 +1,268 @@
+/* test harness for devices caught between the common and the phy update
+ *
+ * UpdateCommonDevice bumps a device's modification sequence before the phy
+ * handler fills in its own fields.  Anything which looks at the device in
+ * between must still see it as modified once the phy is done:
+ *
+ *  - a summary view must not be left holding the half-updated row
+ *  - a device store or database log, which remembers the sequence when it
+ *    starts and next collects the devices modified since, must collect it
+ *
+ * This feeds 802.11 data frames and Bluetooth advertisements from new devices
+ * through their phy trackers.  When the tracker announces the new device,
+ * which it does after the common update and before the phy fields are
+ * written, it renders a view and starts a flush.  Once the packet is done, the
+ * row the view cached must match a fresh summary and the device must be dirty
+ * for the next flush.
+ *
+ * # build kismet, then
+ * make check
+ *
+ * ./summary_view_test [devices]
+ *
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <functional>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "globalregistry.h"
+#include "configfile.h"
+#include "messagebus.h"
+#include "timetracker.h"
+#include "entrytracker.h"
+#include "packetchain.h"
+#include "alertracker.h"
+#include "kis_httpd_registry.h"
+#include "devicetracker.h"
+#include "phy_80211.h"
+#include "phy_bluetooth.h"
+
+// Catch the device when the tracker announces it
+class catch_on_detect : public MessageClient {
+public:
+    catch_on_detect(GlobalRegistry *in_globalreg, shared_ptr<Devicetracker> in_tracker) :
+        MessageClient(in_globalreg, NULL) {
+        devicetracker = in_tracker;
+        caught = 0;
+        flush_seq = 0;
+    }
+
+    virtual void ProcessMessage(string in_msg, int in_flags) {
+        if (view == NULL || in_msg.find("Detected new ") != 0)
+            return;
+
+        std::shared_ptr<kis_tracked_device_base> dev = devicetracker->FetchDevice(key);
+
+        if (dev == NULL)
+            return;
+
+        std::vector<std::shared_ptr<kis_tracked_device_base> > devices;
+        devices.push_back(dev);
+
+        std::stringstream ss;
+        view->render(ss, devices);
+
+        // As store_devices and databaselog_write_devices start a flush
+        flush_seq = kis_tracked_device_base::current_mod_sequence();
+
+        caught++;
+    }
+
+    shared_ptr<Devicetracker> devicetracker;
+    std::shared_ptr<devicetracker_summary_view> view;
+    TrackedDeviceKey key;
+
+    unsigned int caught;
+    uint64_t flush_seq;
+};
+
+// Run one packet through a phy tracker, catching the device part way through;
+// returns false if the device is left stale
+static bool check_device(GlobalRegistry *globalreg, catch_on_detect& client,
+        std::vector<SharedElementSummary>& fields, Kis_Phy_Handler *phy,
+        mac_addr in_mac, std::function<void (void)> track) {
+
+    client.key = TrackedDeviceKey(globalreg->server_uuid_hash, phy->FetchPhynameHash(), in_mac);
+    unsigned int caught = client.caught;
+
+    track();
+
+    if (client.caught != caught + 1) {
+        fprintf(stderr, "%s device %s was not announced during tracking\n",
+                phy->FetchPhyName().c_str(), in_mac.Mac2String().c_str());
+        return false;
+    }
+
+    std::vector<std::shared_ptr<kis_tracked_device_base> > devices;
+    devices.push_back(client.devicetracker->FetchDevice(client.key));
+
+    std::stringstream cached, fresh;
+
+    client.view->render(cached, devices);
+
+    devicetracker_summary_view fresh_view(globalreg, fields, 300);
+    fresh_view.render(fresh, devices);
+
+    bool ok = true;
+
+    if (cached.str() != fresh.str()) {
+        fprintf(stderr, "%s device %s cached a stale row:\n  cached %s\n  fresh  %s\n",
+                phy->FetchPhyName().c_str(), in_mac.Mac2String().c_str(),
+                cached.str().c_str(), fresh.str().c_str());
+        ok = false;
+    }
+
+    if (devices[0]->get_mod_sequence() < client.flush_seq) {
+        fprintf(stderr, "%s device %s is not dirty for the next flush\n",
+                phy->FetchPhyName().c_str(), in_mac.Mac2String().c_str());
+        ok = false;
+    }
+
+    return ok;
+}
+
+int main(int argc, char *argv[]) {
+    unsigned int num_devices = 64;
+
+    if (argc > 1)
+        num_devices = strtoul(argv[1], NULL, 10);
+
+    if (num_devices == 0 || num_devices > 65536) {
+        fprintf(stderr, "usage: %s [devices]\n", argv[0]);
+        return 1;
+    }
+
+    GlobalRegistry *globalreg = new GlobalRegistry();
+    MessageBus::create_messagebus(globalreg);
+    globalreg->kismet_config = new ConfigFile(globalreg);
+
+    // Current configs, without device storage
+    globalreg->kismet_config->SetOpt("persistent_config_present", "true", 0);
+    globalreg->kismet_config->SetOpt("persistent_state", "false", 0);
+
+    Timetracker::create_timetracker(globalreg);
+    std::shared_ptr<EntryTracker> entrytracker =
+        EntryTracker::create_entrytracker(globalreg);
+    std::shared_ptr<Packetchain> packetchain =
+        Packetchain::create_packetchain(globalreg);
+    Kis_Httpd_Registry::create_http_registry(globalreg);
+    Alertracker::create_alertracker(globalreg);
+    std::shared_ptr<Devicetracker> devicetracker =
+        Devicetracker::create_devicetracker(globalreg);
+
+    devicetracker->RegisterPhyHandler(new Kis_80211_Phy(globalreg));
+    devicetracker->RegisterPhyHandler(new Kis_Bluetooth_Phy(globalreg));
+
+    Kis_80211_Phy *dot11phy =
+        (Kis_80211_Phy *) devicetracker->FetchPhyHandlerByName("IEEE802.11");
+    Kis_Bluetooth_Phy *btphy =
+        (Kis_Bluetooth_Phy *) devicetracker->FetchPhyHandlerByName("Bluetooth");
+
+    if (dot11phy == NULL || btphy == NULL) {
+        fprintf(stderr, "could not create the phys\n");
+        return 1;
+    }
+
+    int pack_comp_80211 = packetchain->RegisterPacketComponent("PHY80211");
+    int pack_comp_common = packetchain->RegisterPacketComponent("COMMON");
+    int pack_comp_btdevice = packetchain->RegisterPacketComponent("BTDEVICE");
+
+    std::vector<SharedElementSummary> fields;
+
+    for (auto f : { "kismet.device.base.macaddr", "kismet.device.base.type",
+            "kismet.device.base.name", "kismet.device.base.basic_type_set",
+            "dot11.device/dot11.device.last_bssid",
+            "dot11.device/dot11.device.datasize",
+            "bluetooth.device/bluetooth.device.txpower" })
+        fields.push_back(SharedElementSummary(new TrackerElementSummary(f, entrytracker)));
+
+    catch_on_detect client(globalreg, devicetracker);
+    client.view.reset(new devicetracker_summary_view(globalreg, fields, 300));
+    globalreg->messagebus->RegisterClient(&client, MSGFLAG_ALL);
+
+    mac_addr bssid("00:11:22:00:00:01");
+    unsigned int checked = 0, passed = 0;
+
+    for (unsigned int d = 0; d < num_devices; d++) {
+        char macstr[18];
+
+        // A data frame from a client to the AP, as the dissectors leave it
+        snprintf(macstr, sizeof(macstr), "00:22:33:00:%02x:%02x", (d >> 8) & 0xFF, d & 0xFF);
+        mac_addr client_mac(macstr);
+
+        kis_packet *pack = packetchain->GeneratePacket();
+        gettimeofday(&(pack->ts), NULL);
+        globalreg->timestamp = pack->ts;
+
+        dot11_packinfo *dot11info = new dot11_packinfo();
+        dot11info->type = packet_data;
+        dot11info->subtype = packet_sub_data;
+        dot11info->distrib = distrib_to;
+        dot11info->source_mac = client_mac;
+        dot11info->dest_mac = bssid;
+        dot11info->bssid_mac = bssid;
+        dot11info->datasize = 100 + d;
+        dot11info->channel = "6";
+        pack->insert(pack_comp_80211, dot11info);
+
+        kis_common_info *common = new kis_common_info();
+        common->phyid = dot11phy->FetchPhyId();
+        common->type = packet_basic_data;
+        common->source = client_mac;
+        common->dest = bssid;
+        common->device = client_mac;
+        common->transmitter = client_mac;
+        common->datasize = dot11info->datasize;
+        common->channel = "6";
+        pack->insert(pack_comp_common, common);
+
+        checked++;
+        if (check_device(globalreg, client, fields, dot11phy, client_mac,
+                    [&]() { dot11phy->TrackerDot11(pack); }))
+            passed++;
+
+        packetchain->DestroyPacket(pack);
+
+        // A Bluetooth LE advertisement, as the bluetooth datasource reports it
+        snprintf(macstr, sizeof(macstr), "00:44:55:00:%02x:%02x", (d >> 8) & 0xFF, d & 0xFF);
+        mac_addr bt_mac(macstr);
+
+        pack = packetchain->GeneratePacket();
+        gettimeofday(&(pack->ts), NULL);
+        globalreg->timestamp = pack->ts;
+
+        bluetooth_packinfo *btpi = new bluetooth_packinfo();
+        btpi->address = bt_mac;
+        btpi->name = std::string("sensor ") + macstr;
+        btpi->txpower = d % 20;
+        btpi->type = 1;
+        pack->insert(pack_comp_btdevice, btpi);
+
+        Kis_Bluetooth_Phy::CommonClassifierBluetooth(globalreg, btphy, pack);
+
+        checked++;
+        if (check_device(globalreg, client, fields, btphy, bt_mac,
+                    [&]() { Kis_Bluetooth_Phy::PacketTrackerBluetooth(globalreg, btphy, pack); }))
+            passed++;
+
+        packetchain->DestroyPacket(pack);
+    }
+
+    printf("%u of %u devices caught mid-update are current in the view and dirty "
+            "for the next flush\n", passed, checked);
+
+    globalreg->messagebus->RemoveClient(&client);
+
+    if (passed != checked)
+        return 1;
+
+    return 0;
+}
@@ -132,43 +132,48 @@ int TcpClientV2::Connect(string in_host, unsigned int in_port) {
     return 0;
 }
 
-int TcpClientV2::MergeSet(int in_max_fd, fd_set *out_rset, fd_set *out_wset) {
+bool TcpClientV2::MergePollFds(std::vector<struct pollfd>& out_fds) {
+    struct pollfd pfd;
+    pfd.fd = cli_fd;
+    pfd.revents = 0;
+
     // All we fill in is the descriptor for writing if we're still trying to
     // connect
     if (pending_connect) {
-        FD_SET(cli_fd, out_wset);
-        if (in_max_fd < cli_fd)
-            return cli_fd;
-        return in_max_fd;
+        pfd.events = POLLOUT;
+        out_fds.push_back(pfd);
+        return true;
     }
 
     if (!connected)
-        return in_max_fd;
+        return true;
+
+    // We always want to read data
+    pfd.events = POLLIN;
 
     // If we have data waiting to be written, fill it in
     if (handler->GetWriteBufferUsed()) {
-        FD_SET(cli_fd, out_wset);
+        pfd.events |= POLLOUT;
     }
 
-    // We always want to read data
-    FD_SET(cli_fd, out_rset);
-
-    if (in_max_fd < cli_fd)
-        return cli_fd;
+    out_fds.push_back(pfd);
 
-    return in_max_fd;
+    return true;
 }
 
-int TcpClientV2::Poll(fd_set& in_rset, fd_set& in_wset) {
+void TcpClientV2::PollFd(int in_fd, bool in_read, bool in_write) {
     stringstream msg;
 
     uint8_t *buf;
     size_t len;
     ssize_t ret, iret;
 
+    if (cli_fd < 0 || in_fd != cli_fd)
+        return;
+
     if (pending_connect) {
         // See if connect has completed
-        if (FD_ISSET(cli_fd, &in_wset)) {
+        if (in_write) {
             int r, e;
             socklen_t l;
 
@@ -187,23 +192,23 @@ int TcpClientV2::Poll(fd_set& in_rset, fd_set& in_wset) {
                 close(cli_fd);
                 connected = false;
                 pending_connect = false;
-                return 0;
+                return;
             } else {
                 connected = true;
                 pending_connect = false;
             }
 
-            return 0;
+            return;
         }
 
         // Nothing else to do if we haven't finished connecting
-        return 0;
+        return;
     }
 
     if (!connected)
-        return 0;
+        return;
 
-    if (FD_ISSET(cli_fd, &in_rset)) {
+    if (in_read) {
         // Allocate the biggest buffer we can fit in the ring, read as much
         // as we can at once.
        
@@ -227,7 +232,7 @@ int TcpClientV2::Poll(fd_set& in_rset, fd_set& in_wset) {
                     handler->BufferError(msg.str());
 
                     Disconnect();
-                    return 0;
+                    return;
                 } else {
                     // Dump the commit
                     handler->CommitReadBufferData(buf, 0);
@@ -242,7 +247,7 @@ int TcpClientV2::Poll(fd_set& in_rset, fd_set& in_wset) {
                     // Die if we couldn't insert all our data, the error is already going
                     // upstream.
                     Disconnect();
-                    return 0;
+                    return;
                 }
             }
 
@@ -251,7 +256,7 @@ int TcpClientV2::Poll(fd_set& in_rset, fd_set& in_wset) {
         }
     }
 
-    if (FD_ISSET(cli_fd, &in_wset)) {
+    if (in_write) {
         len = handler->GetWriteBufferUsed();
 
         // Peek the data into our buffer
@@ -267,7 +272,7 @@ int TcpClientV2::Poll(fd_set& in_rset, fd_set& in_wset) {
                 handler->BufferError(msg.str());
 
                 Disconnect();
-                return 0;
+                return;
             }
         } else {
             // Consume whatever we managed to write
@@ -275,8 +280,6 @@ int TcpClientV2::Poll(fd_set& in_rset, fd_set& in_wset) {
             handler->ConsumeWriteBufferData(iret);
         }
     }
-
-    return 0;
 }
 
 void TcpClientV2::Disconnect() {
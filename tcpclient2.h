@@ -50,8 +50,8 @@ public:
     bool FetchConnected();
 
     // Pollable interface
-    virtual int MergeSet(int in_max_fd, fd_set *out_rset, fd_set *out_wset);
-    virtual int Poll(fd_set& in_rset, fd_set& in_wset);
+    virtual bool MergePollFds(std::vector<struct pollfd>& out_fds);
+    virtual void PollFd(int in_fd, bool in_read, bool in_write);
 
 protected:
     GlobalRegistry *globalreg;
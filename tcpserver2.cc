@@ -19,6 +19,7 @@
 #include "config.h"
 #include "tcpserver2.h"
 #include "ringbuf2.h"
+#include "pollabletracker.h"
 
 TcpServerV2::TcpServerV2(GlobalRegistry *in_globalreg) {
     globalreg = in_globalreg;
@@ -27,6 +28,8 @@ TcpServerV2::TcpServerV2(GlobalRegistry *in_globalreg) {
     server_fd = -1;
 
     ringbuf_size = 128 * 1024;
+
+    watching = false;
 }
 
 TcpServerV2::~TcpServerV2() {
@@ -126,6 +129,17 @@ int TcpServerV2::ConfigureServer(short int in_port, unsigned int in_maxcli,
 
     valid = true;
 
+    // Watch the descriptors directly if the pollable tracker can, so that 
+    // idle connections don't have to be checked on every wakeup
+    pollabletracker = 
+        Globalreg::FetchGlobalAs<PollableTracker>(globalreg, "POLLABLETRACKER");
+
+    if (pollabletracker != NULL && pollabletracker->CanWatchFds())
+        watching = pollabletracker->WatchFd(server_fd, this, true, false);
+
+    if (!watching)
+        pollabletracker.reset();
+
     return 1;
 }
 
@@ -135,6 +149,28 @@ int TcpServerV2::MergeSet(int in_max_fd, fd_set *out_rset, fd_set *out_wset) {
     if (!valid)
         return -1;
 
+    // Watched connections only need their events updated when their buffers
+    // have changed
+    if (watching) {
+        std::set<int> dirty;
+
+        {
+            local_locker lock(&dirty_mutex);
+            dirty.swap(dirty_set);
+        }
+
+        for (auto fd : dirty) {
+            auto i = handler_map.find(fd);
+
+            if (i == handler_map.end() || kill_map.find(fd) != kill_map.end())
+                continue;
+
+            UpdateWatch(i->first, i->second);
+        }
+
+        return maxfd;
+    }
+
     if (server_fd >= 0) {
         FD_SET(server_fd, out_rset);
         if (maxfd < server_fd)
@@ -160,160 +196,265 @@ int TcpServerV2::MergeSet(int in_max_fd, fd_set *out_rset, fd_set *out_wset) {
     return maxfd;
 }
 
-
 int TcpServerV2::Poll(fd_set& in_rset, fd_set& in_wset) {
-    stringstream msg;
-    int ret, iret;
-    size_t len;
-    unsigned char *buf;
-    ssize_t r_sz;
-
     if (!valid)
         return -1;
 
     // Reap any pending closures
-    for (auto i = kill_map.begin(); i != kill_map.end(); ++i) {
-        auto h = handler_map.find(i->first);
-        
-        if (h != kill_map.end()) {
-            close(h->first);
-            handler_map.erase(h);
+    ReapConnections();
+
+    // Watched descriptors are handled in PollFd
+    if (watching)
+        return 0;
+
+    if (server_fd >= 0 && FD_ISSET(server_fd, &in_rset))
+        ProcessAccept();
+
+    for (auto i = handler_map.begin(); i != handler_map.end(); ++i) {
+        // Process incoming data
+        if (FD_ISSET(i->first, &in_rset)) {
+            if (!ReadConnection(i->first, i->second))
+                return 0;
+        }
+
+        if (FD_ISSET(i->first, &in_wset)) {
+            if (!WriteConnection(i->first, i->second))
+                return 0;
         }
     }
-    kill_map.clear();
 
-    int accept_fd = 0;
-    if (server_fd >= 0 && FD_ISSET(server_fd, &in_rset)) {
-        if ((accept_fd = AcceptConnection()) <= 0)
-            return 0;
+    // Reap any pending closures
+    ReapConnections();
 
-        if (!AllowConnection(accept_fd)) {
-            KillConnection(accept_fd);
-            return 0;
-        }
+    return 0;
+}
 
-        shared_ptr<BufferHandlerGeneric> con_handler = AllocateConnection(accept_fd);
+void TcpServerV2::PollFd(int in_fd, bool in_read, bool in_write) {
+    if (!valid)
+        return;
 
-        if (con_handler == NULL) {
-            KillConnection(accept_fd);
-            return 0;
-        }
+    if (in_fd == server_fd) {
+        if (in_read)
+            ProcessAccept();
+
+        return;
+    }
+
+    auto i = handler_map.find(in_fd);
+
+    if (i == handler_map.end() || kill_map.find(in_fd) != kill_map.end())
+        return;
+
+    shared_ptr<BufferHandlerGeneric> handler = i->second;
 
-        handler_map.emplace(accept_fd, con_handler);
+    if (in_read && !ReadConnection(in_fd, handler))
+        return;
+
+    if (in_write && !WriteConnection(in_fd, handler))
+        return;
+
+    UpdateWatch(in_fd, handler);
+}
 
-        NewConnection(con_handler);
+void TcpServerV2::ProcessAccept() {
+    int accept_fd;
+
+    if ((accept_fd = AcceptConnection()) <= 0)
+        return;
+
+    if (!AllowConnection(accept_fd)) {
+        close(accept_fd);
+        return;
     }
 
-    for (auto i = handler_map.begin(); i != handler_map.end(); ++i) {
-        // Process incoming data
-        if (FD_ISSET(i->first, &in_rset)) {
+    // Without the pollable tracker watching our descriptors they go into an
+    // fd_set, which can't hold them past FD_SETSIZE
+    if (!watching && accept_fd >= FD_SETSIZE) {
+        _MSG("TCP server refusing connection, too many open descriptors to "
+                "handle without epoll", MSGFLAG_ERROR);
+        close(accept_fd);
+        return;
+    }
 
-            while (i->second->GetReadBufferAvailable() > 0) {
-                // Read only as much as we can get w/ a direct reference
-                r_sz = i->second->ZeroCopyReserveReadBufferData((void **) &buf, 
-                        i->second->GetReadBufferAvailable());
-
-                if (r_sz < 0) {
-                    msg << "TCP server closing connection from client " << i->first << 
-                        " unable to reserve space in buffer, something went wrong";
-                    i->second->CommitReadBufferData(buf, 0);
-                    i->second->BufferError(msg.str());
-                    KillConnection(i->first);
-                }
+    shared_ptr<BufferHandlerGeneric> con_handler = AllocateConnection(accept_fd);
 
-                if ((ret = read(i->first, buf, r_sz)) <= 0) {
-                    if (errno != EINTR && errno != EAGAIN) {
-                        // Push the error upstream if we failed to read here
-                        if (ret == 0) {
-                            msg << "TCP server closing connection from client " << i->first <<
-                                " - connection closed by remote side";
-                            _MSG(msg.str(), MSGFLAG_ERROR);
-                        } else {
-                            msg << "TCP server error reading from client " << i->first << 
-                                " - " << kis_strerror_r(errno);
-                            _MSG(msg.str(), MSGFLAG_ERROR);
-                        }
-
-                        // Dump the commit
-                        i->second->CommitReadBufferData(buf, 0);
-                        i->second->BufferError(msg.str());
-                        
-                        KillConnection(i->first);
-                        return 0;
-                    } else {
-                        // Drop out of while loop
-                        
-                        // Dump the commit
-                        i->second->CommitReadBufferData(buf, 0);
-
-                        break;
-                    }
-                } else {
-                    // Commit the data
-                    iret = i->second->CommitReadBufferData(buf, ret);
-
-                    if (!iret) {
-                        // Die if we somehow couldn't insert all our data once we
-                        // read it from the socket since we can't put it back on the
-                        // input queue.  This should never happen because we're the
-                        // only input source but we'll handle it
-                        msg << "Could not commit read data for client " << i->first;
-                        _MSG(msg.str(), MSGFLAG_ERROR);
-
-                        KillConnection(i->first);
-                        return 0;
-                    }
-                }
+    if (con_handler == NULL) {
+        close(accept_fd);
+        return;
+    }
 
-                // We never get here; delete 
-                // delete[] buf;
-            }
+    handler_map.emplace(accept_fd, con_handler);
+
+    NewConnection(con_handler);
+
+    if (watching) {
+        // Watch the buffers so the events can be updated when the other side
+        // of the buffer writes data for us or drains what we've read
+        shared_ptr<write_notifier> notifier(new write_notifier(this, accept_fd));
+        notifier_map.emplace(accept_fd, notifier);
+
+        con_handler->SetWriteBufferInterface(notifier.get());
+        con_handler->SetReadBufferDrainCb([this, accept_fd](size_t) {
+                MarkDirty(accept_fd);
+            });
+
+        if (!UpdateWatch(accept_fd, con_handler)) {
+            _MSG("TCP server unable to watch new connection", MSGFLAG_ERROR);
+            KillConnection(accept_fd);
         }
+    }
+}
 
-        if (FD_ISSET(i->first, &in_wset)) {
-            len = i->second->GetWriteBufferUsed();
-
-            // Peek the data into our buffer as a zero-copy op whenever possible; we
-            // don't care how much we get
-            ret = i->second->ZeroCopyPeekWriteBufferData((void **) &buf, len);
-
-            if (ret > 0) {
-                if ((iret = write(i->first, buf, ret)) <= 0) {
-                    if (errno != EINTR && errno != EAGAIN) {
-                        // Push the error upstream
-                        msg << "TCP server error writing to client " << i->first <<
-                            " - " << kis_strerror_r(errno);
-                        _MSG(msg.str(), MSGFLAG_ERROR);
-
-                        i->second->PeekFreeWriteBufferData(buf);
-                        i->second->BufferError(msg.str());
-
-                        KillConnection(i->first);
-                        return 0;
-                    }
+bool TcpServerV2::ReadConnection(int in_fd, shared_ptr<BufferHandlerGeneric> in_handler) {
+    stringstream msg;
+    int ret, iret;
+    unsigned char *buf;
+    ssize_t r_sz;
+
+    while (in_handler->GetReadBufferAvailable() > 0) {
+        // Read only as much as we can get w/ a direct reference
+        r_sz = in_handler->ZeroCopyReserveReadBufferData((void **) &buf, 
+                in_handler->GetReadBufferAvailable());
+
+        if (r_sz < 0) {
+            msg << "TCP server closing connection from client " << in_fd << 
+                " unable to reserve space in buffer, something went wrong";
+            in_handler->CommitReadBufferData(buf, 0);
+            in_handler->BufferError(msg.str());
+            KillConnection(in_fd);
+            return false;
+        }
+
+        if ((ret = read(in_fd, buf, r_sz)) <= 0) {
+            // errno is stale when the remote side closed
+            if (ret == 0 || (errno != EINTR && errno != EAGAIN)) {
+                // Push the error upstream if we failed to read here
+                if (ret == 0) {
+                    msg << "TCP server closing connection from client " << in_fd <<
+                        " - connection closed by remote side";
+                    _MSG(msg.str(), MSGFLAG_ERROR);
                 } else {
-                    // Consume whatever we managed to write
-                    i->second->PeekFreeWriteBufferData(buf);
-                    i->second->ConsumeWriteBufferData(iret);
+                    msg << "TCP server error reading from client " << in_fd << 
+                        " - " << kis_strerror_r(errno);
+                    _MSG(msg.str(), MSGFLAG_ERROR);
                 }
+
+                // Dump the commit
+                in_handler->CommitReadBufferData(buf, 0);
+                in_handler->BufferError(msg.str());
+
+                KillConnection(in_fd);
+                return false;
             } else {
-                i->second->PeekFreeWriteBufferData(buf);
+                // Drop out of while loop
+
+                // Dump the commit
+                in_handler->CommitReadBufferData(buf, 0);
+
+                break;
+            }
+        } else {
+            // Commit the data
+            iret = in_handler->CommitReadBufferData(buf, ret);
+
+            if (!iret) {
+                // Die if we somehow couldn't insert all our data once we
+                // read it from the socket since we can't put it back on the
+                // input queue.  This should never happen because we're the
+                // only input source but we'll handle it
+                msg << "Could not commit read data for client " << in_fd;
+                _MSG(msg.str(), MSGFLAG_ERROR);
+
+                KillConnection(in_fd);
+                return false;
             }
         }
     }
 
-    // Reap any pending closures
+    return true;
+}
+
+bool TcpServerV2::WriteConnection(int in_fd, shared_ptr<BufferHandlerGeneric> in_handler) {
+    stringstream msg;
+    int ret, iret;
+    size_t len;
+    unsigned char *buf;
+
+    len = in_handler->GetWriteBufferUsed();
+
+    // Peek the data into our buffer as a zero-copy op whenever possible; we
+    // don't care how much we get
+    ret = in_handler->ZeroCopyPeekWriteBufferData((void **) &buf, len);
+
+    if (ret > 0) {
+        if ((iret = write(in_fd, buf, ret)) <= 0) {
+            if (errno != EINTR && errno != EAGAIN) {
+                // Push the error upstream
+                msg << "TCP server error writing to client " << in_fd <<
+                    " - " << kis_strerror_r(errno);
+                _MSG(msg.str(), MSGFLAG_ERROR);
+
+                in_handler->PeekFreeWriteBufferData(buf);
+                in_handler->BufferError(msg.str());
+
+                KillConnection(in_fd);
+                return false;
+            }
+
+            in_handler->PeekFreeWriteBufferData(buf);
+        } else {
+            // Consume whatever we managed to write
+            in_handler->PeekFreeWriteBufferData(buf);
+            in_handler->ConsumeWriteBufferData(iret);
+        }
+    } else {
+        in_handler->PeekFreeWriteBufferData(buf);
+    }
+
+    return true;
+}
+
+bool TcpServerV2::UpdateWatch(int in_fd, shared_ptr<BufferHandlerGeneric> in_handler) {
+    return pollabletracker->WatchFd(in_fd, this, 
+            in_handler->GetReadBufferAvailable() > 0,
+            in_handler->GetWriteBufferUsed() > 0);
+}
+
+void TcpServerV2::MarkDirty(int in_fd) {
+    bool wake;
+
+    {
+        local_locker lock(&dirty_mutex);
+
+        // A wakeup is already pending if anything else is dirty
+        wake = dirty_set.size() == 0;
+        dirty_set.insert(in_fd);
+    }
+
+    if (wake)
+        pollabletracker->Wakeup();
+}
+
+void TcpServerV2::ReapConnections() {
     for (auto i = kill_map.begin(); i != kill_map.end(); ++i) {
         auto h = handler_map.find(i->first);
         
-        if (h != kill_map.end()) {
-            close(h->first);
-            handler_map.erase(h);
+        if (h == handler_map.end())
+            continue;
+
+        if (watching) {
+            pollabletracker->UnwatchFd(h->first);
+
+            h->second->RemoveWriteBufferInterface();
+            h->second->RemoveReadBufferDrainCb();
+            notifier_map.erase(h->first);
         }
+
+        close(h->first);
+        handler_map.erase(h);
     }
-    kill_map.clear();
 
-    return 0;
+    kill_map.clear();
 }
 
 void TcpServerV2::KillConnection(int in_fd) {
@@ -325,14 +466,17 @@ void TcpServerV2::KillConnection(int in_fd) {
     if (i != handler_map.end()) {
         kill_map.emplace(i->first, i->second);
         i->second->BufferError("TCP connection closed");
+
+        // Stop waiting on it until it's reaped
+        if (watching)
+            pollabletracker->WatchFd(in_fd, this, false, false);
     }
 }
 
 void TcpServerV2::KillConnection(shared_ptr<BufferHandlerGeneric> in_handler) {
     for (auto i = handler_map.begin(); i != handler_map.end(); ++i) {
         if (i->second == in_handler) {
-            kill_map.emplace(i->first, i->second);
-            i->second->BufferError("TCP connection closed");
+            KillConnection(i->first);
             return;
         }
     }
@@ -385,6 +529,14 @@ int TcpServerV2::AcceptConnection() {
     // Nonblocking, don't clone
     fcntl(new_fd, F_SETFL, fcntl(new_fd, F_GETFL, 0) | O_NONBLOCK);
 
+    // Writes are split where the ring buffer wraps; don't let the tail of a
+    // response sit behind the client's delayed ack
+    int one = 1;
+    if (setsockopt(new_fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one)) < 0) {
+        _MSG("TCP server unable to set TCP_NODELAY: " + kis_strerror_r(errno),
+                MSGFLAG_ERROR);
+    }
+
     // Return the new fd; it is validated elsewhere and the buffer and handler
     // is made for it elsewhere
     return new_fd;
@@ -443,7 +595,20 @@ void TcpServerV2::Shutdown() {
         KillConnection(i->first);
     }
 
-    close(server_fd);
+    // Close them now; the tracker can't hold on to watched descriptors once
+    // we're gone
+    ReapConnections();
+
+    if (server_fd >= 0) {
+        if (watching)
+            pollabletracker->UnwatchFd(server_fd);
+
+        close(server_fd);
+        server_fd = -1;
+    }
+
+    watching = false;
+    pollabletracker.reset();
 
     valid = false;
 }
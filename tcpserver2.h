@@ -31,16 +31,22 @@
 #include <sys/ioctl.h>
 #include <arpa/inet.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <unistd.h>
 #include <netdb.h>
 #include <fcntl.h>
 #include <errno.h>
 
+#include <set>
+
 #include "messagebus.h"
 #include "globalregistry.h"
 #include "buffer_handler.h"
+#include "kis_mutex.h"
 #include "pollable.h"
 
+class PollableTracker;
+
 #ifndef MAXHOSTNAMELEN
 #define MAXHOSTNAMELEN 64
 #endif
@@ -73,6 +79,7 @@ public:
     // Pollable
     virtual int MergeSet(int in_max_fd, fd_set *out_rset, fd_set *out_wset);
     virtual int Poll(fd_set& in_rset, fd_set& in_wset);
+    virtual void PollFd(int in_fd, bool in_read, bool in_write);
    
     // Must be filled in
     virtual void NewConnection(shared_ptr<BufferHandlerGeneric> conn_handler) = 0;
@@ -88,6 +95,17 @@ protected:
     // Allocate the connection
     virtual shared_ptr<BufferHandlerGeneric> AllocateConnection(int in_fd);
 
+    // Accept, filter, and allocate a pending connection
+    void ProcessAccept();
+
+    // Move data between a connection and its buffer; returns false if the
+    // connection was killed
+    bool ReadConnection(int in_fd, shared_ptr<BufferHandlerGeneric> in_handler);
+    bool WriteConnection(int in_fd, shared_ptr<BufferHandlerGeneric> in_handler);
+
+    // Close killed connections
+    void ReapConnections();
+
     bool valid;
 
     unsigned int ringbuf_size;
@@ -107,6 +125,37 @@ protected:
 
     map<int, shared_ptr<BufferHandlerGeneric> > kill_map;
 
+    // Are our descriptors watched directly by the pollable tracker
+    shared_ptr<PollableTracker> pollabletracker;
+    bool watching;
+
+    // Update what a watched connection is waiting for from its buffer state
+    bool UpdateWatch(int in_fd, shared_ptr<BufferHandlerGeneric> in_handler);
+
+    // Flag a watched connection whose buffer has changed, possibly from 
+    // another thread, and wake the tracker to update it
+    void MarkDirty(int in_fd);
+
+    class write_notifier : public BufferInterface {
+    public:
+        write_notifier(TcpServerV2 *in_server, int in_fd) :
+            server(in_server),
+            fd(in_fd) { }
+
+        virtual void BufferAvailable(size_t in_amt __attribute__((unused))) {
+            server->MarkDirty(fd);
+        }
+
+    protected:
+        TcpServerV2 *server;
+        int fd;
+    };
+
+    map<int, shared_ptr<write_notifier> > notifier_map;
+
+    kis_recursive_timed_mutex dirty_mutex;
+    std::set<int> dirty_set;
+
 };
 
 #endif
@@ -0,0 +1,186 @@
+/* benchmark harness for the timer wheel
+ *
+ * Registers a large number of one-shot timers spread over a few seconds, so
+ * that they land on the root wheel and cascade down from the level above it,
+ * cancels a share of them, and then drives Tick the way the main loop does
+ * until every timer is due.  A set of recurring timers end themselves after a
+ * few runs.
+ *
+ * Every live timer has to fire exactly once and never before it is due, and
+ * no cancelled timer may fire.  The cost of registering, cancelling, and
+ * ticking is reported along with how late the timers fired.
+ *
+ * # build kismet, then
+ * make timer_bench
+ *
+ * ./timer_bench [timers] [longest timer in 1/10 sec slices]
+ *
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include "globalregistry.h"
+#include "messagebus.h"
+#include "timetracker.h"
+
+static double elapsed_ns(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start).count();
+}
+
+// Recurring timers, and how many times each runs before ending itself
+#define TIMER_BENCH_RECURRING   1000
+#define TIMER_BENCH_RUNS        3
+
+int main(int argc, char *argv[]) {
+    unsigned int num_timers = 100000;
+    unsigned int max_slices = 30;
+
+    if (argc > 1)
+        num_timers = strtoul(argv[1], NULL, 10);
+    if (argc > 2)
+        max_slices = strtoul(argv[2], NULL, 10);
+
+    if (num_timers == 0 || max_slices == 0) {
+        fprintf(stderr, "usage: %s [timers] [longest timer in 1/10 sec slices]\n", argv[0]);
+        return 1;
+    }
+
+    GlobalRegistry *globalreg = new GlobalRegistry();
+    MessageBus::create_messagebus(globalreg);
+    shared_ptr<Timetracker> timetracker = Timetracker::create_timetracker(globalreg);
+
+    std::vector<int> timer_ids(num_timers);
+    std::vector<unsigned int> slices(num_timers);
+    std::vector<unsigned int> fired(num_timers, 0);
+    std::vector<bool> cancelled(num_timers, false);
+    std::vector<std::chrono::steady_clock::time_point> due(num_timers);
+    std::vector<double> late_ns(num_timers, 0);
+
+    uint64_t r = 0x9E3779B97F4A7C15ULL;
+
+    auto start = std::chrono::steady_clock::now();
+
+    for (unsigned int t = 0; t < num_timers; t++) {
+        r ^= r << 13;
+        r ^= r >> 7;
+        r ^= r << 17;
+
+        slices[t] = 1 + (r % max_slices);
+        due[t] = std::chrono::steady_clock::now() +
+            std::chrono::microseconds(slices[t] * (1000000 / SERVER_TIMESLICES_SEC));
+
+        timer_ids[t] = timetracker->RegisterTimer(slices[t], NULL, 0,
+                [t, &fired, &due, &late_ns](int) -> int {
+                    fired[t]++;
+                    late_ns[t] = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                            std::chrono::steady_clock::now() - due[t]).count();
+                    return 0;
+                });
+    }
+
+    double register_ns = elapsed_ns(start);
+
+    unsigned int recurring_runs[TIMER_BENCH_RECURRING];
+
+    for (unsigned int t = 0; t < TIMER_BENCH_RECURRING; t++) {
+        recurring_runs[t] = 0;
+
+        timetracker->RegisterTimer(1, NULL, 1, [t, &recurring_runs](int) -> int {
+                    return ++recurring_runs[t] < TIMER_BENCH_RUNS;
+                });
+    }
+
+    // Cancel every seventh timer
+    unsigned int num_cancelled = 0;
+
+    start = std::chrono::steady_clock::now();
+
+    for (unsigned int t = 0; t < num_timers; t += 7) {
+        timetracker->RemoveTimer(timer_ids[t]);
+        cancelled[t] = true;
+        num_cancelled++;
+    }
+
+    double cancel_ns = elapsed_ns(start);
+
+    printf("%u timers of up to %u slices, %u cancelled\n", num_timers, max_slices,
+            num_cancelled);
+    printf("  register: %8.1f ns per timer\n", register_ns / num_timers);
+    printf("  cancel:   %8.1f ns per timer\n", cancel_ns / num_cancelled);
+
+    // Tick at the wheel resolution until everything is due, then a little
+    // longer to catch anything firing twice
+    auto end = std::chrono::steady_clock::now() +
+        std::chrono::microseconds((max_slices + 5) * (1000000 / SERVER_TIMESLICES_SEC));
+
+    unsigned long ticks = 0;
+    double tick_ns = 0;
+
+    while (std::chrono::steady_clock::now() < end) {
+        start = std::chrono::steady_clock::now();
+        timetracker->Tick();
+        tick_ns += elapsed_ns(start);
+        ticks++;
+
+        std::this_thread::sleep_for(std::chrono::microseconds(TIMETRACKER_WHEEL_TICK_US));
+    }
+
+    unsigned int missed = 0, repeated = 0, early = 0, fired_cancelled = 0;
+    unsigned int bad_recurring = 0;
+    double total_late = 0, max_late = 0;
+
+    for (unsigned int t = 0; t < num_timers; t++) {
+        if (cancelled[t]) {
+            if (fired[t] != 0)
+                fired_cancelled++;
+            continue;
+        }
+
+        if (fired[t] == 0) {
+            missed++;
+            continue;
+        }
+
+        if (fired[t] > 1)
+            repeated++;
+
+        if (late_ns[t] < 0)
+            early++;
+
+        total_late += late_ns[t];
+
+        if (late_ns[t] > max_late)
+            max_late = late_ns[t];
+    }
+
+    for (unsigned int t = 0; t < TIMER_BENCH_RECURRING; t++) {
+        if (recurring_runs[t] != TIMER_BENCH_RUNS)
+            bad_recurring++;
+    }
+
+    unsigned int num_live = num_timers - num_cancelled;
+
+    printf("  tick:     %8.1f ns per tick over %lu ticks\n", tick_ns / ticks, ticks);
+    printf("  fired %u of %u live timers, %.1f ms late on average, %.1f ms at most\n",
+            num_live - missed, num_live, total_late / (num_live - missed) / 1e6,
+            max_late / 1e6);
+    printf("  %u missed, %u fired twice, %u early, %u cancelled fired, "
+            "%u of %u recurring timers ran wrong\n",
+            missed, repeated, early, fired_cancelled, bad_recurring,
+            TIMER_BENCH_RECURRING);
+
+    if (missed || repeated || early || fired_cancelled || bad_recurring) {
+        fprintf(stderr, "FAILED\n");
+        return 1;
+    }
+
+    return 0;
+}
@@ -29,6 +29,15 @@ Timetracker::Timetracker(GlobalRegistry *in_globalreg) {
 
 	globalreg->start_time = time(0);
 	gettimeofday(&(globalreg->timestamp), NULL);
+
+    for (unsigned int x = 0; x < TIMETRACKER_WHEEL_ROOT_SIZE; x++)
+        wheel_root[x] = NULL;
+
+    for (unsigned int l = 0; l < TIMETRACKER_WHEEL_LEVELS; l++)
+        for (unsigned int x = 0; x < TIMETRACKER_WHEEL_LEVEL_SIZE; x++)
+            wheel_level[l][x] = NULL;
+
+    wheel_tick = FetchWheelTick();
 }
 
 Timetracker::~Timetracker() {
@@ -38,11 +47,141 @@ Timetracker::~Timetracker() {
     globalreg->timetracker = NULL;
 
     // Free the events
-    for (map<int, timer_event *>::iterator x = timer_map.begin();
-         x != timer_map.end(); ++x)
+    for (auto x = timer_map.begin(); x != timer_map.end(); ++x)
         delete x->second;
 }
 
+uint64_t Timetracker::FetchWheelTick() {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ((uint64_t) ts.tv_sec * 1000000ULL + (uint64_t) ts.tv_nsec / 1000ULL) / 
+        TIMETRACKER_WHEEL_TICK_US;
+}
+
+void Timetracker::WheelAdd_nb(timer_event *evt) {
+    uint64_t expire = evt->expire_tick;
+
+    // Anything already due goes in the next slot to be processed
+    if (expire < wheel_tick)
+        expire = wheel_tick;
+
+    uint64_t delta = expire - wheel_tick;
+    timer_event **slot;
+
+    if (delta < TIMETRACKER_WHEEL_ROOT_SIZE) {
+        slot = &(wheel_root[expire & (TIMETRACKER_WHEEL_ROOT_SIZE - 1)]);
+    } else {
+        unsigned int level;
+        unsigned int shift = TIMETRACKER_WHEEL_ROOT_BITS;
+
+        for (level = 0; level < TIMETRACKER_WHEEL_LEVELS - 1; level++) {
+            if (delta < (1ULL << (shift + TIMETRACKER_WHEEL_LEVEL_BITS)))
+                break;
+
+            shift += TIMETRACKER_WHEEL_LEVEL_BITS;
+        }
+
+        // Timers past the end of the wheel are filed in the furthest slot,
+        // and filed again when it cascades
+        if (delta >= (1ULL << (shift + TIMETRACKER_WHEEL_LEVEL_BITS)))
+            expire = wheel_tick + (1ULL << (shift + TIMETRACKER_WHEEL_LEVEL_BITS)) - 1;
+
+        slot = &(wheel_level[level][(expire >> shift) & (TIMETRACKER_WHEEL_LEVEL_SIZE - 1)]);
+    }
+
+    evt->wheel_slot = slot;
+    evt->wheel_prev = NULL;
+    evt->wheel_next = *slot;
+
+    if (*slot != NULL)
+        (*slot)->wheel_prev = evt;
+
+    *slot = evt;
+}
+
+void Timetracker::WheelRemove_nb(timer_event *evt) {
+    if (evt->wheel_slot == NULL)
+        return;
+
+    if (evt->wheel_prev != NULL)
+        evt->wheel_prev->wheel_next = evt->wheel_next;
+    else
+        *(evt->wheel_slot) = evt->wheel_next;
+
+    if (evt->wheel_next != NULL)
+        evt->wheel_next->wheel_prev = evt->wheel_prev;
+
+    evt->wheel_slot = NULL;
+    evt->wheel_prev = NULL;
+    evt->wheel_next = NULL;
+}
+
+void Timetracker::WheelCascade_nb(timer_event **slot) {
+    timer_event *evt = *slot;
+    timer_event *next;
+
+    *slot = NULL;
+
+    while (evt != NULL) {
+        next = evt->wheel_next;
+        WheelAdd_nb(evt);
+        evt = next;
+    }
+}
+
+void Timetracker::WheelAdvance_nb(uint64_t in_tick, vector<timer_event *>& expired) {
+    // Nothing to turn through
+    if (timer_map.size() == 0) {
+        if (in_tick >= wheel_tick)
+            wheel_tick = in_tick + 1;
+
+        return;
+    }
+
+    while (wheel_tick <= in_tick) {
+        unsigned int idx = wheel_tick & (TIMETRACKER_WHEEL_ROOT_SIZE - 1);
+
+        // Completed a rotation of the root, so pull the next slot of the
+        // higher levels down, and so on up the wheel
+        if (idx == 0) {
+            unsigned int shift = TIMETRACKER_WHEEL_ROOT_BITS;
+
+            for (unsigned int l = 0; l < TIMETRACKER_WHEEL_LEVELS; l++) {
+                unsigned int lidx = 
+                    (wheel_tick >> shift) & (TIMETRACKER_WHEEL_LEVEL_SIZE - 1);
+
+                WheelCascade_nb(&(wheel_level[l][lidx]));
+
+                if (lidx != 0)
+                    break;
+
+                shift += TIMETRACKER_WHEEL_LEVEL_BITS;
+            }
+        }
+
+        timer_event *evt = wheel_root[idx];
+        timer_event *next;
+
+        wheel_root[idx] = NULL;
+
+        while (evt != NULL) {
+            next = evt->wheel_next;
+
+            evt->wheel_slot = NULL;
+            evt->wheel_prev = NULL;
+            evt->wheel_next = NULL;
+
+            expired.push_back(evt);
+
+            evt = next;
+        }
+
+        wheel_tick++;
+    }
+}
+
 int Timetracker::Tick() {
     vector<timer_event *> action_timers;
 
@@ -55,23 +194,21 @@ int Timetracker::Tick() {
     gettimeofday(&cur_tm, NULL);
 	globalreg->timestamp.tv_sec = cur_tm.tv_sec;
 	globalreg->timestamp.tv_usec = cur_tm.tv_usec;
-    timer_event *evt;
-    int timerid;
 
-    std::vector<int> removed_timers;
+    uint64_t cur_tick = FetchWheelTick();
 
-    for (unsigned int x = 0; x < sorted_timers.size(); x++) {
-        evt = sorted_timers[x];
-        timerid = evt->timer_id;
+    WheelAdvance_nb(cur_tick, action_timers);
 
-        if ((cur_tm.tv_sec < evt->trigger_tm.tv_sec) ||
-            ((cur_tm.tv_sec == evt->trigger_tm.tv_sec) && 
-			 (cur_tm.tv_usec < evt->trigger_tm.tv_usec))) {
+    lock.unlock();
 
+    for (auto evt : action_timers) {
+        // Removed by an earlier callback
+        lock.lock();
+        if (evt->cancelled) {
+            delete evt;
             lock.unlock();
-            break;
-		}
-
+            continue;
+        }
         lock.unlock();
 
         // Call the function with the given parameters
@@ -84,7 +221,9 @@ int Timetracker::Tick() {
             ret = evt->event_func(evt->timer_id);
         }
 
-        if (ret > 0 && evt->timeslices != -1 && evt->recurring) {
+        lock.lock();
+
+        if (!evt->cancelled && ret > 0 && evt->timeslices != -1 && evt->recurring) {
             evt->schedule_tm.tv_sec = cur_tm.tv_sec;
             evt->schedule_tm.tv_usec = cur_tm.tv_usec;
             evt->trigger_tm.tv_sec = evt->schedule_tm.tv_sec + 
@@ -93,29 +232,89 @@ int Timetracker::Tick() {
 				((evt->timeslices % SERVER_TIMESLICES_SEC) *
                  (1000000L / SERVER_TIMESLICES_SEC));
 
-            if (evt->trigger_tm.tv_usec >= 999999L) {
+            if (evt->trigger_tm.tv_usec >= 1000000L) {
                 evt->trigger_tm.tv_sec++;
                 evt->trigger_tm.tv_usec %= 1000000L;
             }
 
+            evt->expire_tick = cur_tick + 1 + (uint64_t) evt->timeslices *
+                ((1000000L / SERVER_TIMESLICES_SEC) / TIMETRACKER_WHEEL_TICK_US);
+
+            WheelAdd_nb(evt);
         } else {
-            removed_timers.push_back(timerid);
-        }
+            // Cancelled events were already dropped from the map
+            if (!evt->cancelled)
+                timer_map.erase(evt->timer_id);
 
-        for (auto x : removed_timers) {
-            RemoveTimer_nb(x);
+            delete evt;
         }
 
-        // Re-sort the list
-        lock.lock();
-        stable_sort(sorted_timers.begin(), sorted_timers.end(), 
-                SortTimerEventsTrigger());
         lock.unlock();
     }
 
     return 1;
 }
 
+int Timetracker::Schedule_nb(timer_event *evt, int in_timeslices, 
+        struct timeval *in_trigger, int in_recurring) {
+    evt->timer_id = next_timer_id++;
+    gettimeofday(&(evt->schedule_tm), NULL);
+
+    // The current tick is partly over; count from the next one so we never
+    // fire early
+    uint64_t cur_tick = FetchWheelTick() + 1;
+
+    if (in_trigger != NULL) {
+        evt->trigger_tm.tv_sec = in_trigger->tv_sec;
+        evt->trigger_tm.tv_usec = in_trigger->tv_usec;
+        evt->timeslices = -1;
+
+        // Convert the time of day to a delay on the monotonic clock, rounding
+        // up
+        int64_t delta_us = 
+            ((int64_t) evt->trigger_tm.tv_sec - evt->schedule_tm.tv_sec) * 1000000LL +
+            ((int64_t) evt->trigger_tm.tv_usec - evt->schedule_tm.tv_usec);
+
+        if (delta_us < 0)
+            delta_us = 0;
+
+        evt->expire_tick = cur_tick + 
+            (delta_us + TIMETRACKER_WHEEL_TICK_US - 1) / TIMETRACKER_WHEEL_TICK_US;
+    } else {
+        if (in_timeslices < 0)
+            in_timeslices = 0;
+
+        evt->trigger_tm.tv_sec = evt->schedule_tm.tv_sec + 
+            (in_timeslices / SERVER_TIMESLICES_SEC);
+        evt->trigger_tm.tv_usec = evt->schedule_tm.tv_usec + 
+            ((in_timeslices % SERVER_TIMESLICES_SEC) *
+             (1000000L / SERVER_TIMESLICES_SEC));
+
+        if (evt->trigger_tm.tv_usec >= 1000000L) {
+            evt->trigger_tm.tv_sec++;
+            evt->trigger_tm.tv_usec %= 1000000L;
+        }
+            
+        evt->timeslices = in_timeslices;
+
+        evt->expire_tick = cur_tick + (uint64_t) in_timeslices *
+            ((1000000L / SERVER_TIMESLICES_SEC) / TIMETRACKER_WHEEL_TICK_US);
+    }
+
+    evt->recurring = in_recurring;
+
+    evt->wheel_prev = NULL;
+    evt->wheel_next = NULL;
+    evt->wheel_slot = NULL;
+    evt->cancelled = false;
+
+    timer_map[evt->timer_id] = evt;
+
+    WheelAdd_nb(evt);
+
+    return evt->timer_id;
+}
+
 int Timetracker::RegisterTimer(int in_timeslices, struct timeval *in_trigger,
                                int in_recurring, 
                                int (*in_callback)(TIMEEVENT_PARMS),
@@ -131,31 +330,11 @@ int Timetracker::RegisterTimer_nb(int in_timeslices, struct timeval *in_trigger,
                                void *in_parm) {
     timer_event *evt = new timer_event;
 
-    evt->timer_id = next_timer_id++;
-    gettimeofday(&(evt->schedule_tm), NULL);
-
-    if (in_trigger != NULL) {
-        evt->trigger_tm.tv_sec = in_trigger->tv_sec;
-        evt->trigger_tm.tv_usec = in_trigger->tv_usec;
-        evt->timeslices = -1;
-    } else {
-        evt->trigger_tm.tv_sec = evt->schedule_tm.tv_sec + (in_timeslices / 10);
-        evt->trigger_tm.tv_usec = evt->schedule_tm.tv_usec + (in_timeslices % 10);
-        evt->timeslices = in_timeslices;
-    }
-
-    evt->recurring = in_recurring;
     evt->callback = in_callback;
     evt->callback_parm = in_parm;
     evt->event = NULL;
 
-    timer_map[evt->timer_id] = evt;
-    sorted_timers.push_back(evt);
-
-    // Resort the list
-    stable_sort(sorted_timers.begin(), sorted_timers.end(), SortTimerEventsTrigger());
-
-    return evt->timer_id;
+    return Schedule_nb(evt, in_timeslices, in_trigger, in_recurring);
 }
 
 int Timetracker::RegisterTimer(int in_timeslices, struct timeval *in_trigger,
@@ -168,40 +347,11 @@ int Timetracker::RegisterTimer_nb(int in_timeslices, struct timeval *in_trigger,
         int in_recurring, TimetrackerEvent *in_event) {
     timer_event *evt = new timer_event;
 
-    evt->timer_id = next_timer_id++;
-    gettimeofday(&(evt->schedule_tm), NULL);
-
-    if (in_trigger != NULL) {
-        evt->trigger_tm.tv_sec = in_trigger->tv_sec;
-        evt->trigger_tm.tv_usec = in_trigger->tv_usec;
-        evt->timeslices = -1;
-    } else {
-        evt->trigger_tm.tv_sec = evt->schedule_tm.tv_sec + 
-            (in_timeslices / SERVER_TIMESLICES_SEC);
-        evt->trigger_tm.tv_usec = evt->schedule_tm.tv_usec + 
-            ((in_timeslices % SERVER_TIMESLICES_SEC) *
-             (1000000L / SERVER_TIMESLICES_SEC));
-
-        if (evt->trigger_tm.tv_usec >= 999999L) {
-            evt->trigger_tm.tv_sec++;
-            evt->trigger_tm.tv_usec %= 1000000L;
-        }
-            
-        evt->timeslices = in_timeslices;
-    }
-
-    evt->recurring = in_recurring;
     evt->callback = NULL;
     evt->callback_parm = NULL;
     evt->event = in_event;
 
-    timer_map[evt->timer_id] = evt;
-    sorted_timers.push_back(evt);
-
-    // Resort the list
-    stable_sort(sorted_timers.begin(), sorted_timers.end(), SortTimerEventsTrigger());
-
-    return evt->timer_id;
+    return Schedule_nb(evt, in_timeslices, in_trigger, in_recurring);
 }
 
 int Timetracker::RegisterTimer(int in_timeslices, struct timeval *in_trigger,
@@ -214,41 +364,13 @@ int Timetracker::RegisterTimer_nb(int in_timeslices, struct timeval *in_trigger,
         int in_recurring, std::function<int (int)> in_event) {
     timer_event *evt = new timer_event;
 
-    evt->timer_id = next_timer_id++;
-    gettimeofday(&(evt->schedule_tm), NULL);
-
-    if (in_trigger != NULL) {
-        evt->trigger_tm.tv_sec = in_trigger->tv_sec;
-        evt->trigger_tm.tv_usec = in_trigger->tv_usec;
-        evt->timeslices = -1;
-    } else {
-        evt->trigger_tm.tv_sec = evt->schedule_tm.tv_sec + 
-            (in_timeslices / SERVER_TIMESLICES_SEC);
-        evt->trigger_tm.tv_usec = evt->schedule_tm.tv_usec + 
-            ((in_timeslices % SERVER_TIMESLICES_SEC) * 
-             (1000000L / SERVER_TIMESLICES_SEC));
-        evt->timeslices = in_timeslices;
-
-        if (evt->trigger_tm.tv_usec >= 999999L) {
-            evt->trigger_tm.tv_sec++;
-            evt->trigger_tm.tv_usec %= 1000000L;
-        }
-    }
-
-    evt->recurring = in_recurring;
     evt->callback = NULL;
     evt->callback_parm = NULL;
     evt->event = NULL;
     
     evt->event_func = in_event;
 
-    timer_map[evt->timer_id] = evt;
-    sorted_timers.push_back(evt);
-
-    // Resort the list
-    stable_sort(sorted_timers.begin(), sorted_timers.end(), SortTimerEventsTrigger());
-
-    return evt->timer_id;
+    return Schedule_nb(evt, in_timeslices, in_trigger, in_recurring);
 }
 
 int Timetracker::RemoveTimer(int in_timerid) {
@@ -257,27 +379,24 @@ int Timetracker::RemoveTimer(int in_timerid) {
 }
 
 int Timetracker::RemoveTimer_nb(int in_timerid) {
-    map<int, timer_event *>::iterator itr;
-
-    itr = timer_map.find(in_timerid);
+    auto itr = timer_map.find(in_timerid);
 
-    if (itr != timer_map.end()) {
-        for (unsigned int x = 0; x < sorted_timers.size(); x++) {
-            if (sorted_timers[x]->timer_id == in_timerid) {
-                sorted_timers.erase(sorted_timers.begin() + x);
-                break;
-            }
-        }
+    if (itr == timer_map.end())
+        return -1;
 
-        delete itr->second;
-        timer_map.erase(itr);
+    timer_event *evt = itr->second;
 
-        // Resort the list
-        stable_sort(sorted_timers.begin(), sorted_timers.end(), SortTimerEventsTrigger());
+    timer_map.erase(itr);
 
-        return 1;
+    if (evt->wheel_slot != NULL) {
+        WheelRemove_nb(evt);
+        delete evt;
+    } else {
+        // Expired and waiting to be called, or being called right now; Tick
+        // owns it and frees it once it's done with it
+        evt->cancelled = true;
     }
 
-    return -1;
+    return 1;
 }
 
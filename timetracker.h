@@ -22,9 +22,11 @@
 #include "config.h"
 
 #include <stdio.h>
+#include <stdint.h>
 #include <time.h>
 #include <list>
 #include <map>
+#include <unordered_map>
 #include <vector>
 #include <algorithm>
 #include <string>
@@ -40,6 +42,16 @@
 #define TIMEEVENT_PARMS Timetracker::timer_event *evt __attribute__ ((unused)), \
     void *auxptr __attribute__ ((unused)), GlobalRegistry *globalreg __attribute__ ((unused))
 
+// Timer wheel resolution, and the wheel geometry; a 10ms tick gives the
+// wheel a span of just under 500 days
+#define TIMETRACKER_WHEEL_TICK_US       10000
+#define TIMETRACKER_WHEEL_ROOT_BITS     8
+#define TIMETRACKER_WHEEL_LEVEL_BITS    6
+#define TIMETRACKER_WHEEL_LEVELS        4
+
+#define TIMETRACKER_WHEEL_ROOT_SIZE     (1 << TIMETRACKER_WHEEL_ROOT_BITS)
+#define TIMETRACKER_WHEEL_LEVEL_SIZE    (1 << TIMETRACKER_WHEEL_LEVEL_BITS)
+
 class TimetrackerEvent;
 
 class Timetracker : public LifetimeGlobal {
@@ -66,20 +78,15 @@ public:
         // C function, if we weren't
         int (*callback)(timer_event *, void *, GlobalRegistry *);
         void *callback_parm;
-    };
 
-    // Sort alerts by alert trigger time
-    class SortTimerEventsTrigger {
-    public:
-        inline bool operator() (const Timetracker::timer_event *x, 
-								const Timetracker::timer_event *y) const {
-            if ((x->trigger_tm.tv_sec < y->trigger_tm.tv_sec) ||
-                ((x->trigger_tm.tv_sec == y->trigger_tm.tv_sec) && 
-				 (x->trigger_tm.tv_usec < y->trigger_tm.tv_usec)))
-                return 1;
-
-            return 0;
-        }
+        // Wheel tick the event expires on, and its links in the wheel slot
+        // it's filed under; wheel_slot is NULL when it isn't in the wheel
+        uint64_t expire_tick;
+        timer_event *wheel_prev, *wheel_next;
+        timer_event **wheel_slot;
+
+        // Event was removed while it was waiting to be called by Tick
+        bool cancelled;
     };
 
     static shared_ptr<Timetracker> create_timetracker(GlobalRegistry *in_globalreg) {
@@ -130,9 +137,43 @@ protected:
             int in_recurring, std::function<int (int)> event);
     int RemoveTimer_nb(int timer_id);
 
+    // Fill in the schedule and trigger of a new event and add it to the wheel
+    int Schedule_nb(timer_event *evt, int in_timeslices, struct timeval *in_trigger,
+            int in_recurring);
+
     int next_timer_id;
-    map<int, timer_event *> timer_map;
-    vector<timer_event *> sorted_timers;
+    std::unordered_map<int, timer_event *> timer_map;
+
+    // Timers are kept in a hierarchical timing wheel, in the style of the
+    // classic BSD and Linux kernel timer wheels:  the first level has a slot
+    // for each of the next 256 ticks, and each higher level has 64 slots which
+    // each cover an entire rotation of the level below.  Adding and removing
+    // a timer is constant time; as the wheel turns, the next slot of a higher
+    // level is cascaded down into the lower levels, so every timer is only
+    // moved a handful of times over its life.
+    //
+    // The wheel is driven by the monotonic clock, so changes to the system
+    // time don't fire or stall relative timers.  Timers set for an explicit
+    // time of day are converted to a delay when they're registered.
+    timer_event *wheel_root[TIMETRACKER_WHEEL_ROOT_SIZE];
+    timer_event *wheel_level[TIMETRACKER_WHEEL_LEVELS][TIMETRACKER_WHEEL_LEVEL_SIZE];
+
+    // Next tick the wheel will process
+    uint64_t wheel_tick;
+
+    // Current tick of the monotonic clock
+    uint64_t FetchWheelTick();
+
+    void WheelAdd_nb(timer_event *evt);
+    void WheelRemove_nb(timer_event *evt);
+
+    // Move every timer in a slot back into the wheel, relative to the
+    // current tick
+    void WheelCascade_nb(timer_event **slot);
+
+    // Turn the wheel through in_tick, collecting the expired timers in
+    // order
+    void WheelAdvance_nb(uint64_t in_tick, vector<timer_event *>& expired);
 };
 
 class TimetrackerEvent {
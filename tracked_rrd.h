@@ -36,6 +36,7 @@
 #include "globalregistry.h"
 #include "trackedelement.h"
 #include "entrytracker.h"
+#include "kis_mutex.h"
 
 // Aggregator class used for RRD.  Performs functions like combining elements
 // (for instance, adding to the existing element, or choosing to replace the
@@ -53,16 +54,14 @@ public:
         return a + b;
     }
 
-    // Combine a vector for a higher-level record (seconds to minutes, minutes to 
-    // hours, and so on).
-    static int64_t combine_vector(shared_ptr<TrackerElement> e) {
-        TrackerElementVector v(e);
-
+    // Combine a bucket array for a higher-level record (seconds to minutes, 
+    // minutes to hours, and so on).
+    static int64_t combine_vector(const int64_t *v, size_t sz) {
         int64_t avg = 0;
-        for (TrackerElementVector::iterator i = v.begin(); i != v.end(); ++i) 
-            avg += GetTrackerValue<int64_t>(*i);
+        for (size_t i = 0; i < sz; i++)
+            avg += v[i];
 
-        return avg / v.size();
+        return avg / (int64_t) sz;
     }
 
     // Default 'empty' value
@@ -75,6 +74,49 @@ public:
     }
 };
 
+// RRD buckets are kept as plain int64 arrays inside the RRD object instead of
+// as a vector of tracked elements; a device carries several RRDs and hundreds
+// of shared tracked elements per device adds up quickly.  See rrd_bench.
+//
+// The minute, hour, and day vectors are ONLY populated between pre_serialize()
+// and post_serialize(); outside of serialization they are empty.  Anything
+// which reads them by field path (GetTrackerElementPath and friends) must
+// bracket the read with TrackerElementSerializer::pre_serialize_path(...) and
+// post_serialize_path(...), the same as a serializer does.
+//
+// add_sample(...) does not lock; like every other field of a tracked record it
+// relies on the owner (the device mutex for device RRDs) to serialize updates.
+// The RRD mutex only guards building and releasing the vectors, since several
+// serializers may share the same RRD at once.
+
+// Populate a serialization vector from an array of buckets
+inline void kis_tracked_rrd_fill_vector(SharedTrackerElement vec, const int64_t *vals, 
+        size_t sz, int entry_id) {
+    vec->clear_vector();
+
+    for (size_t i = 0; i < sz; i++) {
+        SharedTrackerElement e(new TrackerElement(TrackerInt64, entry_id));
+        e->set((int64_t) vals[i]);
+        vec->add_vector(e);
+    }
+}
+
+// Import an array of buckets from a populated vector (such as a record restored
+// from a stored object) and release the elements
+inline void kis_tracked_rrd_load_vector(SharedTrackerElement vec, int64_t *vals, 
+        size_t sz, int64_t default_val) {
+    TrackerElementVector v(vec);
+
+    for (size_t i = 0; i < sz; i++) {
+        if (i < v.size())
+            vals[i] = GetTrackerValue<int64_t>(v[i]);
+        else
+            vals[i] = default_val;
+    }
+
+    vec->clear_vector();
+}
+
 template <class Aggregator = kis_tracked_rrd_default_aggregator>
 class kis_tracked_rrd : public tracker_component {
 public:
@@ -112,7 +154,8 @@ public:
 
     __Proxy(last_time, uint64_t, time_t, time_t, last_time);
 
-    // Add a sample.  Use combinator function 'c' to derive the new sample value
+    // Add a sample.  Use combinator function 'c' to derive the new sample value.
+    // Not locked; callers must hold the lock of whatever owns the RRD
     void add_sample(int64_t in_s, time_t in_time) {
         Aggregator agg;
 
@@ -134,39 +177,34 @@ public:
             return;
         }
         
-        shared_ptr<TrackerElement> e;
-
         // If we haven't seen data in a day, we reset everything because
         // none of it is valid.  This is the simplest case.
         if (in_time - ltime > (60 * 60 * 24)) {
             // Directly fill in this second, clear rest of the minute
-            TrackerElementVector mv(minute_vec);
-            for (TrackerElementVector::iterator i = mv.begin(); i != mv.end(); ++i) {
-                if (i - mv.begin() == sec_bucket)
-                    (*i)->set(in_s);
+            for (int i = 0; i < 60; i++) {
+                if (i == sec_bucket)
+                    minute_vals[i] = in_s;
                 else
-                    (*i)->set((int64_t) agg.default_val());
+                    minute_vals[i] = agg.default_val();
             }
 
             // Reset the last hour, setting it to a single sample
             // Get the combined value for the minute
-            int64_t min_val = agg.combine_vector(minute_vec);
-            TrackerElementVector hv = TrackerElementVector(hour_vec);
-            for (TrackerElementVector::iterator i = hv.begin(); i != hv.end(); ++i) {
-                if (i - hv.begin() == min_bucket)
-                    (*i)->set(min_val);
+            int64_t min_val = agg.combine_vector(minute_vals, 60);
+            for (int i = 0; i < 60; i++) {
+                if (i == min_bucket)
+                    hour_vals[i] = min_val;
                 else
-                    (*i)->set((int64_t) agg.default_val());
+                    hour_vals[i] = agg.default_val();
             }
 
             // Reset the last day, setting it to a single sample
-            int64_t hr_val = agg.combine_vector(hour_vec);
-            TrackerElementVector dv = TrackerElementVector(day_vec);
-            for (TrackerElementVector::iterator i = dv.begin(); i != dv.end(); ++i) {
-                if (i - dv.begin() == hour_bucket)
-                    (*i)->set(hr_val);
+            int64_t hr_val = agg.combine_vector(hour_vals, 60);
+            for (int i = 0; i < 24; i++) {
+                if (i == hour_bucket)
+                    day_vals[i] = hr_val;
                 else
-                    (*i)->set((int64_t) agg.default_val());
+                    day_vals[i] = agg.default_val();
             }
 
             set_last_time(in_time);
@@ -184,36 +222,31 @@ public:
 
             // We only have this entry in the minute, so set it and get the 
             // combined value
-            
-            TrackerElementVector mv(minute_vec);
-            for (TrackerElementVector::iterator i = mv.begin(); i != mv.end(); ++i) {
-                if (i - mv.begin() == sec_bucket)
-                    (*i)->set(in_s);
+            for (int i = 0; i < 60; i++) {
+                if (i == sec_bucket)
+                    minute_vals[i] = in_s;
                 else
-                    (*i)->set((int64_t) agg.default_val());
+                    minute_vals[i] = agg.default_val();
             }
-            sec_avg = agg.combine_vector(minute_vec);
+            sec_avg = agg.combine_vector(minute_vals, 60);
 
             // We haven't seen anything in this hour, so clear it, set the minute
             // and get the aggregate
-            TrackerElementVector hv = TrackerElementVector(hour_vec);
-            for (TrackerElementVector::iterator i = hv.begin(); i != hv.end(); ++i) {
-                if (i - hv.begin() == min_bucket)
-                    (*i)->set(sec_avg);
+            for (int i = 0; i < 60; i++) {
+                if (i == min_bucket)
+                    hour_vals[i] = sec_avg;
                 else
-                    (*i)->set((int64_t) agg.default_val());
+                    hour_vals[i] = agg.default_val();
             }
-            min_avg = agg.combine_vector(hour_vec);
+            min_avg = agg.combine_vector(hour_vals, 60);
 
             // Fill the hours between the last time we saw data and now with
             // zeroes; fastforward time
             for (int h = 0; h < hours_different(last_hour_bucket + 1, hour_bucket); h++) {
-                e = hour_vec->get_vector_value((last_hour_bucket + 1 + h) % 24);
-                e->set((int64_t) agg.default_val());
+                day_vals[(last_hour_bucket + 1 + h) % 24] = agg.default_val();
             }
 
-            e = day_vec->get_vector_value(hour_bucket);
-            e->set(min_avg);
+            day_vals[hour_bucket] = min_avg;
 
         } else if (in_time - ltime > 60) {
             // - Calculate the average seconds
@@ -225,31 +258,27 @@ public:
 
             int64_t sec_avg = 0, min_avg = 0;
 
-            TrackerElementVector mv(minute_vec);
-            for (TrackerElementVector::iterator i = mv.begin(); i != mv.end(); ++i) {
-                if (i - mv.begin() == sec_bucket)
-                    (*i)->set(in_s);
+            for (int i = 0; i < 60; i++) {
+                if (i == sec_bucket)
+                    minute_vals[i] = in_s;
                 else
-                    (*i)->set((int64_t) agg.default_val());
+                    minute_vals[i] = agg.default_val();
             }
-            sec_avg = agg.combine_vector(minute_vec);
+            sec_avg = agg.combine_vector(minute_vals, 60);
 
             // Zero between last and current
             for (int m = 0; 
                     m < minutes_different(last_min_bucket + 1, min_bucket); m++) {
-                e = hour_vec->get_vector_value((last_min_bucket + 1 + m) % 60);
-                e->set((int64_t) agg.default_val());
+                hour_vals[(last_min_bucket + 1 + m) % 60] = agg.default_val();
             }
 
             // Set the updated value
-            e = hour_vec->get_vector_value(min_bucket);
-            e->set((int64_t) sec_avg);
+            hour_vals[min_bucket] = sec_avg;
 
-            min_avg = agg.combine_vector(hour_vec);
+            min_avg = agg.combine_vector(hour_vals, 60);
 
             // Reset the hour
-            e = day_vec->get_vector_value(hour_bucket);
-            e->set(min_avg);
+            day_vals[hour_bucket] = min_avg;
 
         } else {
             // printf("debug - rrd - w/in the last minute %d seconds\n", in_time - last_time);
@@ -259,33 +288,29 @@ public:
             // Otherwise, fast-forward seconds with zero data, then propagate the
             // changes up
             if (in_time == ltime) {
-                e = minute_vec->get_vector_value(sec_bucket);
-                e->set(agg.combine_element(GetTrackerValue<int64_t>(e), in_s));
+                minute_vals[sec_bucket] = 
+                    agg.combine_element(minute_vals[sec_bucket], in_s);
             } else {
                 for (int s = 0; 
                         s < minutes_different(last_sec_bucket + 1, sec_bucket); s++) {
-                    e = minute_vec->get_vector_value((last_sec_bucket + 1 + s) % 60);
-                    e->set((int64_t) agg.default_val());
+                    minute_vals[(last_sec_bucket + 1 + s) % 60] = agg.default_val();
                 }
 
-                e = minute_vec->get_vector_value(sec_bucket);
-                e->set((int64_t) in_s);
+                minute_vals[sec_bucket] = in_s;
             }
 
             // Update all the averages
             int64_t sec_avg = 0, min_avg = 0;
 
-            sec_avg = agg.combine_vector(minute_vec);
+            sec_avg = agg.combine_vector(minute_vals, 60);
 
             // Set the minute
-            e = hour_vec->get_vector_value(min_bucket);
-            e->set(sec_avg);
+            hour_vals[min_bucket] = sec_avg;
 
-            min_avg = agg.combine_vector(hour_vec);
+            min_avg = agg.combine_vector(hour_vals, 60);
 
             // Set the hour
-            e = day_vec->get_vector_value(hour_bucket);
-            e->set(min_avg);
+            day_vals[hour_bucket] = min_avg;
         }
 
         set_last_time(in_time);
@@ -300,6 +325,27 @@ public:
         if (update_first) {
             add_sample(agg.default_val(), globalreg->timestamp.tv_sec);
         }
+
+        // Build the bucket vectors for the first concurrent serializer
+        local_locker lock(&rrd_mutex);
+
+        if (serialize_ref++ == 0) {
+            kis_tracked_rrd_fill_vector(minute_vec, minute_vals, 60, second_entry_id);
+            kis_tracked_rrd_fill_vector(hour_vec, hour_vals, 60, minute_entry_id);
+            kis_tracked_rrd_fill_vector(day_vec, day_vals, 24, hour_entry_id);
+        }
+    }
+
+    virtual void post_serialize() {
+        tracker_component::post_serialize();
+
+        local_locker lock(&rrd_mutex);
+
+        if (serialize_ref > 0 && --serialize_ref == 0) {
+            minute_vec->clear_vector();
+            hour_vec->clear_vector();
+            day_vec->clear_vector();
+        }
     }
 
 protected:
@@ -366,32 +412,16 @@ protected:
     virtual void reserve_fields(shared_ptr<TrackerElement> e) {
         tracker_component::reserve_fields(e);
 
-        // Build slots for all the times
-        int x;
-        if ((x = minute_vec->get_vector()->size()) != 60) {
-            for ( ; x < 60; x++) {
-                SharedTrackerElement me(new TrackerElement(TrackerInt64, 
-                            second_entry_id));
-                minute_vec->add_vector(me);
-            }
-        }
+        Aggregator agg;
 
-        if ((x = hour_vec->get_vector()->size()) != 60) {
-            for ( ; x < 60; x++) {
-                SharedTrackerElement he(new TrackerElement(TrackerInt64, 
-                            minute_entry_id));
-                hour_vec->add_vector(he);
-            }
-        }
+        // Pull in any buckets we inherited, and release the vectors until
+        // they're needed for serialization
+        kis_tracked_rrd_load_vector(minute_vec, minute_vals, 60, agg.default_val());
+        kis_tracked_rrd_load_vector(hour_vec, hour_vals, 60, agg.default_val());
+        kis_tracked_rrd_load_vector(day_vec, day_vals, 24, agg.default_val());
 
-        if ((x = day_vec->get_vector()->size()) != 24) {
-            for ( ; x < 24; x++) {
-                SharedTrackerElement he(new TrackerElement(TrackerInt64, hour_entry_id));
-                day_vec->add_vector(he);
-            }
-        }
+        serialize_ref = 0;
 
-        Aggregator agg;
         (*blank_val).set(agg.default_val());
         (*aggregator_name).set(agg.name());
 
@@ -409,6 +439,16 @@ protected:
     int hour_entry_id;
 
     bool update_first;
+
+    // Protects building and releasing the serialization vectors
+    kis_recursive_timed_mutex rrd_mutex;
+
+    // Number of serializers currently holding the populated vectors
+    unsigned int serialize_ref;
+
+    int64_t minute_vals[60];
+    int64_t hour_vals[60];
+    int64_t day_vals[24];
 };
 
 // Easier to make this it's own class since for a single-minute RRD the logic is
@@ -465,13 +505,10 @@ public:
             return;
         }
         
-        SharedTrackerElement e;
-
         // If we haven't seen data in a minute, wipe
         if (in_time - ltime > 60) {
             for (int x = 0; x < 60; x++) {
-                e = minute_vec->get_vector_value(x);
-                e->set((int64_t) agg.default_val());
+                minute_vals[x] = agg.default_val();
             }
         } else {
             // If in_time == last_time then we're updating an existing record, so
@@ -479,17 +516,15 @@ public:
             // Otherwise, fast-forward seconds with zero data, average the seconds,
             // and propagate the averages up
             if (in_time == ltime) {
-                e = minute_vec->get_vector_value(sec_bucket);
-                e->set(agg.combine_element(GetTrackerValue<int64_t>(e), in_s));
+                minute_vals[sec_bucket] = 
+                    agg.combine_element(minute_vals[sec_bucket], in_s);
             } else {
                 for (int s = 0; 
                         s < minutes_different(last_sec_bucket + 1, sec_bucket); s++) {
-                    e = minute_vec->get_vector_value((last_sec_bucket + 1 + s) % 60);
-                    e->set((int64_t) agg.default_val());
+                    minute_vals[(last_sec_bucket + 1 + s) % 60] = agg.default_val();
                 }
 
-                e = minute_vec->get_vector_value(sec_bucket);
-                e->set((int64_t) in_s);
+                minute_vals[sec_bucket] = in_s;
             }
         }
 
@@ -504,6 +539,20 @@ public:
         if (update_first) {
             add_sample(agg.default_val(), globalreg->timestamp.tv_sec);
         }
+
+        local_locker lock(&rrd_mutex);
+
+        if (serialize_ref++ == 0)
+            kis_tracked_rrd_fill_vector(minute_vec, minute_vals, 60, second_entry_id);
+    }
+
+    virtual void post_serialize() {
+        tracker_component::post_serialize();
+
+        local_locker lock(&rrd_mutex);
+
+        if (serialize_ref > 0 && --serialize_ref == 0)
+            minute_vec->clear_vector();
     }
 
 protected:
@@ -541,17 +590,12 @@ protected:
 
         set_last_time(0);
 
-        // Build slots for all the times
-        int x;
-        if ((x = minute_vec->get_vector()->size()) != 60) {
-            for ( ; x < 60; x++) {
-                SharedTrackerElement me(new TrackerElement(TrackerInt64, 
-                            second_entry_id));
-                minute_vec->add_vector(me);
-            }
-        }
-
         Aggregator agg;
+
+        kis_tracked_rrd_load_vector(minute_vec, minute_vals, 60, agg.default_val());
+
+        serialize_ref = 0;
+
         (*blank_val).set(agg.default_val());
         (*aggregator_name).set(agg.name());
     }
@@ -564,6 +608,14 @@ protected:
     int second_entry_id;
 
     bool update_first;
+
+    // Protects building and releasing the serialization vectors
+    kis_recursive_timed_mutex rrd_mutex;
+
+    // Number of serializers currently holding the populated vectors
+    unsigned int serialize_ref;
+
+    int64_t minute_vals[60];
 };
 
 // Signal level RRD, peak selector on overlap, averages signal but ignores
@@ -578,18 +630,14 @@ public:
     }
 
     // Select the strongest signal of the bucket
-    static int64_t combine_vector(SharedTrackerElement e) {
-        TrackerElementVector v(e);
-
+    static int64_t combine_vector(const int64_t *v, size_t sz) {
         int64_t avg = 0, avgc = 0;
 
-        for (TrackerElementVector::iterator i = v.begin(); i != v.end(); ++i) {
-            int64_t v = GetTrackerValue<int64_t>(*i);
-
-            if (v == 0)
+        for (size_t i = 0; i < sz; i++) {
+            if (v[i] == 0)
                 continue;
 
-            avg += v;
+            avg += v[i];
             avgc++;
         }
 
@@ -600,11 +648,9 @@ public:
 
 #if 0
         int64_t max = 0;
-        for (TrackerElementVector::iterator i = v.begin(); i != v.end(); ++i) {
-            int64_t v = GetTrackerValue<int64_t>(*i);
-
-            if (max == 0 || max < v)
-                max = v;
+        for (size_t i = 0; i < sz; i++) {
+            if (max == 0 || max < v[i])
+                max = v[i];
         }
 
         return max;
@@ -650,14 +696,12 @@ public:
     }
 
     // Simple average
-    static int64_t combine_vector(SharedTrackerElement e) {
-        TrackerElementVector v(e);
-
+    static int64_t combine_vector(const int64_t *v, size_t sz) {
         int64_t avg = 0;
-        for (TrackerElementVector::iterator i = v.begin(); i != v.end(); ++i) 
-            avg += GetTrackerValue<int64_t>(*i);
+        for (size_t i = 0; i < sz; i++)
+            avg += v[i];
 
-        return avg / v.size();
+        return avg / (int64_t) sz;
     }
 
     // Default 'empty' value, no legit signal would be 0
@@ -672,4 +716,3 @@ public:
 
 
 #endif
-
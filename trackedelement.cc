@@ -123,7 +123,7 @@ ostream& operator<<(ostream& os, const TrackedDeviceKey& k) {
 
 void TrackerElement::Initialize() {
     this->type = TrackerUnassigned;
-    reference_count = 0;
+    local_name = NULL;
 
     set_id(-1);
 
@@ -170,6 +170,8 @@ TrackerElement::TrackerElement(TrackerType type, int id) {
 }
 
 TrackerElement::~TrackerElement() {
+    delete local_name;
+
     // If we contain references to other things, unlink them.  This may cause them to
     // auto-delete themselves.
     if (type == TrackerVector) {
@@ -235,7 +237,6 @@ void TrackerElement::set_type(TrackerType in_type) {
     } else if (type == TrackerByteArray && dataunion.bytearray_value != NULL) {
         delete(dataunion.bytearray_value);
         dataunion.bytearray_value = NULL;
-        bytearray_value_len = 0;
     }
 
     this->type = in_type;
@@ -261,8 +262,8 @@ void TrackerElement::set_type(TrackerType in_type) {
     } else if (type == TrackerString) {
         dataunion.string_value = new string();
     } else if (type == TrackerByteArray) {
-        dataunion.bytearray_value = new shared_ptr<uint8_t>();
-        bytearray_value_len = 0;
+        dataunion.bytearray_value = new tracked_bytearray();
+        dataunion.bytearray_value->len = 0;
     }
 }
 
@@ -1467,16 +1468,17 @@ size_t TrackerElement::size_vector() {
 void TrackerElement::set_bytearray(uint8_t *d, size_t len) {
     except_type_mismatch(TrackerByteArray);
 
-    dataunion.bytearray_value->reset(new uint8_t[len], std::default_delete<uint8_t[]>());
-    memcpy(dataunion.bytearray_value->get(), d, len);
-    bytearray_value_len = len;
+    dataunion.bytearray_value->data.reset(new uint8_t[len], 
+            std::default_delete<uint8_t[]>());
+    memcpy(dataunion.bytearray_value->data.get(), d, len);
+    dataunion.bytearray_value->len = len;
 }
 
 void TrackerElement::set_bytearray(shared_ptr<uint8_t> d, size_t len) {
     except_type_mismatch(TrackerByteArray);
 
-    *(dataunion.bytearray_value) = d;
-    bytearray_value_len = len;
+    dataunion.bytearray_value->data = d;
+    dataunion.bytearray_value->len = len;
 }
 
 void TrackerElement::set_bytearray(std::string s) {
@@ -1486,21 +1488,21 @@ void TrackerElement::set_bytearray(std::string s) {
 size_t TrackerElement::get_bytearray_size() {
     except_type_mismatch(TrackerByteArray);
 
-    return bytearray_value_len;
+    return dataunion.bytearray_value->len;
 }
 
 std::shared_ptr<uint8_t> TrackerElement::get_bytearray() {
     except_type_mismatch(TrackerByteArray);
 
-    return *(dataunion.bytearray_value);
+    return dataunion.bytearray_value->data;
 }
 
 std::string TrackerElement::get_bytearray_str() {
     except_type_mismatch(TrackerByteArray);
 
-    uint8_t *ba = dataunion.bytearray_value->get();
+    uint8_t *ba = dataunion.bytearray_value->data.get();
 
-    return std::string((const char *) ba, bytearray_value_len);
+    return std::string((const char *) ba, dataunion.bytearray_value->len);
 }
 
 size_t TrackerElement::size() {
@@ -1902,7 +1904,13 @@ void tracker_component::reserve_fields(SharedTrackerElement e) {
             *(rf->assign) = import_or_new(e, rf->id);
         } else {
         }
+
+        delete rf;
     }
+
+    // The registration table is only needed to bind the fields; don't carry it
+    // around for the life of every component
+    std::vector<registered_field *>().swap(registered_fields);
 }
 
 SharedTrackerElement 
@@ -66,6 +66,7 @@ typedef std::shared_ptr<TrackerElement> SharedTrackerElement;
 // Values are exported as big endian, hex, [SPKEY]_[DKEY]
 class TrackedDeviceKey {
 public:
+    friend struct std::hash<TrackedDeviceKey>;
     friend bool operator <(const TrackedDeviceKey& x, const TrackedDeviceKey& y);
     friend bool operator ==(const TrackedDeviceKey& x, const TrackedDeviceKey& y);
     friend ostream& operator<<(ostream& os, const TrackedDeviceKey& k);
@@ -92,6 +93,10 @@ public:
 
     std::string as_string() const;
 
+    // Raw host-order components, for serializers which format the key themselves
+    uint64_t get_spkey() const { return spkey; }
+    uint64_t get_dkey() const { return dkey; }
+
     // Generate a cached phykey component; phyhandlers do this to cache
     static uint32_t gen_pkey(std::string in_phy);
 
@@ -109,6 +114,24 @@ bool operator <(const TrackedDeviceKey& x, const TrackedDeviceKey& y);
 bool operator ==(const TrackedDeviceKey& x, const TrackedDeviceKey& y);
 ostream& operator<<(ostream& os, const TrackedDeviceKey& k);
 
+// Hash a device key for unordered containers.  The dkey is usually a mac 
+// address, so the components are mixed instead of simply xor'd, to keep devices
+// which share a phy and vendor prefix spread over the buckets
+namespace std {
+    template<> struct hash<TrackedDeviceKey> {
+        std::size_t operator()(const TrackedDeviceKey& k) const {
+            uint64_t h = k.spkey ^ (k.dkey + 0x9e3779b97f4a7c15ULL + 
+                    (k.spkey << 6) + (k.spkey >> 2));
+
+            h ^= h >> 33;
+            h *= 0xff51afd7ed558ccdULL;
+            h ^= h >> 33;
+
+            return (std::size_t) h;
+        }
+    };
+}
+
 // Types of fields we can track and automatically resolve
 // Statically assigned type numbers which MUST NOT CHANGE as things go forwards for 
 // binary/fast serialization, new types must be added to the end of the list
@@ -177,8 +200,9 @@ public:
 
     // Factory-style for easily making more of the same if we're subclassed
     virtual shared_ptr<TrackerElement> clone_type() {
-        std::shared_ptr<TrackerElement> dup1(new TrackerElement(get_type(), get_id()));
-        return dup1;
+        // Allocate the element and the shared_ptr control block together; leaf
+        // elements are by far the most common object we allocate
+        return std::make_shared<TrackerElement>(get_type(), get_id());
     }
 
     virtual shared_ptr<TrackerElement> clone_type(int in_id) {
@@ -202,11 +226,25 @@ public:
         tracked_id = id;
     }
 
+    // Local names are only used on a handful of wrapper and summary elements, so
+    // they are only allocated when set; all other elements resolve their name
+    // through the entrytracker by field id
     void set_local_name(std::string in_name) {
-        local_name = in_name;
+        if (local_name == NULL)
+            local_name = new std::string(in_name);
+        else
+            *local_name = in_name;
     }
 
     std::string get_local_name() {
+        if (local_name == NULL)
+            return "";
+
+        return *local_name;
+    }
+
+    // Local name without copying it, or NULL if none is set
+    const std::string *get_local_name_ptr() const {
         return local_name;
     }
 
@@ -248,12 +286,26 @@ public:
     typedef std::map<TrackedDeviceKey, SharedTrackerElement>::const_iterator key_map_const_iterator;
     typedef std::pair<TrackedDeviceKey, SharedTrackerElement> key_map_pair;
 
+    // Byte arrays carry their length with the data, so that the length doesn't
+    // take up space in every other element
+    struct tracked_bytearray {
+        std::shared_ptr<uint8_t> data;
+        size_t len;
+    };
+
     // Getter per type, use templated GetTrackerValue() for easy fetch
     std::string get_string() {
         except_type_mismatch(TrackerString);
         return *(dataunion.string_value);
     }
 
+    // Reference to the string value, for serializers which would otherwise copy
+    // every string they write
+    const std::string& get_string_ref() {
+        except_type_mismatch(TrackerString);
+        return *(dataunion.string_value);
+    }
+
     uint8_t get_uint8() {
         except_type_mismatch(TrackerUInt8);
         return dataunion.uint8_value;
@@ -656,16 +708,11 @@ protected:
     }
 #endif
 
-    // Garbage collection?  Say it ain't so...
-    int reference_count;
-
     TrackerType type;
     int tracked_id;
 
-    // Overridden name for this instance only
-    std::string local_name;
-
-    size_t bytearray_value_len;
+    // Overridden name for this instance only, NULL unless set
+    std::string *local_name;
 
     // We could make these all one type, but then we'd have odd interactions
     // with incrementing and I'm not positive that's safe in all cases
@@ -713,7 +760,7 @@ protected:
 
         TrackedDeviceKey *key_value;
 
-        std::shared_ptr<uint8_t> *bytearray_value;
+        tracked_bytearray *bytearray_value;
 
         void *custom_value;
     } dataunion;
@@ -1364,6 +1411,7 @@ protected:
     GlobalRegistry *globalreg;
     std::shared_ptr<EntryTracker> entrytracker;
 
+    // Fields registered but not yet bound; emptied by reserve_fields
     std::vector<registered_field *> registered_fields;
 };
 
@@ -49,6 +49,7 @@
 #include <thread>
 #include <mutex>
 #include <condition_variable>
+#include <chrono>
 
 #include <sys/time.h>
 
@@ -309,6 +310,15 @@ public:
         return data;
     }
 
+    // Block this thread until another thread unlocks us or the timeout expires;
+    // returns false if we timed out
+    bool block_for_ms(unsigned int in_ms) {
+        std::unique_lock<std::mutex> lk(m);
+
+        return cv.wait_for(lk, std::chrono::milliseconds(in_ms), 
+                [this](){ return !locked; });
+    }
+
     // Unlock the conditional, unblocking whatever thread was blocked
     // waiting for us, and passing whatever data we'd like to pass
     void unlock(t in_data) {